@@ -0,0 +1,149 @@
+#include <stdexcept>
+
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <signal.h>
+  #include <sys/types.h>
+  #include <sys/wait.h>
+#endif
+
+#include "ChildProcess.hpp"
+
+using namespace MediaArchiver;
+
+ChildProcess::ChildProcess()
+  : m_out(nullptr)
+  , m_in(-1)
+  , m_pid(-1)
+{
+}
+
+ChildProcess::~ChildProcess()
+{
+  if(m_out)
+    kill();
+}
+
+void ChildProcess::start(const std::string &cmdLine, bool withInput)
+{
+  if(m_out)
+    throw std::runtime_error("process is already running");
+
+#ifdef WIN32
+  if(withInput)
+    throw std::runtime_error("input pipe not supported for: " + cmdLine);
+
+  m_out = popen(cmdLine.c_str(), "r");
+  if(!m_out)
+    throw std::runtime_error("could not start: " + cmdLine);
+#else
+  int fds[2];
+  if(pipe(fds))
+    throw std::runtime_error("could not create pipe for: " + cmdLine);
+
+  // the writer must not leak into encoders started by other lanes, they
+  // would keep the pipe open
+  int in[2] = {-1, -1};
+  if(withInput && pipe2(in, O_CLOEXEC))
+  {
+    ::close(fds[0]);
+    ::close(fds[1]);
+    throw std::runtime_error("could not create pipe for: " + cmdLine);
+  }
+
+  const pid_t pid = fork();
+  if(pid < 0)
+  {
+    ::close(fds[0]);
+    ::close(fds[1]);
+    if(withInput)
+    {
+      ::close(in[0]);
+      ::close(in[1]);
+    }
+    throw std::runtime_error("could not fork for: " + cmdLine);
+  }
+
+  if(pid == 0)
+  {
+    // child: own process group, so the whole command can be signaled
+    setpgid(0, 0);
+    ::close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    ::close(fds[1]);
+    if(withInput)
+    {
+      ::close(in[1]);
+      dup2(in[0], STDIN_FILENO);
+      ::close(in[0]);
+    }
+
+    // exec makes the encoder itself the child instead of the shell
+    const std::string cmd = "exec " + cmdLine;
+    execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char *>(nullptr));
+    _exit(127);
+  }
+
+  ::close(fds[1]);
+  if(withInput)
+    ::close(in[0]);
+  m_out = fdopen(fds[0], "r");
+  if(!m_out)
+  {
+    ::close(fds[0]);
+    if(withInput)
+      ::close(in[1]);
+    ::kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    throw std::runtime_error("could not read output of: " + cmdLine);
+  }
+  m_in = in[1];
+  m_pid = pid;
+#endif
+}
+
+void ChildProcess::closeInput()
+{
+#ifndef WIN32
+  if(m_in >= 0)
+    ::close(m_in);
+#endif
+  m_in = -1;
+}
+
+int ChildProcess::close()
+{
+  if(!m_out)
+    return -1;
+
+  closeInput();
+#ifdef WIN32
+  const int status = pclose(m_out);
+#else
+  fclose(m_out);
+  int status = -1;
+  while(waitpid(m_pid, &status, 0) < 0 && errno == EINTR) {}
+#endif
+  m_out = nullptr;
+  m_pid = -1;
+  return status;
+}
+
+void ChildProcess::kill()
+{
+  terminate();
+  close();
+}
+
+void ChildProcess::terminate()
+{
+#ifndef WIN32
+  if(m_pid > 0)
+  {
+    // a stopped process would never see the SIGKILL otherwise
+    ::kill(-m_pid, SIGCONT);
+    ::kill(-m_pid, SIGKILL);
+  }
+#endif
+}
@@ -0,0 +1,62 @@
+#ifndef __CHILDPROCESS_HPP__
+#define __CHILDPROCESS_HPP__
+
+#include <cstdio>
+#include <string>
+
+namespace MediaArchiver
+{
+/**
+ * @brief External command whose output (stdout + stderr) can be read like
+ * with popen(), but the process id is known so that it can be signaled,
+ * reniced, etc.
+ */
+class ChildProcess
+{
+public:
+  ChildProcess();
+  ChildProcess(const ChildProcess &) = delete;
+  ~ChildProcess();
+
+  /**
+   * @brief run the command line using the shell
+   *
+   * @param cmdLine command line to execute
+   * @param withInput connect a pipe to the stdin of the process
+   * @throws std::runtime_error if the command cannot be started
+   */
+  void start(const std::string &cmdLine, bool withInput = false);
+
+  /** output stream of the process or nullptr if not running */
+  FILE *get() const { return m_out; }
+  explicit operator bool() const { return m_out != nullptr; }
+
+  /** write end of the stdin pipe, -1 if not connected */
+  int input() const { return m_in; }
+
+  /** signal the end of the input to the process */
+  void closeInput();
+
+  /** process id, -1 if not known */
+  int pid() const { return m_pid; }
+
+  /**
+   * @brief wait for the process to exit
+   *
+   * @return int exit status as returned by pclose()
+   */
+  int close();
+
+  /** terminate the process without waiting for its output */
+  void kill();
+
+  /** send the kill signal only, the pipes stay open until close() */
+  void terminate();
+
+private:
+  FILE *m_out;
+  int m_in;
+  int m_pid;
+};
+}
+#endif // !__CHILDPROCESS_HPP__
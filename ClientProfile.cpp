@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifndef WIN32
+  #include <sys/statvfs.h>
+#endif
+
+#include "ClientProfile.hpp"
+#include "ChildProcess.hpp"
+#include "StagingWorkspace.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+ClientProfile::ClientProfile(const ClientConfig &cfg, unsigned slots)
+  : m_cfg(cfg)
+  , m_slots(slots)
+  , m_cores(std::thread::hardware_concurrency())
+{
+  if(cfg.encoderEngine != "ffmpeg" || cfg.pathToEncoder.empty())
+    return;
+
+  try
+  {
+    ChildProcess proc;
+    proc.start(cfg.pathToEncoder + " -hide_banner -encoders 2>&1");
+    std::stringstream ss;
+    char line[512];
+    while(fgets(line, sizeof(line), proc.get()))
+      ss << line;
+    proc.close();
+    m_codecs = parseEncoders(ss);
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(WARNING, "Could not list the encoders: %s", e.what());
+  }
+  LOG_F(INFO, "Profile: %u cores, %.1f fps, %u slots, %lu encoders",
+    m_cores, cfg.benchmarkFps, slots, m_codecs.size());
+}
+
+bool ClientProfile::update(MediaFileRequirements &filter) const
+{
+  filter.cores = m_cores;
+  filter.benchmarkFps = m_cfg.benchmarkFps;
+  filter.slots = m_slots;
+  filter.codecs = m_codecs;
+  filter.memory = getAvailableMemory();
+
+  // new jobs are received into the checkpoint folder if there is one
+  filter.freeTempSpace = getFreeSpace(m_cfg.checkpointFolder.empty() ?
+      m_cfg.tempFolder :
+      m_cfg.checkpointFolder);
+  if(!filter.freeTempSpace)
+    return true;
+
+  const auto fits =
+    StagingWorkspace::getMaxFileLength(filter.freeTempSpace);
+  if(!fits)
+    return false;
+
+  filter.maxFileSize =
+    filter.maxFileSize ? std::min<uint64_t>(filter.maxFileSize, fits) : fits;
+  return true;
+}
+
+uint64_t ClientProfile::getFreeSpace(const std::string &folder)
+{
+#ifdef WIN32
+  return 0;
+#else
+  struct statvfs st;
+  if(statvfs(folder.c_str(), &st) != 0)
+    return 0;
+  return static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
+#endif
+}
+
+uint64_t ClientProfile::getAvailableMemory()
+{
+  // "MemAvailable:   12345678 kB"
+  std::ifstream fs("/proc/meminfo");
+  std::string key;
+  uint64_t kb;
+  while(fs >> key >> kb)
+  {
+    if(key == "MemAvailable:")
+      return kb * 1024;
+    fs.ignore(256, '\n');
+  }
+  return 0;
+}
+
+std::vector<std::string> ClientProfile::parseEncoders(std::istream &output)
+{
+  // the legend ends with " ------", then " V....D libx264  description"
+  std::vector<std::string> encoders;
+  std::string line;
+  bool list = false;
+  while(std::getline(output, line))
+  {
+    std::istringstream ss(line);
+    std::string flags, name;
+    if(!(ss >> flags))
+      continue;
+
+    if(flags == "------")
+      list = true;
+    else if(list && ss >> name)
+      encoders.emplace_back(name);
+  }
+  return encoders;
+}
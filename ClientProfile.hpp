@@ -0,0 +1,53 @@
+#ifndef __CLIENTPROFILE_HPP__
+#define __CLIENTPROFILE_HPP__
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "IMediaArchiverServer.hpp"
+#include "MediaArchiverClientConfig.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Capabilities of the machine sent with each request for a job: the
+ * cores, the calibrated speed and the encoders are found out once, the
+ * free temp space and memory each time.
+ */
+class ClientProfile
+{
+public:
+  /**
+   * @param cfg client configuration (encoder, temp folder, benchmark)
+   * @param slots jobs encoded in parallel on the machine
+   */
+  ClientProfile(const ClientConfig &cfg, unsigned slots);
+  ClientProfile(const ClientProfile &) = delete;
+
+  /**
+   * @brief fill in the capabilities, the largest file is limited to the
+   * one whose temp files still fit into the free space
+   *
+   * @return false not even a small job fits into the temp folder
+   */
+  bool update(MediaFileRequirements &filter) const;
+
+  /** bytes free in the folder, 0 if unknown */
+  static uint64_t getFreeSpace(const std::string &folder);
+
+  /** bytes of memory available without swapping, 0 if unknown */
+  static uint64_t getAvailableMemory();
+
+  /** names of the encoders listed by ffmpeg -encoders */
+  static std::vector<std::string> parseEncoders(std::istream &output);
+
+private:
+  const ClientConfig &m_cfg;
+  const unsigned m_slots;
+  const unsigned m_cores;
+  std::vector<std::string> m_codecs;
+};
+}
+#endif // !__CLIENTPROFILE_HPP__
@@ -0,0 +1,294 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <unistd.h>
+#endif
+
+#include "CommandLineEncoder.hpp"
+#include "StreamingSource.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+CommandLineEncoder::CommandLineEncoder(const ClientConfig &cfg)
+  : m_cfg(cfg)
+  , m_source(nullptr)
+  , m_progress{0, 0, 0}
+{
+}
+
+CommandLineEncoder::~CommandLineEncoder()
+{
+  kill();
+}
+
+bool CommandLineEncoder::canStream(const EncodeJob &job) const
+{
+#ifdef WIN32
+  return false;
+#else
+  // the 1st pass has to see the whole file before the 2nd one starts anyway
+  return m_cfg.streamSource && job.source && job.passLogPrefix.empty() &&
+    !job.outFile.empty() &&
+    job.source->getLayout() == StreamingSource::Layout::Sequential;
+#endif
+}
+
+std::string CommandLineEncoder::getCommandLine(
+  const EncodeJob &job, bool fromPipe) const
+{
+  std::stringstream cmd;
+#ifdef WIN32
+  const std::string nul = "NUL";
+#else
+  const std::string nul = "/dev/null";
+#endif
+  std::stringstream outFile;
+
+  if(!job.outFile.empty())
+  {
+    outFile << " \"" << job.outFile << "\"";
+  }
+  else
+  {
+    outFile << nul;
+  }
+
+  // chunks are cut from the input, the server's options may keep the
+  // timestamps of the source (-copyts)
+  cmd << m_cfg.pathToEncoder;
+  if(job.startTime)
+    cmd << " -ss " << job.startTime;
+  if(job.duration)
+    cmd << " -t " << job.duration;
+
+  if(fromPipe)
+    cmd << " -i pipe:0 ";
+  else
+    cmd << " -i \"" << job.inFile << "\" ";
+
+  cmd << job.parameters << " -progress pipe:1";
+
+  if(job.threads)
+  {
+    cmd << " -threads " << job.threads;
+  }
+
+  if(!job.passLogPrefix.empty())
+  {
+    cmd << " -pass " << (job.passNo == 1 ? "1 -an -f null " : "2 ")
+        << " -passlogfile \"" << job.passLogPrefix << "\" ";
+  }
+
+  cmd << " " << job.clientOptions << " " << outFile.str();
+
+  // the options in front of an output apply to it only, the source is
+  // decoded once for all of them
+  for(const auto &o: job.extraOutputs)
+    cmd << " " << o.parameters << " \"" << o.outFile << "\"";
+
+  cmd << " 2>&1 ";
+  return cmd.str();
+}
+
+void CommandLineEncoder::start(const EncodeJob &job)
+{
+  const bool fromPipe = job.source && !job.source->isComplete();
+  const auto cmdLine = getCommandLine(job, fromPipe);
+  LOG_F(2, "launching: %s", cmdLine.c_str());
+  try
+  {
+    m_process.start(cmdLine, fromPipe);
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(ERROR, "could not launch '%s': %s", cmdLine.c_str(), e.what());
+    throw std::runtime_error(
+      std::string("could not start external command: ") + cmdLine);
+  }
+
+#ifndef WIN32
+  // the output is read without blocking the lane
+  const int fd = fileno(m_process.get());
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_progress = EncoderProgress{0, 0, 0};
+    m_line.clear();
+  }
+
+  if(fromPipe)
+  {
+    m_source = job.source;
+    m_feeder.reset(new std::thread([this]() { feed(m_source); }));
+  }
+}
+
+void CommandLineEncoder::feed(StreamingSource *source)
+{
+#ifndef WIN32
+  loguru::set_thread_name("feeder");
+  // an encoder exiting early must fail the write, not kill the client
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+  const int fd = m_process.input();
+  std::vector<char> buffer(1024 * 1024);
+  uint64_t pos = 0;
+  int64_t rd;
+  while((rd = source->read(pos, buffer.data(), buffer.size())) > 0)
+  {
+    const char *data = buffer.data();
+    while(rd > 0)
+    {
+      const auto wr = write(fd, data, rd);
+      if(wr < 0 && errno == EINTR)
+        continue;
+      if(wr <= 0)
+      {
+        LOG_F(WARNING, "encoder stopped reading its input at %lu: %s",
+          static_cast<unsigned long>(pos), strerror(errno));
+        m_process.closeInput();
+        return;
+      }
+      data += wr;
+      rd -= wr;
+      pos += wr;
+    }
+  }
+
+  if(rd < 0)
+    LOG_F(WARNING, "streaming the source aborted at %lu",
+      static_cast<unsigned long>(pos));
+  else
+    LOG_F(2, "source streamed into the encoder: %lu bytes",
+      static_cast<unsigned long>(pos));
+
+  // EOF for the encoder
+  m_process.closeInput();
+#endif
+}
+
+void CommandLineEncoder::stopFeeding()
+{
+  if(!m_feeder)
+    return;
+
+  m_feeder->join();
+  m_feeder.reset();
+  m_source = nullptr;
+}
+
+bool CommandLineEncoder::poll(std::string &output)
+{
+  if(!m_process)
+    return false;
+
+  bool eof = false;
+#ifdef WIN32
+  char buffer[1024];
+  if(fgets(buffer, sizeof(buffer), m_process.get()))
+    m_line += buffer;
+  eof = std::feof(m_process.get());
+#else
+  char buffer[4096];
+  const int fd = fileno(m_process.get());
+  while(true)
+  {
+    const auto rd = read(fd, buffer, sizeof(buffer));
+    if(rd > 0)
+    {
+      m_line.append(buffer, rd);
+    }
+    else if(rd < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    else
+    {
+      eof = rd == 0 || errno != EAGAIN;
+      break;
+    }
+  }
+#endif
+
+  size_t pos;
+  while((pos = m_line.find('\n')) != std::string::npos)
+  {
+    const auto line = m_line.substr(0, pos + 1);
+    m_line.erase(0, pos + 1);
+    if(!parseProgress(line))
+      output += line;
+  }
+
+  if(eof)
+  {
+    output += m_line;
+    m_line.clear();
+  }
+  return !eof;
+}
+
+bool CommandLineEncoder::parseProgress(const std::string &line)
+{
+  // key=value lines, e.g. frame=25, out_time_us=1000000, total_size=4096
+  const auto eq = line.find('=');
+  if(eq == std::string::npos || eq == 0 ||
+    line.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_") != eq ||
+    line.find(' ') != std::string::npos)
+  {
+    return false;
+  }
+
+  const auto key = line.substr(0, eq);
+  const char *value = line.c_str() + eq + 1;
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if(key == "frame")
+    m_progress.frames = strtoull(value, nullptr, 10);
+  else if(key == "out_time_us")
+    m_progress.outTime = strtoll(value, nullptr, 10);
+  else if(key == "total_size")
+    m_progress.outBytes = strtoull(value, nullptr, 10);
+  return true;
+}
+
+int CommandLineEncoder::finish()
+{
+  stopFeeding();
+  return m_process.close();
+}
+
+void CommandLineEncoder::kill()
+{
+  // the feeder may wait for data that never arrives
+  if(m_source)
+    m_source->abort();
+
+  // the feeder's writes fail once the encoder is gone, its pipe must not
+  // be closed before
+  m_process.terminate();
+  stopFeeding();
+  if(m_process)
+    m_process.kill();
+}
+
+int CommandLineEncoder::pid() const
+{
+  return m_process ? m_process.pid() : 0;
+}
+
+EncoderProgress CommandLineEncoder::getProgress() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_progress;
+}
@@ -0,0 +1,55 @@
+#ifndef __COMMANDLINEENCODER_HPP__
+#define __COMMANDLINEENCODER_HPP__
+
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "IEncoder.hpp"
+#include "ChildProcess.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Runs the encoder executable (pathToEncoder) on temp files. A
+ * source still being received is piped into its stdin.
+ */
+class CommandLineEncoder : public IEncoder
+{
+public:
+  CommandLineEncoder(const ClientConfig &cfg);
+  CommandLineEncoder(const CommandLineEncoder &) = delete;
+  ~CommandLineEncoder();
+
+  void start(const EncodeJob &job) override;
+  bool poll(std::string &output) override;
+  int finish() override;
+  void kill() override;
+  int pid() const override;
+  bool canStream(const EncodeJob &job) const override;
+  EncoderProgress getProgress() const override;
+
+  /**
+   * @param fromPipe the source is read from stdin instead of inFile
+   */
+  std::string getCommandLine(
+    const EncodeJob &job, bool fromPipe = false) const;
+
+private:
+  /** copy the source into the stdin of the encoder as it arrives */
+  void feed(StreamingSource *source);
+  void stopFeeding();
+
+  /** consume a line of the -progress output */
+  bool parseProgress(const std::string &line);
+
+  const ClientConfig &m_cfg;
+  ChildProcess m_process;
+  StreamingSource *m_source;
+  std::unique_ptr<std::thread> m_feeder;
+  std::string m_line;
+  EncoderProgress m_progress;
+  mutable std::mutex m_mtx;
+};
+}
+#endif // !__COMMANDLINEENCODER_HPP__
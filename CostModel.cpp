@@ -0,0 +1,148 @@
+#include <algorithm>
+
+#include "CostModel.hpp"
+
+using namespace MediaArchiver;
+
+CostModel::CostModel()
+  : m_samples(0)
+{
+}
+
+void CostModel::add(const JobRecord &job)
+{
+  if(job.result != EncodingResultInfo::EncodingResult::OK || job.remux ||
+    job.seconds <= 0 || job.duration <= 0 || !job.fileSize ||
+    !job.outputSize)
+  {
+    return;
+  }
+
+  const int res = getResolutionClass(job.height);
+  const Key keys[] = {Key{job.client, job.videoCodec, res},
+    Key{job.client, "", -1}, Key{"", job.videoCodec, res}, Key{"", "", -1}};
+
+  std::lock_guard<std::mutex> lck(m_mtx);
+  for(const auto &k: keys)
+  {
+    auto &s = m_sums[k];
+    s.seconds += job.seconds;
+    s.duration += job.duration;
+    s.input += job.fileSize;
+    s.output += job.outputSize;
+    s.count++;
+  }
+  m_samples++;
+}
+
+void CostModel::clear()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_sums.clear();
+  m_samples = 0;
+}
+
+int CostModel::samples() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_samples;
+}
+
+JobForecast CostModel::predict(
+  const PendingFile &file, const std::string &client) const
+{
+  JobForecast fc{-1.0, 0, 0};
+
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto all = find(Key{"", "", -1});
+  if(!all)
+    return fc;
+
+  const int res = getResolutionClass(file.height);
+  const auto size = findSize(file.videoCodec, res);
+  fc.outputSize = static_cast<uint64_t>(
+    file.fileSize * size->output / size->input);
+  fc.samples = size->count;
+
+  // the length of the source by the bit rate of the sources seen so far
+  const double duration = file.duration > 0 ?
+    file.duration :
+    file.fileSize * all->duration / all->input;
+
+  const auto cls = find(Key{"", file.videoCodec, res});
+  const auto own = client.empty() ? nullptr : find(Key{client, "", -1});
+  const auto exact =
+    client.empty() ? nullptr : find(Key{client, file.videoCodec, res});
+
+  double rate;
+  if(exact)
+  {
+    rate = exact->seconds / exact->duration;
+    fc.samples = exact->count;
+  }
+  else if(own && cls)
+  {
+    // the speed of the client scaled by how hard the class is for all
+    rate = own->seconds / own->duration * (cls->seconds / cls->duration) /
+      (all->seconds / all->duration);
+    fc.samples = std::min(own->count, cls->count);
+  }
+  else if(own)
+  {
+    rate = own->seconds / own->duration;
+    fc.samples = own->count;
+  }
+  else
+  {
+    const auto s = cls ? cls : all;
+    rate = s->seconds / s->duration;
+    fc.samples = s->count;
+  }
+  fc.seconds = duration * rate;
+  return fc;
+}
+
+double CostModel::getSpeed(const std::string &client) const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto s = find(Key{client, "", -1});
+  return s ? s->duration / s->seconds : 0.0;
+}
+
+double CostModel::getBytesPerSecond() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto s = find(Key{"", "", -1});
+  return s ? s->input / s->duration : 0.0;
+}
+
+double CostModel::getMeanSeconds() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto s = find(Key{"", "", -1});
+  return s ? s->seconds / s->count : 0.0;
+}
+
+int CostModel::getResolutionClass(int height)
+{
+  if(height <= 0)
+    return 0;
+  if(height <= 576)
+    return 1;
+  if(height <= 1080)
+    return 2;
+  return 3;
+}
+
+const CostModel::Sum *CostModel::find(const Key &key) const
+{
+  const auto it = m_sums.find(key);
+  return it == m_sums.end() ? nullptr : &it->second;
+}
+
+const CostModel::Sum *CostModel::findSize(
+  const std::string &codec, int res) const
+{
+  const auto s = find(Key{"", codec, res});
+  return s ? s : find(Key{"", "", -1});
+}
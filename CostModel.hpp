@@ -0,0 +1,83 @@
+#ifndef __COSTMODEL_HPP__
+#define __COSTMODEL_HPP__
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "IDatabase.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief cost of a job predicted from the jobs finished before
+ */
+struct JobForecast
+{
+  double seconds;      ///< wall time of the encoding, negative if unknown
+  uint64_t outputSize; ///< size of the result, 0 if unknown
+  int samples;         ///< finished jobs the prediction is based on
+};
+
+/**
+ * @brief Predicts the wall time and the output size of jobs from the
+ * recorded history. The time is fitted as seconds per source second for
+ * each client, source codec and resolution class, the output size as share
+ * of the source size for each codec and resolution class. Where a class
+ * has no history yet, the wider one is used (client only, all clients).
+ */
+class CostModel
+{
+public:
+  CostModel();
+
+  /** learn from a finished job, only successful encodes count */
+  void add(const JobRecord &job);
+  void clear();
+
+  /** finished jobs learnt from */
+  int samples() const;
+
+  /**
+   * @param client name of the client, empty: the average of all clients
+   * @return JobForecast samples is 0 if there is no history at all
+   */
+  JobForecast predict(const PendingFile &file,
+    const std::string &client = std::string()) const;
+
+  /** source seconds encoded per second by the client, 0 if unknown */
+  double getSpeed(const std::string &client) const;
+
+  /** bytes per second of the sources seen so far, 0 if unknown */
+  double getBytesPerSecond() const;
+
+  /** average wall time (s) of a job, 0 if unknown */
+  double getMeanSeconds() const;
+
+  /** 0: unknown, 1: SD, 2: HD (up to 1080 lines), 3: UHD */
+  static int getResolutionClass(int height);
+
+private:
+  struct Sum
+  {
+    double seconds = 0;  ///< wall time of the encodes
+    double duration = 0; ///< length of the sources
+    double input = 0;    ///< bytes of the sources
+    double output = 0;   ///< bytes of the results
+    int count = 0;
+  };
+
+  /** client, codec, resolution class, empty or -1: any */
+  using Key = std::tuple<std::string, std::string, int>;
+
+  const Sum *find(const Key &key) const;
+  const Sum *findSize(const std::string &codec, int res) const;
+
+  std::map<Key, Sum> m_sums;
+  int m_samples;
+  mutable std::mutex m_mtx;
+};
+}
+#endif // !__COSTMODEL_HPP__
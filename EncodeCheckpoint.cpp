@@ -0,0 +1,137 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "EncodeCheckpoint.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+EncodeCheckpoint::EncodeCheckpoint(const std::string &folder, unsigned lane)
+  : m_folder(folder)
+{
+  char name[16];
+  snprintf(name, sizeof(name), "lane%02u.journal", lane);
+  m_journal = m_folder + "/" + name;
+}
+
+bool EncodeCheckpoint::load(State &state) const
+{
+  std::ifstream fs(m_journal);
+  if(!fs.is_open())
+    return false;
+
+  // one "key value" per line, texts take the rest of their line
+  State st{0, MediaEncoderSettings{0}, 0, 0, 0};
+  unsigned found = 0;
+  std::string line;
+  while(std::getline(fs, line))
+  {
+    const auto pos = line.find(' ');
+    const auto key = line.substr(0, pos);
+    const auto value = pos == std::string::npos ? "" : line.substr(pos + 1);
+    std::istringstream ss(value);
+
+    if(key == "token")
+      ss >> st.token;
+    else if(key == "jobId")
+      ss >> st.settings.jobId;
+    else if(key == "fileLength")
+      ss >> st.settings.fileLength;
+    else if(key == "encoderType")
+      st.settings.encoderType = value;
+    else if(key == "fileExtension")
+      st.settings.fileExtension = value;
+    else if(key == "finalExtension")
+      st.settings.finalExtension = value;
+    else if(key == "sourceTime")
+      ss >> st.settings.sourceTime;
+    else if(key == "settingsHash")
+      ss >> st.settings.settingsHash;
+    else if(key == "passNo")
+      ss >> st.passNo;
+    else if(key == "chunks")
+      ss >> st.chunks;
+    else if(key == "duration")
+      ss >> st.duration;
+    else if(key == "parameters")
+      st.settings.commandLineParameters = value;
+    else if(key == "rendition")
+    {
+      // optional, one line each: name extension parameters
+      RenditionSettings r;
+      if(ss >> r.name >> r.extension)
+      {
+        std::getline(ss >> std::ws, r.commandLineParameters);
+        st.settings.renditions.push_back(r);
+      }
+      continue;
+    }
+    else
+      continue;
+
+    if(ss.fail())
+    {
+      LOG_F(WARNING, "Checkpoint: invalid line '%s' in %s", line.c_str(),
+        m_journal.c_str());
+      return false;
+    }
+    found++;
+  }
+
+  if(found < 12 || !st.settings.fileLength ||
+    (st.passNo != 1 && st.passNo != 2))
+  {
+    LOG_F(WARNING, "Checkpoint: incomplete journal %s", m_journal.c_str());
+    return false;
+  }
+
+  state = st;
+  return true;
+}
+
+void EncodeCheckpoint::save(const State &state) const
+{
+  const auto tmp = m_journal + ".tmp";
+  {
+    const auto &s = state.settings;
+    std::ofstream fs(tmp, std::ios::out | std::ios::trunc);
+    fs << "token " << state.token << '\n'
+       << "jobId " << s.jobId << '\n'
+       << "fileLength " << s.fileLength << '\n'
+       << "encoderType " << s.encoderType << '\n'
+       << "fileExtension " << s.fileExtension << '\n'
+       << "finalExtension " << s.finalExtension << '\n'
+       << "sourceTime " << s.sourceTime << '\n'
+       << "settingsHash " << s.settingsHash << '\n'
+       << "passNo " << state.passNo << '\n'
+       << "chunks " << state.chunks << '\n'
+       << "duration " << state.duration << '\n'
+       << "parameters " << s.commandLineParameters << '\n';
+    for(const auto &r: s.renditions)
+    {
+      fs << "rendition " << r.name << ' ' << r.extension << ' '
+         << r.commandLineParameters << '\n';
+    }
+
+    fs.close();
+    if(fs.fail())
+    {
+      throw IOError("could not write checkpoint " + tmp);
+    }
+  }
+
+#ifdef WIN32
+  std::remove(m_journal.c_str());
+#endif
+  if(std::rename(tmp.c_str(), m_journal.c_str()) != 0)
+  {
+    throw IOError("could not replace checkpoint " + m_journal);
+  }
+}
+
+void EncodeCheckpoint::clear() const
+{
+  std::remove(m_journal.c_str());
+}
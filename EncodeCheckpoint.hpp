@@ -0,0 +1,47 @@
+#ifndef __ENCODECHECKPOINT_HPP__
+#define __ENCODECHECKPOINT_HPP__
+
+#include <string>
+
+#include "IMediaArchiverServer.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Journal of the job of a lane kept next to its temp files, so a
+ * client restarted after a crash continues with the last finished pass or
+ * chunk instead of encoding the whole file again.
+ */
+class EncodeCheckpoint
+{
+public:
+  struct State
+  {
+    int token;                     ///< session token of the job
+    MediaEncoderSettings settings; ///< job as received from the server
+    int passNo;                    ///< pass to run next
+    unsigned chunks;               ///< chunks already encoded
+    int duration;                  ///< source length (s), 0: not chunked
+  };
+
+  /**
+   * @param folder folder of the temp files and the journal
+   * @param lane index of the lane the journal belongs to
+   */
+  EncodeCheckpoint(const std::string &folder, unsigned lane);
+  EncodeCheckpoint(const EncodeCheckpoint &) = delete;
+
+  /** @return false there is no valid journal */
+  bool load(State &state) const;
+  /** replace the journal, throws IOError */
+  void save(const State &state) const;
+  void clear() const;
+
+  const std::string &getFolder() const { return m_folder; }
+
+private:
+  const std::string m_folder;
+  std::string m_journal;
+};
+}
+#endif // !__ENCODECHECKPOINT_HPP__
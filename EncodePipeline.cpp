@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <thread>
+
+#include "EncodePipeline.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+EncodePipeline::EncodePipeline(const ClientConfig &cfg)
+  : m_busy{0, 0}
+  , m_paused(false)
+{
+  const unsigned jobs = std::max(1, cfg.parallelJobs);
+  const unsigned share = std::min(std::max(cfg.pass1ThreadShare, 1), 99);
+  const unsigned threads = cfg.encoderThreads > 0 ?
+    cfg.encoderThreads :
+    std::thread::hardware_concurrency();
+
+  m_maxJobs = jobs;
+  m_capacity[static_cast<int>(Stage::Analysis)] = jobs;
+  m_capacity[static_cast<int>(Stage::Encode)] = jobs;
+
+  // every running final pass gets a companion lane prefetching the next
+  // file and running its 1st pass
+  m_lanes = cfg.overlapPasses ? 2 * jobs : jobs;
+
+  const bool budgeted =
+    cfg.encoderThreads > 0 || jobs > 1 || cfg.overlapPasses;
+
+  if(!budgeted || !threads)
+  {
+    m_threads[static_cast<int>(Stage::Analysis)] = 0;
+    m_threads[static_cast<int>(Stage::Encode)] = 0;
+  }
+  else if(cfg.overlapPasses)
+  {
+    const unsigned analysis = std::max(1u, threads * share / 100);
+    const unsigned encode = threads > analysis ? threads - analysis : 1;
+    m_threads[static_cast<int>(Stage::Analysis)] =
+      std::max(1u, analysis / jobs);
+    m_threads[static_cast<int>(Stage::Encode)] = std::max(1u, encode / jobs);
+  }
+  else
+  {
+    m_threads[static_cast<int>(Stage::Analysis)] =
+      std::max(1u, threads / jobs);
+    m_threads[static_cast<int>(Stage::Encode)] = std::max(1u, threads / jobs);
+  }
+
+  LOG_F(1, "Encode pipeline: %u lanes, %u jobs, threads pass1=%u final=%u",
+    m_lanes, jobs, m_threads[static_cast<int>(Stage::Analysis)],
+    m_threads[static_cast<int>(Stage::Encode)]);
+}
+
+bool EncodePipeline::tryAcquire(Stage stage)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  auto &busy = m_busy[static_cast<int>(stage)];
+  if(m_paused || busy >= m_capacity[static_cast<int>(stage)])
+  {
+    return false;
+  }
+
+  ++busy;
+  return true;
+}
+
+void EncodePipeline::release(Stage stage)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  auto &busy = m_busy[static_cast<int>(stage)];
+  if(busy > 0)
+  {
+    --busy;
+  }
+}
+
+unsigned EncodePipeline::threadsFor(Stage stage) const
+{
+  return m_threads[static_cast<int>(stage)];
+}
+
+void EncodePipeline::setEncodeCapacity(unsigned capacity)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  capacity = std::min(std::max(capacity, 1u), m_maxJobs);
+  if(capacity != m_capacity[static_cast<int>(Stage::Encode)])
+  {
+    LOG_F(1, "Encode pipeline: capacity %u -> %u",
+      m_capacity[static_cast<int>(Stage::Encode)], capacity);
+  }
+  m_capacity[static_cast<int>(Stage::Analysis)] = capacity;
+  m_capacity[static_cast<int>(Stage::Encode)] = capacity;
+}
+
+unsigned EncodePipeline::getEncodeCapacity() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_capacity[static_cast<int>(Stage::Encode)];
+}
+
+void EncodePipeline::setPaused(bool paused)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_paused = paused;
+}
+
+bool EncodePipeline::isPaused() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_paused;
+}
+
+void EncodePipeline::addEncoder(int pid)
+{
+  if(pid <= 0)
+    return;
+
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_encoders.push_back(pid);
+}
+
+void EncodePipeline::removeEncoder(int pid)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_encoders.erase(std::remove(m_encoders.begin(), m_encoders.end(), pid),
+    m_encoders.end());
+}
+
+std::vector<int> EncodePipeline::getEncoders() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_encoders;
+}
@@ -0,0 +1,78 @@
+#ifndef __ENCODEPIPELINE_HPP__
+#define __ENCODEPIPELINE_HPP__
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "MediaArchiverClientConfig.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Shares the encoder resources of the machine among the client
+ * lanes. Every lane works on its own job, but may only run an encoder when
+ * it holds a slot of the corresponding stage. With overlapping passes the
+ * cheap 1st pass of the next job runs next to the final pass of the
+ * current one, each stage getting its own share of the cores.
+ */
+class EncodePipeline
+{
+public:
+  enum class Stage : uint8_t
+  {
+    Analysis, ///< 1st pass of a 2-pass encoding
+    Encode,   ///< final pass producing the output file
+  };
+
+  EncodePipeline(const ClientConfig &cfg);
+  EncodePipeline(const EncodePipeline &) = delete;
+
+  /** number of client lanes needed to keep all stages busy */
+  unsigned lanes() const { return m_lanes; }
+
+  /**
+   * @brief reserve a slot of a stage
+   *
+   * @return true the slot is reserved and the encoder may be launched
+   * @return false all slots of the stage are busy, try again later
+   */
+  bool tryAcquire(Stage stage);
+  void release(Stage stage);
+
+  /**
+   * @brief number of threads an encoder of the given stage may use
+   *
+   * @return unsigned thread count or 0 to let the encoder decide
+   */
+  unsigned threadsFor(Stage stage) const;
+
+  /**
+   * @brief limit the number of concurrently running final passes (at least
+   * 1, at most parallelJobs)
+   */
+  void setEncodeCapacity(unsigned capacity);
+  unsigned getEncodeCapacity() const;
+  unsigned getMaxJobs() const { return m_maxJobs; }
+
+  /** while paused no slots are handed out */
+  void setPaused(bool paused);
+  bool isPaused() const;
+
+  /** bookkeeping of the running encoder processes */
+  void addEncoder(int pid);
+  void removeEncoder(int pid);
+  std::vector<int> getEncoders() const;
+
+private:
+  unsigned m_lanes;
+  unsigned m_threads[2];
+  unsigned m_capacity[2];
+  unsigned m_busy[2];
+  unsigned m_maxJobs;
+  bool m_paused;
+  std::vector<int> m_encoders;
+  mutable std::mutex m_mtx;
+};
+}
+#endif // !__ENCODEPIPELINE_HPP__
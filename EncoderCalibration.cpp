@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifndef WIN32
+  #include <sys/resource.h>
+#endif
+
+#include "EncoderCalibration.hpp"
+#include "ChildProcess.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+double getChildrenCpuTime()
+{
+#ifdef WIN32
+  return 0.0;
+#else
+  struct rusage ru;
+  if(getrusage(RUSAGE_CHILDREN, &ru))
+    return 0.0;
+
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+#endif
+}
+}
+
+EncoderCalibration::EncoderCalibration(const ClientConfig &cfg,
+  const std::string &sample, const std::string &encoderOptions,
+  const std::vector<std::string> &presets, int seconds)
+  : m_cfg(cfg)
+  , m_sample(sample)
+  , m_encoderOptions(encoderOptions)
+  , m_presets(presets.empty() ? std::vector<std::string>{""} : presets)
+  , m_seconds(seconds)
+{
+}
+
+std::vector<std::pair<unsigned, unsigned>> EncoderCalibration::getGrid(
+  unsigned cores)
+{
+  std::vector<std::pair<unsigned, unsigned>> grid;
+  cores = std::max(1u, cores);
+
+  // all cores busy, or twice as many threads as cores to hide the serial
+  // parts of the encoder
+  for(unsigned jobs = 1; jobs <= cores; jobs *= 2)
+  {
+    for(unsigned load = 1; load <= 2; load++)
+    {
+      const auto item =
+        std::make_pair(jobs, std::max(1u, cores * load / jobs));
+      if(std::find(grid.begin(), grid.end(), item) == grid.end())
+        grid.push_back(item);
+    }
+  }
+  return grid;
+}
+
+const CalibrationResult &EncoderCalibration::getBest(
+  const std::vector<CalibrationResult> &results)
+{
+  const CalibrationResult *best = nullptr;
+  for(const auto &r: results)
+  {
+    if(!r.ok)
+      continue;
+
+    // within the measurement noise the cheaper one wins
+    if(!best || r.fps > best->fps * 1.02 ||
+      (r.fps > best->fps * 0.98 &&
+        r.cpuSecondsPerFrame < best->cpuSecondsPerFrame))
+    {
+      best = &r;
+    }
+  }
+
+  if(!best)
+    throw std::runtime_error("none of the trial encodes succeeded");
+
+  return *best;
+}
+
+std::vector<CalibrationResult> EncoderCalibration::run()
+{
+  std::vector<CalibrationResult> results;
+  const auto grid = getGrid(std::thread::hardware_concurrency());
+
+  for(const auto &preset: m_presets)
+  {
+    for(const auto &g: grid)
+    {
+      results.push_back(trial(g.first, g.second, preset));
+      const auto &r = results.back();
+      LOG_F(INFO,
+        "calibration: jobs=%u threads=%u preset='%s': %s %.2f fps, %.3f CPU s/frame",
+        r.jobs, r.threads, r.preset.c_str(), r.ok ? "OK" : "FAILED", r.fps,
+        r.cpuSecondsPerFrame);
+    }
+  }
+
+  return results;
+}
+
+CalibrationResult EncoderCalibration::trial(
+  unsigned jobs, unsigned threads, const std::string &preset)
+{
+  CalibrationResult result{jobs, threads, preset, 0.0, 0.0, true};
+
+  std::stringstream cmd;
+  cmd << m_cfg.pathToEncoder
+      << " -y -hide_banner -nostdin -nostats -progress pipe:1 -i \""
+      << m_sample << "\" -t " << m_seconds << " " << m_encoderOptions << " "
+      << preset << " -threads " << threads << " -an -f null - 2>&1";
+
+  std::vector<std::unique_ptr<ChildProcess>> procs;
+  std::vector<long> frames(jobs, 0);
+  std::vector<int> retcodes(jobs, 0);
+  const auto cpuStart = getChildrenCpuTime();
+  const auto start = std::chrono::steady_clock::now();
+
+  try
+  {
+    for(unsigned i = 0; i < jobs; i++)
+    {
+      procs.emplace_back(new ChildProcess());
+      procs.back()->start(cmd.str());
+    }
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(ERROR, "calibration: %s", e.what());
+    result.ok = false;
+    return result;
+  }
+
+  // the outputs are read in parallel, a full pipe would slow down the
+  // encoder being measured
+  std::vector<std::thread> readers;
+  for(unsigned i = 0; i < jobs; i++)
+  {
+    readers.emplace_back([&, i]() {
+      char line[256];
+      while(fgets(line, sizeof(line), procs[i]->get()))
+      {
+        // progress lines like: frame=123
+        if(strncmp(line, "frame=", 6) == 0)
+          frames[i] = atol(line + 6);
+      }
+      retcodes[i] = procs[i]->close();
+    });
+  }
+
+  for(auto &t: readers)
+    t.join();
+
+  const std::chrono::duration<double> wall =
+    std::chrono::steady_clock::now() - start;
+  long total = 0;
+  for(unsigned i = 0; i < jobs; i++)
+  {
+    total += frames[i];
+    if(frames[i] <= 0 || retcodes[i] != 0)
+      result.ok = false;
+  }
+
+  if(total > 0 && wall.count() > 0)
+  {
+    result.fps = total / wall.count();
+    result.cpuSecondsPerFrame = (getChildrenCpuTime() - cpuStart) / total;
+  }
+
+  return result;
+}
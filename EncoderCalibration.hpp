@@ -0,0 +1,61 @@
+#ifndef __ENCODERCALIBRATION_HPP__
+#define __ENCODERCALIBRATION_HPP__
+
+#include <string>
+#include <vector>
+
+#include "MediaArchiverClientConfig.hpp"
+
+namespace MediaArchiver
+{
+struct CalibrationResult
+{
+  unsigned jobs;             ///< encoders running in parallel
+  unsigned threads;          ///< threads of each encoder
+  std::string preset;        ///< encoder options of the preset
+  double fps;                ///< frames encoded per wall clock second
+  double cpuSecondsPerFrame; ///< CPU time spent on one frame
+  bool ok;                   ///< all trial encodes succeeded
+};
+
+/**
+ * @brief Runs short trial encodes of a sample clip over a grid of parallel
+ * jobs, thread counts and presets to find the combination with the highest
+ * throughput on the current machine.
+ */
+class EncoderCalibration
+{
+public:
+  /**
+   * @param cfg client configuration (path of the encoder)
+   * @param sample media file to encode
+   * @param encoderOptions codec options used for every trial
+   * @param presets encoder options of the presets to compare
+   * @param seconds length of the sample to encode in each trial
+   */
+  EncoderCalibration(const ClientConfig &cfg, const std::string &sample,
+    const std::string &encoderOptions,
+    const std::vector<std::string> &presets, int seconds);
+
+  /** jobs x threads combinations worth trying on this machine */
+  static std::vector<std::pair<unsigned, unsigned>> getGrid(unsigned cores);
+
+  /** best of the results, throws if none succeeded */
+  static const CalibrationResult &getBest(
+    const std::vector<CalibrationResult> &results);
+
+  std::vector<CalibrationResult> run();
+
+protected:
+  CalibrationResult trial(
+    unsigned jobs, unsigned threads, const std::string &preset);
+
+private:
+  const ClientConfig &m_cfg;
+  const std::string m_sample;
+  const std::string m_encoderOptions;
+  const std::vector<std::string> m_presets;
+  const int m_seconds;
+};
+}
+#endif // !__ENCODERCALIBRATION_HPP__
@@ -0,0 +1,30 @@
+#include <mutex>
+
+#include "IEncoder.hpp"
+#include "CommandLineEncoder.hpp"
+#ifdef WITH_LIBAV
+  #include "LibavEncoder.hpp"
+#endif
+
+#include "loguru.hpp"
+
+namespace MediaArchiver
+{
+IEncoder *createEncoder(const ClientConfig &cfg, const EncodeJob &job)
+{
+  if(cfg.encoderEngine == "libav")
+  {
+#ifdef WITH_LIBAV
+    if(LibavEncoder::supports(job))
+      return new LibavEncoder(cfg);
+#else
+    (void)job;
+    static std::once_flag warned;
+    std::call_once(warned, []() {
+      LOG_F(WARNING, "libav encoder not available, using pathToEncoder");
+    });
+#endif
+  }
+  return new CommandLineEncoder(cfg);
+}
+}
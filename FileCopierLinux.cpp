@@ -7,6 +7,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 
 #include <sstream>
 #include <stdexcept>
@@ -24,17 +26,12 @@ void FileCopierLinux::copyFile(
   if(s < 0)
     throw std::runtime_error("Could not open file");
 
-  auto st = fstat(s, &finfo);
-  auto fsize = lseek(s, 0, SEEK_END);
-  if(fsize == -1)
+  if(fstat(s, &finfo) != 0)
   {
-    throw std::runtime_error("Could not seek in file");
+    close(s);
+    throw std::runtime_error("Could not stat file");
   }
 
-  lseek(s, 0, SEEK_SET);
-
-  posix_fadvise(s, 0, 0, POSIX_FADV_SEQUENTIAL);
-
   if(mtime)
   {
     ts[0] = *mtime;
@@ -46,28 +43,38 @@ void FileCopierLinux::copyFile(
     ts[1] = finfo.st_mtim;
   }
 
-  int d = open(dst, O_WRONLY | O_CREAT | O_TRUNC, &ts[0]);
-  posix_fallocate(d, 0, fsize);
+  int d = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(d < 0)
+  {
+    close(s);
+    throw std::runtime_error("Could not create file");
+  }
 
-  char buf[8192];
-  while(true)
+  // copy-on-write file systems share the data instead of copying it
+  if(ioctl(d, FICLONE, s) != 0)
   {
-    auto rs = read(s, buf, sizeof(buf));
-    if(!rs)
-      break;
+    posix_fadvise(s, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fallocate(d, 0, finfo.st_size);
 
-    auto rs2 = write(d, buf, sizeof(buf));
-    if(rs != rs2)
+    char buf[8192];
+    while(true)
     {
-      close(s);
-      close(d);
-      throw std::runtime_error("IO error during copying the file");
+      auto rs = read(s, buf, sizeof(buf));
+      if(!rs)
+        break;
+
+      auto rs2 = rs > 0 ? write(d, buf, rs) : -1;
+      if(rs != rs2)
+      {
+        close(s);
+        close(d);
+        throw std::runtime_error("IO error during copying the file");
+      }
     }
   }
 
-  close(d);
-
   futimens(d, ts);
+  close(d);
   close(s);
 }
 
@@ -0,0 +1,115 @@
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FileFingerprint.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t Prime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+  return x << r | x >> (64 - r);
+}
+
+inline uint64_t read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t mix(uint64_t acc, uint64_t v)
+{
+  return rotl(acc + v * Prime2, 31) * Prime1;
+}
+}
+
+uint64_t FileFingerprint::hash(const void *data, size_t len, uint64_t seed)
+{
+  const auto p = static_cast<const uint8_t *>(data);
+  size_t i = 0;
+  uint64_t h;
+
+  if(len >= 32)
+  {
+    uint64_t lane[4] = {
+      seed + Prime1 + Prime2, seed + Prime2, seed, seed - Prime1};
+    for(; i + 32 <= len; i += 32)
+    {
+      for(int l = 0; l < 4; l++)
+        lane[l] = mix(lane[l], read64(p + i + 8 * l));
+    }
+    h = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) +
+      rotl(lane[3], 18);
+    for(const auto l: lane)
+      h = (h ^ mix(0, l)) * Prime1 + Prime4;
+  }
+  else
+    h = seed + Prime5;
+
+  h += len;
+  for(; i + 8 <= len; i += 8)
+    h = rotl(h ^ mix(0, read64(p + i)), 27) * Prime1 + Prime4;
+  for(; i < len; i++)
+    h = rotl(h ^ (p[i] * Prime5), 11) * Prime1;
+
+  h ^= h >> 33;
+  h *= Prime2;
+  h ^= h >> 29;
+  h *= Prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+bool FileFingerprint::read(const std::string &fileName, SourceFingerprint &fp)
+{
+  const int fd = open(fileName.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+  fp.device = st.st_dev;
+  fp.inode = st.st_ino;
+
+  // blocks at the start, in the middle and at the end, small files whole
+  const uint64_t size = st.st_size;
+  std::vector<uint64_t> offsets{0};
+  size_t len = size;
+  if(size > 3 * BlockSize)
+  {
+    offsets = {0, size / 2 - BlockSize / 2, size - BlockSize};
+    len = BlockSize;
+  }
+
+  std::vector<uint8_t> buf(len);
+  uint64_t h = size;
+  for(const auto offset: offsets)
+  {
+    if(pread(fd, buf.data(), len, offset) != static_cast<ssize_t>(len))
+    {
+      close(fd);
+      return false;
+    }
+    h = hash(buf.data(), len, h);
+  }
+  close(fd);
+
+  fp.hash = h;
+  return true;
+}
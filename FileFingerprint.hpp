@@ -0,0 +1,34 @@
+#ifndef __FILEFINGERPRINT_HPP__
+#define __FILEFINGERPRINT_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "IDatabase.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Identifies copies of a source file cheaply: only the first, the
+ * middle and the last block are hashed together with the size, so copies
+ * are found without reading whole files. Hard links are found by their
+ * device and inode.
+ */
+class FileFingerprint
+{
+public:
+  /** bytes hashed at the start, in the middle and at the end */
+  static constexpr size_t BlockSize = 64 * 1024;
+
+  /** @return false the file could not be read */
+  static bool read(const std::string &fileName, SourceFingerprint &fp);
+
+  /**
+   * @brief 64 bit hash of a buffer, mixed in four independent lanes so
+   * that the multiplications run in parallel
+   */
+  static uint64_t hash(const void *data, size_t len, uint64_t seed);
+};
+}
+#endif // !__FILEFINGERPRINT_HPP__
@@ -35,6 +35,7 @@ FileSystemWatcherLinux::FileSystemWatcherLinux(
   , m_eventfd(-1)
   , m_stopping(false)
   , m_moveFrom(false)
+  , m_moveDir(false)
   , m_cookie(0)
   , m_dst(listener)
 {
@@ -218,11 +219,115 @@ void FileSystemWatcherLinux::stop()
   }
 }
 
+void FileSystemWatcherLinux::unwatchDir(const std::string &dirName)
+{
+  const auto prefix = dirName + "/";
+  for(auto it = m_watchedDirs.begin(); it != m_watchedDirs.end();)
+  {
+    if(it->second == dirName ||
+      !it->second.compare(0, prefix.size(), prefix))
+    {
+      inotify_rm_watch(m_fd, it->first);
+      it = m_watchedDirs.erase(it);
+    }
+    else
+      ++it;
+  }
+}
+
+void FileSystemWatcherLinux::notifyMove(
+  const std::string &src, const std::string &dst, bool directory)
+{
+  if(!directory)
+  {
+    m_dst.onFileSystemChange(
+      IFileSystemChangeListener::EventType::FileMoved, src, dst);
+  }
+  else if(src.empty())
+  {
+    // moved in from an unwatched folder, its files are new
+    try
+    {
+      watchDir(dst);
+    }
+    catch(const std::exception &e)
+    {
+      LOG_F(ERROR, "directory '%s' could not be watched: %s", dst.c_str(),
+        e.what());
+    }
+  }
+  else if(dst.empty())
+  {
+    LOG_F(4, "directory '%s' was moved away", src.c_str());
+    unwatchDir(src);
+    // e.g. into the trash, its files are gone
+    m_dst.onFileSystemChange(
+      IFileSystemChangeListener::EventType::DirectoryMoved, src, dst);
+  }
+  else
+  {
+    // the watches follow the inodes, only their names change
+    const auto prefix = src + "/";
+    for(auto &w: m_watchedDirs)
+    {
+      if(w.second == src)
+        w.second = dst;
+      else if(!w.second.compare(0, prefix.size(), prefix))
+        w.second = dst + w.second.substr(src.size());
+    }
+    LOG_F(4, "directory '%s' was moved to '%s'", src.c_str(), dst.c_str());
+    m_dst.onFileSystemChange(
+      IFileSystemChangeListener::EventType::DirectoryMoved, src, dst);
+  }
+}
+
 void FileSystemWatcherLinux::handleInotifyEvent(
   const struct inotify_event *e)
 {
   const auto fileName = m_watchedDirs[e->wd] + "/" + e->name;
-  if(e->mask & IN_ISDIR)
+  const bool movePending = m_cookie > 0 &&
+    (std::chrono::steady_clock::now() - m_moveStart >
+      FileSystemWatcherLinux::MoveTimeout);
+
+  if(movePending)
+  {
+    // move to/from outer directory with only 1
+    // notification
+    m_cookie = 0;
+    std::string n;
+    notifyMove(
+      m_moveFrom ? m_moveName : n, m_moveFrom ? n : m_moveName, m_moveDir);
+    LOG_F(4, "movePending '%s'", m_moveName.c_str());
+  }
+
+  if(e->mask & IN_MOVE && e->cookie)
+  {
+    if(m_cookie == 0)
+    {
+      LOG_F(4, "'%s' move start (%u)", fileName.c_str(), e->cookie);
+      // 1st part of possible 2 messages
+      m_cookie = e->cookie;
+      m_moveName = fileName;
+      m_moveFrom = e->mask & IN_MOVED_FROM;
+      m_moveDir = e->mask & IN_ISDIR;
+      m_moveStart = std::chrono::steady_clock::now();
+    }
+    else if(e->cookie == m_cookie)
+    {
+      LOG_F(4, "'%s' move end (%u)", fileName.c_str(), e->cookie);
+      // pair of move found
+      m_cookie = 0;
+      const bool from = e->mask & IN_MOVED_FROM;
+      const std::string src = from ? fileName : m_moveName;
+      const std::string dst = from ? m_moveName : fileName;
+      notifyMove(src, dst, e->mask & IN_ISDIR);
+    }
+    else
+    {
+      LOG_F(ERROR, "INVALID INOTIFY EVENT: %s", fileName.c_str());
+    }
+  }
+  else if(e->mask & IN_ISDIR)
   {
     // user does not receive any directory-related info, but we process it
     if(e->mask & IN_DELETE)
@@ -260,7 +365,7 @@ void FileSystemWatcherLinux::handleInotifyEvent(
     {
     }
     else
-    { // ToDo: move directories, add to watch
+    {
       LOG_F(
         4, "directory '%s' inotify event %08X", fileName.c_str(), e->mask);
     }
@@ -270,21 +375,6 @@ void FileSystemWatcherLinux::handleInotifyEvent(
     std::stringstream ssLog;
 
     ssLog << "file '" << fileName << "' ";
-    const bool movePending = m_cookie > 0 &&
-      (std::chrono::steady_clock::now() - m_moveStart >
-        FileSystemWatcherLinux::MoveTimeout);
-
-    if(movePending)
-    {
-      // move to/from outer directory with only 1
-      // notification
-      m_cookie = 0;
-      std::string n;
-      m_dst.onFileSystemChange(
-        IFileSystemChangeListener::EventType::FileMoved,
-        m_moveFrom ? m_moveName : n, m_moveFrom ? n : m_moveName);
-      ssLog << "movePending";
-    }
 
     if(e->mask & IN_CLOSE_WRITE)
     {
@@ -300,34 +390,6 @@ void FileSystemWatcherLinux::handleInotifyEvent(
       m_dst.onFileSystemChange(
         IFileSystemChangeListener::EventType::FileDeleted, "", fileName);
     }
-    else if(e->mask & IN_MOVE && e->cookie)
-    {
-      if(m_cookie == 0)
-      {
-        ssLog << "move start (" << e->cookie << ")";
-        // 1st part of possible 2 messages
-        m_cookie = e->cookie;
-        m_moveName = fileName;
-        m_moveFrom = e->mask & IN_MOVED_FROM;
-        m_moveStart = std::chrono::steady_clock::now();
-      }
-      else if(e->cookie == m_cookie)
-      {
-        ssLog << "move end (" << e->cookie << ")";
-        // pair of move found
-        m_cookie = 0;
-        const bool from = e->mask & IN_MOVED_FROM;
-        const std::string src = from ? fileName : m_moveName;
-        const std::string dst = from ? m_moveName : fileName;
-
-        m_dst.onFileSystemChange(
-          IFileSystemChangeListener::EventType::FileMoved, src, dst);
-      }
-      else
-      {
-        LOG_F(ERROR, "INVALID INOTIFY EVENT: %s", fileName.c_str());
-      }
-    }
     else if(e->mask & IN_CLOSE_NOWRITE)
     {
       ssLog << "existing file closed: " << e->mask;
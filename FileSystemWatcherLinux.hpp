@@ -30,10 +30,16 @@ private:
   void threadMain();
   void handleInotifyEvent(const struct inotify_event *e);
   void watchDir(const std::string &dirName);
+  /** stop watching a folder and the folders below it */
+  void unwatchDir(const std::string &dirName);
+  /** pass a move on, src or dst is empty if it left/entered the tree */
+  void notifyMove(
+    const std::string &src, const std::string &dst, bool directory);
   int m_fd;
   int m_eventfd;
   bool m_stopping;
   bool m_moveFrom;
+  bool m_moveDir;
   uint32_t m_cookie;
   std::string m_moveName;
   std::unordered_map<int, std::string> m_watchedDirs;
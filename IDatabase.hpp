@@ -2,9 +2,13 @@
 #define __IDATABASE_HPP__
 
 #include <exception>
+#include <functional>
 #include <string>
+#include <vector>
 
 #include "IMediaArchiverServer.hpp"
+#include "PendingIndex.hpp"
+#include "RetryPolicy.hpp"
 
 namespace MediaArchiver
 {
@@ -14,10 +18,88 @@ struct BasicFileInfo
   size_t fileSize;
 };
 
+/**
+ * @brief part of a long source file encoded as a job of its own
+ */
+struct SegmentInfo
+{
+  uint32_t id;             ///< file ID of the segment in source table
+  unsigned index;          ///< position of the segment in the source
+  std::string fileName;    ///< segment cut from the source
+  std::string archiveName; ///< encoded segment, empty if not done yet
+  int8_t status;           ///< queue status of the segment
+  int count;               ///< number of attempts
+};
+
+/**
+ * @brief stream details of a source file read from its container header
+ */
+struct MediaDetails
+{
+  double duration;        ///< seconds, negative if unknown
+  std::string videoCodec; ///< ffmpeg name, e.g. h264, empty if unknown
+  std::string audioCodec; ///< ffmpeg name, e.g. aac, empty if unknown
+  int width;              ///< pixels, 0 if unknown
+  int height;             ///< pixels, 0 if unknown
+  int bitRate;            ///< kb/s of the whole file, 0 if unknown
+};
+
+/**
+ * @brief content and inode of a source file to find its copies and links
+ */
+struct SourceFingerprint
+{
+  uint64_t hash;   ///< of the size and the first, middle and last block
+  uint64_t device; ///< st_dev of the file
+  uint64_t inode;  ///< st_ino of the file
+};
+
+/**
+ * @brief archived file of a source file
+ */
+struct ArchiveInfo
+{
+  std::string fileName; ///< encoded or remuxed file
+  bool remux;           ///< the streams were copied instead of encoded
+  std::string preset;   ///< tier of the encoder speed, empty: default
+  uint32_t settings;    ///< hash of the encoder settings, 0 if unknown
+};
+
+/**
+ * @brief order the archives made with other settings are encoded again in
+ */
+enum class ReencodeOrder
+{
+  Oldest,  ///< archived first
+  Largest, ///< largest source first
+  Smallest ///< smallest source first
+};
+
+/**
+ * @brief an attempt to encode a source file kept in the job history, the
+ * source details are copied from source table when it is added
+ */
+struct JobRecord
+{
+  uint32_t fileId;        ///< file ID in source table
+  std::string client;     ///< name of the client that encoded it
+  int8_t result;          ///< EncodingResult of the attempt
+  bool remux;             ///< the streams were copied instead of encoded
+  double seconds;         ///< wall time from handing out to the result
+  uint64_t outputSize;    ///< length of the result, 0 if none
+  double duration;        ///< seconds of the source, negative if unknown
+  uint64_t fileSize;      ///< length of the source
+  std::string videoCodec; ///< of the source, empty if unknown
+  int height;             ///< of the source, 0 if unknown
+};
+
 struct EncodedFile : public EncodingResultInfo
 {
   uint32_t originalFileId;
   std::string fileName;
+  bool remux = false; ///< the streams were copied instead of encoded
+  std::string preset; ///< tier of the encoder speed, empty: default
+  uint32_t settings = 0; ///< hash of the encoder settings, 0: unknown
 
   EncodedFile(){};
 
@@ -36,6 +118,20 @@ struct EncodedFile : public EncodingResultInfo
   }
 };
 
+/**
+ * @brief last failure of a source file and what the retry policy made of
+ * it
+ */
+struct FailureInfo
+{
+  int8_t status;   ///< queue status, Quarantined: not handed out anymore
+  int attempts;    ///< times the file was handed out
+  int repeats;     ///< identical failures in a row
+  int64_t retryAt; ///< earliest next hand out (s), 0: none planned
+  RetryPolicy::FailureClass failureClass;
+  std::string error;
+};
+
 class IDatabase
 {
 public:
@@ -58,6 +154,38 @@ public:
    */
   virtual uint32_t getNextFile(
     const MediaFileRequirements &filter, BasicFileInfo &file) = 0;
+  /**
+   * Reserve a given media file for processing, e.g. to take over a result
+   * encoded earlier.
+   *
+   * @param srcFileId file ID in source table
+   * @param file basic file info
+   * @return true the file is reserved
+   * @return false the file is unknown or already archived
+   */
+  virtual bool reserveFile(uint32_t srcFileId, BasicFileInfo &file) = 0;
+  /**
+   * @brief order the pending files by the scheduling policy, the pending
+   * index is reloaded
+   */
+  virtual void setPendingRank(const PendingIndex::Rank &rank) = 0;
+  /**
+   * Reserve the pending media file chosen by the scheduler and count the
+   * attempt like getNextFile does.
+   *
+   * @param select chooses the file ID from the pending files, 0 for none
+   * @param file basic file info
+   * @return uint32_t file ID in source table or 0 if no file was chosen
+   */
+  virtual uint32_t startNextFile(
+    const std::function<uint32_t(const PendingIndex &)> &select,
+    BasicFileInfo &file) = 0;
+  /**
+   * @brief look up a file in source table
+   *
+   * @return false the file is unknown
+   */
+  virtual bool getFile(uint32_t srcFileId, BasicFileInfo &file) = 0;
   /**
    * Adds a media file to original source media table (if not exists) and
    * returns its id
@@ -77,6 +205,78 @@ public:
    */
   virtual void addEncodedFile(const EncodedFile &file) = 0;
 
+  /** @return ID of the source file with this path, 0 if not catalogued */
+  virtual uint32_t getFileId(const std::string &fileName) = 0;
+
+  /**
+   * @brief rename a source or an archive in place, its queue state and
+   * archive are kept; a file replaced at the new path is dropped
+   *
+   * @return ID of the moved source, 0 if the old path is not catalogued
+   */
+  virtual uint32_t moveFile(
+    const std::string &from, const std::string &to) = 0;
+
+  /**
+   * @brief rewrite the paths of the sources and archives below a moved
+   * folder
+   *
+   * @return number of sources moved
+   */
+  virtual size_t moveDirectory(
+    const std::string &from, const std::string &to) = 0;
+
+  /**
+   * @brief record the size and modification time of a source file, a file
+   * whose content changed since is encoded again
+   *
+   * @return true the file changed, its queue was reset
+   */
+  virtual bool updateFileStat(
+    uint32_t srcFileId, size_t size, int64_t mtime) = 0;
+
+  /**
+   * @brief forget a deleted source file, an archived one is kept as the
+   * record of its archive
+   *
+   * @return false the file is archived or not catalogued
+   */
+  virtual bool removeFile(uint32_t srcFileId) = 0;
+
+  /**
+   * @brief forget the sources below a folder that is gone, archived ones
+   * are kept like with removeFile
+   *
+   * @return IDs of all sources below the folder
+   */
+  virtual std::vector<uint32_t> removeDirectory(
+    const std::string &folder) = 0;
+
+  /**
+   * @brief forget a deleted archive, its source is encoded again
+   *
+   * @return ID of the source file, 0 if the archive is not catalogued
+   */
+  virtual uint32_t removeArchive(const std::string &fileName) = 0;
+
+  /**
+   * @brief keep a source file that is still being written from being
+   * handed out, not kept across restarts
+   */
+  virtual void setSettling(uint32_t srcFileId, bool settling) = 0;
+
+  /**
+   * @brief the policy applied to failed jobs, a failed file is handed out
+   * again once its retry time has come
+   */
+  virtual void setRetryPolicy(const RetryPolicy &policy) = 0;
+
+  /**
+   * @return false the file is not catalogued or its last job did not
+   * fail
+   */
+  virtual bool getFailure(uint32_t srcFileId, FailureInfo &failure) = 0;
+
   /**
    * @brief resets the queue for source file to not started
    *
@@ -84,6 +284,109 @@ public:
    */
   virtual void reset(uint32_t srcFileId) = 0;
 
+  /**
+   * @brief queue the segments of a source file as jobs of their own, the
+   * source file itself is not handed out anymore
+   *
+   * @param srcFileId source file ID
+   * @param segments segment files in their order
+   */
+  virtual void addSegments(
+    uint32_t srcFileId, const std::vector<BasicFileInfo> &segments) = 0;
+
+  /**
+   * @brief segments of a source file in their order
+   *
+   * @return std::vector<SegmentInfo> empty if the file is not segmented
+   */
+  virtual std::vector<SegmentInfo> getSegments(uint32_t srcFileId) = 0;
+
+  /**
+   * @return uint32_t source file ID the segment was cut from, 0 if the file
+   * is not a segment
+   */
+  virtual uint32_t getParent(uint32_t fileId) = 0;
+
+  /** source files waiting for their segments */
+  virtual std::vector<uint32_t> getSegmentedFiles() = 0;
+
+  /**
+   * @brief forget the segments of a source file after joining them or
+   * giving up
+   */
+  virtual void removeSegments(uint32_t srcFileId) = 0;
+
+  /**
+   * @brief store the details read from the header of a source file, a
+   * negative duration marks a file whose header could not be read
+   */
+  virtual void setMediaDetails(
+    uint32_t srcFileId, const MediaDetails &details) = 0;
+
+  /**
+   * @return false the header of the source file has not been indexed yet
+   */
+  virtual bool getMediaDetails(uint32_t srcFileId, MediaDetails &details) = 0;
+
+  /**
+   * @brief look up the archive of a source file
+   *
+   * @return false the file is not archived
+   */
+  virtual bool getArchive(uint32_t srcFileId, ArchiveInfo &archive) = 0;
+
+  virtual void setFingerprint(
+    uint32_t srcFileId, const SourceFingerprint &fp) = 0;
+
+  /** @return false the source file has not been fingerprinted yet */
+  virtual bool getFingerprint(
+    uint32_t srcFileId, SourceFingerprint &fp) = 0;
+
+  /** source files with the same size, fingerprint and inode */
+  virtual std::vector<uint32_t> findFiles(
+    const SourceFingerprint &fp, size_t size) = 0;
+
+  /**
+   * @brief another source file with the same size and fingerprint or the
+   * same inode that is archived already
+   *
+   * @return file ID of the twin, 0 if there is none
+   */
+  virtual uint32_t findArchivedTwin(uint32_t srcFileId) = 0;
+
+  /** pending source files with the same content as the given one */
+  virtual std::vector<uint32_t> getPendingTwins(uint32_t srcFileId) = 0;
+
+  /**
+   * @brief record the settings of the archives made before the settings
+   * were kept with them
+   */
+  virtual void setUnknownArchiveSettings(uint32_t settings) = 0;
+
+  /**
+   * @brief archived source files whose archive was encoded with other
+   * settings, remuxed archives are left alone
+   *
+   * @param limit return at most this many
+   */
+  virtual std::vector<uint32_t> getOutdatedArchives(
+    uint32_t settings, ReencodeOrder order, size_t limit) = 0;
+
+  /**
+   * @brief record a finished attempt in the job history, the details of
+   * the source are taken from source table
+   */
+  virtual void addJob(const JobRecord &job) = 0;
+
+  /** the job history, oldest first */
+  virtual std::vector<JobRecord> getJobs() = 0;
+
+  /**
+   * @brief the files waiting to be handed out with their details in the
+   * order of the pending index, for reports
+   */
+  virtual std::vector<PendingFile> getPendingFiles() = 0;
+
   virtual ~IDatabase(){};
 };
 
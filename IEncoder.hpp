@@ -0,0 +1,88 @@
+#ifndef __IENCODER_HPP__
+#define __IENCODER_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MediaArchiverClientConfig.hpp"
+
+namespace MediaArchiver
+{
+class StreamingSource;
+
+/** further output of the same run, e.g. a preview */
+struct EncodeOutput
+{
+  std::string parameters; ///< encoder options of the output
+  std::string outFile;
+};
+
+struct EncodeJob
+{
+  std::string inFile;        ///< source file
+  std::string outFile;       ///< empty for the 1st pass of 2
+  std::string parameters;    ///< encoder options sent by the server
+  std::string clientOptions; ///< options of the client for this pass
+  std::string passLogPrefix; ///< empty for single pass encoding
+  int passNo;                ///< 1 or 2, single pass encodings use 2
+  unsigned threads;          ///< 0: let the encoder decide
+  uint64_t fileLength;       ///< length of the source file
+  StreamingSource *source;   ///< source still being received or nullptr
+  int startTime;             ///< position (s) to start encoding at
+  int duration;              ///< seconds to encode, 0: up to the end
+  std::vector<EncodeOutput> extraOutputs; ///< encoded besides outFile
+};
+
+struct EncoderProgress
+{
+  uint64_t frames;   ///< video frames encoded
+  int64_t outTime;   ///< timestamp of the output in microseconds
+  uint64_t outBytes; ///< size of the output written so far
+};
+
+/**
+ * @brief Encoding engine turning the source of a job into its output.
+ */
+class IEncoder
+{
+public:
+  /**
+   * @brief start encoding
+   *
+   * @throws std::runtime_error if the encoder cannot be started
+   */
+  virtual void start(const EncodeJob &job) = 0;
+
+  /**
+   * @brief collect the diagnostic output of the encoder without blocking
+   *
+   * @return false the encoder has finished, call finish()
+   */
+  virtual bool poll(std::string &output) = 0;
+
+  /**
+   * @brief wait for the encoder to end
+   *
+   * @return int 0 on success
+   */
+  virtual int finish() = 0;
+
+  /** abort encoding */
+  virtual void kill() = 0;
+
+  /** process id of the encoder or 0 if it runs in this process */
+  virtual int pid() const = 0;
+
+  /** can the encoder start while the source is still being received */
+  virtual bool canStream(const EncodeJob &job) const = 0;
+
+  virtual EncoderProgress getProgress() const = 0;
+
+  virtual ~IEncoder(){};
+};
+
+/** engine configured for the job */
+IEncoder *createEncoder(const ClientConfig &cfg, const EncodeJob &job);
+}
+#endif // !__IENCODER_HPP__
@@ -26,6 +26,8 @@ public:
     FileMoved,
     FileDiscovered,
     Unmounted,
+    DirectoryMoved, ///< src and dst are the old and the new folder, dst
+                    ///< is empty when moved out of the watched ones
     Unknown = -1
   };
 
@@ -37,11 +37,35 @@ public:
   virtual ~IVersion(){};
 };
 
+/**
+ * @brief what the client asks for and the capabilities of its machine, the
+ * server matches the jobs to them
+ */
 struct MediaFileRequirements
 {
   std::string encoderType;
-  size_t maxFileSize;
-  MSGPACK_DEFINE_ARRAY_(encoderType, maxFileSize)
+  size_t maxFileSize;      ///< largest source the client takes, 0: any
+  std::string clientName;  ///< the server keeps the job history by it
+  unsigned cores;          ///< of the machine, 0 if unknown
+  double benchmarkFps;     ///< measured by the calibration, 0 if unknown
+  uint64_t freeTempSpace;  ///< bytes free for the temp files, 0 if unknown
+  uint64_t memory;         ///< bytes of memory available, 0 if unknown
+  std::vector<std::string> codecs; ///< encoders supported, empty: unknown
+  unsigned slots;          ///< jobs encoded in parallel, 0 if unknown
+  MSGPACK_DEFINE_ARRAY_(encoderType, maxFileSize, clientName, cores,
+    benchmarkFps, freeTempSpace, memory, codecs, slots)
+};
+
+/**
+ * @brief further output of a job encoded from the same decoded frames as
+ * the archive, e.g. a low resolution preview
+ */
+struct RenditionSettings
+{
+  std::string name;      ///< identifies the output, e.g. preview
+  std::string extension; ///< of the output file, with the dot
+  std::string commandLineParameters; ///< encoder options of the output
+  MSGPACK_DEFINE_ARRAY_(name, extension, commandLineParameters)
 };
 
 struct MediaEncoderSettings
@@ -51,8 +75,15 @@ struct MediaEncoderSettings
   std::string fileExtension;
   std::string finalExtension;
   std::string commandLineParameters;
+  uint32_t jobId;        ///< id of the source file at the server
+  uint64_t sourceTime;   ///< modification time of the source file
+  uint32_t settingsHash; ///< identifies the encoder settings of the server
+  std::string preset;    ///< tier of the encoder speed, empty: default
+  /** outputs encoded besides the archive */
+  std::vector<RenditionSettings> renditions;
   MSGPACK_DEFINE_ARRAY_(fileLength, encoderType, fileExtension,
-    finalExtension, commandLineParameters)
+    finalExtension, commandLineParameters, jobId, sourceTime, settingsHash,
+    preset, renditions)
 };
 
 struct EncodingResultInfo
@@ -60,18 +91,23 @@ struct EncodingResultInfo
   enum EncodingResult : int8_t
   {
     Started = 1,
+    Segmented = 2, ///< the segments are encoded as jobs of their own
+    NoGain = 3,    ///< the encoding would not save enough space
     OK = 5,
     NotStarted = 0,
     RetriableError = -1,
     ServerIOError = -9,
     UnknownError = -50,
     PermanentError = -100,
+    Quarantined = -101, ///< failed repeatedly, not handed out anymore
   };
 
   int8_t result;
   size_t fileLength;
   std::string error;
-  MSGPACK_DEFINE_ARRAY_(result, fileLength, error)
+  /** sent after the archive in the order of the renditions, 0: missing */
+  std::vector<uint64_t> renditionLengths;
+  MSGPACK_DEFINE_ARRAY_(result, fileLength, error, renditionLengths)
   EncodingResultInfo() {}
   EncodingResultInfo(EncodingResult result, size_t size, std::string error)
     : result(static_cast<int8_t>(result))
@@ -81,6 +117,51 @@ struct EncodingResultInfo
   }
 };
 
+/**
+ * @brief result of a finished encoding kept by the client until the server
+ * took it over
+ */
+struct SpooledResult
+{
+  uint32_t jobId;
+  std::string token;     ///< token of the session the job was received in
+  size_t sourceLength;   ///< identity of the source file ...
+  uint64_t sourceTime;   ///< ... at the time it was received
+  uint32_t settingsHash; ///< settings the result was encoded with
+  EncodingResultInfo result;
+  MSGPACK_DEFINE_ARRAY_(
+    jobId, token, sourceLength, sourceTime, settingsHash, result)
+};
+
+/**
+ * @brief output size and speed of a job predicted from short trial encodes
+ * of samples of its source
+ */
+struct EncodeEstimate
+{
+  double sizeRatio;    ///< predicted output size / source size
+  double speed;        ///< seconds of the source encoded per second
+  uint64_t outputSize; ///< predicted size of the output
+  int samples;         ///< trial encodes the prediction is based on
+  MSGPACK_DEFINE_ARRAY_(sizeRatio, speed, outputSize, samples)
+};
+
+/** @brief what the server wants the client to do with an estimated job */
+struct EstimateVerdict
+{
+  enum Action : int8_t
+  {
+    Encode = 0,    ///< go on as planned
+    Skip = 1,      ///< not worth encoding, post a NoGain result
+    Downgrade = 2, ///< encode with commandLineParameters
+    Cancel = 3,    ///< the source changed or is gone, drop the job
+  };
+
+  int8_t action;
+  std::string commandLineParameters; ///< faster settings for Downgrade
+  MSGPACK_DEFINE_ARRAY_(action, commandLineParameters)
+};
+
 using DataChunk = std::vector<char>;
 class IServer : public IVersion
 {
@@ -94,6 +175,22 @@ public:
     MediaEncoderSettings &settings) = 0;
   virtual bool readChunk(std::ostream &file) = 0;
   virtual void postFile(const EncodingResultInfo &result) = 0;
+  /**
+   * @brief offer a result encoded in an earlier session
+   *
+   * @return true the server wants the file, send it with writeChunk
+   * @return false the result is not needed (anymore)
+   */
+  virtual bool offerResult(const SpooledResult &result) = 0;
+  /**
+   * @brief report the estimate of the received job before it is encoded
+   */
+  virtual EstimateVerdict reportEstimate(const EncodeEstimate &estimate) = 0;
+  /**
+   * @return false the server cancelled the job of the session because its
+   * source changed or was deleted
+   */
+  virtual bool checkJob() = 0;
   virtual bool writeChunk(const std::vector<char> &data) = 0;
   virtual ~IServer(){};
 };
@@ -0,0 +1,438 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+
+#include "JobScheduler.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+// typical for DVB recordings and camera files (8 Mbit/s)
+constexpr double AssumedBytesPerSecond = 1000000.0;
+
+// frame rate of most sources (PAL), converts the calibrated fps
+constexpr double AssumedFrameRate = 25.0;
+
+// source seconds per second of a core encoding to a slow archive codec
+constexpr double AssumedSpeedPerCore = 0.05;
+
+// less memory than this for each slot and UHD encodes swap
+constexpr uint64_t MinMemoryPerSlot = 2ull * 1024 * 1024 * 1024;
+
+// clients not asking for a job for longer are not compared with anymore
+constexpr std::chrono::hours ClientTimeout(24);
+
+// wall time of a job until some have been measured
+constexpr double AssumedJobSeconds = 3600.0;
+
+std::string getDirectory(const std::string &fileName)
+{
+  const auto pos = fileName.find_last_of('/');
+  return pos == std::string::npos ? std::string() : fileName.substr(0, pos);
+}
+
+// ranks of the directories and of the retries above all file IDs
+constexpr double IdRange = 4294967296.0;
+
+/** in the order of the catalog */
+class FifoPolicy : public ISchedulingPolicy
+{
+public:
+  double rank(const PendingFile &file) override { return file.id; }
+};
+
+/** shortest job first, keeps many clients busy and results coming */
+class ShortestFirstPolicy : public ISchedulingPolicy
+{
+public:
+  ShortestFirstPolicy(const CostModel *model)
+    : m_model(model)
+  {
+  }
+
+  double rank(const PendingFile &file) override
+  {
+    return estimateCost(file, m_model);
+  }
+
+private:
+  const CostModel *m_model;
+};
+
+/** most space freed first, for a filling disk */
+class LargestSavingsPolicy : public ISchedulingPolicy
+{
+public:
+  LargestSavingsPolicy(const CostModel *model)
+    : m_model(model)
+  {
+  }
+
+  double rank(const PendingFile &file) override
+  {
+    return -estimateSavings(file, m_model);
+  }
+
+private:
+  const CostModel *m_model;
+};
+
+/**
+ * shares the work by the measured speed of the clients: the ones faster
+ * than the average of the clients asking lately get the longest pending
+ * job, the others and the ones not measured yet the shortest, so all
+ * finish at about the same time
+ */
+class FairSharePolicy : public ISchedulingPolicy
+{
+public:
+  FairSharePolicy(const CostModel *model)
+    : m_model(model)
+  {
+  }
+
+  double rank(const PendingFile &file) override
+  {
+    return estimateCost(file, m_model);
+  }
+
+  const PendingIndex::Entry *select(const PendingIndex &index,
+    size_t maxSize, const std::string &client) override
+  {
+    const double speed = m_model ? m_model->getSpeed(client) : 0.0;
+    const auto now = std::chrono::steady_clock::now();
+    m_clients[client] = Client{speed, now};
+
+    double total = 0.0;
+    unsigned measured = 0;
+    for(auto it = m_clients.begin(); it != m_clients.end();)
+    {
+      if(now - it->second.seen > ClientTimeout)
+      {
+        it = m_clients.erase(it);
+        continue;
+      }
+      if(it->second.speed > 0)
+      {
+        total += it->second.speed;
+        measured++;
+      }
+      ++it;
+    }
+
+    const bool fast = speed > 0 && speed * measured > total;
+    return fast ? index.last(maxSize) : index.first(maxSize);
+  }
+
+private:
+  struct Client
+  {
+    double speed; ///< source seconds per second, 0: not measured yet
+    std::chrono::steady_clock::time_point seen;
+  };
+
+  const CostModel *m_model;
+  std::map<std::string, Client> m_clients; ///< asked for a job lately
+};
+
+/** files that failed before wait until all new ones have been tried */
+class RetryLastPolicy : public ISchedulingPolicy
+{
+public:
+  double rank(const PendingFile &file) override
+  {
+    return (file.retry ? IdRange : 0.0) + file.id;
+  }
+};
+
+/** finish a directory before starting another, e.g. a season */
+class DirectoryPolicy : public ISchedulingPolicy
+{
+public:
+  DirectoryPolicy()
+    : m_current(-1.0)
+  {
+  }
+
+  double rank(const PendingFile &file) override
+  {
+    // directories in the order they were found
+    const auto dir = getDirectory(file.fileName);
+    auto it = m_directories.find(dir);
+    if(it == m_directories.end())
+      it = m_directories.emplace(dir, m_directories.size()).first;
+    return it->second * IdRange + file.id;
+  }
+
+  const PendingIndex::Entry *select(const PendingIndex &index,
+    size_t maxSize, const std::string &client) override
+  {
+    if(m_current >= 0)
+    {
+      const auto e = index.first(m_current * IdRange, maxSize);
+      if(e && getDirectoryRank(*e) == m_current)
+        return e;
+    }
+    return index.first(maxSize);
+  }
+
+  void onStarted(
+    const PendingIndex::Entry &entry, const std::string &client) override
+  {
+    m_current = getDirectoryRank(entry);
+  }
+
+private:
+  static double getDirectoryRank(const PendingIndex::Entry &entry)
+  {
+    return std::floor(entry.rank / IdRange);
+  }
+
+  std::map<std::string, uint32_t> m_directories;
+  double m_current; ///< directory handed out last
+};
+}
+
+namespace MediaArchiver
+{
+ISchedulingPolicy *createSchedulingPolicy(
+  const std::string &name, const CostModel *model)
+{
+  if(name == "fifo")
+    return new FifoPolicy();
+  if(name == "shortest")
+    return new ShortestFirstPolicy(model);
+  if(name == "savings")
+    return new LargestSavingsPolicy(model);
+  if(name == "fairshare")
+    return new FairSharePolicy(model);
+  if(name == "retrylast")
+    return new RetryLastPolicy();
+  if(name == "directory")
+    return new DirectoryPolicy();
+
+  throw std::invalid_argument("unknown scheduling policy: " + name);
+}
+
+double estimateDuration(const PendingFile &file)
+{
+  return file.duration > 0 ? file.duration :
+                             file.fileSize / AssumedBytesPerSecond;
+}
+
+double estimateSavings(const PendingFile &file)
+{
+  // share of the source size the archive codec typically saves
+  const std::pair<const char *, double> gains[] = {{"mpeg1video", 0.7},
+    {"mpeg2video", 0.7}, {"mjpeg", 0.85}, {"msmpeg4v3", 0.5},
+    {"mpeg4", 0.5}, {"vc1", 0.5}, {"h264", 0.4}, {"vp9", 0.1},
+    {"hevc", 0.1}, {"av1", 0.0}};
+
+  double gain = 0.5;
+  for(const auto &g: gains)
+  {
+    if(file.videoCodec == g.first)
+    {
+      gain = g.second;
+      break;
+    }
+  }
+  return file.fileSize * gain;
+}
+
+double estimateCost(const PendingFile &file, const CostModel *model)
+{
+  if(model)
+  {
+    const auto fc = model->predict(file);
+    if(fc.samples)
+      return fc.seconds;
+  }
+  return estimateDuration(file);
+}
+
+double estimateSavings(const PendingFile &file, const CostModel *model)
+{
+  if(model)
+  {
+    const auto fc = model->predict(file);
+    if(fc.samples)
+      return static_cast<double>(file.fileSize) - fc.outputSize;
+  }
+  return estimateSavings(file);
+}
+}
+
+CapabilityMatcher::CapabilityMatcher(const CostModel &model, double jobHours)
+  : m_model(model)
+  , m_jobSeconds(jobHours * 3600)
+{
+}
+
+double CapabilityMatcher::getSpeed(
+  const std::string &client, const MediaFileRequirements &filter) const
+{
+  const double measured = m_model.getSpeed(client);
+  if(measured > 0)
+    return measured;
+
+  const unsigned slots = std::max(1u, filter.slots);
+  if(filter.benchmarkFps > 0)
+    return filter.benchmarkFps / AssumedFrameRate / slots;
+  return filter.cores * AssumedSpeedPerCore / slots;
+}
+
+size_t CapabilityMatcher::getMaxFileSize(
+  const std::string &client, const MediaFileRequirements &filter)
+{
+  const double speed = getSpeed(client, filter);
+  const auto now = std::chrono::steady_clock::now();
+  m_clients[client] = Client{speed, std::max(1u, filter.slots), now};
+  double fastest = 0.0;
+  for(auto it = m_clients.begin(); it != m_clients.end();)
+  {
+    if(now - it->second.seen > ClientTimeout)
+    {
+      it = m_clients.erase(it);
+      continue;
+    }
+    fastest = std::max(fastest, it->second.speed);
+    ++it;
+  }
+
+  if(m_jobSeconds <= 0 || speed <= 0)
+    return filter.maxFileSize;
+
+  const bool lowMemory = filter.memory &&
+    filter.memory / std::max(1u, filter.slots) < MinMemoryPerSlot;
+  if(speed >= fastest && !lowMemory)
+    return filter.maxFileSize;
+
+  const double bytesPerSecond = m_model.getBytesPerSecond() > 0 ?
+    m_model.getBytesPerSecond() :
+    AssumedBytesPerSecond;
+  const auto limit = std::max<size_t>(
+    1, static_cast<size_t>(m_jobSeconds * speed * bytesPerSecond));
+  LOG_F(5, "Client %s (%.2fx of %.2fx) takes files up to %lu MiB",
+    client.c_str(), speed, fastest, limit >> 20);
+  return filter.maxFileSize ? std::min(filter.maxFileSize, limit) : limit;
+}
+
+double CapabilityMatcher::getBacklogHours(size_t pending) const
+{
+  unsigned slots = 0;
+  for(const auto &c: m_clients)
+    slots += c.second.slots;
+
+  const double job = m_model.getMeanSeconds() > 0 ?
+    m_model.getMeanSeconds() :
+    AssumedJobSeconds;
+  return pending * job / std::max(1u, slots) / 3600;
+}
+
+JobScheduler::JobScheduler(
+  IDatabase &db, const std::string &policy, double jobHours)
+  : m_db(db)
+  , m_matcher(m_model, jobHours)
+  , m_policy(createSchedulingPolicy(policy, &m_model))
+  , m_rankedSamples(0)
+  , m_pending(0)
+{
+  for(const auto &job: m_db.getJobs())
+    m_model.add(job);
+  LOG_F(1, "Cost model learnt from %i jobs", m_model.samples());
+
+  reloadRanks();
+}
+
+void JobScheduler::reloadRanks()
+{
+  m_rankedSamples = m_model.samples();
+
+  // the index keeps the policy alive as long as it is used
+  const auto p = m_policy;
+  m_db.setPendingRank(
+    [p](const PendingFile &file) { return p->rank(file); });
+}
+
+uint32_t JobScheduler::getNextFile(const std::string &client,
+  const MediaFileRequirements &filter, BasicFileInfo &file)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto maxSize = m_matcher.getMaxFileSize(client, filter);
+  return m_db.startNextFile(
+    [&](const PendingIndex &index) -> uint32_t {
+      m_pending = index.size();
+      const auto e = m_policy->select(index, maxSize, client);
+      if(!e)
+        return 0;
+
+      LOG_F(5, "Scheduled file %u out of %lu pending", e->id, index.size());
+      m_policy->onStarted(*e, client);
+      return e->id;
+    },
+    file);
+}
+
+void JobScheduler::addJob(JobRecord job)
+{
+  MediaDetails details;
+  BasicFileInfo file;
+  if(!m_db.getMediaDetails(job.fileId, details))
+    details = MediaDetails{-1.0, "", "", 0, 0, 0};
+  job.duration = details.duration;
+  job.videoCodec = details.videoCodec;
+  job.height = details.height;
+  job.fileSize = m_db.getFile(job.fileId, file) ? file.fileSize : 0;
+
+  m_db.addJob(job);
+  m_model.add(job);
+
+  // the files already ranked were predicted with less history, they are
+  // ranked again each time it doubled
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if(m_model.samples() >= std::max(1, 2 * m_rankedSamples))
+    reloadRanks();
+}
+
+double JobScheduler::getBacklogHours()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_matcher.getBacklogHours(m_pending);
+}
+
+JobForecast JobScheduler::forecast(uint32_t srcFileId,
+  const BasicFileInfo &file, const std::string &client) const
+{
+  MediaDetails details;
+  if(!m_db.getMediaDetails(srcFileId, details))
+    details = MediaDetails{-1.0, "", "", 0, 0, 0};
+
+  return m_model.predict(PendingFile{srcFileId, file.fileName,
+                           file.fileSize, details.duration,
+                           details.videoCodec, details.height, false},
+    client);
+}
+
+std::vector<PendingForecast> JobScheduler::forecastPending(
+  const std::vector<std::string> &clients)
+{
+  const auto slots =
+    clients.empty() ? std::vector<std::string>{std::string()} : clients;
+  std::vector<double> freeAt(slots.size(), 0.0);
+
+  // each file goes to the slot that is free first
+  std::vector<PendingForecast> result;
+  for(auto &f: m_db.getPendingFiles())
+  {
+    const auto slot = std::min_element(freeAt.begin(), freeAt.end());
+    const auto cost = m_model.predict(f, slots[slot - freeAt.begin()]);
+    *slot += cost.seconds > 0 ? cost.seconds : 0.0;
+    result.emplace_back(PendingForecast{std::move(f), cost, *slot});
+  }
+  return result;
+}
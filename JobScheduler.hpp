@@ -0,0 +1,189 @@
+#ifndef __JOBSCHEDULER_HPP__
+#define __JOBSCHEDULER_HPP__
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "CostModel.hpp"
+#include "IDatabase.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Decides which of the pending files a client gets next. The
+ * pending index is kept in the order of the rank of the policy.
+ */
+class ISchedulingPolicy
+{
+public:
+  /** position of a file in the pending index */
+  virtual double rank(const PendingFile &file) = 0;
+
+  /**
+   * @param maxSize largest file the client accepts, 0: any
+   * @param client name of the requesting client, see CostModel
+   * @return const PendingIndex::Entry* file to hand out or nullptr
+   */
+  virtual const PendingIndex::Entry *select(const PendingIndex &index,
+    size_t maxSize, const std::string &client)
+  {
+    return index.first(maxSize);
+  }
+
+  /** the file has been handed out to the client */
+  virtual void onStarted(
+    const PendingIndex::Entry &entry, const std::string &client)
+  {
+  }
+
+  virtual ~ISchedulingPolicy(){};
+};
+
+/**
+ * @brief policy by its name (fifo, shortest, savings, fairshare, retrylast,
+ * directory)
+ *
+ * @param model history the costs of the jobs are predicted from, nullptr:
+ * guessed from the size and the codec
+ * @throws std::invalid_argument the name is unknown
+ */
+ISchedulingPolicy *createSchedulingPolicy(
+  const std::string &name, const CostModel *model = nullptr);
+
+/** expected length (s) of the file, guessed from its size if unknown */
+double estimateDuration(const PendingFile &file);
+
+/** expected bytes saved by encoding the file, by its current codec */
+double estimateSavings(const PendingFile &file);
+
+/**
+ * expected encoding time (s) of the file predicted by the model, the
+ * length of the file without history
+ */
+double estimateCost(const PendingFile &file, const CostModel *model);
+
+/** expected bytes saved, predicted by the model if it has history */
+double estimateSavings(const PendingFile &file, const CostModel *model);
+
+/**
+ * @brief cost of a pending file and when it is expected to be done
+ */
+struct PendingForecast
+{
+  PendingFile file;
+  JobForecast cost;
+  double eta; ///< seconds from now until the file is encoded
+};
+
+/**
+ * @brief Matches the size of the jobs to the capabilities of the clients:
+ * the fastest client takes any job, the others only the ones they are
+ * expected to finish within the time limit, so long jobs go to the strong
+ * machines and short clips to the weak ones.
+ */
+class CapabilityMatcher
+{
+public:
+  /**
+   * @param model measured speeds of the clients
+   * @param jobHours longest time a job may take on a client that is not
+   * the fastest one, 0: no limit
+   */
+  CapabilityMatcher(const CostModel &model, double jobHours);
+
+  /**
+   * @return double source seconds the client encodes per second in each
+   * of its slots, measured or guessed from its profile, 0 if unknown
+   */
+  double getSpeed(
+    const std::string &client, const MediaFileRequirements &filter) const;
+
+  /**
+   * @brief remember the client asking for a job
+   *
+   * @return size_t largest file to hand out to it, 0: any
+   */
+  size_t getMaxFileSize(
+    const std::string &client, const MediaFileRequirements &filter);
+
+  /**
+   * @brief hours the slots of the clients asking lately need for the
+   * pending files, by the average time of the finished jobs
+   */
+  double getBacklogHours(size_t pending) const;
+
+private:
+  struct Client
+  {
+    double speed;
+    unsigned slots;
+    std::chrono::steady_clock::time_point seen;
+  };
+
+  const CostModel &m_model;
+  const double m_jobSeconds;
+  std::map<std::string, Client> m_clients; ///< asked for a job lately
+};
+
+/**
+ * @brief Hands out the pending files of the catalog in the order of the
+ * configured scheduling policy.
+ */
+class JobScheduler
+{
+public:
+  /** @param jobHours see CapabilityMatcher */
+  JobScheduler(
+    IDatabase &db, const std::string &policy, double jobHours = 0.0);
+  JobScheduler(const JobScheduler &) = delete;
+
+  /**
+   * Reserve the next file for a client.
+   *
+   * @param client name of the requesting client, see CostModel
+   * @return uint32_t file ID in source table or 0 if no file is pending
+   */
+  uint32_t getNextFile(const std::string &client,
+    const MediaFileRequirements &filter, BasicFileInfo &file);
+
+  /**
+   * @brief record a finished attempt in the job history and learn from it,
+   * the source details are filled in from the catalog
+   */
+  void addJob(JobRecord job);
+
+  /** predicted cost of a file in source table for the client */
+  JobForecast forecast(uint32_t srcFileId, const BasicFileInfo &file,
+    const std::string &client) const;
+
+  /**
+   * @brief the pending files in the order of the policy with the time they
+   * are expected to be done, shared out among the given clients
+   *
+   * @param clients names of the encoding slots, empty: one average client
+   */
+  std::vector<PendingForecast> forecastPending(
+    const std::vector<std::string> &clients);
+
+  const CostModel &getCostModel() const { return m_model; }
+
+  /** see CapabilityMatcher::getBacklogHours */
+  double getBacklogHours();
+
+private:
+  /** rank the pending files by the current model */
+  void reloadRanks();
+
+  IDatabase &m_db;
+  CostModel m_model;
+  CapabilityMatcher m_matcher;
+  std::shared_ptr<ISchedulingPolicy> m_policy;
+  int m_rankedSamples; ///< size of the history the ranks were made with
+  size_t m_pending;    ///< files pending when a job was handed out last
+  std::mutex m_mtx;
+};
+}
+#endif // !__JOBSCHEDULER_HPP__
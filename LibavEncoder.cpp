@@ -0,0 +1,719 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+#include "LibavEncoder.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+constexpr int IoBufferSize = 64 * 1024;
+constexpr int DefaultAudioFrameSize = 1024;
+
+std::string avError(int err)
+{
+  char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+  av_strerror(err, buf, sizeof(buf));
+  return buf;
+}
+
+void check(int ret, const char *what)
+{
+  if(ret < 0)
+  {
+    throw std::runtime_error(std::string(what) + ": " + avError(ret));
+  }
+}
+
+/** the ffmpeg command line options the in-process encoder understands */
+struct Options
+{
+  std::string videoCodec = "libx265";
+  std::string audioCodec = "aac";
+  bool noAudio = false;
+  AVDictionary *video = nullptr;
+  AVDictionary *audio = nullptr;
+  AVDictionary *muxer = nullptr;
+
+  ~Options()
+  {
+    av_dict_free(&video);
+    av_dict_free(&audio);
+    av_dict_free(&muxer);
+  }
+
+  void parse(const std::string &cmdLine)
+  {
+    std::istringstream iss(cmdLine);
+    std::vector<std::string> t;
+    for(std::string s; iss >> s;)
+      t.push_back(s);
+
+    // options without value
+    const char *flags[] = {"-y", "-n", "-hide_banner", "-nostats",
+      "-copyts", "-an", "-vn", "-sn", "-dn"};
+
+    for(size_t i = 0; i < t.size(); i++)
+    {
+      const auto &k = t[i];
+      bool flag = false;
+      for(const auto f: flags)
+        flag = flag || k == f;
+
+      if(flag || k[0] != '-' || i + 1 == t.size())
+      {
+        noAudio = noAudio || k == "-an";
+        continue;
+      }
+
+      const auto &v = t[++i];
+      if(k == "-c:v" || k == "-vcodec" || k == "-codec:v")
+        videoCodec = v;
+      else if(k == "-c:a" || k == "-acodec" || k == "-codec:a")
+        audioCodec = v;
+      else if(k == "-b:v")
+        av_dict_set(&video, "b", v.c_str(), 0);
+      else if(k == "-b:a")
+        av_dict_set(&audio, "b", v.c_str(), 0);
+      else if(k == "-movflags")
+        av_dict_set(&muxer, "movflags", v.c_str(), 0);
+      else if(k == "-loglevel" || k == "-map_metadata" || k == "-f" ||
+        k == "-threads" || k == "-progress" || k == "-pass" ||
+        k == "-passlogfile")
+        continue;
+      else if(k.size() > 2 && k.compare(k.size() - 2, 2, ":a") == 0)
+      {
+        const auto name = k.substr(1, k.size() - 3);
+        av_dict_set(&audio, name.c_str(), v.c_str(), 0);
+      }
+      else if(k.size() > 2 && k.compare(k.size() - 2, 2, ":v") == 0)
+      {
+        const auto name = k.substr(1, k.size() - 3);
+        av_dict_set(&video, name.c_str(), v.c_str(), 0);
+      }
+      else // e.g. -crf, -preset, -cpu-used
+        av_dict_set(&video, k.c_str() + 1, v.c_str(), 0);
+    }
+  }
+};
+
+struct Stream
+{
+  int inIndex = -1;
+  AVCodecContext *dec = nullptr;
+  AVCodecContext *enc = nullptr;
+  AVStream *out = nullptr;
+  SwsContext *sws = nullptr;
+  SwrContext *swr = nullptr;
+  AVAudioFifo *fifo = nullptr;
+  AVFrame *converted = nullptr;
+  int64_t nextPts = AV_NOPTS_VALUE;
+
+  ~Stream()
+  {
+    avcodec_free_context(&dec);
+    avcodec_free_context(&enc);
+    sws_freeContext(sws);
+    swr_free(&swr);
+    if(fifo)
+      av_audio_fifo_free(fifo);
+    av_frame_free(&converted);
+  }
+};
+
+struct Context
+{
+  AVFormatContext *in = nullptr;
+  AVFormatContext *out = nullptr;
+  AVIOContext *inIo = nullptr;
+  AVIOContext *outIo = nullptr;
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  Stream video;
+  Stream audio;
+
+  ~Context()
+  {
+    avformat_close_input(&in);
+    avformat_free_context(out);
+    if(inIo)
+      av_freep(&inIo->buffer);
+    avio_context_free(&inIo);
+    if(outIo)
+      av_freep(&outIo->buffer);
+    avio_context_free(&outIo);
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+  }
+};
+
+AVCodecContext *openDecoder(
+  AVFormatContext *in, int index, unsigned threads)
+{
+  const auto st = in->streams[index];
+  const AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+  if(!codec)
+    throw std::runtime_error("no decoder for the source");
+
+  AVCodecContext *dec = avcodec_alloc_context3(codec);
+  check(avcodec_parameters_to_context(dec, st->codecpar), "decoder");
+  dec->pkt_timebase = st->time_base;
+  dec->thread_count = threads;
+  if(dec->codec_type == AVMEDIA_TYPE_VIDEO)
+    dec->framerate = av_guess_frame_rate(in, st, nullptr);
+  check(avcodec_open2(dec, codec, nullptr), "open decoder");
+  return dec;
+}
+
+void openEncoder(AVCodecContext *enc, const AVCodec *codec,
+  AVDictionary *options, AVFormatContext *out)
+{
+  if(out->oformat->flags & AVFMT_GLOBALHEADER)
+    enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+  AVDictionary *opts = nullptr;
+  av_dict_copy(&opts, options, 0);
+  const int ret = avcodec_open2(enc, codec, &opts);
+
+  const AVDictionaryEntry *e = nullptr;
+  while((e = av_dict_get(opts, "", e, AV_DICT_IGNORE_SUFFIX)) != nullptr)
+  {
+    LOG_F(WARNING, "%s: option %s not used", codec->name, e->key);
+  }
+  av_dict_free(&opts);
+  check(ret, "open encoder");
+}
+}
+
+struct LibavEncoder::Io
+{
+  static int read(void *opaque, uint8_t *buf, int size)
+  {
+    auto self = static_cast<LibavEncoder *>(opaque);
+    const auto rd = self->m_source->read(
+      self->m_readPos, reinterpret_cast<char *>(buf), size);
+    if(rd < 0)
+      return self->m_abort ? AVERROR_EXIT : AVERROR(EIO);
+    if(rd == 0)
+      return AVERROR_EOF;
+
+    self->m_readPos += rd;
+    return static_cast<int>(rd);
+  }
+
+  static int64_t seek(void *opaque, int64_t offset, int whence)
+  {
+    auto self = static_cast<LibavEncoder *>(opaque);
+    const auto length = static_cast<int64_t>(self->m_source->getLength());
+    if(whence & AVSEEK_SIZE)
+      return length;
+
+    // data beyond the received part is waited for when read
+    switch(whence & ~AVSEEK_FORCE)
+    {
+      case SEEK_SET: break;
+      case SEEK_CUR: offset += self->m_readPos; break;
+      case SEEK_END: offset += length; break;
+      default: return AVERROR(EINVAL);
+    }
+
+    if(offset < 0 || offset > length)
+      return AVERROR(EINVAL);
+
+    self->m_readPos = offset;
+    return offset;
+  }
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+  static int write(void *opaque, const uint8_t *buf, int size)
+#else
+  static int write(void *opaque, uint8_t *buf, int size)
+#endif
+  {
+    auto self = static_cast<LibavEncoder *>(opaque);
+    if(fwrite(buf, 1, size, self->m_out) != static_cast<size_t>(size))
+      return AVERROR(EIO);
+
+    const uint64_t pos = ftello(self->m_out);
+    if(pos > self->m_outBytes)
+      self->m_outBytes = pos;
+    return size;
+  }
+
+  static int64_t seekOut(void *opaque, int64_t offset, int whence)
+  {
+    auto self = static_cast<LibavEncoder *>(opaque);
+    if(whence & AVSEEK_SIZE)
+    {
+      struct stat st;
+      fflush(self->m_out);
+      return fstat(fileno(self->m_out), &st) == 0 ? st.st_size :
+                                                    AVERROR(EIO);
+    }
+
+    if(fseeko(self->m_out, offset, whence & ~AVSEEK_FORCE) != 0)
+      return AVERROR(errno);
+    return ftello(self->m_out);
+  }
+
+  static int interrupted(void *opaque)
+  {
+    return static_cast<LibavEncoder *>(opaque)->m_abort ? 1 : 0;
+  }
+
+  static void encode(LibavEncoder &self, Context &ctx, Stream &s,
+    AVFrame *frame)
+  {
+    int ret = avcodec_send_frame(s.enc, frame);
+    check(ret, "encode");
+    while((ret = avcodec_receive_packet(s.enc, ctx.pkt)) == 0)
+    {
+      ctx.pkt->stream_index = s.out->index;
+      av_packet_rescale_ts(ctx.pkt, s.enc->time_base, s.out->time_base);
+      if(ctx.pkt->pts != AV_NOPTS_VALUE)
+      {
+        self.m_outTime = av_rescale_q(
+          ctx.pkt->pts, s.out->time_base, AVRational{1, AV_TIME_BASE});
+      }
+      check(av_interleaved_write_frame(ctx.out, ctx.pkt), "write");
+    }
+
+    if(ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+      check(ret, "encode");
+  }
+
+  static void video(LibavEncoder &self, Context &ctx, AVFrame *frame)
+  {
+    auto &s = ctx.video;
+    frame->pts = frame->best_effort_timestamp;
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+
+    AVFrame *f = frame;
+    if(frame->format != s.enc->pix_fmt || frame->width != s.enc->width ||
+      frame->height != s.enc->height)
+    {
+      s.sws = sws_getCachedContext(s.sws, frame->width, frame->height,
+        static_cast<AVPixelFormat>(frame->format), s.enc->width,
+        s.enc->height, s.enc->pix_fmt, SWS_BICUBIC, nullptr, nullptr,
+        nullptr);
+      if(!s.sws)
+        throw std::runtime_error("no pixel format conversion");
+
+      if(!s.converted)
+      {
+        s.converted = av_frame_alloc();
+        s.converted->format = s.enc->pix_fmt;
+        s.converted->width = s.enc->width;
+        s.converted->height = s.enc->height;
+        check(av_frame_get_buffer(s.converted, 0), "frame buffer");
+      }
+      check(av_frame_make_writable(s.converted), "frame buffer");
+      sws_scale(s.sws, frame->data, frame->linesize, 0, frame->height,
+        s.converted->data, s.converted->linesize);
+      s.converted->pts = frame->pts;
+      f = s.converted;
+    }
+
+    encode(self, ctx, s, f);
+    self.m_frames++;
+  }
+
+  static void audioFrames(LibavEncoder &self, Context &ctx, bool flush)
+  {
+    auto &s = ctx.audio;
+    const int frameSize = s.enc->frame_size > 0 ?
+      s.enc->frame_size :
+      DefaultAudioFrameSize;
+
+    while(av_audio_fifo_size(s.fifo) >= frameSize ||
+      (flush && av_audio_fifo_size(s.fifo) > 0))
+    {
+      const int n = std::min(frameSize, av_audio_fifo_size(s.fifo));
+      AVFrame *f = av_frame_alloc();
+      f->nb_samples = n;
+      f->format = s.enc->sample_fmt;
+      f->sample_rate = s.enc->sample_rate;
+      av_channel_layout_copy(&f->ch_layout, &s.enc->ch_layout);
+      int ret = av_frame_get_buffer(f, 0);
+      if(ret >= 0)
+      {
+        av_audio_fifo_read(s.fifo, reinterpret_cast<void **>(f->data), n);
+        f->pts = s.nextPts;
+        s.nextPts += n;
+        try
+        {
+          encode(self, ctx, s, f);
+        }
+        catch(...)
+        {
+          av_frame_free(&f);
+          throw;
+        }
+      }
+      av_frame_free(&f);
+      check(ret, "audio buffer");
+    }
+  }
+
+  static void audio(LibavEncoder &self, Context &ctx, AVFrame *frame)
+  {
+    auto &s = ctx.audio;
+    if(s.nextPts == AV_NOPTS_VALUE)
+    {
+      // keep the timestamps of the source like -copyts
+      const auto pts = frame->best_effort_timestamp;
+      s.nextPts = pts == AV_NOPTS_VALUE ?
+        0 :
+        av_rescale_q(pts, s.dec->pkt_timebase, s.enc->time_base);
+    }
+
+    AVFrame *resampled = av_frame_alloc();
+    resampled->format = s.enc->sample_fmt;
+    resampled->sample_rate = s.enc->sample_rate;
+    av_channel_layout_copy(&resampled->ch_layout, &s.enc->ch_layout);
+    int ret = swr_convert_frame(s.swr, resampled, frame);
+    if(ret >= 0)
+    {
+      ret = av_audio_fifo_write(s.fifo,
+        reinterpret_cast<void **>(resampled->data), resampled->nb_samples);
+    }
+    av_frame_free(&resampled);
+    check(ret, "resample");
+
+    audioFrames(self, ctx, false);
+  }
+
+  static void decode(LibavEncoder &self, Context &ctx, Stream &s,
+    const AVPacket *pkt)
+  {
+    int ret = avcodec_send_packet(s.dec, pkt);
+    if(ret < 0 && ret != AVERROR_EOF)
+    {
+      // damaged packets are skipped like ffmpeg does
+      LOG_F(WARNING, "decoding error: %s", avError(ret).c_str());
+      return;
+    }
+
+    while((ret = avcodec_receive_frame(s.dec, ctx.frame)) == 0)
+    {
+      if(&s == &ctx.video)
+        video(self, ctx, ctx.frame);
+      else
+        audio(self, ctx, ctx.frame);
+      av_frame_unref(ctx.frame);
+    }
+  }
+};
+
+LibavEncoder::LibavEncoder(const ClientConfig &cfg)
+  : m_cfg(cfg)
+  , m_source(nullptr)
+  , m_readPos(0)
+  , m_out(nullptr)
+  , m_abort(false)
+  , m_running(false)
+  , m_frames(0)
+  , m_outTime(0)
+  , m_outBytes(0)
+  , m_result(-1)
+{
+}
+
+LibavEncoder::~LibavEncoder()
+{
+  kill();
+}
+
+bool LibavEncoder::supports(const EncodeJob &job)
+{
+  // no analysis passes, no chunks, a single output
+  return job.passLogPrefix.empty() && !job.outFile.empty() &&
+    !job.startTime && !job.duration && job.extraOutputs.empty();
+}
+
+bool LibavEncoder::canStream(const EncodeJob &job) const
+{
+  // seeks to the end of the file would block until it has been received
+  return m_cfg.streamSource && supports(job) && job.source &&
+    job.source->getLayout() == StreamingSource::Layout::Sequential;
+}
+
+void LibavEncoder::start(const EncodeJob &job)
+{
+  if(m_thread)
+    throw std::runtime_error("encoder already running");
+
+  m_job = job;
+  m_source = job.source;
+  if(!m_source)
+  {
+    m_ownSource.reset(new StreamingSource(job.inFile, job.fileLength));
+    m_ownSource->setReceived(job.fileLength);
+    m_source = m_ownSource.get();
+  }
+
+  m_out = fopen(job.outFile.c_str(), "wb");
+  if(!m_out)
+  {
+    throw std::runtime_error("could not open " + job.outFile);
+  }
+
+  m_readPos = 0;
+  m_abort = false;
+  m_frames = 0;
+  m_outTime = 0;
+  m_outBytes = 0;
+  m_result = -1;
+  m_log.clear();
+  m_running = true;
+  m_thread.reset(new std::thread([this]() { threadMain(); }));
+}
+
+void LibavEncoder::threadMain()
+{
+  loguru::set_thread_name("libav");
+  int result = 0;
+  std::string error;
+  try
+  {
+    transcode();
+  }
+  catch(const std::exception &e)
+  {
+    error = e.what();
+    result = 1;
+  }
+
+  if(fclose(m_out) != 0 && !result)
+  {
+    error = std::string("writing output: ") + strerror(errno);
+    result = 1;
+  }
+  m_out = nullptr;
+
+  LOG_IF_F(ERROR, result, "libav encoder: %s", error.c_str());
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_result = result;
+  if(!error.empty())
+    m_log += error + "\n";
+  m_running = false;
+}
+
+void LibavEncoder::transcode()
+{
+  Options opt;
+  opt.parse(m_job.parameters + " " + m_job.clientOptions);
+
+  Context ctx;
+  ctx.in = avformat_alloc_context();
+  ctx.inIo = avio_alloc_context(
+    static_cast<unsigned char *>(av_malloc(IoBufferSize)), IoBufferSize, 0,
+    this, &Io::read, nullptr, &Io::seek);
+  ctx.in->pb = ctx.inIo;
+  ctx.in->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ctx.in->interrupt_callback = AVIOInterruptCB{&Io::interrupted, this};
+  check(avformat_open_input(&ctx.in, nullptr, nullptr, nullptr), "input");
+  check(avformat_find_stream_info(ctx.in, nullptr), "stream info");
+
+  check(avformat_alloc_output_context2(
+          &ctx.out, nullptr, nullptr, m_job.outFile.c_str()),
+    "output format");
+  ctx.outIo = avio_alloc_context(
+    static_cast<unsigned char *>(av_malloc(IoBufferSize)), IoBufferSize, 1,
+    this, nullptr, &Io::write, &Io::seekOut);
+  ctx.out->pb = ctx.outIo;
+  ctx.out->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ctx.out->interrupt_callback = AVIOInterruptCB{&Io::interrupted, this};
+  // -map_metadata 0
+  av_dict_copy(&ctx.out->metadata, ctx.in->metadata, 0);
+
+  // video
+  ctx.video.inIndex =
+    av_find_best_stream(ctx.in, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if(ctx.video.inIndex < 0)
+    throw std::runtime_error("no video stream found");
+  {
+    auto &s = ctx.video;
+    const auto st = ctx.in->streams[s.inIndex];
+    s.dec = openDecoder(ctx.in, s.inIndex, m_job.threads);
+
+    const AVCodec *codec =
+      avcodec_find_encoder_by_name(opt.videoCodec.c_str());
+    if(!codec)
+      throw std::runtime_error("unknown video encoder " + opt.videoCodec);
+
+    s.enc = avcodec_alloc_context3(codec);
+    s.enc->width = s.dec->width;
+    s.enc->height = s.dec->height;
+    s.enc->sample_aspect_ratio = s.dec->sample_aspect_ratio;
+    s.enc->pix_fmt = s.dec->pix_fmt;
+    if(codec->pix_fmts)
+    {
+      bool supported = false;
+      for(auto p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++)
+        supported = supported || *p == s.dec->pix_fmt;
+      if(!supported)
+        s.enc->pix_fmt = avcodec_find_best_pix_fmt_of_list(
+          codec->pix_fmts, s.dec->pix_fmt, 0, nullptr);
+    }
+    s.enc->color_range = s.dec->color_range;
+    s.enc->color_primaries = s.dec->color_primaries;
+    s.enc->color_trc = s.dec->color_trc;
+    s.enc->colorspace = s.dec->colorspace;
+    s.enc->framerate = s.dec->framerate;
+    s.enc->time_base = st->time_base;
+    s.enc->thread_count = m_job.threads;
+    openEncoder(s.enc, codec, opt.video, ctx.out);
+
+    s.out = avformat_new_stream(ctx.out, nullptr);
+    check(avcodec_parameters_from_context(s.out->codecpar, s.enc),
+      "video stream");
+    s.out->time_base = s.enc->time_base;
+    s.out->avg_frame_rate = st->avg_frame_rate;
+    av_dict_copy(&s.out->metadata, st->metadata, 0);
+  }
+
+  // audio
+  ctx.audio.inIndex = opt.noAudio ?
+    -1 :
+    av_find_best_stream(ctx.in, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+  if(ctx.audio.inIndex >= 0)
+  {
+    auto &s = ctx.audio;
+    const auto st = ctx.in->streams[s.inIndex];
+    s.dec = openDecoder(ctx.in, s.inIndex, m_job.threads);
+
+    const AVCodec *codec =
+      avcodec_find_encoder_by_name(opt.audioCodec.c_str());
+    if(!codec)
+      throw std::runtime_error("unknown audio encoder " + opt.audioCodec);
+
+    s.enc = avcodec_alloc_context3(codec);
+    s.enc->sample_rate = s.dec->sample_rate;
+    if(codec->supported_samplerates)
+    {
+      bool supported = false;
+      for(auto r = codec->supported_samplerates; *r; r++)
+        supported = supported || *r == s.dec->sample_rate;
+      if(!supported)
+        s.enc->sample_rate = codec->supported_samplerates[0];
+    }
+    if(s.dec->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC)
+      av_channel_layout_default(
+        &s.enc->ch_layout, s.dec->ch_layout.nb_channels);
+    else
+      av_channel_layout_copy(&s.enc->ch_layout, &s.dec->ch_layout);
+    s.enc->sample_fmt =
+      codec->sample_fmts ? codec->sample_fmts[0] : s.dec->sample_fmt;
+    s.enc->time_base = AVRational{1, s.enc->sample_rate};
+    s.enc->thread_count = m_job.threads;
+    openEncoder(s.enc, codec, opt.audio, ctx.out);
+
+    s.out = avformat_new_stream(ctx.out, nullptr);
+    check(avcodec_parameters_from_context(s.out->codecpar, s.enc),
+      "audio stream");
+    s.out->time_base = s.enc->time_base;
+    av_dict_copy(&s.out->metadata, st->metadata, 0);
+
+    check(swr_alloc_set_opts2(&s.swr, &s.enc->ch_layout, s.enc->sample_fmt,
+            s.enc->sample_rate, &s.dec->ch_layout, s.dec->sample_fmt,
+            s.dec->sample_rate, 0, nullptr),
+      "resampler");
+    check(swr_init(s.swr), "resampler");
+    s.fifo = av_audio_fifo_alloc(
+      s.enc->sample_fmt, s.enc->ch_layout.nb_channels, 1);
+  }
+
+  AVDictionary *muxOpts = nullptr;
+  av_dict_copy(&muxOpts, opt.muxer, 0);
+  const int ret = avformat_write_header(ctx.out, &muxOpts);
+  av_dict_free(&muxOpts);
+  check(ret, "write header");
+
+  while(!m_abort)
+  {
+    const int rd = av_read_frame(ctx.in, ctx.pkt);
+    if(rd == AVERROR_EOF)
+      break;
+    check(rd, "read");
+
+    const int index = ctx.pkt->stream_index;
+    if(index == ctx.video.inIndex)
+      Io::decode(*this, ctx, ctx.video, ctx.pkt);
+    else if(index == ctx.audio.inIndex)
+      Io::decode(*this, ctx, ctx.audio, ctx.pkt);
+    av_packet_unref(ctx.pkt);
+  }
+
+  if(m_abort)
+    throw std::runtime_error("encoding aborted");
+
+  // flush decoders and encoders
+  Io::decode(*this, ctx, ctx.video, nullptr);
+  Io::encode(*this, ctx, ctx.video, nullptr);
+  if(ctx.audio.inIndex >= 0)
+  {
+    Io::decode(*this, ctx, ctx.audio, nullptr);
+    Io::audioFrames(*this, ctx, true);
+    Io::encode(*this, ctx, ctx.audio, nullptr);
+  }
+
+  check(av_write_trailer(ctx.out), "write trailer");
+  avio_flush(ctx.outIo);
+  if(ctx.outIo->error < 0)
+    check(ctx.outIo->error, "write output");
+}
+
+bool LibavEncoder::poll(std::string &output)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  output += m_log;
+  m_log.clear();
+  return m_running;
+}
+
+int LibavEncoder::finish()
+{
+  if(m_thread)
+  {
+    m_thread->join();
+    m_thread.reset();
+  }
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_result;
+}
+
+void LibavEncoder::kill()
+{
+  if(!m_thread)
+    return;
+
+  m_abort = true;
+  if(m_source)
+    m_source->abort();
+  finish();
+}
+
+EncoderProgress LibavEncoder::getProgress() const
+{
+  return EncoderProgress{m_frames, m_outTime, m_outBytes};
+}
@@ -0,0 +1,64 @@
+#ifndef __LIBAVENCODER_HPP__
+#define __LIBAVENCODER_HPP__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "IEncoder.hpp"
+#include "StreamingSource.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Encodes in this process using libavformat/libavcodec. The source
+ * is read through a custom AVIO context while it is still being received
+ * and the output is written through another one, so no encoder process is
+ * spawned. The first video and audio streams are transcoded, 2-pass
+ * encodings are left to the command line encoder.
+ */
+class LibavEncoder : public IEncoder
+{
+public:
+  LibavEncoder(const ClientConfig &cfg);
+  LibavEncoder(const LibavEncoder &) = delete;
+  ~LibavEncoder();
+
+  void start(const EncodeJob &job) override;
+  bool poll(std::string &output) override;
+  int finish() override;
+  void kill() override;
+  int pid() const override { return 0; }
+  bool canStream(const EncodeJob &job) const override;
+  EncoderProgress getProgress() const override;
+
+  /** can the job be encoded in process */
+  static bool supports(const EncodeJob &job);
+
+private:
+  // AVIO callbacks, their signatures depend on the libav version
+  struct Io;
+  friend struct Io;
+
+  void threadMain();
+  void transcode();
+
+  const ClientConfig &m_cfg;
+  EncodeJob m_job;
+  StreamingSource *m_source;
+  std::unique_ptr<StreamingSource> m_ownSource;
+  uint64_t m_readPos;
+  FILE *m_out;
+  std::atomic<bool> m_abort;
+  std::atomic<bool> m_running;
+  std::atomic<uint64_t> m_frames;
+  std::atomic<int64_t> m_outTime;
+  std::atomic<uint64_t> m_outBytes;
+  int m_result;
+  std::string m_log;
+  mutable std::mutex m_mtx;
+  std::unique_ptr<std::thread> m_thread;
+};
+}
+#endif // !__LIBAVENCODER_HPP__
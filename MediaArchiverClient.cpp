@@ -15,12 +15,14 @@
 #ifdef _MSVC_STL_VERSION
 #else
   #include <dirent.h>
+  #include <unistd.h>
 #endif
 
 #include "rpc/client.h"
 #include "rpc/rpc_error.h"
 #include "MediaArchiverClient.hpp"
 #include "MediaArchiverConfig.hpp"
+#include "TrialEncode.hpp"
 
 #include "loguru.hpp"
 
@@ -30,19 +32,57 @@ namespace
 {
 const std::string pass1ResultFilePrefix = "ffmpeg2pass";
 const std::string pass1ResultFileSuffix = "-0.log";
+
+std::string getClientName(const ClientConfig &cfg)
+{
+  if(!cfg.clientName.empty())
+    return cfg.clientName;
+
+  char name[256] = "";
+#ifndef _MSVC_STL_VERSION
+  gethostname(name, sizeof(name) - 1);
+#endif
+  return name;
+}
 }
 
-MediaArchiverClient::MediaArchiverClient(const ClientConfig &cfg)
-  : m_cfg(cfg)
-  , m_filter{"ffmpeg", 4u * 1024 * 1024 * 1024}
-  , m_encodeProcess{nullptr, pclose}
-  , m_authenticated(false)
-  , m_stopRequested(false)
+MediaArchiverClient::MediaArchiverClient(const ClientConfig &cfg,
+  EncodePipeline *pipeline, unsigned lane, StagingWorkspace *staging,
+  ResultSpool *spool, const ClientProfile *profile)
+  : m_encoderStarted(false)
   , m_shutdown(false)
+  , m_stopRequested(false)
+  , m_output(0)
+  , m_cfg(cfg)
+  , m_filter{"ffmpeg", 4u * 1024 * 1024 * 1024, getClientName(cfg)}
+  , m_authenticated(false)
+  , m_lane(lane)
+  , m_pipeline(pipeline)
+  , m_holdsStage(false)
+  , m_staging(staging)
+  , m_workFolder(cfg.tempFolder)
+  , m_stagedBytes(0)
+  , m_spool(spool)
+  , m_spooled(false)
+  , m_sendFailures(0)
+  , m_checkpointed(false)
+  , m_chunk(0)
+  , m_duration(0)
+  , m_movieLength(0)
+  , m_profile(profile)
+{
+  if(!cfg.checkpointFolder.empty())
+    m_checkpoint.reset(new EncodeCheckpoint(cfg.checkpointFolder, lane));
+  createToken();
+}
+
+void MediaArchiverClient::createToken()
 {
   std::random_device rd;
-  std::mt19937 mt(rd());
-  mt.seed(time(nullptr));
+  // lanes started in the same second must not share their token
+  std::seed_seq seed{
+    rd(), static_cast<unsigned>(time(nullptr)), static_cast<unsigned>(m_lane)};
+  std::mt19937 mt(seed);
   std::uniform_int_distribution<> dist(0, std::numeric_limits<int>::max());
   m_token = dist(mt);
 }
@@ -53,7 +93,55 @@ MediaArchiverClient::~MediaArchiverClient()
   m_rpc.reset();
 }
 
-void MediaArchiverClient::init() {}
+void MediaArchiverClient::init()
+{
+  if(m_checkpoint)
+    resume();
+}
+
+void MediaArchiverClient::resume()
+{
+  EncodeCheckpoint::State st;
+  if(!m_checkpoint->load(st))
+    return;
+
+  m_workFolder = m_checkpoint->getFolder();
+  m_token = st.token;
+  m_encSettings = st.settings;
+  m_passNo = st.passNo;
+  m_chunk = st.chunks;
+  m_duration = st.duration;
+  m_movieLength = m_duration;
+  m_checkpointed = true;
+
+  const auto fname = getInFileName();
+  std::ifstream fs(fname, std::ios::in | std::ios::binary);
+  fs.seekg(0, std::ios_base::end);
+  if(!fs.is_open() ||
+    static_cast<size_t>(fs.tellg()) != m_encSettings.fileLength)
+  {
+    LOG_F(WARNING, "Checkpoint: source of job %u is missing, dropped",
+      m_encSettings.jobId);
+    cleanUp();
+    return;
+  }
+
+  LOG_F(INFO, "Checkpoint: resuming job %u at pass %i, chunk %u",
+    m_encSettings.jobId, m_passNo, m_chunk);
+  m_stdOut.str("");
+  m_source.reset(new StreamingSource(fname, m_encSettings.fileLength));
+  m_source->setReceived(m_encSettings.fileLength);
+  m_encResult = EncodingResultInfo(
+    EncodingResultInfo::EncodingResult::UnknownError, 0, "");
+  m_mainState = MainStates::WaitForEncoderSlot;
+}
+
+void MediaArchiverClient::saveCheckpoint()
+{
+  m_checkpoint->save(EncodeCheckpoint::State{
+    m_token, m_encSettings, m_passNo, m_chunk, m_duration});
+  m_checkpointed = true;
+}
 
 void MediaArchiverClient::stop(bool forced)
 {
@@ -126,6 +214,118 @@ bool MediaArchiverConfig<ClientConfig>::parse(const std::string &key,
   {
     config.extraOptionsPass2 = value;
   }
+  else if(k == "paralleljobs")
+  {
+    config.parallelJobs = atoi(value.c_str());
+  }
+  else if(k == "overlappasses")
+  {
+    config.overlapPasses = atoi(value.c_str()) != 0;
+  }
+  else if(k == "encoderthreads")
+  {
+    config.encoderThreads = atoi(value.c_str());
+  }
+  else if(k == "pass1threadshare")
+  {
+    config.pass1ThreadShare = atoi(value.c_str());
+  }
+  else if(k == "governor")
+  {
+    config.governor = atoi(value.c_str()) != 0;
+  }
+  else if(k == "governorinterval")
+  {
+    config.governorInterval = atoi(value.c_str());
+  }
+  else if(k == "governornice")
+  {
+    config.governorNice = atoi(value.c_str());
+  }
+  else if(k == "loadthreshold")
+  {
+    config.loadThreshold = atof(value.c_str());
+  }
+  else if(k == "pressurethreshold")
+  {
+    config.pressureThreshold = atof(value.c_str());
+  }
+  else if(k == "useridletime")
+  {
+    config.userIdleTime = atoi(value.c_str());
+  }
+  else if(k == "useridlecommand")
+  {
+    config.userIdleCommand = value;
+  }
+  else if(k == "governorcgroup")
+  {
+    config.governorCgroup = value;
+  }
+  else if(k == "reducedcpuquota")
+  {
+    config.reducedCpuQuota = atoi(value.c_str());
+  }
+  else if(k == "benchmarkfps")
+  {
+    config.benchmarkFps = atof(value.c_str());
+  }
+  else if(k == "stagingfolder")
+  {
+    config.stagingFolder = value;
+  }
+  else if(k == "stagingmemorybudget")
+  {
+    config.stagingMemoryBudget = atoi(value.c_str());
+  }
+  else if(k == "spoolfolder")
+  {
+    config.spoolFolder = value;
+  }
+  else if(k == "resultretries")
+  {
+    config.resultRetries = atoi(value.c_str());
+  }
+  else if(k == "encoderengine")
+  {
+    config.encoderEngine = value;
+  }
+  else if(k == "streamsource")
+  {
+    config.streamSource = atoi(value.c_str()) != 0;
+  }
+  else if(k == "checkpointfolder")
+  {
+    config.checkpointFolder = value;
+  }
+  else if(k == "checkpointinterval")
+  {
+    config.checkpointInterval = atoi(value.c_str());
+  }
+  else if(k == "maxsizeratio")
+  {
+    config.maxSizeRatio = atof(value.c_str());
+  }
+  else if(k == "sizecheckstart")
+  {
+    config.sizeCheckStart = atoi(value.c_str());
+  }
+  else if(k == "trialsamples")
+  {
+    config.trialSamples = atoi(value.c_str());
+  }
+  else if(k == "triallength")
+  {
+    config.trialLength = atoi(value.c_str());
+  }
+  else if(k == "clientname")
+  {
+    config.clientName = value;
+  }
+  else if(k == "jobcheckinterval")
+  {
+    config.jobCheckInterval = atoi(value.c_str());
+  }
   else
   {
     return false;
@@ -152,7 +352,13 @@ bool MediaArchiverClient::pass2Enabled() const
 {
   const auto hasCrf = m_encSettings.commandLineParameters.find("-crf") !=
     std::string::npos;
-  return !hasCrf;
+  return !hasCrf && !isRemux();
+}
+
+bool MediaArchiverClient::isRemux() const
+{
+  return m_encSettings.commandLineParameters.find("-c copy") !=
+    std::string::npos;
 }
 
 void MediaArchiverClient::doAuth()
@@ -190,7 +396,12 @@ void MediaArchiverClient::doAuth()
   }
   catch(const rpc::system_error &e)
   {
-    m_prevMainState = MainStates::Idle;
+    if(m_spooled && abandonResult())
+      return;
+
+    // a spooled result is delivered again after reconnecting
+    if(!m_spooled)
+      m_prevMainState = MainStates::Idle;
     m_mainState = MainStates::WaitForReconnect;
     m_timeToWait = m_cfg.serverConnectionTimeout;
     m_startTime = std::chrono::steady_clock::now();
@@ -217,20 +428,41 @@ void MediaArchiverClient::doIdle()
     }
     else
     {
-      auto newFile = m_rpc->getNextFile(m_filter, m_encSettings);
+      auto filter = m_filter;
+      const bool fits = !m_profile || m_profile->update(filter);
+      LOG_IF_F(WARNING, !fits, "doIdle: no space left for a job in %s",
+        m_cfg.tempFolder.c_str());
+      auto newFile = fits && m_rpc->getNextFile(filter, m_encSettings);
       if(newFile)
       {
         next = MainStates::Receiving;
-        std::stringstream fname;
-        fname << InTmpFileName << "." << m_encSettings.fileExtension;
-        m_srcFile.open(fname.str(),
-          std::ios_base::out | std::ios_base::binary);
+        if(m_checkpoint)
+        {
+          m_workFolder = m_checkpoint->getFolder();
+        }
+        else if(m_staging)
+        {
+          m_workFolder =
+            m_staging->reserve(m_stagedBytes, m_encSettings.fileLength);
+        }
+        const auto fname = getInFileName();
+        m_srcFile.open(fname, std::ios_base::out | std::ios_base::binary);
         if(m_srcFile.fail())
         {
           std::stringstream ss;
-          ss << "could not open file \"" << fname.str() << "\" for write";
+          ss << "could not open file \"" << fname << "\" for write";
           throw IOError(ss.str());
         }
+
+        // start with pass number 2 if "-crf" parameter given
+        m_passNo = pass2Enabled() ? 1 : 2;
+        m_jobChecked = std::chrono::steady_clock::now();
+        m_chunk = 0;
+        m_duration = 0;
+        m_movieLength = 0;
+        m_stdOut.str("");
+        m_source.reset(new StreamingSource(fname, m_encSettings.fileLength));
+        m_encoder.reset(createEncoder(m_cfg, getEncodeJob()));
       }
       else
       {
@@ -294,6 +526,35 @@ void MediaArchiverClient::doReceive()
   try
   {
     auto cont = m_rpc->readChunk(m_srcFile);
+    m_srcFile.flush();
+    m_source->setReceived(m_srcFile.tellp());
+
+    if(m_encoderStarted)
+    {
+      // a full output pipe would stall the streaming encoder
+      std::string output;
+      m_encoder->poll(output);
+      m_stdOut << output;
+    }
+
+    // checkpointed jobs are resumed from the complete source
+    if(cont && m_encoder && !m_encoderStarted && !m_checkpoint &&
+      m_encoder->canStream(getEncodeJob()))
+    {
+      // encode while the rest of the file arrives
+      try
+      {
+        startPass();
+      }
+      catch(const std::exception &e)
+      {
+        LOG_F(WARNING, "doReceive: streaming not possible: %s", e.what());
+        releaseStage();
+        m_encoder.reset();
+        m_encoderStarted = false;
+      }
+    }
+
     if(!cont)
     {
       // EOF
@@ -306,55 +567,233 @@ void MediaArchiverClient::doReceive()
           "Received file size is different to one reported by server");
       }
       m_srcFile.close();
-      disconnect();
       m_encResult =
         EncodingResultInfo(EncodingResultInfo::EncodingResult::UnknownError,
           0, m_stdOut.str());
 
-      // start with pass number 2 if "-crf" parameter given
-      m_passNo = pass2Enabled() ? 1 : 2;
-      launch(getTranscodeCommand());
-      m_mainState = MainStates::WaitForEncodingFinished;
+      if(m_checkpoint)
+      {
+        // a final pass can only be resumed if it is cut into chunks, copied
+        // streams are cut at key frames only, renditions are not cut
+        if(m_passNo == 2 && !isRemux() && m_encSettings.renditions.empty())
+        {
+          const int len = getMovieLength(getInFileName());
+          m_movieLength = len;
+          if(len > m_cfg.checkpointInterval && m_cfg.checkpointInterval > 0)
+          {
+            m_duration = len;
+            // created for the whole file, maybe one that cannot seek
+            m_encoder.reset();
+          }
+        }
+        saveCheckpoint();
+      }
+
+      if(m_encoderStarted)
+      {
+        m_mainState = MainStates::WaitForEncodingFinished;
+      }
+      else if(m_cfg.trialSamples > 0 && !isRemux())
+      {
+        // the session is needed for reporting the estimate
+        m_mainState = MainStates::Estimating;
+        return;
+      }
+      else
+      {
+        m_mainState = MainStates::WaitForEncoderSlot;
+      }
+      disconnect();
     }
   }
   catch(const std::exception &e)
   {
     LOG_F(ERROR, "doReceive: %s", e.what());
+    if(isJobCancelled())
+    {
+      dropJob();
+      return;
+    }
     m_srcFile.seekp(0, std::ios_base::beg);
+    m_source->setReceived(0);
 
     // start reading the file from the beginning
     m_rpc->reset();
   }
 }
 
+void MediaArchiverClient::doEstimate()
+{
+  if(m_stopRequested)
+  {
+    m_shutdown = true;
+    return;
+  }
+
+  if(!m_movieLength)
+    m_movieLength = getMovieLength(getInFileName());
+
+  // the samples would take a large share of the time of the whole job
+  const bool worthIt =
+    m_movieLength >= 4 * m_cfg.trialSamples * m_cfg.trialLength;
+  if(worthIt && m_pipeline &&
+    !m_pipeline->tryAcquire(EncodePipeline::Stage::Encode))
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    return;
+  }
+
+  EstimateVerdict verdict{EstimateVerdict::Action::Encode, ""};
+  if(worthIt)
+  {
+    // a single pass with the options of the final pass
+    auto job = getEncodeJob();
+    job.outFile = getTempFileName(
+      OutTmpFileName, "_trial" + m_encSettings.finalExtension);
+    job.passLogPrefix.clear();
+    job.extraOutputs.clear();
+    job.passNo = 2;
+    job.clientOptions = m_cfg.extraCommandLineOptions;
+    if(pass2Enabled())
+      job.clientOptions += " " + m_cfg.extraOptionsPass2;
+    job.threads =
+      m_pipeline ? m_pipeline->threadsFor(EncodePipeline::Stage::Encode) : 0;
+    job.source = nullptr;
+
+    try
+    {
+      const auto estimate = TrialEncode(m_cfg, job).run(m_movieLength);
+      if(m_pipeline)
+        m_pipeline->release(EncodePipeline::Stage::Encode);
+
+      checkCreateRpc();
+      verdict = m_rpc->reportEstimate(estimate);
+    }
+    catch(const std::exception &e)
+    {
+      // e.g. a server not knowing estimates, the job is encoded anyway
+      if(m_pipeline)
+        m_pipeline->release(EncodePipeline::Stage::Encode);
+      LOG_F(WARNING, "doEstimate: %s", e.what());
+    }
+  }
+
+  switch(verdict.action)
+  {
+    case EstimateVerdict::Action::Skip:
+      LOG_F(INFO, "Job %u is not worth encoding", m_encSettings.jobId);
+      m_encResult = EncodingResultInfo(
+        EncodingResultInfo::EncodingResult::NoGain, 0,
+        "estimated by trial encodes");
+      m_mainState = MainStates::SendResult;
+      return;
+    case EstimateVerdict::Action::Cancel:
+      LOG_F(
+        INFO, "Job %u was cancelled by the server", m_encSettings.jobId);
+      dropJob();
+      return;
+    case EstimateVerdict::Action::Downgrade:
+      LOG_F(INFO, "Job %u is encoded with faster settings",
+        m_encSettings.jobId);
+      m_encSettings.commandLineParameters = verdict.commandLineParameters;
+      if(m_checkpointed)
+        saveCheckpoint();
+      break;
+    default: break;
+  }
+
+  disconnect();
+  m_mainState = MainStates::WaitForEncoderSlot;
+}
+
+EncodePipeline::Stage MediaArchiverClient::currentStage() const
+{
+  return m_passNo == 1 ? EncodePipeline::Stage::Analysis :
+                         EncodePipeline::Stage::Encode;
+}
+
+void MediaArchiverClient::releaseStage()
+{
+  if(m_holdsStage && m_pipeline)
+  {
+    m_pipeline->removeEncoder(m_encoder ? m_encoder->pid() : 0);
+    m_pipeline->release(currentStage());
+  }
+  m_holdsStage = false;
+}
+
+bool MediaArchiverClient::startPass()
+{
+  if(m_pipeline && !m_pipeline->tryAcquire(currentStage()))
+  {
+    return false;
+  }
+
+  m_holdsStage = true;
+  const auto job = getEncodeJob();
+  if(!m_encoder)
+    m_encoder.reset(createEncoder(m_cfg, job));
+
+  m_encoder->start(job);
+  m_encoderStarted = true;
+  m_progressTime = std::chrono::steady_clock::now();
+  if(m_pipeline)
+    m_pipeline->addEncoder(m_encoder->pid());
+  return true;
+}
+
+void MediaArchiverClient::doStartPass()
+{
+  try
+  {
+    if(!startPass())
+    {
+      // all encoders of this stage are busy, the other lanes go ahead
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      return;
+    }
+    m_mainState = MainStates::WaitForEncodingFinished;
+  }
+  catch(const std::exception &e)
+  {
+    releaseStage();
+    m_encResult.error = e.what();
+    m_encResult.result = EncodingResultInfo::EncodingResult::UnknownError;
+    LOG_F(ERROR, "doStartPass: %s", e.what());
+    m_mainState = MainStates::SendResult;
+  }
+}
+
 void MediaArchiverClient::launch(const std::string &cmdLine)
 {
   LOG_F(2, "launching: %s", cmdLine.c_str());
-  auto handle = popen(cmdLine.c_str(), "r");
-  if(!handle)
+  try
+  {
+    m_process.start(cmdLine);
+  }
+  catch(const std::exception &e)
   {
-    LOG_F(ERROR, "could not launch '%s'", cmdLine.c_str());
+    LOG_F(ERROR, "could not launch '%s': %s", cmdLine.c_str(), e.what());
     throw std::runtime_error(
       std::string("could not start external command: ") + cmdLine);
   }
 
   std::this_thread::sleep_for(std::chrono::seconds(2));
-  m_encodeProcess.reset(handle);
 }
 
 int MediaArchiverClient::waitForFinish(std::string &stdOut)
 {
   std::array<char, 4096> buffer;
   std::stringstream ss;
-  while(!std::feof(m_encodeProcess.get()))
+  while(!std::feof(m_process.get()))
   {
     std::this_thread::sleep_for(std::chrono::milliseconds(250));
     memset(buffer.data(), 0, buffer.size());
-    auto rd = fgets(buffer.data(), buffer.size(), m_encodeProcess.get());
+    auto rd = fgets(buffer.data(), buffer.size(), m_process.get());
     ss << buffer.data();
   }
 
-  auto retcode = pclose(m_encodeProcess.release());
+  auto retcode = m_process.close();
   stdOut = ss.str();
   VLOG_F(retcode ? -2 : 2, "waitForFinish: return: %i, <%s>", retcode,
     stdOut.c_str());
@@ -421,26 +860,112 @@ int MediaArchiverClient::getMovieLength(const std::string &path)
   }
 }
 
+void MediaArchiverClient::logProgress()
+{
+  const auto now = std::chrono::steady_clock::now();
+  if(now - m_progressTime < std::chrono::seconds(10))
+    return;
+
+  m_progressTime = now;
+  const auto p = m_encoder->getProgress();
+  LOG_F(1, "Encoding pass %i: %llu frames, %.1fs, %llu kB", m_passNo,
+    static_cast<unsigned long long>(p.frames), p.outTime / 1e6,
+    static_cast<unsigned long long>(p.outBytes >> 10));
+}
+
+bool MediaArchiverClient::checkGain(uint64_t outBytes, double encoded)
+{
+  // only the final pass writes the output, a source still being received
+  // cannot be probed, remuxing keeps the size anyway
+  if(m_cfg.maxSizeRatio <= 0 || m_passNo != 2 || isRemux() ||
+    (m_source && !m_source->isComplete()))
+  {
+    return true;
+  }
+
+  if(!m_movieLength)
+    m_movieLength = getMovieLength(getInFileName());
+
+  // the headers and the first key frames distort the projection
+  if(m_movieLength <= 0 ||
+    encoded < m_movieLength * m_cfg.sizeCheckStart / 100.0 || encoded <= 0)
+  {
+    return true;
+  }
+
+  const double projected = outBytes * (m_movieLength / encoded);
+  if(projected <= m_cfg.maxSizeRatio * m_encSettings.fileLength)
+    return true;
+
+  std::stringstream ss;
+  ss << "projected output size " << static_cast<uint64_t>(projected)
+     << " exceeds " << m_cfg.maxSizeRatio * 100 << "% of the source size "
+     << m_encSettings.fileLength << " after " << static_cast<int>(encoded)
+     << "s of " << m_movieLength << "s";
+  LOG_F(WARNING, "Giving up job %u: %s", m_encSettings.jobId,
+    ss.str().c_str());
+  m_encResult = EncodingResultInfo(
+    EncodingResultInfo::EncodingResult::NoGain, 0, ss.str());
+  return false;
+}
+
 void MediaArchiverClient::doConvert()
 {
   std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  std::array<char, 1024> buffer;
-  auto rd = fgets(buffer.data(), buffer.size(), m_encodeProcess.get());
+  std::string output;
+  const bool running = m_encoder->poll(output);
+  m_stdOut << output;
+  logProgress();
+
+  // the source may have changed since it was received
+  if(running && !m_shutdown && m_cfg.jobCheckInterval > 0 &&
+    std::chrono::steady_clock::now() - m_jobChecked >=
+      std::chrono::seconds(m_cfg.jobCheckInterval))
+  {
+    const bool cancelled = isJobCancelled();
+    disconnect();
+    if(cancelled)
+    {
+      dropJob();
+      return;
+    }
+  }
+
+  // chunks are checked when they are finished, their timestamps may be
+  // those of the source
+  if(running && !m_shutdown && !m_duration)
+  {
+    const auto p = m_encoder->getProgress();
+    if(!checkGain(p.outBytes, p.outTime / 1e6))
+    {
+      releaseStage();
+      m_encoder->kill();
+      m_encoder.reset();
+      m_encoderStarted = false;
+      m_mainState = MainStates::SendResult;
+      return;
+    }
+  }
 
-  if(std::feof(m_encodeProcess.get()) || m_shutdown)
+  if(!running || m_shutdown)
   {
     // EOF
     int retcode = -1;
+
+    // the encoder is finishing, let other lanes use the slot
+    releaseStage();
     if(m_shutdown)
     {
       LOG_F(INFO, "doConvert: stopping encoding due to stop request");
-      m_encodeProcess.reset();
+      m_encoder->kill();
     }
     else
     {
       LOG_F(INFO, "doConvert: closing encoding process...");
-      retcode = pclose(m_encodeProcess.release());
+      retcode = m_encoder->finish();
     }
+    m_encoder.reset();
+    m_encoderStarted = false;
 
     bool changeState = true;
     // std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -451,9 +976,8 @@ void MediaArchiverClient::doConvert()
         if(m_passNo == 1)
         {
           {
-            std::ifstream fs(m_cfg.tempFolder + "/" +
-                pass1ResultFilePrefix + pass1ResultFileSuffix,
-              std::ios::in);
+            std::ifstream fs(
+              getPassLogPrefix() + pass1ResultFileSuffix, std::ios::in);
             if(!fs.good())
             {
               fs.close();
@@ -463,16 +987,40 @@ void MediaArchiverClient::doConvert()
           }
           LOG_F(INFO, "doConvert: 1st pass finished, starting 2nd one...");
           m_passNo = 2;
-          // stay in the current state to process 2nd conversion run
+          if(m_checkpointed)
+            saveCheckpoint();
+          // wait for a free encoder to process 2nd conversion run
           changeState = false;
-          launch(getTranscodeCommand());
+          m_mainState = MainStates::WaitForEncoderSlot;
+        }
+        else if(m_duration && m_chunk + 1 < getChunkCount())
+        {
+          LOG_F(INFO, "doConvert: chunk %u of %u finished", m_chunk + 1,
+            getChunkCount());
+          m_chunk++;
+
+          uint64_t bytes = 0;
+          for(unsigned i = 0; i < m_chunk; i++)
+          {
+            std::ifstream fs(getChunkFileName(i),
+              std::ios::in | std::ios::binary | std::ios::ate);
+            bytes += fs.is_open() ? static_cast<uint64_t>(fs.tellg()) : 0;
+          }
+
+          // m_encResult tells the server to keep the source
+          if(checkGain(bytes, m_chunk * m_cfg.checkpointInterval))
+          {
+            saveCheckpoint();
+            changeState = false;
+            m_mainState = MainStates::WaitForEncoderSlot;
+          }
         }
         else
         {
-          std::stringstream cmd;
-          cmd << m_cfg.tempFolder << "/" << OutTmpFileName
-              << m_encSettings.finalExtension;
-          std::string outFile = cmd.str();
+          if(m_duration)
+            joinChunks();
+
+          const std::string outFile = getOutFileName();
           int lenOut = getMovieLength(outFile);
 
           if(lenOut <= 0)
@@ -482,10 +1030,7 @@ void MediaArchiverClient::doConvert()
             throw std::runtime_error("1");
           }
 
-          cmd = std::stringstream();
-          cmd << m_cfg.tempFolder << "/" << InTmpFileName << "."
-              << m_encSettings.fileExtension;
-          int lenIn = getMovieLength(cmd.str());
+          int lenIn = getMovieLength(getInFileName());
 
           if(abs(lenOut - lenIn) > 1)
           {
@@ -502,19 +1047,44 @@ void MediaArchiverClient::doConvert()
             throw std::runtime_error("3");
           }
 
-          m_dstFile.ignore(std::numeric_limits<std::streamsize>::max());
-          m_encResult.fileLength = m_dstFile.gcount();
-          // leave file open for transmission stage
+          // the length without reading the whole file
+          m_dstFile.seekg(0, std::ios_base::end);
+          m_encResult.fileLength = m_dstFile.tellg();
 
           // everything ok, Connect to server and send status
           m_encResult.result = EncodingResultInfo::EncodingResult::OK;
           m_encResult.error.clear();
+
+          // a rendition that was not produced does not fail the archive
+          m_encResult.renditionLengths.clear();
+          for(size_t i = 0; i < m_encSettings.renditions.size(); i++)
+          {
+            std::ifstream fs(getRenditionFileName(i),
+              std::ios::in | std::ios::binary | std::ios::ate);
+            const uint64_t len =
+              fs.is_open() ? static_cast<uint64_t>(fs.tellg()) : 0;
+            LOG_IF_F(WARNING, !len, "doConvert: rendition %s is missing",
+              m_encSettings.renditions[i].name.c_str());
+            m_encResult.renditionLengths.push_back(len);
+          }
+
+          if(m_spool && m_encSettings.jobId)
+          {
+            m_dstFile.close();
+            m_dstFile.open(
+              spoolResult(outFile), std::ios::in | std::ios::binary);
+            if(!m_dstFile.is_open())
+            {
+              LOG_F(ERROR, "could not open spooled output file");
+              throw std::runtime_error("4");
+            }
+          }
+          // leave file open for transmission stage
           LOG_F(INFO, "doConvert: File opened to stream to server");
         }
       }
       catch(std::exception &e)
       {
-        m_stdOut << buffer.data();
         m_encResult.error = m_stdOut.str();
         m_encResult.result =
           EncodingResultInfo::EncodingResult::UnknownError;
@@ -523,7 +1093,6 @@ void MediaArchiverClient::doConvert()
     }
     else
     {
-      m_stdOut << buffer.data();
       m_encResult.error = m_stdOut.str();
       m_encResult.result = EncodingResultInfo::EncodingResult::UnknownError;
       LOG_F(ERROR, "doConvert: Encoding failed: %s",
@@ -533,10 +1102,6 @@ void MediaArchiverClient::doConvert()
     if(changeState)
       m_mainState = MainStates::SendResult;
   }
-  else
-  {
-    m_stdOut << buffer.data();
-  }
 }
 
 void MediaArchiverClient::doSendResult()
@@ -549,6 +1114,10 @@ void MediaArchiverClient::doSendResult()
       m_prevMainState = m_mainState;
       m_mainState = MainStates::Authenticateing;
     }
+    else if(isJobCancelled())
+    {
+      dropJob();
+    }
     else
     {
       m_rpc->postFile(m_encResult);
@@ -557,11 +1126,13 @@ void MediaArchiverClient::doSendResult()
       {
         m_dstFile.seekg(0, std::ios_base::beg);
         m_dstFile.clear(); // remove EOF
+        m_output = 0;
         m_mainState = MainStates::Transmitting;
       }
       else
       { // no success
         cleanUp();
+        m_sendFailures = 0;
         m_mainState = MainStates::Idle;
       }
     }
@@ -569,6 +1140,9 @@ void MediaArchiverClient::doSendResult()
   catch(const std::exception &e)
   {
     LOG_F(ERROR, "doSendResult: %s", e.what());
+    if(abandonResult())
+      return;
+
     m_timeToWait = m_cfg.reconnectDelay;
     m_startTime = std::chrono::steady_clock::now();
     m_prevMainState = m_mainState;
@@ -576,59 +1150,136 @@ void MediaArchiverClient::doSendResult()
   }
 }
 
-std::string MediaArchiverClient::getTranscodeCommand() const
+EncodeJob MediaArchiverClient::getEncodeJob() const
 {
-  std::stringstream cmd;
-#ifdef WIN32
-  const std::string nul = "NUL";
-#else
-  const std::string nul = "/dev/null";
-#endif
-  std::stringstream outFile;
+  EncodeJob job;
+  job.inFile = getInFileName();
+  job.outFile = m_passNo == 2 ? getOutFileName() : "";
+  job.parameters = m_encSettings.commandLineParameters;
+  job.clientOptions = m_cfg.extraCommandLineOptions;
+  job.passNo = m_passNo;
+  job.threads = m_pipeline ? m_pipeline->threadsFor(currentStage()) : 0;
+  job.fileLength = m_encSettings.fileLength;
+  job.source = m_source.get();
+  job.startTime = 0;
+  job.duration = 0;
+
+  // the renditions are encoded from the frames decoded for the archive
+  if(m_passNo == 2 && !m_duration)
+  {
+    for(size_t i = 0; i < m_encSettings.renditions.size(); i++)
+    {
+      job.extraOutputs.push_back(EncodeOutput{
+        m_encSettings.renditions[i].commandLineParameters,
+        getRenditionFileName(i)});
+    }
+  }
 
-  if(m_passNo == 2)
+  if(m_duration && m_passNo == 2)
   {
-    outFile << " \"" << m_cfg.tempFolder << "/" << OutTmpFileName
-            << m_encSettings.finalExtension << "\"";
+    // the last chunk takes the rest of the file
+    job.outFile = getChunkFileName(m_chunk);
+    job.startTime = m_chunk * m_cfg.checkpointInterval;
+    if(m_chunk + 1 < getChunkCount())
+      job.duration = m_cfg.checkpointInterval;
   }
-  else
+
+  if(pass2Enabled())
   {
-    outFile << nul;
+    job.passLogPrefix = getPassLogPrefix();
+    job.clientOptions += " ";
+    job.clientOptions +=
+      m_passNo == 1 ? m_cfg.extraOptionsPass1 : m_cfg.extraOptionsPass2;
   }
+  return job;
+}
 
-  cmd << m_cfg.pathToEncoder << " -i \"" << m_cfg.tempFolder << "/"
-      << InTmpFileName << "." << m_encSettings.fileExtension << "\" "
-      << m_encSettings.commandLineParameters;
+std::string MediaArchiverClient::getTempFileName(
+  const char *prefix, const std::string &extension) const
+{
+  char lane[8];
+  snprintf(lane, sizeof(lane), "%02u", m_lane);
+  return m_workFolder + "/" + prefix + lane + extension;
+}
 
-  if(pass2Enabled())
+std::string MediaArchiverClient::getInFileName() const
+{
+  return getTempFileName(InTmpFileName, "." + m_encSettings.fileExtension);
+}
+
+std::string MediaArchiverClient::getOutFileName() const
+{
+  return getTempFileName(OutTmpFileName, m_encSettings.finalExtension);
+}
+
+std::string MediaArchiverClient::getPassLogPrefix() const
+{
+  return getTempFileName(pass1ResultFilePrefix.c_str(), "");
+}
+
+std::string MediaArchiverClient::getChunkFileName(unsigned chunk) const
+{
+  char name[16];
+  snprintf(name, sizeof(name), "_chunk%03u", chunk);
+  return getTempFileName(OutTmpFileName, name + m_encSettings.finalExtension);
+}
+
+std::string MediaArchiverClient::getRenditionFileName(
+  size_t rendition) const
+{
+  return getTempFileName(OutTmpFileName,
+    "_rendition" + std::to_string(rendition) +
+      m_encSettings.renditions[rendition].extension);
+}
+
+unsigned MediaArchiverClient::getChunkCount() const
+{
+  const int interval = std::max(1, m_cfg.checkpointInterval);
+  return std::max(1, (m_duration + interval - 1) / interval);
+}
+
+void MediaArchiverClient::joinChunks()
+{
+  const auto list = getTempFileName(OutTmpFileName, "_chunks.txt");
   {
-    std::stringstream passFile;
-    passFile << " \"" << m_cfg.tempFolder << "/" << pass1ResultFilePrefix
-             << "\"";
+    std::ofstream fs(list, std::ios::out | std::ios::trunc);
+    for(unsigned i = 0; i < getChunkCount(); i++)
+      fs << "file '" << getChunkFileName(i) << "'\n";
 
-    cmd << " -pass " << (m_passNo == 1 ? "1 -an -f null " : "2 ")
-        << " -passlogfile " << passFile.str() << " "
-        << m_cfg.extraCommandLineOptions << " "
-        << (m_passNo == 1 ? m_cfg.extraOptionsPass1 :
-                            m_cfg.extraOptionsPass2);
+    fs.close();
+    if(fs.fail())
+      throw IOError("could not write " + list);
   }
-  else
+
+  // the metadata of the source is kept like for encodings in one piece
+  std::stringstream cmd;
+  std::string stdOut;
+  cmd << m_cfg.pathToEncoder << " -y -f concat -safe 0 -i \"" << list
+      << "\" -i \"" << getInFileName()
+      << "\" -map 0 -map_metadata 1 -c copy \"" << getOutFileName()
+      << "\" 2>&1";
+
+  launch(cmd.str());
+  if(waitForFinish(stdOut) != 0)
   {
-    cmd << " " << m_cfg.extraCommandLineOptions;
+    m_stdOut << stdOut;
+    throw std::runtime_error("could not join the chunks");
   }
 
-  cmd << " " << outFile.str() << " 2>&1 ";
-  return cmd.str();
+  for(unsigned i = 0; i < getChunkCount(); i++)
+    std::remove(getChunkFileName(i).c_str());
+  std::remove(list.c_str());
 }
 
 void MediaArchiverClient::doTransmit()
 {
   try
   {
+    auto &fs = m_output ? m_renditionFile : m_dstFile;
     DataChunk chunk(m_cfg.chunkSize);
-    m_dstFile.read(chunk.data(), chunk.size());
+    fs.read(chunk.data(), chunk.size());
 
-    const auto lastReadLength = m_dstFile.gcount();
+    const auto lastReadLength = fs.gcount();
     if(lastReadLength < chunk.size())
     {
       chunk.resize(lastReadLength);
@@ -636,8 +1287,12 @@ void MediaArchiverClient::doTransmit()
 
     auto res = m_rpc->writeChunk(chunk);
 
-    if(m_dstFile.eof())
+    if(fs.peek() == std::ifstream::traits_type::eof())
     {
+      // the renditions follow the archive, each one in a stream of its own
+      if(res && openNextRendition())
+        return;
+
       if(res)
       {
         throw NetworkError(
@@ -645,35 +1300,169 @@ void MediaArchiverClient::doTransmit()
       }
 
       cleanUp();
+      if(m_spooled)
+        m_spool->remove(m_encSettings.jobId);
+      m_spooled = false;
+      m_sendFailures = 0;
       m_mainState = MainStates::Idle;
     }
   }
   catch(const std::exception &e)
   {
-    // ToDo: in case of error client may stay in an endless loop. There
-    // should be a counter maintained to return to main state after some
-    // trials
     LOG_F(ERROR, "doTransmit: %s", e.what());
+    if(isJobCancelled())
+    {
+      dropJob();
+      return;
+    }
+    if(abandonResult())
+      return;
+
     // after an error the transmission starts from the beginning
     m_rpc->reset();
+    m_renditionFile.close();
+    m_output = 0;
     m_dstFile.seekg(0, std::ios_base::beg);
     m_dstFile.clear();
   }
 }
 
+bool MediaArchiverClient::openNextRendition()
+{
+  // the ones not produced are skipped, see doConvert
+  const auto &lengths = m_encResult.renditionLengths;
+  size_t next = m_output;
+  while(next < lengths.size() && !lengths[next])
+    next++;
+  if(next >= lengths.size())
+    return false;
+
+  m_renditionFile.close();
+  m_renditionFile.clear();
+  m_renditionFile.open(
+    getRenditionFileName(next), std::ios::in | std::ios::binary);
+  if(!m_renditionFile.is_open())
+  {
+    throw IOError("could not open rendition " + getRenditionFileName(next));
+  }
+  m_output = next + 1;
+  LOG_F(INFO, "doTransmit: sending rendition %s",
+    m_encSettings.renditions[next].name.c_str());
+  return true;
+}
+
+std::string MediaArchiverClient::spoolResult(const std::string &outFile)
+{
+  // the spool keeps the archive only, the renditions are sent in this
+  // session or not at all
+  auto encResult = m_encResult;
+  encResult.renditionLengths.clear();
+  const SpooledResult result{m_encSettings.jobId, std::to_string(m_token),
+    m_encSettings.fileLength, m_encSettings.sourceTime,
+    m_encSettings.settingsHash, encResult};
+
+  const auto fileName =
+    m_spool->add(result, outFile, m_encSettings.finalExtension);
+  m_spooled = true;
+  m_sendFailures = 0;
+  return fileName;
+}
+
+bool MediaArchiverClient::abandonResult()
+{
+  if(++m_sendFailures < m_cfg.resultRetries)
+    return false;
+
+  if(m_dstFile.is_open())
+    m_dstFile.close();
+
+  if(m_spooled)
+  {
+    LOG_F(WARNING, "Result of job %u left to the spool after %i trials",
+      m_encSettings.jobId, m_sendFailures);
+  }
+  else
+  {
+    LOG_F(WARNING, "Result of job %u dropped after %i trials",
+      m_encSettings.jobId, m_sendFailures);
+    // the server hands the file out again
+    try
+    {
+      if(m_rpc)
+        m_rpc->abort();
+    }
+    catch(const std::exception &e)
+    {
+      LOG_F(WARNING, "abandonResult: %s", e.what());
+    }
+  }
+
+  // the server still holds the session of the job, the next one gets a new
+  // session
+  disconnect();
+  createToken();
+  if(m_spooled)
+  {
+    m_spool->release(m_encSettings.jobId);
+    m_spool->wakeUp();
+  }
+  m_spooled = false;
+  m_sendFailures = 0;
+  cleanUp();
+  m_mainState = MainStates::Idle;
+  return true;
+}
+
+bool MediaArchiverClient::isJobCancelled()
+{
+  m_jobChecked = std::chrono::steady_clock::now();
+  try
+  {
+    checkCreateRpc();
+    if(!m_authenticated)
+    {
+      std::stringstream ss;
+      ss << m_token;
+      m_rpc->authenticate(ss.str());
+      m_authenticated = true;
+    }
+    if(m_rpc->checkJob())
+      return false;
+  }
+  catch(const std::exception &e)
+  {
+    // an older server or an unreachable one, the job goes on
+    LOG_F(WARNING, "isJobCancelled: %s", e.what());
+    return false;
+  }
+  LOG_F(WARNING, "Job %u was cancelled, its source changed or is gone",
+    m_encSettings.jobId);
+  return true;
+}
+
+void MediaArchiverClient::dropJob()
+{
+  cleanUp();
+  if(m_spooled)
+    m_spool->remove(m_encSettings.jobId);
+  m_spooled = false;
+  m_sendFailures = 0;
+  m_mainState = MainStates::Idle;
+}
+
 void MediaArchiverClient::removeTempFiles()
 {
 #ifdef _MSVC_STL_VERSION
   HANDLE dir;
   WIN32_FIND_DATA file_data;
 
-  if((dir = FindFirstFile((m_cfg.tempFolder + "/*").c_str(), &file_data)) ==
+  if((dir = FindFirstFile((m_workFolder + "/*").c_str(), &file_data)) ==
     INVALID_HANDLE_VALUE)
     return; /* No files found */
 
   do {
     const std::string file_name = file_data.cFileName;
-    const std::string full_file_name = m_cfg.tempFolder + "/" + file_name;
+    const std::string full_file_name = m_workFolder + "/" + file_name;
     const bool is_directory = (file_data.dwFileAttributes &
                                 FILE_ATTRIBUTE_DIRECTORY) != 0;
 
@@ -691,15 +1480,20 @@ void MediaArchiverClient::removeTempFiles()
 #else
   DIR *dir;
   struct dirent *ent;
-  if((dir = opendir(m_cfg.tempFolder.c_str())) != nullptr)
+  const auto inPrefix = getTempFileName(InTmpFileName, "");
+  const auto outPrefix = getTempFileName(OutTmpFileName, "");
+  const auto folderLen = m_workFolder.size() + 1;
+  if((dir = opendir(m_workFolder.c_str())) != nullptr)
   {
     while((ent = readdir(dir)) != nullptr)
     {
       std::string s(ent->d_name);
-      if(s.rfind(InTmpFileName, 0) == 0 || s.rfind(OutTmpFileName, 0) == 0)
+      // only the files of this lane, other lanes may still use theirs
+      if(s.rfind(inPrefix.c_str() + folderLen, 0) == 0 ||
+        s.rfind(outPrefix.c_str() + folderLen, 0) == 0)
       {
         LOG_F(1, "Removing Temp file: %s", ent->d_name);
-        std::remove(ent->d_name);
+        std::remove((m_workFolder + "/" + s).c_str());
       }
     }
     closedir(dir);
@@ -708,27 +1502,55 @@ void MediaArchiverClient::removeTempFiles()
   {
     /* could not open directory */
     LOG_F(ERROR, "Could not open folder \"%s\" for enumerating files",
-      m_cfg.tempFolder.c_str());
+      m_workFolder.c_str());
   }
 #endif
-  const std::string passLog = " \"" + m_cfg.tempFolder + "/" +
-    pass1ResultFilePrefix + pass1ResultFileSuffix + "\"";
+  const std::string passLog = getPassLogPrefix() + pass1ResultFileSuffix;
   std::remove(passLog.c_str());
 }
 
 void MediaArchiverClient::cleanUp()
 {
   LOG_F(INFO, "Cleaning up...");
-  if(m_encodeProcess)
-    pclose(m_encodeProcess.release());
+  releaseStage();
+  // a reader waiting for data of the source gives up
+  if(m_source)
+    m_source->abort();
+
+  if(m_encoder)
+    m_encoder->kill();
+  m_encoder.reset();
+  m_encoderStarted = false;
+
+  if(m_process)
+    m_process.kill();
 
   if(m_srcFile.is_open())
     m_srcFile.close();
 
   if(m_dstFile.is_open())
     m_dstFile.close();
+  m_renditionFile.close();
+  m_output = 0;
+
+  if(m_checkpointed && m_shutdown)
+  {
+    // resumed after the restart
+    LOG_F(INFO, "Checkpoint of job %u kept", m_encSettings.jobId);
+  }
+  else
+  {
+    if(m_checkpointed)
+      m_checkpoint->clear();
+    removeTempFiles();
+  }
+  m_checkpointed = false;
+  m_source.reset();
 
-  removeTempFiles();
+  if(m_staging)
+    m_staging->release(m_stagedBytes);
+  m_stagedBytes = 0;
+  m_workFolder = m_cfg.tempFolder;
 }
 
 int MediaArchiverClient::poll()
@@ -738,9 +1560,11 @@ int MediaArchiverClient::poll()
     case MainStates::Idle: doIdle(); break;
     case MainStates::Authenticateing: doAuth(); break;
     case MainStates::Receiving: doReceive(); break;
+    case MainStates::Estimating: doEstimate(); break;
     case MainStates::WaitForConnect:
     case MainStates::WaitForFileCheck:
     case MainStates::WaitForReconnect: doWait(); break;
+    case MainStates::WaitForEncoderSlot: doStartPass(); break;
     case MainStates::WaitForEncodingFinished: doConvert(); break;
     case MainStates::SendResult: doSendResult(); break;
     case MainStates::Transmitting: doTransmit(); break;
@@ -15,6 +15,14 @@
 
 #include "IMediaArchiverServer.hpp"
 #include "MediaArchiverClientConfig.hpp"
+#include "EncodePipeline.hpp"
+#include "StagingWorkspace.hpp"
+#include "ResultSpool.hpp"
+#include "ChildProcess.hpp"
+#include "IEncoder.hpp"
+#include "StreamingSource.hpp"
+#include "EncodeCheckpoint.hpp"
+#include "ClientProfile.hpp"
 
 namespace MediaArchiver
 {
@@ -24,15 +32,23 @@ IServer *createServer(const MediaArchiver::ClientConfig &config);
 class MediaArchiverClient
 {
 protected:
-  static constexpr const char *InTmpFileName = "infile00";
-  static constexpr const char *OutTmpFileName = "outfile00";
-  std::unique_ptr<FILE, decltype(&pclose)> m_encodeProcess;
+  static constexpr const char *InTmpFileName = "infile";
+  static constexpr const char *OutTmpFileName = "outfile";
+  ChildProcess m_process;
+  std::unique_ptr<IEncoder> m_encoder;
+  std::unique_ptr<StreamingSource> m_source;
+  bool m_encoderStarted;
+  std::chrono::steady_clock::time_point m_progressTime;
   std::unique_ptr<MediaArchiver::IServer> m_rpc;
   std::stringstream m_stdOut;
   std::atomic<bool> m_shutdown;
   std::atomic<bool> m_stopRequested;
   std::ofstream m_srcFile;
   std::ifstream m_dstFile;
+  // rendition being transmitted after the archive
+  std::ifstream m_renditionFile;
+  // output being transmitted, 0: the archive, n: rendition n - 1
+  size_t m_output;
   std::chrono::steady_clock::time_point m_startTime;
   int m_token;
   const ClientConfig &m_cfg;
@@ -42,6 +58,29 @@ protected:
   int m_timeToWait;
   bool m_authenticated;
   int m_passNo;
+  unsigned m_lane;
+  EncodePipeline *m_pipeline;
+  bool m_holdsStage;
+  StagingWorkspace *m_staging;
+  // folder of the temp files of the current job
+  std::string m_workFolder;
+  uint64_t m_stagedBytes;
+  ResultSpool *m_spool;
+  // the result of the current job is kept in the spool
+  bool m_spooled;
+  int m_sendFailures;
+  std::unique_ptr<EncodeCheckpoint> m_checkpoint;
+  // the current job has a journal in the checkpoint folder
+  bool m_checkpointed;
+  // chunks finished and source length (s) of a job encoded in chunks
+  unsigned m_chunk;
+  int m_duration;
+  // length of the source (s), 0: not probed yet, -1: unknown
+  int m_movieLength;
+  // capabilities sent with the requests for a job, nullptr: only m_filter
+  const ClientProfile *m_profile;
+  // last time the server was asked whether the job is still wanted
+  std::chrono::steady_clock::time_point m_jobChecked;
 
   enum class MainStates
   {
@@ -51,6 +90,8 @@ protected:
     WaitForFileCheck,
     Authenticateing,
     Receiving,
+    Estimating,
+    WaitForEncoderSlot,
     WaitForEncodingFinished,
     SendResult,
     Transmitting,
@@ -64,22 +105,93 @@ protected:
   void doWait();
   void doTransmit();
   void doReceive();
+  void doEstimate();
+  void doStartPass();
   void doConvert();
   void doSendResult();
 
-  std::string getTranscodeCommand() const;
+  EncodeJob getEncodeJob() const;
+  EncodePipeline::Stage currentStage() const;
+  void releaseStage();
+  /**
+   * @brief start the encoder of the current pass if a slot is free
+   *
+   * @return false all encoders of the stage are busy
+   */
+  bool startPass();
+  void logProgress();
+  /**
+   * @brief extrapolate the size of the output from the part encoded so far
+   *
+   * @param outBytes size of the output written so far
+   * @param encoded seconds of the source encoded so far
+   * @return false the job saves too little space, m_encResult is set
+   */
+  bool checkGain(uint64_t outBytes, double encoded);
+
+  /** name of a temp file of this lane, e.g. tempFolder/infile00.ext or
+   * stagingFolder/infile00.ext if the job is staged in memory */
+  std::string getTempFileName(
+    const char *prefix, const std::string &extension) const;
+  std::string getInFileName() const;
+  std::string getOutFileName() const;
+  std::string getPassLogPrefix() const;
+  std::string getChunkFileName(unsigned chunk) const;
+  std::string getRenditionFileName(size_t rendition) const;
+  unsigned getChunkCount() const;
 
   void launch(const std::string &cmdLine);
   int waitForFinish(std::string &stdOut);
   int getMovieLength(const std::string &path);
   void removeTempFiles();
+  /** write the progress of the current job into the journal */
+  void saveCheckpoint();
+  /** continue the job of a crashed client */
+  void resume();
+  /** concatenate the encoded chunks into the output file */
+  void joinChunks();
   void cleanUp();
   void checkCreateRpc();
+  void createToken();
+  /**
+   * @brief open the next rendition that was produced for transmitting it
+   *
+   * @return false all of them have been sent
+   */
+  bool openNextRendition();
+  /** move the result into the spool, returns its new path */
+  std::string spoolResult(const std::string &outFile);
+  /**
+   * @brief give up sending the result after resultRetries failures, it is
+   * left to the spool or, without one, dropped
+   */
+  bool abandonResult();
+  /**
+   * @brief ask the server whether it cancelled the job because its source
+   * changed or was deleted, a server not knowing the call keeps it
+   */
+  bool isJobCancelled();
+  /** give up the cancelled job and ask for the next one */
+  void dropJob();
   void disconnect();
   bool pass2Enabled() const;
+  /** the server wants the streams copied into the archive container */
+  bool isRemux() const;
 
 public:
-  MediaArchiverClient(const ClientConfig &cfg);
+  /**
+   * @param cfg client configuration
+   * @param pipeline encoder resources shared among lanes or nullptr if the
+   * client runs alone
+   * @param lane index of the lane, used to separate the temp files
+   * @param staging memory budget for the temp files shared among lanes or
+   * nullptr to keep them in the temp folder
+   * @param spool keeps the results until they are delivered or nullptr
+   */
+  MediaArchiverClient(const ClientConfig &cfg,
+    EncodePipeline *pipeline = nullptr, unsigned lane = 0,
+    StagingWorkspace *staging = nullptr, ResultSpool *spool = nullptr,
+    const ClientProfile *profile = nullptr);
   MediaArchiverClient(const MediaArchiverClient &) = delete;
   MediaArchiverClient(MediaArchiverClient &&) = default;
   ~MediaArchiverClient();
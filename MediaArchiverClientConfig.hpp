@@ -20,6 +20,66 @@ struct ClientConfig
   std::string extraCommandLineOptions;
   std::string extraOptionsPass1;
   std::string extraOptionsPass2;
+  // number of final passes running in parallel
+  int parallelJobs = 1;
+  // run the 1st pass of the next file during the 2nd pass of the current
+  bool overlapPasses = false;
+  // threads shared among the encoders, 0: number of cores
+  int encoderThreads = 0;
+  // share of the threads (%) given to 1st passes when overlapping
+  int pass1ThreadShare = 25;
+  // adapt the encoders to the load of the machine
+  bool governor = false;
+  // time between two checks of the machine load (ms)
+  int governorInterval = 5000;
+  // niceness of the encoders while the machine is not used otherwise
+  int governorNice = 10;
+  // load per core caused by other processes to throttle the encoders
+  double loadThreshold = 0.5;
+  // CPU pressure (PSI some avg10, %) to throttle the encoders
+  double pressureThreshold = 25.0;
+  // pause the encoders if the user was active within this time (s)
+  int userIdleTime = 0;
+  // command printing the idle time of the desktop user in ms
+  std::string userIdleCommand;
+  // cgroup (v2) folder the encoders are moved into for CPU quota
+  std::string governorCgroup;
+  // CPU quota (% of all cores) of the encoders while throttled
+  int reducedCpuQuota = 50;
+  // frames per second of the machine measured by the calibration
+  double benchmarkFps = 0.0;
+  // RAM backed folder (tmpfs) the temp files of small jobs are staged in
+  std::string stagingFolder;
+  // space (MiB) the staged jobs may use in stagingFolder together
+  int stagingMemoryBudget = 0;
+  // folder keeping finished results until the server took them over
+  std::string spoolFolder;
+  // failed attempts to deliver a result before it is left to the spool or,
+  // without one, dropped
+  int resultRetries = 3;
+  // ffmpeg: run pathToEncoder, libav: encode in process (if built in)
+  std::string encoderEngine = "ffmpeg";
+  // single pass jobs: encode while the source is still being received
+  bool streamSource = true;
+  // folder keeping long jobs resumable after a crash, empty: off
+  std::string checkpointFolder;
+  // single pass jobs longer than this (s) are encoded in chunks of it
+  int checkpointInterval = 300;
+  // give up jobs whose projected output exceeds this share of the source
+  // size, 0: off
+  double maxSizeRatio = 0.0;
+  // share of the source (%) encoded before the output size is projected
+  int sizeCheckStart = 10;
+  // short samples encoded to estimate a job before it is encoded, 0: off
+  int trialSamples = 0;
+  // length of each sample (s)
+  int trialLength = 5;
+  // name the server keeps the job history of this machine by, empty: the
+  // host name
+  std::string clientName;
+  // ask the server this often (s) during encoding whether the source of the
+  // job changed or was deleted, 0: only when connected anyway
+  int jobCheckInterval = 600;
 };
 }
 
@@ -1,12 +1,21 @@
 #include <signal.h>
+#include <getopt.h>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <map>
 
 #include "MediaArchiverConfig.hpp"
 #include "MediaArchiverClientConfig.hpp"
 #include "MediaArchiverClient.hpp"
+#include "ResourceGovernor.hpp"
+#include "EncoderCalibration.hpp"
+#include "ClientProfile.hpp"
 
 #include "loguru.hpp"
 
-static std::unique_ptr<MediaArchiver::MediaArchiverClient> gima;
+static std::vector<std::unique_ptr<MediaArchiver::MediaArchiverClient>>
+  gima;
 
 static MediaArchiver::ClientConfig gCfg{
   .serverConnectionTimeout = 5000,
@@ -29,15 +38,16 @@ static MediaArchiver::ClientConfig gCfg{
 void signal_callback_handler(int signum)
 {
   LOG_F(ERROR, "Signal caught: %i", signum);
-  if(!gima)
+  if(gima.empty())
   {
     exit(signum);
   }
 
-  bool forced = signum != SIGINT || gima->isStopRequested();
+  bool forced = signum != SIGINT || gima.front()->isStopRequested();
   if(!forced)
   {
-    gima->stop(false);
+    for(auto &lane: gima)
+      lane->stop(false);
     std::cerr
       << "Termination requested after finishing the current encoding step..."
       << std::endl;
@@ -45,27 +55,129 @@ void signal_callback_handler(int signum)
   else
   {
     std::cerr << "Aborting process..." << std::endl;
-    gima->stop(true);
+    for(auto &lane: gima)
+      lane->stop(true);
     // Terminate program
     // exit(signum);
   }
 }
 
+/**
+ * @brief find the fastest parallel jobs x threads x preset combination and
+ * store it in the configuration file
+ */
+int calibrate(const std::string &cfgFileName, const std::string &sample,
+  const std::string &encoderOptions, const std::string &presetList,
+  int seconds)
+{
+  std::vector<std::string> presets;
+  std::istringstream iss(presetList);
+  for(std::string buf; std::getline(iss, buf, ';');)
+  {
+    MediaArchiver::trim(buf);
+    presets.emplace_back(std::move(buf));
+  }
+
+  if(presets.empty())
+    presets.push_back(gCfg.extraOptionsPass2);
+
+  MediaArchiver::EncoderCalibration cal(
+    gCfg, sample, encoderOptions, presets, seconds);
+
+  try
+  {
+    const auto results = cal.run();
+    const auto &best = MediaArchiver::EncoderCalibration::getBest(results);
+
+    std::cout << "jobs\tthreads\tfps\tCPU s/frame\tpreset" << std::endl;
+    for(const auto &r: results)
+    {
+      std::cout << r.jobs << "\t" << r.threads << "\t"
+                << (r.ok ? std::to_string(r.fps) : "FAILED") << "\t"
+                << r.cpuSecondsPerFrame << "\t" << r.preset << std::endl;
+    }
+
+    std::map<std::string, std::string> values{
+      {"parallelJobs", std::to_string(best.jobs)},
+      {"encoderThreads", std::to_string(best.jobs * best.threads)},
+      {"benchmarkFps", std::to_string(best.fps)},
+    };
+
+    // the preset is a quality trade-off, only changed if asked for
+    if(!presetList.empty())
+      values["extraOptionsPass2"] = best.preset;
+
+    MediaArchiver::updateConfigFile(cfgFileName, values);
+    std::cout << "Best: " << best.jobs << " jobs x " << best.threads
+              << " threads '" << best.preset << "' " << best.fps
+              << " fps, stored in " << cfgFileName << std::endl;
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(ERROR, "Calibration failed: %s", e.what());
+    return 1;
+  }
+
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
+  std::string cfgFileName = "MediaArchiver.cfg";
+  std::string sample;
+  std::string encoderOptions = "-c:v libaom-av1 -b:v 0 -crf 30";
+  std::string presets;
+  int seconds = 10;
+  bool showHelp = false;
+
   loguru::g_internal_verbosity = 1;
   loguru::Options opts;
   opts.signals.sigint = false;
 
   loguru::init(argc, argv, opts);
 
+  int c;
+  while((c = getopt(argc, argv, "c:C:e:P:t:h")) != -1)
+  {
+    switch(c)
+    {
+      case 'c': cfgFileName = optarg; break;
+      case 'C': sample = optarg; break;
+      case 'e': encoderOptions = optarg; break;
+      case 'P': presets = optarg; break;
+      case 't': seconds = atoi(optarg); break;
+      case 'h': showHelp = true; break;
+
+      default: break;
+    }
+  }
+
+  if(showHelp)
+  {
+    std::cout
+      << "Usage: " << argv[0]
+      << " [-h] [-c configFile] [-C sample [-e options] [-P presets] [-t seconds]]"
+      << std::endl
+      << "\t-h\tshow this help" << std::endl
+      << "\t-c\tconfig file to use, by default MediaArchiver.cfg is used in local folder"
+      << std::endl
+      << "\t-C\tcalibrate the encoder settings using the sample clip and store them in the config file"
+      << std::endl
+      << "\t-e\tencoder options of the calibration, default: "
+      << encoderOptions << std::endl
+      << "\t-P\tpresets to compare separated by ';', e.g. \"-cpu-used 8;-cpu-used 6\""
+      << std::endl
+      << "\t-t\tseconds of the sample to encode in each trial" << std::endl;
+    return -1;
+  }
+
   // load configuration
   {
     auto mac =
       MediaArchiver::MediaArchiverConfig<MediaArchiver::ClientConfig>(gCfg);
     try
     {
-      mac.read("MediaArchiver.cfg");
+      mac.read(cfgFileName);
     }
     catch(const std::exception &e)
     {
@@ -74,6 +186,11 @@ int main(int argc, char **argv)
     }
   }
 
+  if(!sample.empty())
+  {
+    return calibrate(cfgFileName, sample, encoderOptions, presets, seconds);
+  }
+
   loguru::add_file("MediaArchiverClient.log", loguru::FileMode::Append,
     static_cast<loguru::Verbosity>(gCfg.verbosity));
 
@@ -84,14 +201,59 @@ int main(int argc, char **argv)
   signal(SIGKILL, signal_callback_handler);
 #endif
 
-  gima.reset(new MediaArchiver::MediaArchiverClient(gCfg));
-  if(!gima)
-    return 1;
+  MediaArchiver::EncodePipeline pipeline(gCfg);
+  MediaArchiver::StagingWorkspace staging(gCfg);
+
+  // results of earlier runs are offered before new files are requested
+  std::unique_ptr<MediaArchiver::ResultSpool> spool;
+  if(!gCfg.spoolFolder.empty())
+  {
+    spool.reset(new MediaArchiver::ResultSpool(gCfg));
+    try
+    {
+      spool->load();
+    }
+    catch(const std::exception &e)
+    {
+      LOG_F(ERROR, "Spool: %s", e.what());
+      return 1;
+    }
+    spool->upload();
+    spool->start();
+  }
+
+  MediaArchiver::ClientProfile profile(gCfg, pipeline.lanes());
+  for(unsigned i = 0; i < pipeline.lanes(); i++)
+  {
+    gima.emplace_back(new MediaArchiver::MediaArchiverClient(
+      gCfg, &pipeline, i, &staging, spool.get(), &profile));
+    gima.back()->init();
+  }
+
+  std::unique_ptr<MediaArchiver::ResourceGovernor> governor;
+  if(gCfg.governor)
+  {
+    governor.reset(new MediaArchiver::ResourceGovernor(gCfg, pipeline));
+    governor->start();
+  }
+
+  // every lane runs its own job, so waiting for the server or the encoder
+  // in one lane does not block the others
+  std::vector<int> retcodes(gima.size(), 0);
+  std::vector<std::thread> threads;
+  for(size_t i = 0; i < gima.size(); i++)
+  {
+    threads.emplace_back([i, &retcodes]() {
+      auto &lane = *gima[i];
+      while((retcodes[i] = lane.poll()) == 0) {}
+    });
+  }
 
-  gima->init();
-  int retcode = 0;
-  while((retcode = gima->poll()) == 0) {}
+  for(auto &t: threads)
+    t.join();
 
-  gima.reset();
-  return retcode;
+  governor.reset();
+  gima.clear();
+  spool.reset();
+  return *std::max_element(retcodes.begin(), retcodes.end());
 }
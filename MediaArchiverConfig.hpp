@@ -7,6 +7,9 @@
 #include <fstream>
 #include <stdexcept>
 #include <algorithm>
+#include <map>
+#include <vector>
+#include <cstdio>
 
 namespace MediaArchiver
 {
@@ -34,6 +37,69 @@ static inline void trim(std::string &s)
   rtrim(s);
 }
 
+static inline std::string toLower(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(),
+    [](unsigned char ch) { return std::tolower(ch); });
+  return s;
+}
+
+/**
+ * @brief set values in a configuration file, keeping its comments and the
+ * order of the lines. Keys not present yet are appended.
+ *
+ * @param file configuration file to update
+ * @param values key -> value pairs, keys are case insensitive
+ */
+static inline void updateConfigFile(
+  const std::string &file, const std::map<std::string, std::string> &values)
+{
+  std::vector<std::string> lines;
+  std::map<std::string, std::string> pending;
+  for(const auto &v: values)
+    pending[toLower(v.first)] = v.first + " = " + v.second;
+
+  {
+    std::ifstream fs(file);
+    std::string line;
+    while(std::getline(fs, line))
+    {
+      auto key = line.substr(0, line.find('='));
+      trim(key);
+      const auto it = line.find('=') == std::string::npos || key[0] == '#' ?
+        pending.end() :
+        pending.find(toLower(key));
+
+      if(it != pending.end())
+      {
+        line = it->second;
+        pending.erase(it);
+      }
+      lines.emplace_back(std::move(line));
+    }
+  }
+
+  for(const auto &p: pending)
+    lines.emplace_back(p.second);
+
+  const auto tmp = file + ".tmp";
+  std::ofstream fs(tmp, std::ios::out | std::ios::trunc);
+  for(const auto &line: lines)
+    fs << line << "\n";
+  fs.close();
+
+#ifdef WIN32
+  // rename does not replace existing files on windows
+  if(!fs.fail())
+    std::remove(file.c_str());
+#endif
+  if(fs.fail() || std::rename(tmp.c_str(), file.c_str()))
+  {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("could not write configuration file " + file);
+  }
+}
+
 template<class T> class MediaArchiverConfig
 {
 public:
@@ -5,10 +5,13 @@
 #include <getopt.h>
 #include <regex>
 #include <locale>
+#include <algorithm>
 
 #include "MediaArchiverConfig.hpp"
 #include "MediaArchiverDaemonConfig.hpp"
 #include "MediaArchiverDaemon.hpp"
+#include "MediaHeaderParser.hpp"
+#include "FileFingerprint.hpp"
 
 #include "rpc/server.h"
 #include "rpc/this_handler.h"
@@ -63,6 +66,13 @@ static MediaArchiver::DaemonConfig gCfg{
 namespace
 {
 const char gNotAuthenticatedError[] = "Client not authenticated!";
+
+// the job history is kept by the name of the machine, older clients only
+// have their session token
+std::string getClientName(const MediaArchiver::ConnectedClient &cli)
+{
+  return cli.filter.clientName.empty() ? cli.token : cli.filter.clientName;
+}
 }
 
 // Define the function to be called when ctrl-c (SIGINT) is sent to process
@@ -109,6 +119,22 @@ void MediaArchiverDaemon::start()
     return;
   }
 
+  // segmented files whose join was interrupted by a restart
+  for(const auto id: m_db.getSegmentedFiles())
+  {
+    if(m_db.getSegments(id).empty())
+      m_db.reset(id);
+    else
+      checkSegments(id);
+  }
+  m_segmentThread.reset(new std::thread([this]() { segmentMain(); }));
+  m_settleThread.reset(new std::thread([this]() { settleMain(); }));
+
+  // archives made before the settings were recorded are taken as made
+  // with the current ones
+  m_db.setUnknownArchiveSettings(getSettingsHash());
+  logForecast();
+
   std::unique_lock<std::mutex> lck(m_mtxFileMove);
   while(!m_stopRequested || !isIdle())
   {
@@ -140,7 +166,14 @@ void MediaArchiverDaemon::start()
     lck.unlock();
     std::string error;
 
-    if(ftm.result.result != EncodingResultInfo::EncodingResult::OK ||
+    if(ftm.result.result == EncodingResultInfo::EncodingResult::NoGain)
+    {
+      // kept as it is, never handed out again
+      LOG_F(INFO, "File id %u is not worth encoding: %s",
+        ftm.result.originalFileId, ftm.result.error.c_str());
+      m_db.addEncodedFile(ftm.result);
+    }
+    else if(ftm.result.result != EncodingResultInfo::EncodingResult::OK ||
       ftm.result.fileLength == 0)
     {
       LOG_F(ERROR, "Process (file id: %u) resulted in error %i: %s",
@@ -152,11 +185,27 @@ void MediaArchiverDaemon::start()
     {
       try
       {
-        FileCopier().moveFile(ftm.tmp.c_str(), ftm.result.fileName.c_str(),
-          &ftm.mtime);
+        if(ftm.copy)
+        {
+          FileCopier().copyFile(ftm.tmp.c_str(),
+            ftm.result.fileName.c_str(), &ftm.mtime);
+        }
+        else
+        {
+          FileCopier().moveFile(ftm.tmp.c_str(),
+            ftm.result.fileName.c_str(), &ftm.mtime);
+        }
         LOG_F(1, "File %u '%s' was moved to place",
           ftm.result.originalFileId, ftm.result.fileName.c_str());
         m_db.addEncodedFile(ftm.result);
+
+        // copies of the source waiting to be encoded get the archive too
+        if(!ftm.parentId)
+        {
+          const auto id = ftm.result.originalFileId;
+          for(const auto twin: m_db.getPendingTwins(id))
+            takeTwinArchive(twin);
+        }
       }
       catch(const std::exception &e)
       {
@@ -179,9 +228,33 @@ void MediaArchiverDaemon::start()
       // ToDo: delete temporary file
     }
 
+    // a rendition is only kept along with its archive
+    moveRenditions(ftm,
+      error.empty() && ftm.result.fileLength > 0 &&
+        ftm.result.result == EncodingResultInfo::EncodingResult::OK);
+
+    if(ftm.parentId)
+    {
+      checkSegments(ftm.parentId);
+    }
+
     // lock mutex again for next cycle
     lck.lock();
   }
+  lck.unlock();
+
+  {
+    std::lock_guard<std::mutex> lckSeg(m_mtxSegments);
+    m_cvSegments.notify_all();
+  }
+  m_segmentThread->join();
+  m_segmentThread.reset();
+  {
+    std::lock_guard<std::mutex> lckSettle(m_mtxSettle);
+    m_cvSettle.notify_all();
+  }
+  m_settleThread->join();
+  m_settleThread.reset();
 
   m_srv.stop();
 }
@@ -212,7 +285,22 @@ MediaArchiverDaemon::MediaArchiverDaemon(const DaemonConfig &cfg,
   : m_cfg(cfg)
   , m_db(db)
   , m_srv(cfg.serverPort)
+  , m_segmenter(cfg)
+  , m_probe(cfg)
+  , m_scheduler(db, cfg.schedulingPolicy, cfg.maxJobHours)
+  , m_reencode(cfg.reencodeOrder != "none")
+  , m_reencodeOrder(ReencodeOrder::Oldest)
+  , m_settling(std::max(1, cfg.settleTime))
 {
+  if(cfg.reencodeOrder == "largest")
+    m_reencodeOrder = ReencodeOrder::Largest;
+  else if(cfg.reencodeOrder == "smallest")
+    m_reencodeOrder = ReencodeOrder::Smallest;
+  else if(m_reencode && cfg.reencodeOrder != "oldest")
+    throw std::invalid_argument(
+      "unknown reencode order: " + cfg.reencodeOrder);
+
+  m_db.setRetryPolicy(RetryPolicy(std::max(0, cfg.retryDelay)));
   init();
 
   m_srv.bind(RpcFunctions::getVersion,
@@ -304,6 +392,58 @@ MediaArchiverDaemon::MediaArchiverDaemon(const DaemonConfig &cfg,
       }
     });
 
+  m_srv.bind(RpcFunctions::offerResult,
+    [&](const SpooledResult &offer) -> bool
+    {
+      LOG_F(3, "offerResult: job %u, %luBytes", offer.jobId,
+        offer.result.fileLength);
+      bool ret = false;
+      try
+      {
+        ret = this->offerResult(checkClient(), offer);
+      }
+      catch(const std::exception &e)
+      {
+        LOG_F(ERROR, "OfferResult: %s", e.what());
+        rpc::this_handler().respond_error(
+          std::string("I/O error") + e.what());
+      }
+      return ret;
+    });
+
+  m_srv.bind(RpcFunctions::reportEstimate,
+    [&](const EncodeEstimate &estimate) -> EstimateVerdict
+    {
+      EstimateVerdict verdict{EstimateVerdict::Action::Encode, ""};
+      try
+      {
+        verdict = this->reportEstimate(checkClient(), estimate);
+      }
+      catch(const std::exception &e)
+      {
+        LOG_F(ERROR, "ReportEstimate: %s", e.what());
+        rpc::this_handler().respond_error(
+          std::string("I/O error") + e.what());
+      }
+      return verdict;
+    });
+
+  m_srv.bind(RpcFunctions::checkJob,
+    [&]() -> bool
+    {
+      bool ret = true;
+      try
+      {
+        ret = !this->dropCancelledJob(checkClient());
+      }
+      catch(const std::exception &e)
+      {
+        LOG_F(ERROR, "CheckJob: %s", e.what());
+        rpc::this_handler().respond_error(e.what());
+      }
+      return ret;
+    });
+
   m_srv.bind(RpcFunctions::writeChunk,
     [&](const DataChunk &chunk) -> bool
     {
@@ -418,6 +558,90 @@ bool MediaArchiverConfig<DaemonConfig>::parse(const std::string &key,
   {
     config.serverInstances = atoi(value.c_str());
   }
+  else if(k == "segmenterpath")
+  {
+    config.segmenterPath = value;
+  }
+  else if(k == "segmentthreshold")
+  {
+    config.segmentThreshold = atoi(value.c_str());
+  }
+  else if(k == "segmentduration")
+  {
+    config.segmentDuration = atoi(value.c_str());
+  }
+  else if(k == "skipratio")
+  {
+    config.skipRatio = atof(value.c_str());
+  }
+  else if(k == "downgradespeed")
+  {
+    config.downgradeSpeed = atof(value.c_str());
+  }
+  else if(k == "downgradeoptions")
+  {
+    config.downgradeOptions = value;
+  }
+  else if(k == "probepath")
+  {
+    config.probePath = value;
+  }
+  else if(k == "remuxvideocodecs")
+  {
+    config.remuxVideoCodecs = value;
+  }
+  else if(k == "remuxaudiocodecs")
+  {
+    config.remuxAudioCodecs = value;
+  }
+  else if(k == "remuxmaxbitrate")
+  {
+    config.remuxMaxBitRate = atoi(value.c_str());
+  }
+  else if(k == "schedulingpolicy")
+  {
+    config.schedulingPolicy = value;
+  }
+  else if(k == "maxjobhours")
+  {
+    config.maxJobHours = atof(value.c_str());
+  }
+  else if(k == "presettier")
+  {
+    // "<backlog hours> <name> <encoder options>"
+    PresetTier tier;
+    std::istringstream ss(value);
+    ss.imbue(std::locale::classic());
+    if(!(ss >> tier.backlogHours >> tier.name))
+      return false;
+    std::getline(ss, tier.options);
+    trim(tier.options);
+    config.presetTiers.emplace_back(std::move(tier));
+  }
+  else if(k == "reencodeorder")
+  {
+    config.reencodeOrder = value;
+  }
+  else if(k == "settletime")
+  {
+    config.settleTime = atoi(value.c_str());
+  }
+  else if(k == "retrydelay")
+  {
+    config.retryDelay = atoi(value.c_str());
+  }
+  else if(k == "rendition")
+  {
+    // "<name> <extension> <folder> <encoder options>"
+    Rendition r;
+    std::istringstream ss(value);
+    ss.imbue(std::locale::classic());
+    if(!(ss >> r.name >> r.extension >> r.folder))
+      return false;
+    std::getline(ss, r.options);
+    trim(r.options);
+    config.renditions.emplace_back(std::move(r));
+  }
   else
     return false;
 
@@ -433,7 +657,24 @@ bool MediaArchiverDaemon::isArchive(const std::string &fileName) const
 bool MediaArchiverDaemon::isInterestingFile(
   const std::string &fileName) const
 {
-  return regex_search(fileName.c_str(), m_cfg.filenameMatchPattern);
+  // renditions written next to their sources are no sources themselves
+  return regex_search(fileName.c_str(), m_cfg.filenameMatchPattern) &&
+    !isRendition(fileName);
+}
+
+bool MediaArchiverDaemon::isRendition(const std::string &fileName) const
+{
+  for(const auto &r: m_cfg.renditions)
+  {
+    const auto suffix = "." + r.name + r.extension;
+    if(fileName.size() > suffix.size() &&
+      !fileName.compare(fileName.size() - suffix.size(), suffix.size(),
+        suffix))
+    {
+      return true;
+    }
+  }
+  return false;
 }
 
 void MediaArchiverDaemon::onFileSystemChange(
@@ -441,7 +682,35 @@ void MediaArchiverDaemon::onFileSystemChange(
   const std::string &dst)
 {
   if(e == IFileSystemChangeListener::EventType::FileDeleted)
+  {
+    removeCatalogPath(dst);
+    return;
+  }
+
+  // moved out of the watched folders
+  if(e == IFileSystemChangeListener::EventType::FileMoved && dst.empty())
+  {
+    if(!src.empty())
+      removeCatalogPath(src);
     return;
+  }
+
+  if(e == IFileSystemChangeListener::EventType::DirectoryMoved)
+  {
+    if(dst.empty())
+      removeCatalogDirectory(src);
+    else
+      moveCatalogPaths(src, dst, true);
+    return;
+  }
+
+  // renamed in place, its queue state and archive are kept
+  if(e == IFileSystemChangeListener::EventType::FileMoved && !src.empty() &&
+    (isInterestingFile(dst) || isArchive(dst)) &&
+    moveCatalogPaths(src, dst, false))
+  {
+    return;
+  }
 
   size_t size[2];
 
@@ -508,11 +777,30 @@ void MediaArchiverDaemon::onFileSystemChange(
     case IFileSystemChangeListener::EventType::FileDiscovered:
     case IFileSystemChangeListener::EventType::FileCreated:
     case IFileSystemChangeListener::EventType::FileMoved:
+    {
+      // a source moved while it was not watched keeps its row
+      SourceFingerprint fp;
+      bool isNew = !dstIsArchive && !m_db.getFileId(dst);
+      const bool unknown = isNew && FileFingerprint::read(dst, fp);
+      if(unknown && adoptMovedFile(dst, fp, size[1]))
+        isNew = false;
+
       // put file to database
-      m_db.addFile(!dstIsArchive || (dstIsArchive && aSize) ? &fs : nullptr,
+      const auto id = m_db.addFile(
+        !dstIsArchive || (dstIsArchive && aSize) ? &fs : nullptr,
         dstIsArchive || (!dstIsArchive && aSize) ? &fd : nullptr,
         !dstIsArchive || aSize);
+
+      // a rewritten file may have changed its streams
+      if(id && !dstIsArchive &&
+        !startSettling(id, dst, size[1], e, isNew))
+      {
+        indexSource(id, dst, size[1],
+          e == IFileSystemChangeListener::EventType::FileCreated,
+          unknown ? &fp : nullptr);
+      }
       break;
+    }
 
     default: break;
   }
@@ -562,6 +850,15 @@ void MediaArchiverDaemon::reset()
   {
     cli.inFile.seekg(0, ios_base::seekdir::_S_beg);
   }
+  else if(cli.outFile.is_open() && cli.output)
+  {
+    // the client starts again with the archive
+    cli.outFile.close();
+    for(size_t i = 0; i < cli.output; i++)
+      remove(getRenditionTempName(cli, i).c_str());
+    cli.output = 0;
+    openTempFile(cli);
+  }
   else if(cli.outFile.is_open())
   {
     cli.outFile.seekp(0, ios_base::seekdir::_S_beg);
@@ -583,13 +880,46 @@ void MediaArchiverDaemon::abort()
 
   lock_guard<mutex> lck(m_mtxFileMove);
   m_db.reset(cli.originalFileId);
-  cli.inFile = ifstream();
-  cli.outFile = ofstream();
+  clearJob(cli);
+}
+
+void MediaArchiverDaemon::clearJob(ConnectedClient &cli)
+{
   cli.originalFileId = 0;
+  cli.parentId = 0;
+  cli.remux = false;
+  cli.started = std::chrono::steady_clock::time_point();
   cli.tempFileName = "";
   cli.originalFileName = "";
   cli.encSettings = MediaEncoderSettings{.fileLength = 0};
   cli.encResult = EncodingResultInfo();
+  cli.inFile = ifstream();
+  cli.outFile = ofstream();
+  memset(cli.times, 0, sizeof(cli.times));
+}
+
+bool MediaArchiverDaemon::dropCancelledJob(ConnectedClient &cli)
+{
+  lock_guard<mutex> lck(m_mtxFileMove);
+  if(!cli.cancelled)
+    return false;
+
+  // stays cancelled until the next job, so the client learns about it
+  if(cli.originalFileId)
+  {
+    LOG_F(INFO, "Dropping cancelled job %u (%s) of %s", cli.originalFileId,
+      cli.originalFileName.c_str(), getClientName(cli).c_str());
+    cli.inFile.close();
+    if(cli.outFile.is_open())
+    {
+      cli.outFile.close();
+      remove(cli.tempFileName.c_str());
+      for(size_t i = 0; i < cli.output; i++)
+        remove(getRenditionTempName(cli, i).c_str());
+    }
+    clearJob(cli);
+  }
+  return true;
 }
 
 bool MediaArchiverDaemon::getNextFile(ConnectedClient &cli,
@@ -611,18 +941,55 @@ bool MediaArchiverDaemon::getNextFile(ConnectedClient &cli,
     throw std::runtime_error(ss.str());
   }
   cli.originalFileId = 0;
+  cli.cancelled = false;
   cli.filter = filter;
   uint32_t srcId = 0;
 
   cli.encSettings.fileLength = 0;
   cli.originalFileName.clear();
 
-  if(!m_stopRequested)
+  LOG_F(1,
+    "Client %s: %u cores, %.1f fps, %u slots, %lu MiB temp, %lu MiB memory",
+    getClientName(cli).c_str(), filter.cores, filter.benchmarkFps,
+    filter.slots, filter.freeTempSpace >> 20, filter.memory >> 20);
+
+  // the client cannot encode into the archive codec
+  const bool canEncode = filter.codecs.empty() ||
+    std::find(filter.codecs.begin(), filter.codecs.end(), m_cfg.vCodec) !=
+      filter.codecs.end();
+  LOG_IF_F(WARNING, !canEncode, "Client %s has no %s encoder",
+    getClientName(cli).c_str(), m_cfg.vCodec.c_str());
+
+  if(!m_stopRequested && canEncode)
   {
     BasicFileInfo fi;
     fi.fileSize = 0;
 
-    srcId = m_db.getNextFile(cli.filter, fi);
+    bool remux = false;
+    bool reencode = false;
+    for(;;)
+    {
+      srcId =
+        m_scheduler.getNextFile(getClientName(cli), cli.filter, fi);
+      if(!srcId)
+      {
+        // outdated archives only when there is nothing new to encode
+        if(!reencode && (reencode = queueReencode()))
+          continue;
+        break;
+      }
+
+      // copying the streams is fast without splitting
+      remux = isRemuxable(fi);
+      if(remux || !isSplitCandidate(srcId, fi))
+        break;
+
+      // the segments are handed out once they are cut
+      queueSegmentTask(SegmentTask{
+        SegmentTask::Kind::Split, srcId, fi.fileName});
+      fi.fileSize = 0;
+    }
+
     if(srcId > 0)
     {
       if(!fi.fileSize)
@@ -641,31 +1008,40 @@ bool MediaArchiverDaemon::getNextFile(ConnectedClient &cli,
       cli.inFile = move(inFile);
       cli.encSettings.fileLength = fi.fileSize;
       cli.originalFileName = fi.fileName;
-      stringstream ss;
-      ss << "-y -hide_banner -nostats -loglevel warning -copyts -map_metadata 0 -movflags use_metadata_tags -c:v "
-         << m_cfg.vCodec;
-      if(m_cfg.vBitRate >= 0)
-      {
-        ss << " -b:v " << to_string(m_cfg.vBitRate);
-      }
-      if(m_cfg.crf >= 0)
-      {
-        ss << " -crf " << m_cfg.crf;
-      }
-      if(m_cfg.aBitRate >= 0)
+      cli.encSettings.commandLineParameters =
+        remux ? getRemuxParameters() : getCommandLineParameters();
+      const auto tier = remux ? nullptr : getPresetTier();
+      if(tier)
       {
-        ss << " -b:a " << to_string(m_cfg.aBitRate);
+        // ffmpeg takes the last one of repeated options
+        cli.encSettings.commandLineParameters += " " + tier->options;
       }
-      ss << " -c:a " << m_cfg.aCodec;
-      cli.encSettings.commandLineParameters = ss.str();
+      cli.encSettings.preset = tier ? tier->name : "";
+      cli.remux = remux;
+      cli.encSettings.sourceTime = cli.times[1].tv_sec;
+      cli.encSettings.settingsHash = getSettingsHash();
     }
   }
 
   cli.originalFileId = srcId;
+  cli.parentId = srcId ? m_db.getParent(srcId) : 0;
+  cli.encSettings.jobId = srcId;
+
+  // segments are joined without renditions
+  cli.encSettings.renditions.clear();
+  for(const auto &r: m_cfg.renditions)
+  {
+    if(!srcId || cli.parentId)
+      break;
+    cli.encSettings.renditions.push_back(
+      RenditionSettings{r.name, r.extension, r.options});
+  }
   cli.encSettings.encoderType = filter.encoderType;
 
   auto posExt = cli.originalFileName.find_last_of('.');
-  cli.encSettings.fileExtension = cli.originalFileName.substr(posExt + 1);
+  cli.encSettings.fileExtension = cli.parentId ?
+    MediaSegmenter::SegmentExtension :
+    cli.originalFileName.substr(posExt + 1);
   cli.encSettings.finalExtension = m_cfg.finalExtension;
   settings = cli.encSettings;
 
@@ -673,6 +1049,14 @@ bool MediaArchiverDaemon::getNextFile(ConnectedClient &cli,
   {
     LOG_F(INFO, "Next file to process %u (%s)", cli.originalFileId,
       cli.originalFileName.c_str());
+    cli.started = std::chrono::steady_clock::now();
+
+    const auto fc = m_scheduler.forecast(srcId,
+      BasicFileInfo{cli.originalFileName, cli.encSettings.fileLength},
+      getClientName(cli));
+    LOG_IF_F(INFO, fc.samples,
+      "Predicted for %u: %.0f s, %lu bytes (from %i jobs)", srcId,
+      fc.seconds, fc.outputSize, fc.samples);
     return true;
   }
   else
@@ -693,6 +1077,8 @@ bool MediaArchiverDaemon::getNextFile(ConnectedClient &cli,
 bool MediaArchiverDaemon::readChunk(DataChunk &chunk)
 {
   auto &cli = checkClient();
+  if(dropCancelledJob(cli))
+    throw IOError("The job was cancelled");
 
   if(cli.inFile.is_open())
   {
@@ -725,6 +1111,8 @@ bool MediaArchiverDaemon::readChunk(DataChunk &chunk)
 void MediaArchiverDaemon::postFile(const EncodingResultInfo &result)
 {
   auto &cli = checkClient();
+  if(dropCancelledJob(cli))
+    throw std::runtime_error("The job was cancelled");
   if(cli.inFile.is_open())
   {
     if(cli.inFile.tellg() != cli.encSettings.fileLength)
@@ -740,124 +1128,1101 @@ void MediaArchiverDaemon::postFile(const EncodingResultInfo &result)
     throw std::runtime_error("Output file is still open");
   }
 
+  if(cli.started != std::chrono::steady_clock::time_point())
+  {
+    const std::chrono::duration<double> wall =
+      std::chrono::steady_clock::now() - cli.started;
+    LOG_F(1, "Job %u of %s took %.0f s", cli.originalFileId,
+      getClientName(cli).c_str(), wall.count());
+    m_scheduler.addJob(JobRecord{cli.originalFileId, getClientName(cli),
+      result.result, cli.remux, wall.count(), result.fileLength});
+    cli.started = std::chrono::steady_clock::time_point();
+  }
+
   cli.encResult = result;
+  // renditions not asked for are not received
+  auto &lengths = cli.encResult.renditionLengths;
+  if(lengths.size() > cli.encSettings.renditions.size())
+    lengths.resize(cli.encSettings.renditions.size());
+
   if(result.result == EncodingResultInfo::EncodingResult::OK &&
     result.fileLength > 0)
   {
     // prepare for receiving data
-    std::stringstream ss;
-    ss.imbue(std::locale::classic());
-    if(m_cfg.tempFolder == ".")
-    {
-      ss << cli.originalFileName << "." << cli.originalFileId;
-    }
-    else if(m_cfg.tempFolder.empty())
-    {
-      ss << "./" << cli.originalFileId;
-    }
-    else
-    {
-      ss << m_cfg.tempFolder << '/' << cli.originalFileId;
-    }
-
-    cli.tempFileName = ss.str();
-    cli.outFile.open(cli.tempFileName, std::ios::binary | std::ios::out);
-    if(!cli.outFile.is_open())
-    {
-      throw std::runtime_error(
-        string("Could not open output temp file: ") + cli.tempFileName);
-    }
+    openTempFile(cli);
   }
   else
   {
     // error during encoding, no data will be received
-    LOG_F(ERROR, "Encoding failed for id %u (%s)", cli.originalFileId,
+    LOG_IF_F(ERROR,
+      result.result != EncodingResultInfo::EncodingResult::NoGain,
+      "Encoding failed for id %u (%s)", cli.originalFileId,
       cli.originalFileName.c_str());
     std::lock_guard<std::mutex> lck(m_mtxFileMove);
     prepareNewSession(cli);
     m_cv.notify_all();
   }
 }
-bool MediaArchiverDaemon::writeChunk(const std::vector<char> &data)
+
+void MediaArchiverDaemon::logForecast()
 {
-  auto &cli = checkClient();
-  if(!cli.originalFileId || !cli.outFile.is_open() ||
-    !cli.encResult.fileLength || cli.outFile.bad() ||
-    static_cast<size_t>(cli.outFile.tellp()) + data.size() >
-      cli.encResult.fileLength)
+  std::vector<std::string> clients;
   {
-    LOG_F(ERROR,
-      "writeChunk: state: id=%u, outFile=%s, resultLength=%lu, overrun=%i",
-      cli.originalFileId, cli.outFile.is_open() ? "OPEN" : "CLOSED",
-      cli.encResult.fileLength,
-      static_cast<size_t>(cli.outFile.tellp()) + data.size() >
-        cli.encResult.fileLength);
+    std::lock_guard<std::mutex> lck(m_mtxFileMove);
+    for(const auto &c: m_connections)
+      clients.emplace_back(getClientName(c.second));
+  }
 
-    throw std::runtime_error("writeChunk: invalid state");
+  const auto pending = m_scheduler.forecastPending(clients);
+  double eta = 0;
+  uint64_t input = 0;
+  uint64_t output = 0;
+  for(const auto &p: pending)
+  {
+    LOG_F(2, "Pending %u (%s): %.0f s, %lu bytes, done in %.0f s",
+      p.file.id, p.file.fileName.c_str(), p.cost.seconds,
+      p.cost.outputSize, p.eta);
+    eta = std::max(eta, p.eta);
+    input += p.file.fileSize;
+    output += p.cost.outputSize;
   }
 
-  cli.outFile.write(data.data(), data.size());
-  if(cli.outFile.tellp() < cli.encResult.fileLength)
+  if(pending.empty() || !m_scheduler.getCostModel().samples())
   {
-    // copying not finished yet
-    return true;
+    LOG_F(INFO, "%lu files pending, no finished jobs to predict from yet",
+      pending.size());
+    return;
   }
+  LOG_F(INFO,
+    "%lu files pending (%lu MiB): done in %.1f h by %lu clients, %lu MiB predicted",
+    pending.size(), input >> 20, eta / 3600,
+    std::max<size_t>(clients.size(), 1), output >> 20);
+}
+
+EstimateVerdict MediaArchiverDaemon::reportEstimate(
+  ConnectedClient &cli, const EncodeEstimate &estimate)
+{
+  if(dropCancelledJob(cli))
+    return EstimateVerdict{EstimateVerdict::Action::Cancel, ""};
+
+  if(!cli.originalFileId)
   {
-    LOG_F(INFO, "writeChunk: Copying finished, file can be moved");
-    std::lock_guard<std::mutex> lck(m_mtxFileMove);
-    cli.outFile.close();
-    FileCopier().setFileTimes(cli.tempFileName.c_str(), cli.times);
+    throw std::runtime_error("No file is processed in this session");
+  }
 
-    // add file to queue for moving it to place in main thread
-    prepareNewSession(cli);
+  LOG_F(INFO,
+    "Estimate for id %u (%s): %.0f%% of the source, %.2fx realtime (%i samples)",
+    cli.originalFileId, cli.originalFileName.c_str(),
+    estimate.sizeRatio * 100, estimate.speed, estimate.samples);
 
-    // send signal to main loop to start moving file...
-    m_cv.notify_all();
+  if(m_cfg.skipRatio > 0 && estimate.sizeRatio > m_cfg.skipRatio)
+  {
+    return EstimateVerdict{EstimateVerdict::Action::Skip, ""};
   }
-  return false;
+
+  if(m_cfg.downgradeSpeed > 0 && estimate.speed < m_cfg.downgradeSpeed &&
+    !m_cfg.downgradeOptions.empty())
+  {
+    // ffmpeg takes the last one of repeated options
+    cli.encSettings.commandLineParameters += " " + m_cfg.downgradeOptions;
+    cli.encSettings.preset += cli.encSettings.preset.empty() ?
+      "downgrade" :
+      "+downgrade";
+    return EstimateVerdict{EstimateVerdict::Action::Downgrade,
+      cli.encSettings.commandLineParameters};
+  }
+
+  return EstimateVerdict{EstimateVerdict::Action::Encode, ""};
 }
 
-std::string MediaArchiverDaemon::getArchivedFileName(
-  const std::string &origFileName) const
+std::string MediaArchiverDaemon::getTempFileName(
+  const std::string &fileName, uint32_t fileId) const
 {
-  auto posExt = origFileName.find_last_of('.');
-  auto newFileName = origFileName;
-  if(posExt == std::string::npos)
+  std::stringstream ss;
+  ss.imbue(std::locale::classic());
+  if(m_cfg.tempFolder == ".")
   {
-    posExt = origFileName.length();
+    ss << fileName << "." << fileId;
+  }
+  else if(m_cfg.tempFolder.empty())
+  {
+    ss << "./" << fileId;
   }
   else
   {
-    newFileName.resize(posExt);
+    ss << m_cfg.tempFolder << '/' << fileId;
   }
+  return ss.str();
+}
 
-  newFileName += m_cfg.resultFileSuffix;
-  newFileName += m_cfg.finalExtension;
-
-  return newFileName;
+void MediaArchiverDaemon::openTempFile(ConnectedClient &cli)
+{
+  cli.tempFileName =
+    getTempFileName(cli.originalFileName, cli.originalFileId);
+  cli.output = 0;
+  cli.outFile.open(cli.tempFileName, std::ios::binary | std::ios::out);
+  if(!cli.outFile.is_open())
+  {
+    throw std::runtime_error(
+      string("Could not open output temp file: ") + cli.tempFileName);
+  }
 }
 
-void MediaArchiverDaemon::prepareNewSession(ConnectedClient &cli)
+bool MediaArchiverDaemon::offerResult(
+  ConnectedClient &cli, const SpooledResult &offer)
 {
-  m_filesToMove.emplace_back(
-    FileToMove{.result = EncodedFile(cli.encResult, cli.originalFileId,
-                 getArchivedFileName(cli.originalFileName)),
-      .tmp = cli.tempFileName,
-      .atime = cli.times[0],
-      .mtime = cli.times[1]});
+  if(cli.inFile.is_open() || cli.outFile.is_open())
+  {
+    throw std::runtime_error("The session is already processing a file");
+  }
 
-  LOG_F(2, "prepare session after #%u %s", cli.originalFileId,
-    cli.encResult.result == EncodedFile::EncodingResult::OK ? "SUCCEEDED" :
-                                                              "FAILED");
-  // preparing the next file transfer
-  cli.originalFileId = 0;
-  cli.tempFileName = "";
-  cli.originalFileName = "";
-  cli.encSettings = MediaEncoderSettings{.fileLength = 0};
-  cli.encResult = EncodingResultInfo();
-  cli.inFile = ifstream();
-  cli.outFile = ofstream();
-  memset(cli.times, 0, sizeof(cli.times));
+  if(m_stopRequested ||
+    offer.result.result != EncodingResultInfo::EncodingResult::OK ||
+    !offer.result.fileLength)
+  {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lck(m_mtxFileMove);
+    for(auto conn = m_connections.begin(); conn != m_connections.end();)
+    {
+      const auto &other = conn->second;
+      if(&other == &cli || other.originalFileId != offer.jobId)
+      {
+        ++conn;
+      }
+      else if(other.token != offer.token)
+      {
+        LOG_F(WARNING, "offerResult: job %u is processed by another client",
+          offer.jobId);
+        return false;
+      }
+      else
+      {
+        // the client gave up the session the job was received in
+        LOG_F(1, "offerResult: dropping stale session of job %u",
+          offer.jobId);
+        conn = m_connections.erase(conn);
+      }
+    }
+  }
+
+  BasicFileInfo fi;
+  if(!m_db.reserveFile(offer.jobId, fi))
+  {
+    LOG_F(INFO, "offerResult: job %u is unknown or already archived",
+      offer.jobId);
+    return false;
+  }
+
+  // the result is only valid for the file it was encoded from
+  bool valid = false;
+  try
+  {
+    FileCopier().getFileTimes(fi.fileName.c_str(), cli.times);
+    valid = FileCopier().getFileSize(fi.fileName.c_str()) ==
+        offer.sourceLength &&
+      static_cast<uint64_t>(cli.times[1].tv_sec) == offer.sourceTime &&
+      getSettingsHash() == offer.settingsHash;
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(ERROR, "offerResult: %s", e.what());
+  }
+
+  if(!valid)
+  {
+    LOG_F(INFO, "offerResult: source or settings of job %u (%s) changed",
+      offer.jobId, fi.fileName.c_str());
+    m_db.reset(offer.jobId);
+    return false;
+  }
+
+  cli.originalFileId = offer.jobId;
+  cli.cancelled = false;
+  cli.parentId = m_db.getParent(offer.jobId);
+  cli.originalFileName = fi.fileName;
+  cli.encSettings.fileLength = fi.fileSize;
+  cli.encResult = offer.result;
+  // the spool of the client keeps the archive only
+  cli.encResult.renditionLengths.clear();
+  cli.encSettings.settingsHash = offer.settingsHash;
+  openTempFile(cli);
+  LOG_F(INFO, "Taking over result of job %u (%s)", offer.jobId,
+    fi.fileName.c_str());
+  return true;
+}
+
+bool MediaArchiverDaemon::writeChunk(const std::vector<char> &data)
+{
+  auto &cli = checkClient();
+  if(dropCancelledJob(cli))
+    throw std::runtime_error("writeChunk: the job was cancelled");
+
+  // the archive, then the renditions
+  const size_t length = cli.output ?
+    cli.encResult.renditionLengths[cli.output - 1] :
+    cli.encResult.fileLength;
+  if(!cli.originalFileId || !cli.outFile.is_open() || !length ||
+    cli.outFile.bad() ||
+    static_cast<size_t>(cli.outFile.tellp()) + data.size() > length)
+  {
+    LOG_F(ERROR,
+      "writeChunk: state: id=%u, outFile=%s, resultLength=%lu, overrun=%i",
+      cli.originalFileId, cli.outFile.is_open() ? "OPEN" : "CLOSED",
+      length,
+      static_cast<size_t>(cli.outFile.tellp()) + data.size() > length);
+
+    throw std::runtime_error("writeChunk: invalid state");
+  }
+
+  cli.outFile.write(data.data(), data.size());
+  if(cli.outFile.tellp() < length)
+  {
+    // copying not finished yet
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lck(m_mtxFileMove);
+    cli.outFile.close();
+    FileCopier().setFileTimes(cli.output ?
+        getRenditionTempName(cli, cli.output - 1).c_str() :
+        cli.tempFileName.c_str(),
+      cli.times);
+
+    // each rendition follows in a stream of its own
+    if(openNextRendition(cli))
+      return true;
+    LOG_F(INFO, "writeChunk: Copying finished, file can be moved");
+
+    // add file to queue for moving it to place in main thread
+    prepareNewSession(cli);
+
+    // send signal to main loop to start moving file...
+    m_cv.notify_all();
+  }
+  return false;
+}
+
+std::string MediaArchiverDaemon::getArchivedFileName(
+  const std::string &origFileName) const
+{
+  auto posExt = origFileName.find_last_of('.');
+  auto newFileName = origFileName;
+  if(posExt == std::string::npos)
+  {
+    posExt = origFileName.length();
+  }
+  else
+  {
+    newFileName.resize(posExt);
+  }
+
+  newFileName += m_cfg.resultFileSuffix;
+  newFileName += m_cfg.finalExtension;
+
+  return newFileName;
+}
+
+std::string MediaArchiverDaemon::getRenditionFileName(
+  const std::string &origFileName, const Rendition &rendition) const
+{
+  const auto slash = origFileName.find_last_of('/');
+  const auto dot = origFileName.find_last_of('.');
+  const size_t nameStart = slash == std::string::npos ? 0 : slash + 1;
+  const size_t nameEnd =
+    dot == std::string::npos || dot < nameStart ? origFileName.size() : dot;
+
+  std::string fileName = rendition.folder == "." ?
+    origFileName.substr(0, nameEnd) :
+    rendition.folder + "/" +
+      origFileName.substr(nameStart, nameEnd - nameStart);
+  return fileName + "." + rendition.name + rendition.extension;
+}
+
+std::string MediaArchiverDaemon::getRenditionTempName(
+  const ConnectedClient &cli, size_t rendition) const
+{
+  return cli.tempFileName + "." +
+    cli.encSettings.renditions[rendition].name;
+}
+
+bool MediaArchiverDaemon::openNextRendition(ConnectedClient &cli)
+{
+  // the ones the client could not produce are skipped
+  const auto &lengths = cli.encResult.renditionLengths;
+  size_t next = cli.output;
+  while(next < lengths.size() && !lengths[next])
+    next++;
+  if(next >= lengths.size())
+    return false;
+
+  cli.output = next + 1;
+  const auto tmp = getRenditionTempName(cli, next);
+  cli.outFile.open(tmp, std::ios::binary | std::ios::out);
+  if(!cli.outFile.is_open())
+  {
+    throw std::runtime_error(
+      string("Could not open rendition temp file: ") + tmp);
+  }
+  LOG_F(2, "Receiving rendition %s of file %u",
+    cli.encSettings.renditions[next].name.c_str(), cli.originalFileId);
+  return true;
+}
+
+void MediaArchiverDaemon::moveRenditions(
+  const FileToMove &ftm, bool archived)
+{
+  for(const auto &r: ftm.renditions)
+  {
+    if(!archived)
+    {
+      remove(r.tmp.c_str());
+      continue;
+    }
+
+    try
+    {
+      FileCopier().moveFile(r.tmp.c_str(), r.fileName.c_str(), &ftm.mtime);
+      LOG_F(1, "Rendition '%s' of file %u was moved to place",
+        r.fileName.c_str(), ftm.result.originalFileId);
+    }
+    catch(const std::exception &e)
+    {
+      LOG_F(ERROR, "Rendition '%s' of file %u: %s", r.fileName.c_str(),
+        ftm.result.originalFileId, e.what());
+      remove(r.tmp.c_str());
+    }
+  }
+}
+
+std::string MediaArchiverDaemon::getCommandLineParameters() const
+{
+  stringstream ss;
+  ss << "-y -hide_banner -nostats -loglevel warning -copyts -map_metadata 0 -movflags use_metadata_tags -c:v "
+     << m_cfg.vCodec;
+  if(m_cfg.vBitRate >= 0)
+  {
+    ss << " -b:v " << to_string(m_cfg.vBitRate);
+  }
+  if(m_cfg.crf >= 0)
+  {
+    ss << " -crf " << m_cfg.crf;
+  }
+  if(m_cfg.aBitRate >= 0)
+  {
+    ss << " -b:a " << to_string(m_cfg.aBitRate);
+  }
+  ss << " -c:a " << m_cfg.aCodec;
+  return ss.str();
+}
+
+std::string MediaArchiverDaemon::getRemuxParameters() const
+{
+  return "-y -hide_banner -nostats -loglevel warning -copyts -map_metadata 0 -movflags use_metadata_tags -c copy";
+}
+
+const PresetTier *MediaArchiverDaemon::getPresetTier()
+{
+  if(m_cfg.presetTiers.empty())
+    return nullptr;
+
+  // the tier of the highest backlog reached
+  const double backlog = m_scheduler.getBacklogHours();
+  const PresetTier *tier = nullptr;
+  for(const auto &t: m_cfg.presetTiers)
+  {
+    if(t.backlogHours <= backlog &&
+      (!tier || t.backlogHours > tier->backlogHours))
+    {
+      tier = &t;
+    }
+  }
+
+  LOG_F(1, "Backlog of %.1f h per slot: preset %s", backlog,
+    tier ? tier->name.c_str() : "default");
+  return tier;
+}
+
+bool MediaArchiverDaemon::isRemuxable(const BasicFileInfo &file) const
+{
+  MediaInfo info;
+  if(!m_probe.isEnabled() || !m_probe.probe(file.fileName, info) ||
+    !m_probe.isRemuxable(info))
+  {
+    return false;
+  }
+
+  LOG_F(INFO, "%s is remuxed (%s/%s, %i kb/s)", file.fileName.c_str(),
+    info.videoCodec.c_str(), info.audioCodec.c_str(),
+    info.videoBitRate ? info.videoBitRate : info.bitRate);
+  return true;
+}
+
+void MediaArchiverDaemon::indexMediaHeader(
+  uint32_t srcFileId, const std::string &fileName, bool refresh)
+{
+  MediaDetails details;
+  if(!refresh && m_db.getMediaDetails(srcFileId, details))
+    return;
+
+  if(MediaHeaderParser::parse(fileName, details))
+  {
+    LOG_F(5, "%s: %.1f s, %s %ix%i, %s, %i kb/s", fileName.c_str(),
+      details.duration, details.videoCodec.c_str(), details.width,
+      details.height, details.audioCodec.c_str(), details.bitRate);
+  }
+  else
+  {
+    // remembered as unknown, so it is not read again on every start
+    LOG_F(4, "No media header found in %s", fileName.c_str());
+    details = MediaDetails{-1.0, "", "", 0, 0, 0};
+  }
+  m_db.setMediaDetails(srcFileId, details);
+}
+
+void MediaArchiverDaemon::indexFingerprint(
+  uint32_t srcFileId, const std::string &fileName, bool refresh)
+{
+  SourceFingerprint fp;
+  if(!refresh && m_db.getFingerprint(srcFileId, fp))
+    return;
+
+  if(FileFingerprint::read(fileName, fp))
+    m_db.setFingerprint(srcFileId, fp);
+  else
+    LOG_F(4, "Could not fingerprint %s", fileName.c_str());
+}
+
+bool MediaArchiverDaemon::checkFileChange(
+  uint32_t srcFileId, const std::string &fileName, size_t size)
+{
+  timespec times[2];
+  try
+  {
+    FileCopier().getFileTimes(fileName.c_str(), times);
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(WARNING, "checkFileChange: %s", e.what());
+    return false;
+  }
+
+  if(!m_db.updateFileStat(srcFileId, size, times[1].tv_sec))
+    return false;
+
+  LOG_F(INFO, "File %u (%s) changed, it is encoded again", srcFileId,
+    fileName.c_str());
+  cancelJobs(srcFileId);
+  return true;
+}
+
+bool MediaArchiverDaemon::startSettling(uint32_t srcFileId,
+  const std::string &fileName, size_t size,
+  IFileSystemChangeListener::EventType e, bool isNew)
+{
+  if(m_cfg.settleTime <= 0)
+    return false;
+
+  timespec times[2];
+  try
+  {
+    FileCopier().getFileTimes(fileName.c_str(), times);
+  }
+  catch(const std::exception &ex)
+  {
+    LOG_F(WARNING, "startSettling: %s", ex.what());
+    return false;
+  }
+
+  if(e == IFileSystemChangeListener::EventType::FileDiscovered &&
+    time(nullptr) - times[1].tv_sec >= m_cfg.settleTime)
+  {
+    return false;
+  }
+
+  // jobs of the old content are stale already, a new file may have been
+  // handed out before it was held
+  m_db.setSettling(srcFileId, true);
+  if(m_db.updateFileStat(srcFileId, size, times[1].tv_sec) || isNew)
+    cancelJobs(srcFileId);
+
+  std::lock_guard<std::mutex> lck(m_mtxSettle);
+  LOG_F(4, "File %u (%s) is settling, %lu files", srcFileId,
+    fileName.c_str(), m_settling.size() + 1);
+  m_settling.add(
+    SettleWheel::Entry{srcFileId, fileName, size, times[1].tv_sec});
+  return true;
+}
+
+void MediaArchiverDaemon::settleMain()
+{
+  loguru::set_thread_name("settle");
+  auto next = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lck(m_mtxSettle);
+  while(!m_stopRequested)
+  {
+    next += std::chrono::seconds(1);
+    while(!m_stopRequested &&
+      m_cvSettle.wait_until(lck, next) != std::cv_status::timeout)
+    {
+    }
+    if(m_stopRequested)
+      break;
+
+    const auto due = m_settling.tick();
+    lck.unlock();
+    for(const auto &file: due)
+    {
+      try
+      {
+        checkSettled(file);
+      }
+      catch(const std::exception &e)
+      {
+        LOG_F(ERROR, "Settling file %u: %s", file.id, e.what());
+      }
+    }
+    lck.lock();
+  }
+}
+
+void MediaArchiverDaemon::checkSettled(const SettleWheel::Entry &file)
+{
+  auto entry = file;
+  timespec times[2];
+  try
+  {
+    entry.fileSize = FileCopier().getFileSize(file.fileName.c_str());
+    FileCopier().getFileTimes(file.fileName.c_str(), times);
+    entry.mtime = times[1].tv_sec;
+  }
+  catch(const std::exception &)
+  {
+    // renamed while it was settling, a deleted one is purged already
+    BasicFileInfo moved;
+    if(m_db.getFile(file.id, moved) && moved.fileName != file.fileName)
+    {
+      std::lock_guard<std::mutex> lck(m_mtxSettle);
+      m_settling.add(SettleWheel::Entry{file.id, moved.fileName, 0, 0});
+    }
+    else
+      m_db.setSettling(file.id, false);
+    return;
+  }
+
+  if(entry.fileSize != file.fileSize || entry.mtime != file.mtime)
+  {
+    LOG_F(4, "File %u (%s) is still being written", file.id,
+      file.fileName.c_str());
+    std::lock_guard<std::mutex> lck(m_mtxSettle);
+    m_settling.add(entry);
+    return;
+  }
+
+  LOG_F(1, "File %u (%s) settled at %lu bytes", file.id,
+    file.fileName.c_str(), entry.fileSize);
+  m_db.updateFileStat(file.id, entry.fileSize, entry.mtime);
+  m_db.setSettling(file.id, false);
+  indexSource(file.id, file.fileName, entry.fileSize, true, nullptr);
+}
+
+void MediaArchiverDaemon::indexSource(uint32_t srcFileId,
+  const std::string &fileName, size_t size, bool refresh,
+  const SourceFingerprint *fp)
+{
+  refresh = checkFileChange(srcFileId, fileName, size) || refresh;
+  indexMediaHeader(srcFileId, fileName, refresh);
+  if(fp)
+    m_db.setFingerprint(srcFileId, *fp);
+  else
+    indexFingerprint(srcFileId, fileName, refresh);
+
+  ArchiveInfo archive;
+  if(!m_db.getArchive(srcFileId, archive))
+    takeTwinArchive(srcFileId);
+}
+
+void MediaArchiverDaemon::removeCatalogPath(const std::string &fileName)
+{
+  if(isArchive(fileName))
+  {
+    const auto id = m_db.removeArchive(fileName);
+    if(!id)
+      return;
+
+    // the source is encoded again unless it is gone as well
+    BasicFileInfo src;
+    LOG_F(INFO, "Archive of file %u was deleted: %s", id, fileName.c_str());
+    if(m_db.getFile(id, src) && access(src.fileName.c_str(), F_OK) != 0)
+      m_db.removeFile(id);
+    return;
+  }
+
+  const auto id = m_db.getFileId(fileName);
+  if(!id)
+    return;
+
+  cancelJobs(id);
+  if(m_db.removeFile(id))
+    LOG_F(INFO, "File %u was deleted: %s", id, fileName.c_str());
+  else
+    LOG_F(1, "File %u was deleted, its row is kept: %s", id,
+      fileName.c_str());
+}
+
+void MediaArchiverDaemon::removeCatalogDirectory(const std::string &folder)
+{
+  const auto ids = m_db.removeDirectory(folder);
+  for(const auto id: ids)
+    cancelJobs(id);
+  LOG_F(INFO, "Folder %s was moved away with %lu files", folder.c_str(),
+    ids.size());
+}
+
+void MediaArchiverDaemon::cancelJobs(uint32_t srcFileId)
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtxFileMove);
+    for(auto &conn: m_connections)
+    {
+      auto &cli = conn.second;
+      if(!cli.originalFileId ||
+        (cli.originalFileId != srcFileId && cli.parentId != srcFileId))
+      {
+        continue;
+      }
+      // dropped by the next call of the client
+      LOG_F(INFO, "Cancelling job %u of %s", cli.originalFileId,
+        getClientName(cli).c_str());
+      cli.cancelled = true;
+    }
+
+    // results of the old content
+    std::deque<FileToMove> keep;
+    for(const auto &ftm: m_filesToMove)
+    {
+      if(ftm.result.originalFileId != srcFileId &&
+        ftm.parentId != srcFileId)
+      {
+        keep.push_back(ftm);
+      }
+      else if(!ftm.copy)
+      {
+        remove(ftm.tmp.c_str());
+        for(const auto &r: ftm.renditions)
+          remove(r.tmp.c_str());
+      }
+    }
+    m_filesToMove.swap(keep);
+  }
+
+  // split again if it is retried
+  const auto segments = m_db.getSegments(srcFileId);
+  if(!segments.empty())
+  {
+    MediaSegmenter::removeFiles(segments);
+    m_db.removeSegments(srcFileId);
+  }
+}
+
+bool MediaArchiverDaemon::moveCatalogPaths(
+  const std::string &src, const std::string &dst, bool directory)
+{
+  if(directory)
+  {
+    const auto moved = m_db.moveDirectory(src, dst);
+    LOG_F(INFO, "Folder %s moved to %s with %lu files", src.c_str(),
+      dst.c_str(), moved);
+  }
+  else
+  {
+    const auto id = m_db.moveFile(src, dst);
+    if(!id)
+      return false;
+    LOG_F(
+      INFO, "File %u moved from %s to %s", id, src.c_str(), dst.c_str());
+  }
+
+  // running jobs look up the new place when their result arrives, see
+  // prepareNewSession
+  return true;
+}
+
+bool MediaArchiverDaemon::adoptMovedFile(const std::string &fileName,
+  const SourceFingerprint &fp, size_t size)
+{
+  for(const auto id: m_db.findFiles(fp, size))
+  {
+    // hard links and copies are still at their place
+    BasicFileInfo old;
+    if(!m_db.getFile(id, old) || access(old.fileName.c_str(), F_OK) == 0)
+      continue;
+
+    LOG_F(INFO, "File %u was moved to %s while it was not watched", id,
+      fileName.c_str());
+    return moveCatalogPaths(old.fileName, fileName, false);
+  }
+  return false;
+}
+
+bool MediaArchiverDaemon::takeTwinArchive(uint32_t srcFileId)
+{
+  ArchiveInfo archive;
+  const auto twin = m_db.findArchivedTwin(srcFileId);
+  if(!twin || !m_db.getArchive(twin, archive))
+    return false;
+
+  BasicFileInfo src;
+  size_t size = 0;
+  timespec times[2];
+  try
+  {
+    size = FileCopier().getFileSize(archive.fileName.c_str());
+    if(!m_db.getFile(srcFileId, src))
+      return false;
+    FileCopier().getFileTimes(src.fileName.c_str(), times);
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(WARNING, "takeTwinArchive: %s", e.what());
+    return false;
+  }
+
+  // not handed out to a client while it is copied
+  if(!size || !m_db.reserveFile(srcFileId, src))
+    return false;
+
+  LOG_F(INFO, "File %u (%s) is a copy of %u, taking over its archive",
+    srcFileId, src.fileName.c_str(), twin);
+  EncodedFile result(
+    EncodingResultInfo(EncodingResultInfo::EncodingResult::OK, size, ""),
+    srcFileId, getArchivedFileName(src.fileName));
+  result.remux = archive.remux;
+  result.preset = archive.preset;
+  result.settings = archive.settings;
+
+  std::lock_guard<std::mutex> lck(m_mtxFileMove);
+  m_filesToMove.emplace_back(FileToMove{.result = result,
+    .tmp = archive.fileName,
+    .atime = times[0],
+    .mtime = times[1],
+    .parentId = 0,
+    .copy = true});
+  m_cv.notify_all();
+  return true;
+}
+
+uint32_t MediaArchiverDaemon::getSettingsHash() const
+{
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  const auto add = [&hash](const std::string &s) {
+    // including the terminating zero to separate the strings
+    for(size_t i = 0; i <= s.size(); i++)
+    {
+      hash ^= static_cast<unsigned char>(s[i]);
+      hash *= 16777619u;
+    }
+  };
+
+  add(getCommandLineParameters());
+  add(m_cfg.finalExtension);
+  return hash;
+}
+
+bool MediaArchiverDaemon::queueReencode()
+{
+  if(!m_reencode)
+    return false;
+
+  std::lock_guard<std::mutex> lck(m_mtxReencode);
+  // the skipped ones may still be the first ones
+  const auto ids = m_db.getOutdatedArchives(
+    getSettingsHash(), m_reencodeOrder, m_notReencodable.size() + 1);
+  for(const auto id: ids)
+  {
+    if(m_notReencodable.count(id))
+      continue;
+
+    BasicFileInfo src;
+    bool exists = false;
+    try
+    {
+      exists = m_db.getFile(id, src) &&
+        FileCopier().getFileSize(src.fileName.c_str()) > 0;
+    }
+    catch(const std::exception &e)
+    {
+      LOG_F(1, "queueReencode: %s", e.what());
+    }
+
+    if(!exists)
+    {
+      LOG_F(WARNING, "Archive of file %u is outdated, its source is gone",
+        id);
+      m_notReencodable.insert(id);
+      continue;
+    }
+
+    LOG_F(INFO,
+      "Encoding file %u (%s) again, its archive was made with other settings",
+      id, src.fileName.c_str());
+    m_db.reset(id);
+    return true;
+  }
+  return false;
+}
+
+bool MediaArchiverDaemon::isSplitCandidate(
+  uint32_t fileId, const BasicFileInfo &file)
+{
+  if(!m_segmenter.isSegmentable(file))
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lck(m_mtxSegments);
+    if(m_unsplittable.count(fileId))
+      return false;
+  }
+
+  // segments are never split again
+  return m_db.getParent(fileId) == 0;
+}
+
+void MediaArchiverDaemon::queueSegmentTask(const SegmentTask &task)
+{
+  std::lock_guard<std::mutex> lck(m_mtxSegments);
+  for(const auto &t: m_segmentTasks)
+  {
+    if(t.kind == task.kind && t.fileId == task.fileId)
+      return;
+  }
+
+  LOG_F(1, "%s file %u queued", task.kind == SegmentTask::Kind::Split ?
+      "Splitting" : "Joining", task.fileId);
+  m_segmentTasks.push_back(task);
+  m_cvSegments.notify_all();
+}
+
+void MediaArchiverDaemon::segmentMain()
+{
+  loguru::set_thread_name("segmenter");
+  std::unique_lock<std::mutex> lck(m_mtxSegments);
+  while(true)
+  {
+    m_cvSegments.wait(lck,
+      [this]() { return m_stopRequested || !m_segmentTasks.empty(); });
+    if(m_stopRequested)
+      break;
+
+    const auto task = m_segmentTasks.front();
+    m_segmentTasks.pop_front();
+    lck.unlock();
+
+    try
+    {
+      if(task.kind == SegmentTask::Kind::Split)
+        splitFile(task);
+      else
+        joinSegments(task.fileId);
+    }
+    catch(const std::exception &e)
+    {
+      LOG_F(ERROR, "Segmenting file %u: %s", task.fileId, e.what());
+    }
+    lck.lock();
+  }
+
+  // splits not done yet are handed out again after the restart, joins are
+  // picked up by start()
+  for(const auto &task: m_segmentTasks)
+  {
+    if(task.kind == SegmentTask::Kind::Split)
+      m_db.reset(task.fileId);
+  }
+  m_segmentTasks.clear();
+}
+
+void MediaArchiverDaemon::splitFile(const SegmentTask &task)
+{
+  std::vector<BasicFileInfo> segments;
+  try
+  {
+    segments = m_segmenter.split(
+      task.fileName, getTempFileName(task.fileName, task.fileId));
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(ERROR, "Could not split file %u (%s): %s", task.fileId,
+      task.fileName.c_str(), e.what());
+  }
+
+  if(segments.size() < 2)
+  {
+    // encoded as a whole by a single client
+    for(const auto &s: segments)
+      remove(s.fileName.c_str());
+
+    {
+      std::lock_guard<std::mutex> lck(m_mtxSegments);
+      m_unsplittable.insert(task.fileId);
+    }
+    m_db.reset(task.fileId);
+    return;
+  }
+
+  m_db.addSegments(task.fileId, segments);
+}
+
+void MediaArchiverDaemon::checkSegments(uint32_t fileId)
+{
+  const auto segments = m_db.getSegments(fileId);
+  if(segments.empty())
+    return;
+
+  bool done = true;
+  for(const auto &s: segments)
+  {
+    if(s.status == EncodingResultInfo::EncodingResult::NoGain)
+    {
+      stringstream ss;
+      ss << "Segment " << s.index << " is not worth encoding";
+      dropSegments(fileId, segments, ss.str(),
+        EncodingResultInfo::EncodingResult::NoGain);
+      return;
+    }
+    // quarantined by the retry policy
+    if(s.status <= EncodingResultInfo::EncodingResult::PermanentError)
+    {
+      stringstream ss;
+      ss << "Encoding segment " << s.index << " failed " << s.count
+         << " times";
+      dropSegments(fileId, segments, ss.str());
+      return;
+    }
+    done = done && s.status >= EncodingResultInfo::EncodingResult::OK;
+  }
+
+  if(done)
+  {
+    queueSegmentTask(SegmentTask{SegmentTask::Kind::Join, fileId, ""});
+  }
+}
+
+void MediaArchiverDaemon::joinSegments(uint32_t fileId)
+{
+  BasicFileInfo src;
+  const auto segments = m_db.getSegments(fileId);
+  if(segments.empty() || !m_db.getFile(fileId, src))
+    return;
+
+  std::vector<std::string> parts;
+  for(const auto &s: segments)
+  {
+    if(s.status < EncodingResultInfo::EncodingResult::OK)
+      return;
+    parts.push_back(s.archiveName);
+  }
+
+  const auto tmp = getTempFileName(src.fileName, fileId);
+  struct timespec times[2];
+  size_t size = 0;
+  try
+  {
+    m_segmenter.join(parts, src.fileName, tmp);
+    size = FileCopier().getFileSize(tmp.c_str());
+    FileCopier().getFileTimes(src.fileName.c_str(), times);
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(ERROR, "Could not join the segments of file %u (%s): %s", fileId,
+      src.fileName.c_str(), e.what());
+    remove(tmp.c_str());
+    dropSegments(fileId, segments, e.what());
+    return;
+  }
+
+  LOG_F(INFO, "Segments of file %u (%s) joined", fileId,
+    src.fileName.c_str());
+  {
+    // verified like a result received from a client
+    std::lock_guard<std::mutex> lck(m_mtxFileMove);
+    const EncodingResultInfo joined(
+      EncodingResultInfo::EncodingResult::OK, size, "");
+    EncodedFile result(joined, fileId, getArchivedFileName(src.fileName));
+    result.settings = getSettingsHash();
+    m_filesToMove.emplace_back(FileToMove{.result = result,
+      .tmp = tmp,
+      .atime = times[0],
+      .mtime = times[1],
+      .parentId = 0});
+    m_cv.notify_all();
+  }
+
+  MediaSegmenter::removeFiles(segments);
+  m_db.removeSegments(fileId);
+}
+
+void MediaArchiverDaemon::dropSegments(uint32_t fileId,
+  const std::vector<SegmentInfo> &segments, const std::string &error,
+  EncodingResultInfo::EncodingResult result)
+{
+  LOG_F(ERROR, "Giving up the segments of file %u: %s", fileId,
+    error.c_str());
+
+  // the whole file is split again if it is retried
+  m_db.addEncodedFile(
+    EncodedFile(EncodingResultInfo(result, 0, error), fileId));
+  MediaSegmenter::removeFiles(segments);
+  m_db.removeSegments(fileId);
+}
+
+void MediaArchiverDaemon::prepareNewSession(ConnectedClient &cli)
+{
+  // the source may have been moved while it was encoded
+  BasicFileInfo src;
+  const auto srcName = m_db.getFile(cli.originalFileId, src) ?
+    src.fileName :
+    cli.originalFileName;
+
+  // encoded segments wait next to their source for being joined
+  const auto archiveName = cli.parentId ?
+    MediaSegmenter::getSegmentResultName(srcName) :
+    getArchivedFileName(srcName);
+
+  EncodedFile result(cli.encResult, cli.originalFileId, archiveName);
+  result.remux = cli.remux;
+  result.preset = cli.encSettings.preset;
+  result.settings = cli.encSettings.settingsHash;
+
+  // received completely along with the archive
+  std::vector<RenditionFile> renditions;
+  const auto &lengths = cli.encResult.renditionLengths;
+  for(size_t i = 0; i < lengths.size() && i < m_cfg.renditions.size(); i++)
+  {
+    if(!lengths[i] ||
+      cli.encResult.result != EncodingResultInfo::EncodingResult::OK)
+    {
+      continue;
+    }
+    renditions.push_back(RenditionFile{getRenditionTempName(cli, i),
+      getRenditionFileName(srcName, m_cfg.renditions[i])});
+  }
+
+  m_filesToMove.emplace_back(FileToMove{.result = result,
+    .tmp = cli.tempFileName,
+    .atime = cli.times[0],
+    .mtime = cli.times[1],
+    .parentId = cli.parentId,
+    .renditions = renditions});
+
+  LOG_F(2, "prepare session after #%u %s", cli.originalFileId,
+    cli.encResult.result == EncodedFile::EncodingResult::OK ? "SUCCEEDED" :
+                                                              "FAILED");
+  // preparing the next file transfer
+  clearJob(cli);
 }
 
 ConnectedClient &MediaArchiverDaemon::checkClient()
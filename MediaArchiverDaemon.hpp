@@ -13,12 +13,18 @@
 #include <chrono>
 #include <atomic>
 #include <deque>
+#include <set>
+#include <memory>
 #include <condition_variable>
 
 #include "IMediaArchiverServer.hpp"
 #include "MediaArchiverDaemonConfig.hpp"
 #include "IFileSystemChangeListener.hpp"
 #include "IDatabase.hpp"
+#include "MediaSegmenter.hpp"
+#include "MediaProbe.hpp"
+#include "JobScheduler.hpp"
+#include "SettleWheel.hpp"
 #include "rpc/server.h"
 
 namespace MediaArchiver
@@ -29,21 +35,52 @@ struct ConnectedClient
   MediaEncoderSettings encSettings;
   EncodingResultInfo encResult;
   uint32_t originalFileId;
+  uint32_t parentId = 0; ///< source file the job is a segment of
+  bool remux = false;    ///< the streams are copied instead of encoded
   std::string originalFileName;
   std::string tempFileName;
   std::chrono::steady_clock::time_point lastActivity;
+  /** the job was handed out, unset if taken over from an earlier session */
+  std::chrono::steady_clock::time_point started;
   std::string token;
+  /** the source changed or was deleted, the job is dropped */
+  bool cancelled = false;
+  /** output being received, 0: the archive, n: rendition n - 1 */
+  size_t output = 0;
   std::ifstream inFile;
   std::ofstream outFile;
   struct timespec times[2];
 };
 
+struct RenditionFile
+{
+  std::string tmp;      ///< as received
+  std::string fileName; ///< destination
+};
+
 struct FileToMove
 {
   const EncodedFile result;
   const std::string tmp;
   struct timespec atime;
   struct timespec mtime;
+  const uint32_t parentId;
+  const bool copy = false; ///< tmp is the archive of a twin, it is kept
+  /** moved along with the archive only */
+  const std::vector<RenditionFile> renditions = {};
+};
+
+struct SegmentTask
+{
+  enum class Kind
+  {
+    Split, ///< cut the source file into segments
+    Join,  ///< concatenate the encoded segments
+  };
+
+  Kind kind;
+  uint32_t fileId;
+  std::string fileName;
 };
 
 class MediaArchiverDaemon : public IFileSystemChangeListener
@@ -58,6 +95,24 @@ private:
   std::mutex m_mtxFileMove;
   std::deque<FileToMove> m_filesToMove;
   std::condition_variable m_cv;
+  MediaSegmenter m_segmenter;
+  MediaProbe m_probe;
+  JobScheduler m_scheduler;
+  std::mutex m_mtxSegments;
+  std::condition_variable m_cvSegments;
+  std::deque<SegmentTask> m_segmentTasks;
+  std::set<uint32_t> m_unsplittable;
+  std::unique_ptr<std::thread> m_segmentThread;
+  bool m_reencode;
+  ReencodeOrder m_reencodeOrder;
+  std::mutex m_mtxReencode;
+  // outdated archives whose source is gone
+  std::set<uint32_t> m_notReencodable;
+  // files still being written, one tick per second
+  SettleWheel m_settling;
+  std::mutex m_mtxSettle;
+  std::condition_variable m_cvSettle;
+  std::unique_ptr<std::thread> m_settleThread;
 
 public:
   MediaArchiverDaemon(const DaemonConfig &cfg, IDatabase &db);
@@ -79,12 +134,151 @@ protected:
   void authenticate(const std::string &token);
   void reset();
   void abort();
+  /** forget the job of the session, the files are closed */
+  void clearJob(ConnectedClient &cli);
+  /**
+   * @brief drop the job of the session if it was cancelled, the temp file
+   * of its result is removed
+   *
+   * @return true the job was cancelled
+   */
+  bool dropCancelledJob(ConnectedClient &cli);
   bool getNextFile(ConnectedClient &cli,
     const MediaFileRequirements &filter, MediaEncoderSettings &settings);
   bool readChunk(DataChunk &chunk);
   void postFile(const EncodingResultInfo &result);
+  /**
+   * @brief take over a result the client encoded in an earlier session if
+   * the source file and the settings did not change since
+   *
+   * @return true the result is expected through writeChunk
+   */
+  bool offerResult(ConnectedClient &cli, const SpooledResult &offer);
+  /**
+   * @brief decide on the job of the session by its trial encodes: skip it
+   * if it saves too little space or use faster settings if it is too slow
+   */
+  EstimateVerdict reportEstimate(
+    ConnectedClient &cli, const EncodeEstimate &estimate);
   bool writeChunk(const std::vector<char> &data);
   std::string getArchivedFileName(const std::string &origFileName) const;
+  /** e.g. folder/movie.preview.mp4 for movie.ts */
+  std::string getRenditionFileName(
+    const std::string &origFileName, const Rendition &rendition) const;
+  std::string getRenditionTempName(
+    const ConnectedClient &cli, size_t rendition) const;
+  bool isRendition(const std::string &fileName) const;
+  /**
+   * @brief open the temp file of the next rendition the client sends
+   *
+   * @return false all of them have been received
+   */
+  bool openNextRendition(ConnectedClient &cli);
+  /** put the renditions of a result into place, or drop them */
+  void moveRenditions(const FileToMove &ftm, bool archived);
+  std::string getCommandLineParameters() const;
+  /** options copying the streams into the archive container */
+  std::string getRemuxParameters() const;
+  /** faster encoder options for a larger backlog, nullptr: default */
+  const PresetTier *getPresetTier();
+  /** do the streams of the file already meet the archive policy */
+  bool isRemuxable(const BasicFileInfo &file) const;
+  /**
+   * @brief read the container header of a source file into the catalog
+   *
+   * @param refresh read it again even if it is already indexed
+   */
+  void indexMediaHeader(
+    uint32_t srcFileId, const std::string &fileName, bool refresh);
+  /**
+   * @brief rewrite the catalog after a file or a folder was moved
+   *
+   * @return false the file is not catalogued
+   */
+  bool moveCatalogPaths(
+    const std::string &src, const std::string &dst, bool directory);
+  /**
+   * @brief take over the row of a source with the same content and inode
+   * whose old path is gone, so it is not encoded again
+   */
+  bool adoptMovedFile(const std::string &fileName,
+    const SourceFingerprint &fp, size_t size);
+  /**
+   * @brief record the size and time of a source file, a changed one is
+   * encoded again
+   *
+   * @return true the file changed since it was catalogued
+   */
+  bool checkFileChange(
+    uint32_t srcFileId, const std::string &fileName, size_t size);
+  /** forget a deleted source or archive */
+  void removeCatalogPath(const std::string &fileName);
+  /** forget the sources below a folder moved out of the watched ones */
+  void removeCatalogDirectory(const std::string &folder);
+  /**
+   * @brief stop everything done for a source file that changed or is gone:
+   * the jobs of the sessions, the results not moved yet and the segments
+   */
+  void cancelJobs(uint32_t srcFileId);
+  /**
+   * @brief hold a new or rewritten source file back until it did not
+   * change for settleTime, a file found at the start is only held if it
+   * was modified within that time
+   *
+   * @return true the file is settling, it is indexed once it settled
+   */
+  bool startSettling(uint32_t srcFileId, const std::string &fileName,
+    size_t size, IFileSystemChangeListener::EventType e, bool isNew);
+  void settleMain();
+  /** hand out a file whose quiet period ended or wait again */
+  void checkSettled(const SettleWheel::Entry &file);
+  /**
+   * @brief read the header and the fingerprint of a source file that is
+   * complete, a copy of an archived file takes over its archive
+   *
+   * @param fp fingerprint read already or nullptr
+   */
+  void indexSource(uint32_t srcFileId, const std::string &fileName,
+    size_t size, bool refresh, const SourceFingerprint *fp);
+  /** hash the content of a source file to find its copies */
+  void indexFingerprint(
+    uint32_t srcFileId, const std::string &fileName, bool refresh);
+  /**
+   * @brief archive a source file by copying the archive of an identical
+   * one instead of encoding it again
+   *
+   * @return false there is no archived twin
+   */
+  bool takeTwinArchive(uint32_t srcFileId);
+  /** identifies the settings a file is encoded with */
+  uint32_t getSettingsHash() const;
+  /**
+   * @brief queue the next archive made with other settings than the
+   * current ones to be encoded again, one at a time so that new files
+   * always come first
+   *
+   * @return false no archive is outdated
+   */
+  bool queueReencode();
+  /** open the temp file receiving the result of the client */
+  void openTempFile(ConnectedClient &cli);
+  std::string getTempFileName(
+    const std::string &fileName, uint32_t fileId) const;
+  /** should the file be split instead of handed out as a whole */
+  bool isSplitCandidate(uint32_t fileId, const BasicFileInfo &file);
+  void queueSegmentTask(const SegmentTask &task);
+  void segmentMain();
+  void splitFile(const SegmentTask &task);
+  void joinSegments(uint32_t fileId);
+  /**
+   * @brief join the segments of a file once all are encoded, or give up
+   * if one of them failed too often
+   */
+  void checkSegments(uint32_t fileId);
+  void dropSegments(uint32_t fileId,
+    const std::vector<SegmentInfo> &segments, const std::string &error,
+    EncodingResultInfo::EncodingResult result =
+      EncodingResultInfo::EncodingResult::UnknownError);
   bool isArchive(const std::string &fileName) const;
   bool isInterestingFile(const std::string &fileName) const;
   /**
@@ -93,6 +287,8 @@ protected:
    */
   void prepareNewSession(ConnectedClient &cli);
   ConnectedClient &checkClient();
+  /** log the predicted cost of the pending files and when they are done */
+  void logForecast();
 };
 
 }
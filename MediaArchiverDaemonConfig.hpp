@@ -3,9 +3,31 @@
 
 #include <string>
 #include <regex>
+#include <vector>
 
 namespace MediaArchiver
 {
+/**
+ * @brief encoder options used while the backlog is at least backlogHours
+ */
+struct PresetTier
+{
+  double backlogHours; ///< work pending for each client slot
+  std::string name;    ///< recorded with the archives
+  std::string options; ///< appended to the encoder settings
+};
+
+/**
+ * @brief further output encoded together with the archive, e.g. a preview
+ */
+struct Rendition
+{
+  std::string name;      ///< added to the file name, e.g. movie.preview.mp4
+  std::string extension; ///< with the dot
+  std::string folder;    ///< destination, ".": next to the source
+  std::string options;   ///< encoder options of the output
+};
+
 struct DaemonConfig
 {
   int verbosity;
@@ -24,6 +46,46 @@ struct DaemonConfig
   std::string dbPath;
   std::string resultFileSuffix;
   std::string logFile;
+  // ffmpeg used to split long sources and to join the encoded segments
+  std::string segmenterPath;
+  // sources larger than this (MiB) are split, 0: never
+  int segmentThreshold = 0;
+  // length of the segments in seconds
+  int segmentDuration = 600;
+  // skip files whose output is estimated above this share of the source
+  // size, 0: never
+  double skipRatio = 0.0;
+  // jobs estimated slower than this (source seconds per second) are
+  // encoded with downgradeOptions, 0: never
+  double downgradeSpeed = 0.0;
+  // encoder options appended to the settings of downgraded jobs
+  std::string downgradeOptions;
+  // ffmpeg used to read the codecs of the sources
+  std::string probePath;
+  // sources in these codecs (comma separated) are remuxed, empty: never
+  std::string remuxVideoCodecs;
+  std::string remuxAudioCodecs = "aac";
+  // highest video bit rate (kb/s) of remuxed sources, 0: any
+  int remuxMaxBitRate = 0;
+  // order the files are handed out in, see createSchedulingPolicy
+  std::string schedulingPolicy = "fifo";
+  // longest a job may take (h) on a client that is not the fastest one,
+  // longer jobs wait for the fastest, 0: no limit
+  double maxJobHours = 12.0;
+  // faster presets for larger backlogs, empty: always the same settings
+  std::vector<PresetTier> presetTiers;
+  // archives made with other settings are encoded again in this order
+  // while the clients have nothing else to do: oldest, largest, smallest,
+  // none: never
+  std::string reencodeOrder = "oldest";
+  // new or rewritten files are handed out once their size and time did not
+  // change for this long (s), 0: at once
+  int settleTime = 60;
+  // first delay (s) before a failed job is handed out again, doubled with
+  // every attempt and scaled by the kind of failure, 0: at once
+  int retryDelay = 60;
+  // outputs encoded from the same decode as the archive of whole files
+  std::vector<Rendition> renditions;
 };
 }
 
@@ -0,0 +1,856 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <strings.h>
+
+#include "MediaHeaderParser.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+constexpr unsigned MaxBoxes = 1024;
+constexpr unsigned TsPacketSize = 188;
+constexpr unsigned MaxScanChunks = 4;
+constexpr size_t MaxVideoData = 64 * 1024;
+constexpr uint64_t PcrWrap = 1ull << 33;
+constexpr double PcrClock = 90000.0;
+
+uint16_t be16(const uint8_t *p)
+{
+  return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+uint32_t be32(const uint8_t *p)
+{
+  return static_cast<uint32_t>(be16(p)) << 16 | be16(p + 2);
+}
+uint64_t be64(const uint8_t *p)
+{
+  return static_cast<uint64_t>(be32(p)) << 32 | be32(p + 4);
+}
+uint16_t le16(const uint8_t *p)
+{
+  return static_cast<uint16_t>(p[1] << 8 | p[0]);
+}
+uint32_t le32(const uint8_t *p)
+{
+  return static_cast<uint32_t>(le16(p + 2)) << 16 | le16(p);
+}
+
+/** positioned reads from the file */
+class Reader
+{
+public:
+  Reader(std::istream &in, uint64_t size)
+    : m_in(in)
+    , m_size(size)
+  {
+  }
+
+  uint64_t size() const { return m_size; }
+
+  /** @return false fewer than len bytes are available at offset */
+  bool read(uint64_t offset, void *buf, size_t len)
+  {
+    if(offset + len > m_size)
+      return false;
+
+    m_in.clear();
+    m_in.seekg(static_cast<std::streamoff>(offset));
+    m_in.read(static_cast<char *>(buf), len);
+    return static_cast<size_t>(m_in.gcount()) == len;
+  }
+
+  /** up to len bytes at offset */
+  std::vector<uint8_t> read(uint64_t offset, size_t len)
+  {
+    std::vector<uint8_t> buf;
+    if(offset >= m_size)
+      return buf;
+
+    buf.resize(std::min<uint64_t>(len, m_size - offset));
+    if(!read(offset, buf.data(), buf.size()))
+      buf.clear();
+    return buf;
+  }
+
+private:
+  std::istream &m_in;
+  const uint64_t m_size;
+};
+
+/** MP4 box or RIFF chunk, LISTs are named after their list type */
+struct Box
+{
+  char type[4];
+  uint64_t begin; ///< offset of the payload
+  uint64_t end;   ///< offset behind the payload
+};
+
+bool isType(const Box &box, const char *type)
+{
+  return memcmp(box.type, type, 4) == 0;
+}
+
+std::string toLower(const char *fourcc)
+{
+  std::string s(fourcc, 4);
+  s.erase(s.find_last_not_of(' ') + 1);
+  std::transform(s.begin(), s.end(), s.begin(),
+    [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+
+struct Codec
+{
+  const char *tag;
+  const char *name;
+};
+
+/** ffmpeg name of a fourcc, the fourcc itself if unknown */
+std::string codecName(
+  const Codec *codecs, size_t count, const char *fourcc, bool ignoreCase)
+{
+  for(size_t i = 0; i < count; i++)
+  {
+    const auto tag = codecs[i].tag;
+    if(ignoreCase ? strncasecmp(tag, fourcc, 4) == 0 :
+                    strncmp(tag, fourcc, 4) == 0)
+    {
+      return codecs[i].name;
+    }
+  }
+  return toLower(fourcc);
+}
+
+// --- MP4/MOV: moov > trak > mdia > hdlr, minf > stbl > stsd
+
+const Codec Mp4Codecs[] = {{"avc1", "h264"}, {"avc3", "h264"},
+  {"hvc1", "hevc"}, {"hev1", "hevc"}, {"mp4v", "mpeg4"}, {"av01", "av1"},
+  {"vp09", "vp9"}, {"jpeg", "mjpeg"}, {"mjpa", "mjpeg"},
+  {"mp4a", "aac"}, {"ac-3", "ac3"}, {"ec-3", "eac3"}, {".mp3", "mp3"},
+  {"Opus", "opus"}, {"fLaC", "flac"}, {"sowt", "pcm_s16le"},
+  {"twos", "pcm_s16be"}};
+
+bool isMp4Box(const uint8_t *type)
+{
+  const char *types[] = {"ftyp", "moov", "mdat", "free", "skip", "wide"};
+  for(const auto t: types)
+  {
+    if(memcmp(type, t, 4) == 0)
+      return true;
+  }
+  return false;
+}
+
+/** child boxes between begin and end, only their headers are read */
+std::vector<Box> listBoxes(Reader &r, uint64_t begin, uint64_t end)
+{
+  std::vector<Box> boxes;
+  uint8_t h[16];
+  while(begin + 8 <= end && boxes.size() < MaxBoxes)
+  {
+    if(!r.read(begin, h, 8))
+      break;
+
+    Box box;
+    memcpy(box.type, h + 4, 4);
+    box.begin = begin + 8;
+    uint64_t size = be32(h);
+    if(size == 1)
+    {
+      // 64 bit size follows the type
+      if(!r.read(begin + 8, h + 8, 8))
+        break;
+      size = be64(h + 8);
+      box.begin += 8;
+    }
+    else if(size == 0)
+    {
+      // up to the end of the file
+      size = end - begin;
+    }
+
+    if(size < box.begin - begin || size > end - begin)
+      break;
+
+    box.end = begin + size;
+    boxes.push_back(box);
+    begin = box.end;
+  }
+  return boxes;
+}
+
+bool findBox(Reader &r, const Box &parent, const char *type, Box &box)
+{
+  for(const auto &b: listBoxes(r, parent.begin, parent.end))
+  {
+    if(isType(b, type))
+    {
+      box = b;
+      return true;
+    }
+  }
+  return false;
+}
+
+void parseMp4Track(Reader &r, const Box &trak, MediaDetails &d)
+{
+  Box mdia, hdlr, minf, stbl, stsd;
+  uint8_t buf[16];
+  if(!findBox(r, trak, "mdia", mdia) || !findBox(r, mdia, "hdlr", hdlr) ||
+    !r.read(hdlr.begin, buf, 12))
+  {
+    return;
+  }
+
+  // only the first track of each kind
+  const bool video = memcmp(buf + 8, "vide", 4) == 0;
+  const bool audio = memcmp(buf + 8, "soun", 4) == 0;
+  if(!(video && d.videoCodec.empty()) && !(audio && d.audioCodec.empty()))
+    return;
+
+  // version, entry count, then the first sample entry
+  if(!findBox(r, mdia, "minf", minf) || !findBox(r, minf, "stbl", stbl) ||
+    !findBox(r, stbl, "stsd", stsd) || !r.read(stsd.begin, buf, 16))
+  {
+    return;
+  }
+
+  const auto codec = codecName(Mp4Codecs,
+    sizeof(Mp4Codecs) / sizeof(Mp4Codecs[0]),
+    reinterpret_cast<const char *>(buf + 12), false);
+
+  if(audio)
+  {
+    d.audioCodec = codec;
+    return;
+  }
+
+  d.videoCodec = codec;
+  if(r.read(stsd.begin + 40, buf, 4))
+  {
+    d.width = be16(buf);
+    d.height = be16(buf + 2);
+  }
+}
+
+bool parseMp4(Reader &r, MediaDetails &d)
+{
+  const Box file{{}, 0, r.size()};
+  Box moov;
+  if(!findBox(r, file, "moov", moov))
+    return false;
+
+  for(const auto &box: listBoxes(r, moov.begin, moov.end))
+  {
+    if(isType(box, "mvhd"))
+    {
+      // version 1 has 64 bit times and duration
+      uint8_t buf[32];
+      if(!r.read(box.begin, buf, sizeof(buf)))
+        continue;
+
+      const bool v1 = buf[0] == 1;
+      const uint32_t scale = be32(buf + (v1 ? 20 : 12));
+      const uint64_t duration = v1 ? be64(buf + 24) : be32(buf + 16);
+      if(scale)
+        d.duration = static_cast<double>(duration) / scale;
+    }
+    else if(isType(box, "trak"))
+    {
+      parseMp4Track(r, box, d);
+    }
+  }
+  return d.duration >= 0 || !d.videoCodec.empty();
+}
+
+// --- MPEG-TS: PAT > PMT for the codecs, PCR at both ends for the length
+
+/** reads the bits of an H.264 NAL unit */
+class BitReader
+{
+public:
+  BitReader(const std::vector<uint8_t> &data)
+    : m_data(data)
+    , m_pos(0)
+    , m_overrun(false)
+  {
+  }
+
+  unsigned bit()
+  {
+    if(m_pos >= m_data.size() * 8)
+    {
+      m_overrun = true;
+      return 0;
+    }
+    const unsigned b = (m_data[m_pos >> 3] >> (7 - (m_pos & 7))) & 1;
+    m_pos++;
+    return b;
+  }
+
+  unsigned bits(unsigned n)
+  {
+    unsigned v = 0;
+    while(n--)
+      v = v << 1 | bit();
+    return v;
+  }
+
+  /** Exp-Golomb */
+  unsigned ue()
+  {
+    unsigned zeros = 0;
+    while(!bit() && !m_overrun && zeros < 31)
+      zeros++;
+    return (1u << zeros) - 1 + bits(zeros);
+  }
+
+  int se()
+  {
+    const unsigned v = ue();
+    return v & 1 ? static_cast<int>((v + 1) / 2) : -static_cast<int>(v / 2);
+  }
+
+  bool ok() const { return !m_overrun; }
+
+private:
+  const std::vector<uint8_t> &m_data;
+  size_t m_pos;
+  bool m_overrun;
+};
+
+/** picture size from an H.264 sequence parameter set */
+bool parseSps(const std::vector<uint8_t> &sps, int &width, int &height)
+{
+  BitReader br(sps);
+  const unsigned profile = br.bits(8);
+  br.bits(16); // constraints, level
+  br.ue();     // seq_parameter_set_id
+
+  unsigned chroma = 1;
+  const unsigned highProfiles[] = {
+    100, 110, 122, 244, 44, 83, 86, 118, 128, 138, 139, 134, 135};
+  if(std::find(std::begin(highProfiles), std::end(highProfiles),
+       profile) != std::end(highProfiles))
+  {
+    chroma = br.ue();
+    if(chroma == 3)
+      br.bit(); // separate_colour_plane_flag
+    br.ue();    // bit depths
+    br.ue();
+    br.bit();
+    if(br.bit())
+    {
+      // skip the scaling lists
+      for(unsigned i = 0; i < (chroma != 3 ? 8u : 12u); i++)
+      {
+        if(!br.bit())
+          continue;
+
+        int last = 8, next = 8;
+        for(unsigned j = 0; j < (i < 6 ? 16u : 64u) && next; j++)
+        {
+          next = (last + br.se() + 256) % 256;
+          last = next ? next : last;
+        }
+      }
+    }
+  }
+
+  br.ue(); // log2_max_frame_num_minus4
+  const unsigned pocType = br.ue();
+  if(pocType == 0)
+  {
+    br.ue();
+  }
+  else if(pocType == 1)
+  {
+    br.bit();
+    br.se();
+    br.se();
+    const unsigned frames = br.ue();
+    for(unsigned i = 0; i < frames && br.ok(); i++)
+      br.se();
+  }
+  br.ue();  // max_num_ref_frames
+  br.bit(); // gaps_in_frame_num_value_allowed_flag
+
+  const unsigned mbWidth = br.ue() + 1;
+  const unsigned mapHeight = br.ue() + 1;
+  const unsigned frameMbsOnly = br.bit();
+  if(!frameMbsOnly)
+    br.bit();
+  br.bit(); // direct_8x8_inference_flag
+
+  unsigned crop[4] = {0, 0, 0, 0};
+  if(br.bit())
+  {
+    for(auto &c: crop)
+      c = br.ue();
+  }
+
+  if(!br.ok())
+    return false;
+
+  const unsigned cropX = chroma == 1 || chroma == 2 ? 2 : 1;
+  const unsigned cropY = (chroma == 1 ? 2 : 1) * (2 - frameMbsOnly);
+  width = static_cast<int>(mbWidth * 16 - (crop[0] + crop[1]) * cropX);
+  height = static_cast<int>((2 - frameMbsOnly) * mapHeight * 16 -
+    (crop[2] + crop[3]) * cropY);
+  return width > 0 && height > 0;
+}
+
+/** picture size from the start of the video elementary stream */
+void parseVideoSize(
+  const std::string &codec, const std::vector<uint8_t> &es, MediaDetails &d)
+{
+  const bool mpeg = codec == "mpeg2video" || codec == "mpeg1video";
+  const bool h264 = codec == "h264";
+
+  for(size_t i = 0; i + 7 < es.size(); i++)
+  {
+    if(es[i] || es[i + 1] || es[i + 2] != 1)
+      continue;
+
+    const uint8_t code = es[i + 3];
+    if(mpeg && code == 0xB3)
+    {
+      // sequence header: 12 bit width, 12 bit height
+      d.width = es[i + 4] << 4 | es[i + 5] >> 4;
+      d.height = (es[i + 5] & 0x0F) << 8 | es[i + 6];
+      return;
+    }
+
+    if(h264 && (code & 0x1F) == 7)
+    {
+      // drop the emulation prevention bytes
+      std::vector<uint8_t> sps;
+      for(size_t j = i + 4; j < es.size() && sps.size() < 256; j++)
+      {
+        const auto n = sps.size();
+        if(n >= 2 && !sps[n - 1] && !sps[n - 2])
+        {
+          if(es[j] == 3)
+            continue;
+          if(es[j] <= 1)
+            break; // next start code
+        }
+        sps.push_back(es[j]);
+      }
+
+      if(parseSps(sps, d.width, d.height))
+        return;
+    }
+  }
+}
+
+/** codec of an elementary stream of the PMT, nullptr if not media */
+const char *tsCodec(
+  uint8_t type, const uint8_t *desc, const uint8_t *descEnd, bool &video)
+{
+  video = true;
+  switch(type)
+  {
+    case 0x01: return "mpeg1video";
+    case 0x02: return "mpeg2video";
+    case 0x10: return "mpeg4";
+    case 0x1B: return "h264";
+    case 0x24: return "hevc";
+    case 0xEA: return "vc1";
+    default: break;
+  }
+
+  video = false;
+  switch(type)
+  {
+    case 0x03:
+    case 0x04: return "mp2";
+    case 0x0F: return "aac";
+    case 0x11: return "aac_latm";
+    case 0x80: return "pcm_bluray";
+    case 0x81: return "ac3";
+    case 0x82: return "dts";
+    case 0x87: return "eac3";
+    case 0x06:
+      // DVB private data, the descriptors tell the audio codecs
+      while(desc + 2 <= descEnd)
+      {
+        switch(desc[0])
+        {
+          case 0x6A: return "ac3";
+          case 0x7A: return "eac3";
+          case 0x7B: return "dts";
+          default: break;
+        }
+        desc += 2 + desc[1];
+      }
+      return nullptr;
+    default: return nullptr;
+  }
+}
+
+struct TsScan
+{
+  unsigned packetSize; ///< 188, or 192 for M2TS
+  uint64_t start;      ///< offset of the first sync byte
+  int pmtPid;
+  int pcrPid;
+  int videoPid;
+  bool pmtFound;
+  int64_t firstPcr;
+  int64_t lastPcr;
+  std::vector<uint8_t> videoData;
+};
+
+/** PSI section in the payload of a packet starting one */
+bool getSection(const uint8_t *payload, const uint8_t *end, uint8_t tableId,
+  const uint8_t *&section, const uint8_t *&sectionEnd)
+{
+  section = payload + 1 + payload[0];
+  if(section + 8 > end || section[0] != tableId)
+    return false;
+
+  // without the CRC
+  const unsigned length = be16(section + 1) & 0x0FFF;
+  sectionEnd = std::min(section + 3 + length - 4, end);
+  return true;
+}
+
+void parsePat(const uint8_t *payload, const uint8_t *end, TsScan &ts)
+{
+  const uint8_t *sec, *secEnd;
+  if(!getSection(payload, end, 0x00, sec, secEnd))
+    return;
+
+  // the first program, number 0 is the network PID
+  for(const uint8_t *p = sec + 8; p + 4 <= secEnd; p += 4)
+  {
+    if(be16(p))
+    {
+      ts.pmtPid = be16(p + 2) & 0x1FFF;
+      return;
+    }
+  }
+}
+
+void parsePmt(
+  const uint8_t *payload, const uint8_t *end, TsScan &ts, MediaDetails &d)
+{
+  const uint8_t *sec, *secEnd;
+  if(!getSection(payload, end, 0x02, sec, secEnd) || sec + 12 > secEnd)
+    return;
+
+  ts.pmtFound = true;
+  ts.pcrPid = be16(sec + 8) & 0x1FFF;
+  const uint8_t *p = sec + 12 + (be16(sec + 10) & 0x0FFF);
+
+  while(p + 5 <= secEnd)
+  {
+    const uint8_t *desc = p + 5;
+    const uint8_t *descEnd = std::min(desc + (be16(p + 3) & 0x0FFF), secEnd);
+    bool video;
+    const char *codec = tsCodec(p[0], desc, descEnd, video);
+    if(codec && video && d.videoCodec.empty())
+    {
+      d.videoCodec = codec;
+      ts.videoPid = be16(p + 1) & 0x1FFF;
+    }
+    else if(codec && !video && d.audioCodec.empty())
+    {
+      d.audioCodec = codec;
+    }
+    p = descEnd;
+  }
+}
+
+/** scan the packets of a chunk, PCRs are only taken after the PMT */
+void scanPackets(const std::vector<uint8_t> &buf, bool head, TsScan &ts,
+  MediaDetails &d)
+{
+  for(size_t pos = 0; pos + TsPacketSize <= buf.size();
+      pos += ts.packetSize)
+  {
+    const uint8_t *pkt = buf.data() + pos;
+    const uint8_t *end = pkt + TsPacketSize;
+    if(pkt[0] != 0x47)
+      continue;
+
+    const int pid = be16(pkt + 1) & 0x1FFF;
+    const bool unitStart = pkt[1] & 0x40;
+    const unsigned control = pkt[3] >> 4 & 3;
+    const uint8_t *payload = pkt + 4;
+
+    if(control & 2)
+    {
+      // adaptation field, the PCR is its first optional field
+      const uint8_t length = pkt[4];
+      payload += 1 + length;
+      if(pid == ts.pcrPid && length >= 7 && pkt[5] & 0x10)
+      {
+        const int64_t pcr = static_cast<int64_t>(pkt[6]) << 25 |
+          pkt[7] << 17 | pkt[8] << 9 | pkt[9] << 1 | pkt[10] >> 7;
+        if(!head)
+          ts.lastPcr = pcr;
+        else if(ts.firstPcr < 0)
+          ts.firstPcr = pcr;
+      }
+    }
+
+    if(!head || !(control & 1) || payload >= end)
+      continue;
+
+    if(pid == 0 && unitStart && ts.pmtPid < 0)
+    {
+      parsePat(payload, end, ts);
+    }
+    else if(pid == ts.pmtPid && unitStart && !ts.pmtFound)
+    {
+      parsePmt(payload, end, ts, d);
+    }
+    else if(pid == ts.videoPid && ts.videoData.size() < MaxVideoData)
+    {
+      ts.videoData.insert(ts.videoData.end(), payload, end);
+    }
+  }
+}
+
+bool parseTs(Reader &r, MediaDetails &d)
+{
+  const auto first = r.read(0, MediaHeaderParser::ScanSize);
+  TsScan ts{0, 0, -1, -1, -1, false, -1, -1, {}};
+
+  // M2TS (AVCHD, Blu-ray) prefixes the packets with a 4 byte time code
+  for(const unsigned size: {TsPacketSize, TsPacketSize + 4})
+  {
+    for(unsigned o = 0; o < size && !ts.packetSize; o++)
+    {
+      bool synced = o + 4 * size + TsPacketSize <= first.size();
+      for(unsigned i = 0; i < 5 && synced; i++)
+        synced = first[o + i * size] == 0x47;
+
+      if(synced)
+      {
+        ts.packetSize = size;
+        ts.start = o;
+      }
+    }
+  }
+
+  if(!ts.packetSize)
+    return false;
+
+  // whole packets only, the tables and PCRs may come late in the stream
+  const uint64_t chunk =
+    MediaHeaderParser::ScanSize / ts.packetSize * ts.packetSize;
+  for(unsigned i = 0; i < MaxScanChunks; i++)
+  {
+    const uint64_t offset = ts.start + i * chunk;
+    scanPackets(r.read(offset, chunk), true, ts, d);
+    if(ts.pmtFound && ts.firstPcr >= 0)
+      break;
+  }
+
+  if(!ts.pmtFound)
+    return false;
+
+  const uint64_t packets = (r.size() - ts.start) / ts.packetSize;
+  const uint64_t end = ts.start + packets * ts.packetSize;
+  for(unsigned i = 1; i <= MaxScanChunks && ts.firstPcr >= 0; i++)
+  {
+    if(end < ts.start + i * chunk)
+      break;
+
+    scanPackets(r.read(end - i * chunk, chunk), false, ts, d);
+    if(ts.lastPcr >= 0)
+      break;
+  }
+
+  if(ts.firstPcr >= 0 && ts.lastPcr >= 0)
+  {
+    int64_t diff = ts.lastPcr - ts.firstPcr;
+    if(diff < 0)
+      diff += PcrWrap;
+    d.duration = diff / PcrClock;
+  }
+
+  parseVideoSize(d.videoCodec, ts.videoData, d);
+  return true;
+}
+
+// --- AVI: RIFF 'AVI ' > LIST 'hdrl' > avih, LIST 'strl', LIST 'odml'
+
+const Codec AviVideoCodecs[] = {{"XVID", "mpeg4"}, {"DIVX", "mpeg4"},
+  {"DX50", "mpeg4"}, {"FMP4", "mpeg4"}, {"MP4V", "mpeg4"},
+  {"DIV3", "msmpeg4v3"}, {"H264", "h264"}, {"X264", "h264"},
+  {"AVC1", "h264"}, {"HEVC", "hevc"}, {"H265", "hevc"}, {"MJPG", "mjpeg"},
+  {"MPG2", "mpeg2video"}};
+
+const char *aviAudioCodec(uint16_t formatTag)
+{
+  switch(formatTag)
+  {
+    case 0x0001: return "pcm_s16le";
+    case 0x0050: return "mp2";
+    case 0x0055: return "mp3";
+    case 0x00FF: return "aac";
+    case 0x2000: return "ac3";
+    case 0x2001: return "dts";
+    default: return "";
+  }
+}
+
+/** chunks between begin and end, only their headers are read */
+std::vector<Box> listChunks(Reader &r, uint64_t begin, uint64_t end)
+{
+  std::vector<Box> chunks;
+  uint8_t h[12];
+  while(begin + 8 <= end && chunks.size() < MaxBoxes)
+  {
+    if(!r.read(begin, h, 8))
+      break;
+
+    Box chunk;
+    memcpy(chunk.type, h, 4);
+    chunk.begin = begin + 8;
+    chunk.end = chunk.begin + le32(h + 4);
+    if(chunk.end > end)
+      break;
+
+    if(isType(chunk, "LIST"))
+    {
+      if(!r.read(chunk.begin, h + 8, 4))
+        break;
+      memcpy(chunk.type, h + 8, 4);
+      chunk.begin += 4;
+    }
+
+    chunks.push_back(chunk);
+    // chunks are padded to an even size
+    begin = chunk.end + (chunk.end & 1);
+  }
+  return chunks;
+}
+
+void parseAviStream(Reader &r, const Box &strl, MediaDetails &d)
+{
+  uint8_t type[8] = {0};
+  for(const auto &chunk: listChunks(r, strl.begin, strl.end))
+  {
+    uint8_t buf[20];
+    if(isType(chunk, "strh"))
+    {
+      if(!r.read(chunk.begin, type, sizeof(type)))
+        return;
+    }
+    else if(isType(chunk, "strf"))
+    {
+      if(!memcmp(type, "vids", 4) && d.videoCodec.empty() &&
+        r.read(chunk.begin, buf, 20))
+      {
+        // BITMAPINFOHEADER.biCompression
+        d.videoCodec = codecName(AviVideoCodecs,
+          sizeof(AviVideoCodecs) / sizeof(AviVideoCodecs[0]),
+          reinterpret_cast<const char *>(buf + 16), true);
+      }
+      else if(!memcmp(type, "auds", 4) && d.audioCodec.empty() &&
+        r.read(chunk.begin, buf, 2))
+      {
+        // WAVEFORMATEX.wFormatTag
+        d.audioCodec = aviAudioCodec(le16(buf));
+      }
+    }
+  }
+}
+
+bool parseAvi(Reader &r, MediaDetails &d)
+{
+  uint8_t buf[40];
+  if(!r.read(12, buf, 12) || memcmp(buf, "LIST", 4) != 0 ||
+    memcmp(buf + 8, "hdrl", 4) != 0)
+  {
+    return false;
+  }
+
+  const uint64_t end = std::min<uint64_t>(20 + le32(buf + 4), r.size());
+  uint32_t frames = 0;
+  uint32_t frameTime = 0;
+
+  for(const auto &chunk: listChunks(r, 24, end))
+  {
+    if(isType(chunk, "avih") && r.read(chunk.begin, buf, 40))
+    {
+      frameTime = le32(buf);
+      frames = le32(buf + 16);
+      d.width = static_cast<int>(le32(buf + 32));
+      d.height = static_cast<int>(le32(buf + 36));
+    }
+    else if(isType(chunk, "strl"))
+    {
+      parseAviStream(r, chunk, d);
+    }
+    else if(isType(chunk, "odml"))
+    {
+      // avih counts the frames of the first RIFF only (OpenDML)
+      for(const auto &dmlh: listChunks(r, chunk.begin, chunk.end))
+      {
+        if(isType(dmlh, "dmlh") && r.read(dmlh.begin, buf, 4))
+          frames = le32(buf);
+      }
+    }
+  }
+
+  if(frameTime)
+    d.duration = frames * (frameTime / 1000000.0);
+  return true;
+}
+}
+
+bool MediaHeaderParser::parse(
+  const std::string &fileName, MediaDetails &details)
+{
+  // unbuffered: the few header reads should not fetch whole blocks
+  std::ifstream fs;
+  fs.rdbuf()->pubsetbuf(nullptr, 0);
+  fs.open(fileName, std::ios::in | std::ios::binary);
+  if(!fs.is_open())
+    return false;
+
+  fs.seekg(0, std::ios::end);
+  const auto size = fs.tellg();
+  if(size <= 0)
+    return false;
+
+  return parse(fs, static_cast<uint64_t>(size), details);
+}
+
+bool MediaHeaderParser::parse(
+  std::istream &in, uint64_t size, MediaDetails &details)
+{
+  Reader r(in, size);
+  MediaDetails d{-1.0, "", "", 0, 0, 0};
+  uint8_t h[12];
+  if(!r.read(0, h, sizeof(h)))
+    return false;
+
+  bool ok;
+  if(memcmp(h, "RIFF", 4) == 0 && memcmp(h + 8, "AVI ", 4) == 0)
+    ok = parseAvi(r, d);
+  else if(isMp4Box(h + 4))
+    ok = parseMp4(r, d);
+  else
+    ok = parseTs(r, d);
+
+  if(!ok)
+    return false;
+
+  if(d.duration > 0)
+    d.bitRate = static_cast<int>(size * 8 / d.duration / 1000);
+
+  details = d;
+  return true;
+}
@@ -0,0 +1,34 @@
+#ifndef __MEDIAHEADERPARSER_HPP__
+#define __MEDIAHEADERPARSER_HPP__
+
+#include <cstdint>
+#include <istream>
+#include <string>
+
+#include "IDatabase.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Reads duration, codecs and resolution from the container headers
+ * of MP4/MOV, MPEG-TS and AVI files without an external process. Only the
+ * boxes/chunks of the header and a few KB at the start and the end of the
+ * file are read, so a catalog of many files can be indexed on a small NAS.
+ */
+class MediaHeaderParser
+{
+public:
+  /** bytes scanned at the start and at the end of a transport stream */
+  static constexpr unsigned ScanSize = 64 * 1024;
+
+  /** @return false the file could not be read or its format is unknown */
+  static bool parse(const std::string &fileName, MediaDetails &details);
+
+  /**
+   * @param in seekable stream of the whole file
+   * @param size length of the file
+   */
+  static bool parse(std::istream &in, uint64_t size, MediaDetails &details);
+};
+}
+#endif // !__MEDIAHEADERPARSER_HPP__
@@ -0,0 +1,150 @@
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include "MediaProbe.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+/** is the codec in the comma separated list */
+bool contains(const std::string &list, const std::string &codec)
+{
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ','))
+  {
+    const auto first = item.find_first_not_of(' ');
+    const auto last = item.find_last_not_of(' ');
+    if(first != std::string::npos &&
+      item.compare(first, last - first + 1, codec) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** "..., 1234 kb/s, ..." in a line of the input details */
+int getBitRate(const std::string &line)
+{
+  const auto pos = line.find(" kb/s");
+  if(pos == std::string::npos)
+    return 0;
+
+  const auto start = line.find_last_not_of("0123456789", pos - 1);
+  return atoi(line.c_str() + (start == std::string::npos ? 0 : start + 1));
+}
+}
+
+MediaProbe::MediaProbe(const DaemonConfig &cfg)
+  : m_cfg(cfg)
+{
+}
+
+bool MediaProbe::isEnabled() const
+{
+  return !m_cfg.probePath.empty() && !m_cfg.remuxVideoCodecs.empty();
+}
+
+bool MediaProbe::probe(const std::string &fileName, MediaInfo &info) const
+{
+  // without an output file ffmpeg prints the input details and fails
+  const auto cmdLine = "\"" + m_cfg.probePath +
+    "\" -nostdin -hide_banner -i \"" + fileName + "\" 2>&1";
+  LOG_F(2, "running: %s", cmdLine.c_str());
+  FILE *f = popen(cmdLine.c_str(), "r");
+  if(!f)
+  {
+    LOG_F(ERROR, "could not start: %s", cmdLine.c_str());
+    return false;
+  }
+
+  std::string output;
+  char buffer[1024];
+  size_t rd;
+  while((rd = fread(buffer, 1, sizeof(buffer), f)) > 0)
+  {
+    output.append(buffer, rd);
+  }
+  pclose(f);
+
+  if(!parse(output, info))
+  {
+    LOG_F(WARNING, "could not probe %s: %s", fileName.c_str(),
+      output.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool MediaProbe::isRemuxable(const MediaInfo &info) const
+{
+  if(info.videoCodec.empty() ||
+    !contains(m_cfg.remuxVideoCodecs, info.videoCodec))
+  {
+    return false;
+  }
+
+  if(!info.audioCodec.empty() &&
+    !contains(m_cfg.remuxAudioCodecs, info.audioCodec))
+  {
+    return false;
+  }
+
+  // the video stream of some containers (MTS) has no bit rate of its own
+  const int bitRate = info.videoBitRate ? info.videoBitRate : info.bitRate;
+  return m_cfg.remuxMaxBitRate <= 0 ||
+    (bitRate > 0 && bitRate <= m_cfg.remuxMaxBitRate);
+}
+
+bool MediaProbe::parse(const std::string &output, MediaInfo &info)
+{
+  info = MediaInfo{"", "", 0, 0, -1.0};
+
+  // Duration: 00:00:36.93, start: 1.040000, bitrate: 16355 kb/s
+  // Stream #0:0(und): Video: hevc (Main) (hvc1 / 0x31637668), ...
+  // Stream #0:1(und): Audio: aac (LC) (mp4a / 0x6134706D), ..., 256 kb/s
+  std::stringstream ss(output);
+  std::string line;
+  bool found = false;
+  while(std::getline(ss, line))
+  {
+    auto pos = line.find("Duration: ");
+    if(pos != std::string::npos)
+    {
+      int h, m;
+      double s;
+      if(sscanf(line.c_str() + pos + 10, "%d:%d:%lf", &h, &m, &s) == 3)
+        info.duration = h * 3600.0 + m * 60.0 + s;
+      info.bitRate = getBitRate(line);
+      found = true;
+      continue;
+    }
+
+    if(line.find("Stream #") == std::string::npos)
+      continue;
+
+    // only the first streams are selected by the encoder
+    const auto video = line.find(": Video: ");
+    const auto audio = line.find(": Audio: ");
+    if(video != std::string::npos && info.videoCodec.empty())
+    {
+      pos = video + 9;
+      info.videoCodec =
+        line.substr(pos, line.find_first_of(" ,", pos) - pos);
+      info.videoBitRate = getBitRate(line);
+    }
+    else if(audio != std::string::npos && info.audioCodec.empty())
+    {
+      pos = audio + 9;
+      info.audioCodec =
+        line.substr(pos, line.find_first_of(" ,", pos) - pos);
+    }
+  }
+
+  return found;
+}
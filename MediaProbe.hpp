@@ -0,0 +1,46 @@
+#ifndef __MEDIAPROBE_HPP__
+#define __MEDIAPROBE_HPP__
+
+#include <string>
+
+#include "MediaArchiverDaemonConfig.hpp"
+
+namespace MediaArchiver
+{
+/** @brief streams of a media file as far as the archive policy cares */
+struct MediaInfo
+{
+  std::string videoCodec; ///< e.g. hevc, empty if there is no video
+  std::string audioCodec; ///< e.g. aac, empty if there is no audio
+  int videoBitRate;       ///< kb/s of the video stream, 0 if unknown
+  int bitRate;            ///< kb/s of the whole file, 0 if unknown
+  double duration;        ///< seconds, negative if unknown
+};
+
+/**
+ * @brief Reads the codecs of source files with probePath (ffmpeg) to find
+ * the ones already meeting the archive policy, which are only remuxed into
+ * the archive container instead of being encoded again.
+ */
+class MediaProbe
+{
+public:
+  MediaProbe(const DaemonConfig &cfg);
+
+  /** is remuxing configured at all */
+  bool isEnabled() const;
+
+  /** @return false the file could not be probed */
+  bool probe(const std::string &fileName, MediaInfo &info) const;
+
+  /** do the streams meet the archive policy (remux* settings) */
+  bool isRemuxable(const MediaInfo &info) const;
+
+  /** read the input details printed by ffmpeg -i */
+  static bool parse(const std::string &output, MediaInfo &info);
+
+private:
+  const DaemonConfig &m_cfg;
+};
+}
+#endif // !__MEDIAPROBE_HPP__
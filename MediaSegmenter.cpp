@@ -0,0 +1,211 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "MediaSegmenter.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+bool exists(const std::string &fileName)
+{
+  struct stat st;
+  return stat(fileName.c_str(), &st) == 0;
+}
+
+std::string getSegmentName(const std::string &base, unsigned index)
+{
+  // no media extension, the watcher must not take them for sources
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".seg%03u", index);
+  return base + suffix;
+}
+
+/** muxer for the extension of the archives */
+std::string getMuxer(const std::string &extension)
+{
+  auto ext = extension;
+  if(!ext.empty() && ext[0] == '.')
+    ext.erase(0, 1);
+
+  if(ext == "mkv")
+    return "matroska";
+  if(ext == "m4v" || ext == "m4a")
+    return "mp4";
+  return ext;
+}
+}
+
+MediaSegmenter::MediaSegmenter(const DaemonConfig &cfg)
+  : m_cfg(cfg)
+{
+}
+
+bool MediaSegmenter::isSegmentable(const BasicFileInfo &file) const
+{
+  return m_cfg.segmentThreshold > 0 && !m_cfg.segmenterPath.empty() &&
+    file.fileSize >
+    static_cast<size_t>(m_cfg.segmentThreshold) * 1024 * 1024;
+}
+
+std::vector<BasicFileInfo> MediaSegmenter::split(
+  const std::string &src, const std::string &base) const
+{
+  // leftovers of an interrupted attempt
+  for(unsigned i = 0; exists(getSegmentName(base, i)); ++i)
+  {
+    remove(getSegmentName(base, i).c_str());
+  }
+
+  // the segment muxer cuts at the first key frame after segment_time
+  std::stringstream cmd;
+  cmd << "\"" << m_cfg.segmenterPath << "\""
+      << " -nostdin -hide_banner -loglevel error -y -i \"" << src << "\""
+      << " -map 0:v:0 -map 0:a? -c copy -f segment -segment_time "
+      << m_cfg.segmentDuration << " -segment_format " << SegmentExtension
+      << " -reset_timestamps 1 \"" << base << ".seg%03d\"";
+  run(cmd.str());
+
+  std::vector<BasicFileInfo> segments;
+  for(unsigned i = 0;; ++i)
+  {
+    const auto name = getSegmentName(base, i);
+    struct stat st;
+    if(stat(name.c_str(), &st) != 0)
+      break;
+
+    segments.push_back(
+      BasicFileInfo{name, static_cast<size_t>(st.st_size)});
+  }
+
+  if(segments.empty())
+  {
+    throw std::runtime_error("no segments were created from " + src);
+  }
+
+  LOG_F(INFO, "%s was split into %lu segments", src.c_str(),
+    segments.size());
+  return segments;
+}
+
+void MediaSegmenter::join(const std::vector<std::string> &parts,
+  const std::string &src, const std::string &dst) const
+{
+  const std::string list = dst + ".concat";
+  {
+    std::ofstream fs(list, std::ios::out | std::ios::trunc);
+    for(const auto &part: parts)
+    {
+      // the concat demuxer quotes like the shell
+      std::string quoted;
+      for(const char c: part)
+      {
+        if(c == '\'')
+          quoted += "'\\''";
+        else
+          quoted += c;
+      }
+      fs << "file '" << quoted << "'\n";
+    }
+    fs.close();
+    if(fs.fail())
+      throw std::runtime_error("could not write the list " + list);
+  }
+
+  std::stringstream cmd;
+  cmd << "\"" << m_cfg.segmenterPath << "\""
+      << " -nostdin -hide_banner -loglevel error -y -f concat -safe 0 -i \""
+      << list << "\" -i \"" << src << "\""
+      << " -map 0 -map_metadata 1 -c copy -movflags use_metadata_tags -f "
+      << getMuxer(m_cfg.finalExtension) << " \"" << dst << "\"";
+
+  try
+  {
+    run(cmd.str());
+  }
+  catch(const std::exception &)
+  {
+    remove(list.c_str());
+    throw;
+  }
+  remove(list.c_str());
+
+  // every segment may be off by a few frames of audio priming
+  const double srcLen = getDuration(src);
+  const double dstLen = getDuration(dst);
+  const double tolerance = 1.0 + 0.05 * parts.size();
+  if(dstLen <= 0 || (srcLen > 0 && std::fabs(dstLen - srcLen) > tolerance))
+  {
+    std::stringstream ss;
+    ss << "stream duration of the joined segments differs: " << srcLen
+       << " != " << dstLen;
+    throw std::runtime_error(ss.str());
+  }
+}
+
+std::string MediaSegmenter::getSegmentResultName(const std::string &segment)
+{
+  return segment + ".out";
+}
+
+void MediaSegmenter::removeFiles(const std::vector<SegmentInfo> &segments)
+{
+  for(const auto &s: segments)
+  {
+    remove(s.fileName.c_str());
+    remove(getSegmentResultName(s.fileName).c_str());
+    if(!s.archiveName.empty())
+      remove(s.archiveName.c_str());
+  }
+}
+
+double MediaSegmenter::getDuration(const std::string &fileName) const
+{
+  // without an output file ffmpeg prints the input details and fails
+  const auto output = run("\"" + m_cfg.segmenterPath +
+      "\" -nostdin -hide_banner -i \"" + fileName + "\"",
+    false);
+
+  const auto pos = output.find("Duration: ");
+  int h, m;
+  double s;
+  if(pos == std::string::npos ||
+    sscanf(output.c_str() + pos + 10, "%d:%d:%lf", &h, &m, &s) != 3)
+  {
+    return -1.0;
+  }
+  return h * 3600.0 + m * 60.0 + s;
+}
+
+std::string MediaSegmenter::run(
+  const std::string &cmdLine, bool check) const
+{
+  LOG_F(2, "running: %s", cmdLine.c_str());
+  FILE *f = popen((cmdLine + " 2>&1").c_str(), "r");
+  if(!f)
+    throw std::runtime_error("could not start: " + cmdLine);
+
+  std::string output;
+  char buffer[1024];
+  size_t rd;
+  while((rd = fread(buffer, 1, sizeof(buffer), f)) > 0)
+  {
+    output.append(buffer, rd);
+  }
+
+  const int status = pclose(f);
+  if(check && status != 0)
+  {
+    LOG_F(ERROR, "'%s' failed: %s", cmdLine.c_str(), output.c_str());
+    throw std::runtime_error("segmenter failed: " + output);
+  }
+  return output;
+}
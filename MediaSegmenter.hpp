@@ -0,0 +1,67 @@
+#ifndef __MEDIASEGMENTER_HPP__
+#define __MEDIASEGMENTER_HPP__
+
+#include <string>
+#include <vector>
+
+#include "MediaArchiverDaemonConfig.hpp"
+#include "IDatabase.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Cuts long source files into segments at key frames, so that they
+ * can be encoded by several clients in parallel, and joins the encoded
+ * segments again. Both steps copy the streams using segmenterPath (ffmpeg).
+ */
+class MediaSegmenter
+{
+public:
+  /** container the segments are cut into */
+  static constexpr const char *SegmentExtension = "ts";
+
+  MediaSegmenter(const DaemonConfig &cfg);
+
+  /** is segmenting configured and worth it for the file */
+  bool isSegmentable(const BasicFileInfo &file) const;
+
+  /**
+   * @brief cut the source into segments of about segmentDuration seconds
+   *
+   * @param src source file
+   * @param base path prefix of the segment files
+   * @return std::vector<BasicFileInfo> segments in their order
+   * @throws std::runtime_error if the source cannot be split
+   */
+  std::vector<BasicFileInfo> split(
+    const std::string &src, const std::string &base) const;
+
+  /**
+   * @brief concatenate the encoded segments and check the duration of the
+   * result against the source
+   *
+   * @param parts encoded segments in their order
+   * @param src source file, its metadata is copied
+   * @param dst result file
+   * @throws std::runtime_error if joining failed
+   */
+  void join(const std::vector<std::string> &parts, const std::string &src,
+    const std::string &dst) const;
+
+  /** file receiving the encoded segment from a client */
+  static std::string getSegmentResultName(const std::string &segment);
+
+  /** delete the segments and their results */
+  static void removeFiles(const std::vector<SegmentInfo> &segments);
+
+  /** duration of the media file in seconds, negative if unknown */
+  double getDuration(const std::string &fileName) const;
+
+private:
+  /** run the command, its output is returned or thrown on error */
+  std::string run(const std::string &cmdLine, bool check = true) const;
+
+  const DaemonConfig &m_cfg;
+};
+}
+#endif // !__MEDIASEGMENTER_HPP__
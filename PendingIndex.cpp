@@ -0,0 +1,140 @@
+#include "PendingIndex.hpp"
+
+#include <limits>
+
+using namespace MediaArchiver;
+
+namespace
+{
+bool fits(const PendingIndex::Entry &e, size_t maxSize)
+{
+  return !maxSize || e.fileSize <= maxSize;
+}
+
+/** sizes in a bucket differ by less than an eighth, larger is higher */
+unsigned getBucket(size_t size)
+{
+  unsigned shift = 0;
+  while((size >> shift) >= 16)
+    ++shift;
+  return shift * 8 + static_cast<unsigned>(size >> shift);
+}
+}
+
+PendingIndex::PendingIndex()
+  : m_rank([](const PendingFile &f) { return static_cast<double>(f.id); })
+{
+}
+
+void PendingIndex::setRank(const Rank &rank)
+{
+  m_rank = rank;
+  clear();
+}
+
+void PendingIndex::insert(const PendingFile &file)
+{
+  erase(file.id);
+
+  const Entry entry{m_rank(file), file.id, file.fileSize};
+  m_entries.insert(entry);
+  m_buckets[getBucket(entry.fileSize)].insert(entry);
+  m_ids[file.id] = entry;
+}
+
+void PendingIndex::erase(uint32_t id)
+{
+  const auto it = m_ids.find(id);
+  if(it == m_ids.end())
+    return;
+
+  const Entry &entry = it->second;
+  m_entries.erase(entry);
+  const auto bucket = m_buckets.find(getBucket(entry.fileSize));
+  bucket->second.erase(entry);
+  if(bucket->second.empty())
+    m_buckets.erase(bucket);
+  m_ids.erase(it);
+}
+
+void PendingIndex::clear()
+{
+  m_entries.clear();
+  m_buckets.clear();
+  m_ids.clear();
+}
+
+bool PendingIndex::contains(uint32_t id) const
+{
+  return m_ids.count(id) > 0;
+}
+
+const PendingIndex::Entry *PendingIndex::first(size_t maxSize) const
+{
+  return first(-std::numeric_limits<double>::infinity(), maxSize);
+}
+
+const PendingIndex::Entry *PendingIndex::first(
+  double rank, size_t maxSize) const
+{
+  if(!maxSize)
+  {
+    const auto it = m_entries.lower_bound(Entry{rank, 0, 0});
+    return it != m_entries.end() ? &*it : nullptr;
+  }
+
+  const unsigned limit = getBucket(maxSize);
+  const Entry *best = nullptr;
+  for(const auto &bucket: m_buckets)
+  {
+    if(bucket.first > limit)
+      break;
+    const Entry *e = find(bucket.second, rank, maxSize, false);
+    if(e && (!best || *e < *best))
+      best = e;
+  }
+  return best;
+}
+
+const PendingIndex::Entry *PendingIndex::last(size_t maxSize) const
+{
+  if(!maxSize)
+    return m_entries.empty() ? nullptr : &*m_entries.rbegin();
+
+  const unsigned limit = getBucket(maxSize);
+  const Entry *best = nullptr;
+  for(const auto &bucket: m_buckets)
+  {
+    if(bucket.first > limit)
+      break;
+    const Entry *e = find(bucket.second, 0, maxSize, true);
+    if(e && (!best || *best < *e))
+      best = e;
+  }
+  return best;
+}
+
+const PendingIndex::Entry *PendingIndex::find(
+  const std::set<Entry> &bucket, double rank, size_t maxSize,
+  bool highest) const
+{
+  // only the bucket holding maxSize has files too large, all the others
+  // stop at their first file
+  if(highest)
+  {
+    for(auto it = bucket.rbegin(); it != bucket.rend(); ++it)
+    {
+      if(fits(*it, maxSize))
+        return &*it;
+    }
+    return nullptr;
+  }
+
+  for(auto it = bucket.lower_bound(Entry{rank, 0, 0}); it != bucket.end();
+      ++it)
+  {
+    if(fits(*it, maxSize))
+      return &*it;
+  }
+  return nullptr;
+}
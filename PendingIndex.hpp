@@ -0,0 +1,94 @@
+#ifndef __PENDINGINDEX_HPP__
+#define __PENDINGINDEX_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+namespace MediaArchiver
+{
+/**
+ * @brief source file waiting to be handed out
+ */
+struct PendingFile
+{
+  uint32_t id;            ///< file ID in source table
+  std::string fileName;   ///< source file
+  size_t fileSize;        ///< length of the source file
+  double duration;        ///< seconds, negative if unknown
+  std::string videoCodec; ///< ffmpeg name, empty if unknown
+  int height;             ///< pixels, 0 if unknown
+  bool retry;             ///< an earlier attempt has failed
+};
+
+/**
+ * @brief The files waiting to be handed out, kept in memory in the order
+ * of the scheduling policy, so the next job is found without querying the
+ * whole catalog. Only the ID, the size and the rank of a file are kept.
+ */
+class PendingIndex
+{
+public:
+  struct Entry
+  {
+    double rank;     ///< position given by the scheduling policy
+    uint32_t id;     ///< file ID in source table
+    size_t fileSize; ///< length of the source file
+
+    bool operator<(const Entry &e) const
+    {
+      return rank < e.rank || (rank == e.rank && id < e.id);
+    }
+  };
+
+  /** position of a file, the lowest is handed out first */
+  using Rank = std::function<double(const PendingFile &)>;
+
+  /** ranks the files by their ID */
+  PendingIndex();
+
+  /** use another order, the index must be refilled */
+  void setRank(const Rank &rank);
+
+  /** add the file or update its position */
+  void insert(const PendingFile &file);
+  void erase(uint32_t id);
+  void clear();
+  bool contains(uint32_t id) const;
+  size_t size() const { return m_entries.size(); }
+
+  /** the files in the order of their rank */
+  using const_iterator = std::set<Entry>::const_iterator;
+  const_iterator begin() const { return m_entries.begin(); }
+  const_iterator end() const { return m_entries.end(); }
+
+  /**
+   * A size limit only looks at the size buckets that can hold a fitting
+   * file, so it does not walk the files too large for a client.
+   * @param maxSize largest file to consider, 0: any
+   * @return const Entry* lowest ranked file or nullptr
+   */
+  const Entry *first(size_t maxSize) const;
+
+  /** lowest ranked file from rank on */
+  const Entry *first(double rank, size_t maxSize) const;
+
+  /** highest ranked file */
+  const Entry *last(size_t maxSize) const;
+
+private:
+  /** the lowest or highest ranked file of a bucket not above maxSize */
+  const Entry *find(const std::set<Entry> &bucket, double rank,
+    size_t maxSize, bool highest) const;
+
+  Rank m_rank;
+  std::set<Entry> m_entries;
+  /** the files by size, 8 buckets per power of two */
+  std::map<unsigned, std::set<Entry>> m_buckets;
+  std::unordered_map<uint32_t, Entry> m_ids;
+};
+}
+#endif // !__PENDINGINDEX_HPP__
@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+  #include <signal.h>
+  #include <unistd.h>
+  #include <sys/resource.h>
+  #include <sys/syscall.h>
+#endif
+
+#include "ResourceGovernor.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+// see linux/ioprio.h
+constexpr int IoprioWhoProcess = 1;
+constexpr int IoprioClassShift = 13;
+constexpr int IoprioClassBestEffort = 2;
+constexpr int IoprioClassIdle = 3;
+constexpr int CgroupPeriod = 100000;
+
+const char *levelName(ResourceGovernor::Level level)
+{
+  switch(level)
+  {
+    case ResourceGovernor::Level::Full: return "FULL";
+    case ResourceGovernor::Level::Reduced: return "REDUCED";
+    case ResourceGovernor::Level::Paused: return "PAUSED";
+    default: return "?";
+  }
+}
+
+bool writeFile(const std::string &path, const std::string &value)
+{
+  std::ofstream fs(path);
+  fs << value;
+  fs.close();
+  if(fs.fail())
+  {
+    LOG_F(WARNING, "Could not write '%s' into %s", value.c_str(),
+      path.c_str());
+    return false;
+  }
+  return true;
+}
+}
+
+ResourceGovernor::ResourceGovernor(
+  const ClientConfig &cfg, EncodePipeline &pipeline)
+  : m_cfg(cfg)
+  , m_pipeline(pipeline)
+  , m_level(Level::Full)
+  , m_calmSamples(0)
+  , m_stopping(false)
+  , m_cores(std::max(1u, std::thread::hardware_concurrency()))
+  , m_priorityWarned(false)
+{
+}
+
+ResourceGovernor::~ResourceGovernor()
+{
+  stop();
+}
+
+void ResourceGovernor::start()
+{
+#ifdef WIN32
+  LOG_F(WARNING, "Resource governor is not supported on this platform");
+#else
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_stopping = false;
+  if(!m_thread)
+  {
+    m_thread.reset(new std::thread([this]() { threadMain(); }));
+  }
+#endif
+}
+
+void ResourceGovernor::stop()
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    if(!m_thread)
+      return;
+    m_stopping = true;
+  }
+
+  m_cv.notify_all();
+  m_thread->join();
+  m_thread.reset();
+
+  // never leave the encoders stopped
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_level = Level::Full;
+  apply(m_level);
+}
+
+ResourceGovernor::Level ResourceGovernor::getLevel() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_level;
+}
+
+bool ResourceGovernor::isPriorityRestored() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_reduced.empty();
+}
+
+ResourceGovernor::Level ResourceGovernor::evaluate(
+  const Sample &sample) const
+{
+  if(m_cfg.userIdleTime > 0 && sample.userIdle >= 0 &&
+    sample.userIdle < m_cfg.userIdleTime)
+  {
+    return Level::Paused;
+  }
+
+  if(sample.foreignLoad > m_cfg.loadThreshold)
+  {
+    return Level::Reduced;
+  }
+
+  // the encoder threads stall each other as well, so the pressure only
+  // matters if other processes are competing for the CPU
+  if(sample.pressure > m_cfg.pressureThreshold && sample.foreignLoad > 0.1)
+  {
+    return Level::Reduced;
+  }
+
+  return Level::Full;
+}
+
+void ResourceGovernor::threadMain()
+{
+  loguru::set_thread_name("governor");
+  std::unique_lock<std::mutex> lck(m_mtx);
+  while(!m_stopping)
+  {
+    lck.unlock();
+    const auto sample = measure();
+    const auto wanted = evaluate(sample);
+    LOG_F(5, "governor: load=%.2f, pressure=%.1f, idle=%i -> %s",
+      sample.foreignLoad, sample.pressure, sample.userIdle,
+      levelName(wanted));
+    lck.lock();
+
+    update(wanted);
+    m_cv.wait_for(lck, std::chrono::milliseconds(m_cfg.governorInterval),
+      [this]() { return m_stopping; });
+  }
+}
+
+void ResourceGovernor::update(Level wanted)
+{
+  if(wanted > m_level)
+  {
+    // throttle immediately
+    m_calmSamples = 0;
+    m_level = wanted;
+    apply(m_level);
+  }
+  else if(wanted < m_level)
+  {
+    // release only after the machine has been calm for a while
+    if(++m_calmSamples >= RecoverySamples)
+    {
+      m_calmSamples = 0;
+      m_level = wanted;
+      apply(m_level);
+    }
+  }
+  else
+  {
+    m_calmSamples = 0;
+  }
+
+  // encoders started since the last check
+  const auto encoders = m_pipeline.getEncoders();
+  for(const auto pid: encoders)
+  {
+    if(m_configured.count(pid))
+      continue;
+
+    setPriority(pid, m_level != Level::Full);
+#ifndef WIN32
+    if(m_level == Level::Paused)
+      kill(-pid, SIGSTOP);
+#endif
+  }
+
+  m_configured = std::set<int>(encoders.begin(), encoders.end());
+  for(auto it = m_reduced.begin(); it != m_reduced.end();)
+    it = m_configured.count(*it) ? std::next(it) : m_reduced.erase(it);
+}
+
+void ResourceGovernor::apply(Level level)
+{
+  const auto maxJobs = m_pipeline.getMaxJobs();
+
+  switch(level)
+  {
+    case Level::Full:
+      m_pipeline.setEncodeCapacity(maxJobs);
+      setCpuQuota(100);
+      break;
+    case Level::Reduced:
+      m_pipeline.setEncodeCapacity(std::max(1u, maxJobs / 2));
+      setCpuQuota(m_cfg.reducedCpuQuota);
+      break;
+    case Level::Paused:
+      m_pipeline.setEncodeCapacity(1);
+      setCpuQuota(m_cfg.reducedCpuQuota);
+      break;
+  }
+
+  for(const auto pid: m_pipeline.getEncoders())
+  {
+    setPriority(pid, level != Level::Full);
+  }
+
+  m_pipeline.setPaused(level == Level::Paused);
+  pauseEncoders(level == Level::Paused);
+  LOG_F(INFO, "Resource governor: %s%s", levelName(level),
+    m_reduced.empty() ? "" : " (encoder priority stays reduced)");
+}
+
+ResourceGovernor::Sample ResourceGovernor::measure()
+{
+  Sample s{0.0, -1.0, getUserIdle()};
+
+  double load = 0.0;
+  std::ifstream la("/proc/loadavg");
+  if(la >> load)
+  {
+    unsigned own = 0;
+    for(const auto pid: m_pipeline.getEncoders())
+      own += countRunningThreads(pid);
+
+    s.foreignLoad = std::max(0.0, load - own) / m_cores;
+  }
+
+  // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+  std::ifstream psi("/proc/pressure/cpu");
+  std::string line;
+  while(std::getline(psi, line))
+  {
+    if(line.compare(0, 5, "some ") != 0)
+      continue;
+
+    const auto pos = line.find("avg10=");
+    if(pos != std::string::npos)
+      s.pressure = atof(line.c_str() + pos + 6);
+    break;
+  }
+
+  return s;
+}
+
+void ResourceGovernor::setPriority(int pid, bool lowPriority)
+{
+  if(configureProcess(pid, lowPriority))
+  {
+    m_reduced.erase(pid);
+    return;
+  }
+
+  // raising the niceness always works, lowering it again may not
+  if(!lowPriority)
+    m_reduced.insert(pid);
+  if(!m_priorityWarned)
+  {
+    m_priorityWarned = true;
+    LOG_F(WARNING, "Could not %s the priority of encoder %i: %s",
+      lowPriority ? "reduce" : "restore", pid, strerror(errno));
+  }
+}
+
+bool ResourceGovernor::configureProcess(int pid, bool lowPriority)
+{
+  bool ok = true;
+#ifndef WIN32
+  if(!m_configured.count(pid) && !m_cfg.governorCgroup.empty())
+  {
+    writeFile(m_cfg.governorCgroup + "/cgroup.procs", std::to_string(pid));
+  }
+
+  const int nice = lowPriority ? 19 : m_cfg.governorNice;
+  const int ioprio = lowPriority ?
+    IoprioClassIdle << IoprioClassShift :
+    (IoprioClassBestEffort << IoprioClassShift) | 7;
+
+  // niceness and I/O priority are per thread on linux
+  const std::string taskDir = "/proc/" + std::to_string(pid) + "/task";
+  DIR *dir = opendir(taskDir.c_str());
+  if(!dir)
+    return true;
+
+  struct dirent *ent;
+  int error = 0;
+  while((ent = readdir(dir)) != nullptr)
+  {
+    const int tid = atoi(ent->d_name);
+    if(tid <= 0)
+      continue;
+
+    // a thread may end meanwhile
+    if(setpriority(PRIO_PROCESS, tid, nice) != 0 && errno != ESRCH)
+    {
+      ok = false;
+      error = errno;
+    }
+    if(syscall(SYS_ioprio_set, IoprioWhoProcess, tid, ioprio) != 0 &&
+      errno != ESRCH)
+    {
+      ok = false;
+      error = errno;
+    }
+  }
+  closedir(dir);
+  errno = error;
+#endif
+  return ok;
+}
+
+void ResourceGovernor::pauseEncoders(bool pause)
+{
+#ifndef WIN32
+  for(const auto pid: m_pipeline.getEncoders())
+  {
+    kill(-pid, pause ? SIGSTOP : SIGCONT);
+  }
+#endif
+}
+
+void ResourceGovernor::setCpuQuota(int percent)
+{
+  if(m_cfg.governorCgroup.empty())
+    return;
+
+  std::stringstream ss;
+  if(percent >= 100 || percent <= 0)
+  {
+    ss << "max " << CgroupPeriod;
+  }
+  else
+  {
+    ss << static_cast<long>(m_cores) * percent * CgroupPeriod / 100 << " "
+       << CgroupPeriod;
+  }
+  writeFile(m_cfg.governorCgroup + "/cpu.max", ss.str());
+}
+
+unsigned ResourceGovernor::countRunningThreads(int pid) const
+{
+  unsigned running = 0;
+#ifndef WIN32
+  const std::string taskDir = "/proc/" + std::to_string(pid) + "/task";
+  DIR *dir = opendir(taskDir.c_str());
+  if(!dir)
+    return 0;
+
+  struct dirent *ent;
+  while((ent = readdir(dir)) != nullptr)
+  {
+    if(ent->d_name[0] == '.')
+      continue;
+
+    // pid (comm) S ...: the state follows the closing parenthesis
+    std::ifstream fs(taskDir + "/" + ent->d_name + "/stat");
+    std::string stat;
+    std::getline(fs, stat);
+    const auto pos = stat.rfind(')');
+    if(pos != std::string::npos && pos + 2 < stat.size() &&
+      stat[pos + 2] == 'R')
+    {
+      running++;
+    }
+  }
+  closedir(dir);
+#endif
+  return running;
+}
+
+int ResourceGovernor::getUserIdle() const
+{
+  if(!m_cfg.userIdleCommand.empty())
+  {
+    int idle = -1;
+    FILE *f = popen(m_cfg.userIdleCommand.c_str(), "r");
+    if(f)
+    {
+      long ms = 0;
+      if(fscanf(f, "%ld", &ms) == 1)
+        idle = static_cast<int>(ms / 1000);
+      pclose(f);
+    }
+    return idle;
+  }
+
+  // like 'w': the terminals are accessed on every keystroke
+  const time_t now = time(nullptr);
+  int idle = -1;
+  const auto check = [&](const std::string &path) {
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0)
+    {
+      const int i = static_cast<int>(std::max<time_t>(0, now - st.st_atime));
+      idle = idle < 0 ? i : std::min(idle, i);
+    }
+  };
+
+  const char *folders[] = {"/dev/pts", "/dev"};
+  for(const auto folder: folders)
+  {
+    DIR *dir = opendir(folder);
+    if(!dir)
+      continue;
+
+    struct dirent *ent;
+    const bool pts = strcmp(folder, "/dev/pts") == 0;
+    while((ent = readdir(dir)) != nullptr)
+    {
+      const char *n = ent->d_name;
+      const bool tty = pts ?
+        isdigit(n[0]) :
+        strncmp(n, "tty", 3) == 0 && isdigit(n[3]) && n[3] != '0';
+      if(tty)
+        check(std::string(folder) + "/" + n);
+    }
+    closedir(dir);
+  }
+
+  return idle;
+}
@@ -0,0 +1,91 @@
+#ifndef __RESOURCEGOVERNOR_HPP__
+#define __RESOURCEGOVERNOR_HPP__
+
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "MediaArchiverClientConfig.hpp"
+#include "EncodePipeline.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Watches the load of the machine and the activity of its user and
+ * throttles the running encoders accordingly, so that archiving uses only
+ * the spare cycles of shared workstations.
+ */
+class ResourceGovernor
+{
+public:
+  enum class Level : uint8_t
+  {
+    Full,    ///< machine is not used otherwise
+    Reduced, ///< other processes need the CPU
+    Paused,  ///< the user is working on the machine
+  };
+
+  struct Sample
+  {
+    double foreignLoad; ///< load per core not caused by the encoders
+    double pressure;    ///< PSI cpu some avg10 (%), negative if unknown
+    int userIdle;       ///< seconds since last user input, -1 if unknown
+  };
+
+  ResourceGovernor(const ClientConfig &cfg, EncodePipeline &pipeline);
+  ResourceGovernor(const ResourceGovernor &) = delete;
+  ~ResourceGovernor();
+
+  void start();
+  void stop();
+  Level getLevel() const;
+  /**
+   * @brief false some encoders kept the reduced priority after throttling,
+   * e.g. an unprivileged client may not lower the niceness again
+   */
+  bool isPriorityRestored() const;
+
+  /**
+   * @brief level the encoders should run with according to one sample,
+   * without hysteresis
+   */
+  Level evaluate(const Sample &sample) const;
+
+protected:
+  static constexpr int RecoverySamples = 3;
+  Sample measure();
+  /** throttle at once, release after RecoverySamples calm samples */
+  void update(Level wanted);
+  void apply(Level level);
+
+private:
+  void threadMain();
+  /** @return false the priority of a thread could not be set */
+  bool configureProcess(int pid, bool lowPriority);
+  void setPriority(int pid, bool lowPriority);
+  void pauseEncoders(bool pause);
+  void setCpuQuota(int percent);
+  unsigned countRunningThreads(int pid) const;
+  int getUserIdle() const;
+
+  const ClientConfig &m_cfg;
+  EncodePipeline &m_pipeline;
+  Level m_level;
+  int m_calmSamples;
+  bool m_stopping;
+  unsigned m_cores;
+  std::set<int> m_configured;
+  // encoders whose priority could not be restored
+  std::set<int> m_reduced;
+  bool m_priorityWarned;
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::unique_ptr<std::thread> m_thread;
+};
+}
+#endif // !__RESOURCEGOVERNOR_HPP__
@@ -0,0 +1,346 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#ifdef _MSVC_STL_VERSION
+#else
+  #include <dirent.h>
+#endif
+
+#include "ResultSpool.hpp"
+#include "MediaArchiverClient.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+bool moveFile(const std::string &src, const std::string &dst)
+{
+  if(std::rename(src.c_str(), dst.c_str()) == 0)
+    return true;
+
+  // e.g. from a staging folder on another file system
+  {
+    std::ifstream in(src, std::ios::in | std::ios::binary);
+    std::ofstream out(dst, std::ios::out | std::ios::binary);
+    if(!in.is_open() || !out.is_open() || !(out << in.rdbuf()))
+      return false;
+
+    out.close();
+    if(out.fail())
+      return false;
+  }
+  std::remove(src.c_str());
+  return true;
+}
+}
+
+ResultSpool::ResultSpool(const ClientConfig &cfg)
+  : m_cfg(cfg)
+  , m_stopping(false)
+  , m_pending(false)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<> dist(0, std::numeric_limits<int>::max());
+  m_token = std::to_string(dist(mt));
+}
+
+ResultSpool::~ResultSpool()
+{
+  stop();
+}
+
+void ResultSpool::load()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_entries.clear();
+
+  // jobId token sourceLength sourceTime settingsHash fileLength fileName
+  std::ifstream fs(m_cfg.spoolFolder + "/" + JournalName);
+  std::string line;
+  while(std::getline(fs, line))
+  {
+    std::istringstream ss(line);
+    // left over from an earlier run, no lane sends it anymore
+    Entry e{};
+    e.result.result = EncodingResultInfo(
+      EncodingResultInfo::EncodingResult::OK, 0, "");
+    ss >> e.result.jobId >> e.result.token >> e.result.sourceLength >>
+      e.result.sourceTime >> e.result.settingsHash >>
+      e.result.result.fileLength >> std::ws;
+    std::getline(ss, e.fileName);
+    if(ss.fail() || e.fileName.empty())
+    {
+      LOG_F(WARNING, "Spool: invalid journal entry '%s'", line.c_str());
+      continue;
+    }
+
+    std::ifstream f(e.fileName, std::ios::in | std::ios::binary);
+    f.seekg(0, std::ios_base::end);
+    if(!f.is_open() ||
+      static_cast<size_t>(f.tellg()) != e.result.result.fileLength)
+    {
+      LOG_F(WARNING, "Spool: file of job %u is missing or incomplete",
+        e.result.jobId);
+      continue;
+    }
+
+    m_entries[e.result.jobId] = e;
+  }
+
+  LOG_IF_F(INFO, !m_entries.empty(), "Spool: %lu results to upload",
+    m_entries.size());
+  writeJournal();
+  removeOrphans();
+}
+
+std::string ResultSpool::add(const SpooledResult &result,
+  const std::string &file, const std::string &extension)
+{
+  std::stringstream ss;
+  ss << m_cfg.spoolFolder << "/" << FilePrefix << result.jobId << extension;
+  const auto fileName = ss.str();
+
+  if(!moveFile(file, fileName))
+  {
+    throw IOError("could not move \"" + file + "\" to the spool");
+  }
+
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_entries[result.jobId] = Entry{result, fileName, true};
+  writeJournal();
+  LOG_F(1, "Spool: result of job %u spooled as %s", result.jobId,
+    fileName.c_str());
+  return fileName;
+}
+
+void ResultSpool::release(uint32_t jobId)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto it = m_entries.find(jobId);
+  if(it != m_entries.end())
+    it->second.owned = false;
+}
+
+void ResultSpool::remove(uint32_t jobId)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto it = m_entries.find(jobId);
+  if(it == m_entries.end())
+    return;
+
+  std::remove(it->second.fileName.c_str());
+  m_entries.erase(it);
+  writeJournal();
+}
+
+std::vector<ResultSpool::Entry> ResultSpool::getEntries() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  std::vector<Entry> entries;
+  for(const auto &e: m_entries)
+    entries.push_back(e.second);
+  return entries;
+}
+
+bool ResultSpool::upload()
+{
+  // a lane sends its own results with its own session
+  std::vector<Entry> entries;
+  for(const auto &e: getEntries())
+  {
+    if(!e.owned)
+      entries.push_back(e);
+  }
+  if(entries.empty())
+    return true;
+
+  try
+  {
+    std::unique_ptr<IServer> srv(createServer(m_cfg));
+    srv->authenticate(m_token);
+    // drop a transfer interrupted in an earlier round
+    srv->abort();
+
+    for(const auto &e: entries)
+    {
+      {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        if(m_stopping)
+          break;
+        // the job was handed to a lane again meanwhile
+        const auto it = m_entries.find(e.result.jobId);
+        if(it == m_entries.end() || it->second.owned)
+          continue;
+      }
+
+      if(srv->offerResult(e.result))
+      {
+        transmit(*srv, e);
+        LOG_F(INFO, "Spool: result of job %u uploaded", e.result.jobId);
+      }
+      else
+      {
+        LOG_F(INFO, "Spool: result of job %u is not needed anymore",
+          e.result.jobId);
+      }
+      remove(e.result.jobId);
+    }
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(WARNING, "Spool: upload failed: %s", e.what());
+    return false;
+  }
+
+  return true;
+}
+
+void ResultSpool::transmit(IServer &srv, const Entry &entry)
+{
+  std::ifstream fs(entry.fileName, std::ios::in | std::ios::binary);
+  if(!fs.is_open())
+  {
+    throw IOError("could not open spooled file " + entry.fileName);
+  }
+
+  DataChunk chunk(m_cfg.chunkSize);
+  bool more = true;
+  while(more)
+  {
+    chunk.resize(m_cfg.chunkSize);
+    fs.read(chunk.data(), chunk.size());
+    chunk.resize(fs.gcount());
+    more = srv.writeChunk(chunk);
+
+    if(more && fs.eof())
+    {
+      throw NetworkError(
+        "Server still wants to receive data but end of local file has been reached");
+    }
+  }
+}
+
+void ResultSpool::start()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_stopping = false;
+  if(!m_thread)
+  {
+    m_thread.reset(new std::thread([this]() { threadMain(); }));
+  }
+}
+
+void ResultSpool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    if(!m_thread)
+      return;
+    m_stopping = true;
+  }
+
+  m_cv.notify_all();
+  m_thread->join();
+  m_thread.reset();
+}
+
+void ResultSpool::wakeUp()
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_pending = true;
+  }
+  m_cv.notify_all();
+}
+
+void ResultSpool::threadMain()
+{
+  loguru::set_thread_name("spool");
+  bool ok = true;
+  std::unique_lock<std::mutex> lck(m_mtx);
+  while(!m_stopping)
+  {
+    // retry soon while the server is unreachable
+    const auto wait = ok ? m_cfg.checkForNewFileInterval : m_cfg.reconnectDelay;
+    m_cv.wait_for(lck, std::chrono::milliseconds(wait),
+      [this]() { return m_stopping || m_pending; });
+    if(m_stopping)
+      break;
+
+    m_pending = false;
+    lck.unlock();
+    ok = upload();
+    lck.lock();
+  }
+}
+
+void ResultSpool::writeJournal() const
+{
+  const auto journal = m_cfg.spoolFolder + "/" + JournalName;
+  const auto tmp = journal + ".tmp";
+  {
+    std::ofstream fs(tmp, std::ios::out | std::ios::trunc);
+    for(const auto &it: m_entries)
+    {
+      const auto &r = it.second.result;
+      fs << r.jobId << ' ' << r.token << ' ' << r.sourceLength << ' '
+         << r.sourceTime << ' ' << r.settingsHash << ' '
+         << r.result.fileLength << ' ' << it.second.fileName << '\n';
+    }
+
+    fs.close();
+    if(fs.fail())
+    {
+      throw IOError("could not write spool journal " + tmp);
+    }
+  }
+
+#ifdef WIN32
+  std::remove(journal.c_str());
+#endif
+  if(std::rename(tmp.c_str(), journal.c_str()) != 0)
+  {
+    throw IOError("could not replace spool journal " + journal);
+  }
+}
+
+void ResultSpool::removeOrphans() const
+{
+#ifndef _MSVC_STL_VERSION
+  // results spooled just before a crash that did not make it into the
+  // journal
+  DIR *dir = opendir(m_cfg.spoolFolder.c_str());
+  if(!dir)
+  {
+    LOG_F(ERROR, "Could not open spool folder \"%s\"",
+      m_cfg.spoolFolder.c_str());
+    return;
+  }
+
+  struct dirent *ent;
+  while((ent = readdir(dir)) != nullptr)
+  {
+    const std::string s(ent->d_name);
+    if(s.rfind(FilePrefix, 0) != 0)
+      continue;
+
+    const auto path = m_cfg.spoolFolder + "/" + s;
+    bool known = false;
+    for(const auto &e: m_entries)
+      known = known || e.second.fileName == path;
+
+    if(!known)
+    {
+      LOG_F(1, "Spool: removing orphan %s", path.c_str());
+      std::remove(path.c_str());
+    }
+  }
+  closedir(dir);
+#endif
+}
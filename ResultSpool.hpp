@@ -0,0 +1,89 @@
+#ifndef __RESULTSPOOL_HPP__
+#define __RESULTSPOOL_HPP__
+
+#include <cstdint>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IMediaArchiverServer.hpp"
+#include "MediaArchiverClientConfig.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Keeps finished encodings on disk until the server took them over.
+ * A journal in the spool folder describes the spooled results, so they
+ * survive restarts of the client and outages of the server. The results
+ * are uploaded in the background while the lanes encode further files.
+ */
+class ResultSpool
+{
+public:
+  struct Entry
+  {
+    SpooledResult result;
+    std::string fileName; ///< path of the spooled file
+    bool owned;           ///< still sent by its lane, not uploaded here
+  };
+
+  ResultSpool(const ClientConfig &cfg);
+  ResultSpool(const ResultSpool &) = delete;
+  ~ResultSpool();
+
+  /** read the journal, results without their file are dropped */
+  void load();
+
+  /**
+   * @brief move a finished encoding into the spool, it stays with the lane
+   * until released
+   *
+   * @param result identity of the job and its result
+   * @param file output file of the encoder
+   * @param extension extension of the output file
+   * @return std::string path of the spooled file
+   */
+  std::string add(const SpooledResult &result, const std::string &file,
+    const std::string &extension);
+  /** the lane gave up sending it, it is uploaded in the background */
+  void release(uint32_t jobId);
+  /** forget a result and delete its file */
+  void remove(uint32_t jobId);
+  std::vector<Entry> getEntries() const;
+
+  /**
+   * @brief offer the spooled results no lane owns to the server once
+   *
+   * @return false the server could not be reached
+   */
+  bool upload();
+
+  /** upload in the background */
+  void start();
+  void stop();
+  /** a result has been left to the spool */
+  void wakeUp();
+
+private:
+  static constexpr const char *JournalName = "spool.journal";
+  static constexpr const char *FilePrefix = "result";
+  void transmit(IServer &srv, const Entry &entry);
+  void writeJournal() const;
+  void removeOrphans() const;
+  void threadMain();
+
+  const ClientConfig &m_cfg;
+  std::string m_token;
+  std::map<uint32_t, Entry> m_entries;
+  bool m_stopping;
+  bool m_pending;
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::unique_ptr<std::thread> m_thread;
+};
+}
+#endif // !__RESULTSPOOL_HPP__
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cctype>
+#include <initializer_list>
+
+#include "IMediaArchiverServer.hpp"
+#include "RetryPolicy.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+struct ClassRule
+{
+  int attempts;          ///< handed out at most this often
+  unsigned delayFactor;  ///< first delay in units of the base delay
+  int64_t maxDelay;      ///< longest delay (s)
+  int quarantineRepeats; ///< identical failures quarantined, 0: never
+};
+
+ClassRule getRule(RetryPolicy::FailureClass failureClass)
+{
+  switch(failureClass)
+  {
+    case RetryPolicy::FailureClass::Transient: return {10, 1, 6 * 3600, 0};
+    case RetryPolicy::FailureClass::Resource: return {6, 2, 6 * 3600, 0};
+    case RetryPolicy::FailureClass::Encoder: return {3, 5, 24 * 3600, 2};
+    case RetryPolicy::FailureClass::Input: return {2, 10, 24 * 3600, 2};
+    default: return {0, 0, 0, 0};
+  }
+}
+
+std::string toLower(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(),
+    [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+
+bool containsAny(
+  const std::string &text, std::initializer_list<const char *> words)
+{
+  for(const auto w: words)
+  {
+    if(text.find(w) != std::string::npos)
+      return true;
+  }
+  return false;
+}
+
+// the line naming the cause, ffmpeg ends with a generic one
+std::string getCauseLine(const std::string &error)
+{
+  size_t end = error.size();
+  while(end > 0)
+  {
+    const auto pos = error.find_last_of("\r\n", end - 1);
+    const size_t begin = pos == std::string::npos ? 0 : pos + 1;
+    std::string line = error.substr(begin, end - begin);
+    end = pos == std::string::npos ? 0 : pos;
+
+    line.erase(0, line.find_first_not_of(" \t"));
+    line.erase(line.find_last_not_of(" \t") + 1);
+    if(line.empty() || line == "Conversion failed!" ||
+      !line.compare(0, 6, "frame=") || !line.compare(0, 5, "size="))
+    {
+      continue;
+    }
+    return line;
+  }
+  return std::string();
+}
+}
+
+RetryPolicy::RetryPolicy(unsigned baseDelay)
+  : m_baseDelay(baseDelay)
+{
+}
+
+RetryPolicy::Decision RetryPolicy::decide(int8_t result,
+  const std::string &error, int attempts, uint32_t lastSignature,
+  int lastRepeats, int64_t now) const
+{
+  Decision d;
+  d.failureClass = classify(result, error);
+  d.signature = getSignature(error);
+  d.repeats =
+    d.signature && d.signature == lastSignature ? lastRepeats + 1 : 1;
+
+  const auto rule = getRule(d.failureClass);
+  attempts = std::max(1, attempts);
+  d.quarantined = attempts >= rule.attempts ||
+    (rule.quarantineRepeats && d.repeats >= rule.quarantineRepeats);
+
+  // doubled with every attempt
+  int64_t delay = static_cast<int64_t>(m_baseDelay) * rule.delayFactor;
+  for(int i = 1; i < attempts && delay < rule.maxDelay; i++)
+    delay *= 2;
+  d.retryAt = d.quarantined ? 0 : now + std::min(delay, rule.maxDelay);
+  return d;
+}
+
+RetryPolicy::FailureClass RetryPolicy::classify(
+  int8_t result, const std::string &error)
+{
+  if(result <= EncodingResultInfo::EncodingResult::PermanentError)
+    return FailureClass::Permanent;
+  if(result == EncodingResultInfo::EncodingResult::ServerIOError)
+    return FailureClass::Transient;
+
+  const auto text = toLower(error);
+  if(containsAny(text, {"cannot allocate memory", "out of memory",
+                         "bad_alloc", "no space left", "disk quota",
+                         "killed"}))
+  {
+    return FailureClass::Resource;
+  }
+  if(containsAny(text, {"connection", "network", "timed out", "timeout",
+                         "broken pipe"}))
+  {
+    return FailureClass::Transient;
+  }
+  if(containsAny(text, {"invalid data found", "moov atom not found",
+                         "no such file", "could not find codec",
+                         "does not contain any stream", "corrupt"}))
+  {
+    return FailureClass::Input;
+  }
+  return FailureClass::Encoder;
+}
+
+uint32_t RetryPolicy::getSignature(const std::string &error)
+{
+  const auto line = toLower(getCauseLine(error));
+  if(line.empty())
+    return 0;
+
+  // FNV-1a, stable across builds as it is stored in the catalog
+  uint32_t hash = 2166136261u;
+  bool digits = false;
+  for(const unsigned char c: line)
+  {
+    if(std::isdigit(c))
+    {
+      if(digits)
+        continue;
+      digits = true;
+      hash = (hash ^ '#') * 16777619u;
+      continue;
+    }
+    digits = false;
+    hash = (hash ^ c) * 16777619u;
+  }
+  return hash ? hash : 1;
+}
+
+const char *RetryPolicy::getName(FailureClass failureClass)
+{
+  switch(failureClass)
+  {
+    case FailureClass::Transient: return "transient";
+    case FailureClass::Resource: return "resource";
+    case FailureClass::Encoder: return "encoder";
+    case FailureClass::Input: return "input";
+    case FailureClass::Permanent: return "permanent";
+    default: return "none";
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef __RETRYPOLICY_HPP__
+#define __RETRYPOLICY_HPP__
+
+#include <cstdint>
+#include <string>
+
+namespace MediaArchiver
+{
+/**
+ * @brief Decides when a failed job is handed out again. The failure is
+ * classified from the result and the error text; each class has its own
+ * number of attempts and a delay doubled with every attempt. A file that
+ * fails the same way again although the failure depends on the file only
+ * (encoder, unreadable source) is quarantined instead of retried.
+ */
+class RetryPolicy
+{
+public:
+  enum class FailureClass : int8_t
+  {
+    None = 0,
+    Transient = 1, ///< server storage or network, not the file's fault
+    Resource = 2,  ///< the client ran out of memory or disk, or was killed
+    Encoder = 3,   ///< the encoder failed on the file
+    Input = 4,     ///< the source cannot be read
+    Permanent = 5, ///< reported as not to be retried
+  };
+
+  struct Decision
+  {
+    FailureClass failureClass;
+    uint32_t signature; ///< identifies the failure, see getSignature
+    int repeats;        ///< identical failures in a row
+    int64_t retryAt;    ///< when the file may be handed out again (s)
+    bool quarantined;   ///< not handed out anymore
+  };
+
+  /** @param baseDelay seconds before the first retry, 0: at once */
+  explicit RetryPolicy(unsigned baseDelay);
+
+  /**
+   * @param result EncodingResultInfo::EncodingResult of the job
+   * @param error error text reported with it
+   * @param attempts times the file has been handed out
+   * @param lastSignature signature of the failure before, 0: none
+   * @param lastRepeats identical failures in a row before this one
+   * @param now current time (s)
+   */
+  Decision decide(int8_t result, const std::string &error, int attempts,
+    uint32_t lastSignature, int lastRepeats, int64_t now) const;
+
+  static FailureClass classify(int8_t result, const std::string &error);
+
+  /**
+   * @brief hash of the line of the error text telling the cause, numbers
+   * left out so progress and positions do not make failures differ
+   */
+  static uint32_t getSignature(const std::string &error);
+
+  static const char *getName(FailureClass failureClass);
+
+private:
+  unsigned m_baseDelay;
+};
+}
+
+#endif // !__RETRYPOLICY_HPP__
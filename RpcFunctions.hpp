@@ -15,6 +15,9 @@ const char getNextFile[] = "getNextFile";
 const char readChunk[] = "readChunk";
 const char postFile[] = "postFile";
 const char writeChunk[] = "writeChunk";
+const char offerResult[] = "offerResult";
+const char reportEstimate[] = "reportEstimate";
+const char checkJob[] = "checkJob";
 };
 }
 #endif
\ No newline at end of file
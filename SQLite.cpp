@@ -6,6 +6,7 @@ namespace MediaArchiver
 {
 SQLite::SQLite()
   : m_db(nullptr)
+  , m_retry(0)
 {
 }
 
@@ -46,6 +47,8 @@ void SQLite::connect(const char *connectionString, bool create)
       throw DBError(DBError::DBErrorCodes::EmptyDatabase,
         "Database is not initialized");
   }
+  upgradeTables();
+  loadPending();
   LOG_F(2, "Database opened");
 }
 
@@ -92,12 +95,129 @@ void SQLite::setupTables()
 {
   SQL
     << "BEGIN TRANSACTION;"
-       "CREATE TABLE sourcefiles (id INTEGER PRIMARY KEY AUTOINCREMENT, path TEXT, size INTEGER);"
-       "CREATE TABLE archives (id INTEGER PRIMARY KEY, path TEXT);"
-       "CREATE TABLE queue (id INTEGER, status INTEGER, count INTEGER, start timestamp, comment TEXT);"
+       "CREATE TABLE sourcefiles (id INTEGER PRIMARY KEY AUTOINCREMENT, path TEXT, size INTEGER, parent INTEGER, segment INTEGER, duration REAL, vcodec TEXT, acodec TEXT, width INTEGER, height INTEGER, bitrate INTEGER, fingerprint TEXT, device INTEGER, inode INTEGER, mtime INTEGER);"
+       "CREATE TABLE archives (id INTEGER PRIMARY KEY, path TEXT, remux INTEGER, preset TEXT, settings INTEGER);"
+       "CREATE TABLE queue (id INTEGER, status INTEGER, count INTEGER, start timestamp, comment TEXT, retryat INTEGER, failclass INTEGER, failsig INTEGER, repeats INTEGER);"
+       "CREATE TABLE jobs (id INTEGER PRIMARY KEY AUTOINCREMENT, file INTEGER, client TEXT, result INTEGER, remux INTEGER, seconds REAL, outsize INTEGER, duration REAL, size INTEGER, vcodec TEXT, height INTEGER, finished timestamp);"
        "COMMIT;";
 }
 
+void SQLite::upgradeTables()
+{
+  bool segments = false;
+  bool details = false;
+  bool fingerprint = false;
+  bool mtime = false;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      segments = segments || strcmp(fields[1], "parent") == 0;
+      details = details || strcmp(fields[1], "duration") == 0;
+      fingerprint = fingerprint || strcmp(fields[1], "fingerprint") == 0;
+      mtime = mtime || strcmp(fields[1], "mtime") == 0;
+      return 0;
+    }));
+  SQL << cb << "PRAGMA table_info(sourcefiles)";
+
+  if(!segments)
+  {
+    LOG_F(INFO, "Adding segment columns to the database");
+    SQL << "BEGIN TRANSACTION;"
+           "ALTER TABLE sourcefiles ADD COLUMN parent INTEGER;"
+           "ALTER TABLE sourcefiles ADD COLUMN segment INTEGER;"
+           "COMMIT;";
+  }
+
+  if(!details)
+  {
+    LOG_F(INFO, "Adding media detail columns to the database");
+    SQL << "BEGIN TRANSACTION;"
+           "ALTER TABLE sourcefiles ADD COLUMN duration REAL;"
+           "ALTER TABLE sourcefiles ADD COLUMN vcodec TEXT;"
+           "ALTER TABLE sourcefiles ADD COLUMN acodec TEXT;"
+           "ALTER TABLE sourcefiles ADD COLUMN width INTEGER;"
+           "ALTER TABLE sourcefiles ADD COLUMN height INTEGER;"
+           "ALTER TABLE sourcefiles ADD COLUMN bitrate INTEGER;"
+           "COMMIT;";
+  }
+
+  if(!fingerprint)
+  {
+    LOG_F(INFO, "Adding fingerprint columns to the database");
+    SQL << "BEGIN TRANSACTION;"
+           "ALTER TABLE sourcefiles ADD COLUMN fingerprint TEXT;"
+           "ALTER TABLE sourcefiles ADD COLUMN device INTEGER;"
+           "ALTER TABLE sourcefiles ADD COLUMN inode INTEGER;"
+           "COMMIT;";
+  }
+
+  if(!mtime)
+  {
+    LOG_F(INFO, "Adding modification time column to the database");
+    SQL << "ALTER TABLE sourcefiles ADD COLUMN mtime INTEGER";
+  }
+
+  bool remux = false;
+  bool preset = false;
+  bool settings = false;
+  cb.reset(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      remux = remux || strcmp(fields[1], "remux") == 0;
+      preset = preset || strcmp(fields[1], "preset") == 0;
+      settings = settings || strcmp(fields[1], "settings") == 0;
+      return 0;
+    }));
+  SQL << cb << "PRAGMA table_info(archives)";
+
+  if(!remux)
+  {
+    LOG_F(INFO, "Adding remux column to the database");
+    SQL << "ALTER TABLE archives ADD COLUMN remux INTEGER";
+  }
+
+  if(!preset)
+  {
+    LOG_F(INFO, "Adding preset column to the database");
+    SQL << "ALTER TABLE archives ADD COLUMN preset TEXT";
+  }
+
+  if(!settings)
+  {
+    LOG_F(INFO, "Adding settings column to the database");
+    SQL << "ALTER TABLE archives ADD COLUMN settings INTEGER";
+  }
+
+  bool retry = false;
+  cb.reset(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      retry = retry || strcmp(fields[1], "retryat") == 0;
+      return 0;
+    }));
+  SQL << cb << "PRAGMA table_info(queue)";
+
+  if(!retry)
+  {
+    // files failed 3 times were not handed out anymore before
+    LOG_F(INFO, "Adding retry columns to the database");
+    SQL << "BEGIN TRANSACTION;"
+           "ALTER TABLE queue ADD COLUMN retryat INTEGER;"
+           "ALTER TABLE queue ADD COLUMN failclass INTEGER;"
+           "ALTER TABLE queue ADD COLUMN failsig INTEGER;"
+           "ALTER TABLE queue ADD COLUMN repeats INTEGER;"
+           "UPDATE queue SET status=-101 WHERE status<0 AND status>=-99 AND count>=3;"
+           "COMMIT;";
+  }
+
+  // history of the encoded jobs for the cost model
+  SQL << "CREATE TABLE IF NOT EXISTS jobs (id INTEGER PRIMARY KEY AUTOINCREMENT, file INTEGER, client TEXT, result INTEGER, remux INTEGER, seconds REAL, outsize INTEGER, duration REAL, size INTEGER, vcodec TEXT, height INTEGER, finished timestamp)";
+
+  // lookups of single files, e.g. to refresh the pending index
+  SQL << "CREATE INDEX IF NOT EXISTS queue_id ON queue (id);"
+         "CREATE INDEX IF NOT EXISTS sourcefiles_path ON sourcefiles (path);"
+         "CREATE INDEX IF NOT EXISTS sourcefiles_parent ON sourcefiles (parent);"
+         "CREATE INDEX IF NOT EXISTS sourcefiles_fingerprint ON sourcefiles (size, fingerprint);"
+         "CREATE INDEX IF NOT EXISTS sourcefiles_inode ON sourcefiles (device, inode);";
+}
+
 void SQLite::execSql(const char *sql, sqlite3_callback cb, void *data) const
 {
   char *zErrMsg = nullptr;
@@ -121,70 +241,217 @@ void SQLite::disconnect()
   checkDBOpened();
 }
 
+namespace
+{
+// handed out by getNextFile: not queued, reset or failed and due for a
+// retry, see RetryPolicy
+constexpr const char *PendingCondition =
+  "(queue.status is null or queue.status=0 or (queue.status<0 and queue.status>=-99 and ifnull(queue.retryat,0)<=cast(strftime('%s','now') as integer)))";
+
+// failed files waiting for their retry time
+constexpr const char *RetryCondition =
+  "queue.status<0 and queue.status>=-99 and queue.retryat>cast(strftime('%s','now') as integer)";
+
+// the queue of a file not started yet
+constexpr const char *ClearedQueue =
+  "status=0,count=0,comment=NULL,retryat=NULL,failclass=NULL,failsig=NULL,repeats=NULL";
+
+// read by toPendingFile
+constexpr const char *PendingColumns =
+  "select sourcefiles.id, path, size, duration, vcodec, height, queue.status from sourcefiles left join queue using (id) where ";
+
+PendingFile toPendingFile(char **fields)
+{
+  return PendingFile{static_cast<uint32_t>(atol(fields[0])), fields[1],
+    static_cast<size_t>(atol(fields[2])),
+    fields[3] ? atof(fields[3]) : -1.0, fields[4] ? fields[4] : "",
+    fields[5] ? atoi(fields[5]) : 0, fields[6] && atoi(fields[6]) < 0};
+}
+}
+
 uint32_t SQLite::getNextFile(
   const MediaFileRequirements &filter, BasicFileInfo &file)
 {
   lock_guard<mutex> lck(m_mtx);
   checkDBOpened();
+  releaseRetries();
 
-  auto maxSize = filter.maxFileSize > 0 ?
-    filter.maxFileSize :
-    std::numeric_limits<size_t>().max();
+  const auto next = m_pending.first(filter.maxFileSize);
+  const uint32_t srcId = next ? next->id : 0;
+  if(!srcId || !start(srcId, file))
+  {
+    // no file has been found
+    file.fileSize = 0;
+    file.fileName = "";
+    return 0;
+  }
+  return srcId;
+}
 
-  uint32_t srcId = 0;
+uint32_t SQLite::startNextFile(
+  const std::function<uint32_t(const PendingIndex &)> &select,
+  BasicFileInfo &file)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+  releaseRetries();
+
+  const uint32_t srcId = select(m_pending);
+  if(!srcId || !m_pending.contains(srcId) || !start(srcId, file))
+  {
+    file.fileSize = 0;
+    file.fileName = "";
+    return 0;
+  }
+  return srcId;
+}
+
+bool SQLite::start(uint32_t srcFileId, BasicFileInfo &file)
+{
+  m_pending.erase(srcFileId);
 
+  bool found = false;
   auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
     [&](void *ptr, int argc, char **fields, char **names) {
-      srcId = atoi(fields[0]);
-      file.fileName = fields[1];
-      file.fileSize = atol(fields[2]);
-      return 1; // abort after 1st record
+      found = true;
+      file.fileName = fields[0];
+      file.fileSize = atol(fields[1]);
+      return 0;
     }));
 
-  SQL
-    << cb
-    << "select sourcefiles.id, path, size from sourcefiles join queue on queue.id=sourcefiles.id where sourcefiles.size <= "
-    << maxSize
-    << " and queue.status=0 union select sourcefiles.id, path, size from sourcefiles where sourcefiles.size <= "
-    << maxSize
-    << " and sourcefiles.id not in (select id from queue) union select sourcefiles.id, path, size from sourcefiles join queue on queue.id=sourcefiles.id where sourcefiles.size <= "
-    << maxSize
-    << " and queue.status<0 and queue.status >=-99 and queue.count < 3 LIMIT 1";
+  SQL << cb << "select path, size from sourcefiles where id=" << srcFileId;
+  if(!found)
+    return false;
+
+  // update queue/status, the file may not be queued yet
+  SQL << "update queue set status=1,count=count+1,start=" << ExecSQL::now
+      << " where id=" << srcFileId
+      << ";insert into queue (id,status,count,start) select " << srcFileId
+      << ",1,1," << ExecSQL::now << " where changes()=0";
+  return true;
+}
+
+void SQLite::setPendingRank(const PendingIndex::Rank &rank)
+{
+  lock_guard<mutex> lck(m_mtx);
+  m_pending.setRank(rank);
+  if(m_db)
+    loadPending();
+}
+
+void SQLite::loadPending()
+{
+  m_pending.clear();
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      const auto file = toPendingFile(fields);
+      if(!m_settling.count(file.id))
+        m_pending.insert(file);
+      return 0;
+    }));
+
+  SQL << cb << PendingColumns << PendingCondition;
+  LOG_F(2, "%lu files pending", m_pending.size());
+
+  m_retries.clear();
+  cb.reset(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      m_retries.emplace(atoll(fields[1]), atol(fields[0]));
+      return 0;
+    }));
+  SQL << cb << "select id, retryat from queue where " << RetryCondition;
+  LOG_F(2, "%lu failed files wait for a retry", m_retries.size());
+}
 
-  if(srcId == 0)
+void SQLite::releaseRetries()
+{
+  const int64_t now = time(nullptr);
+  while(!m_retries.empty() && m_retries.begin()->first <= now)
   {
-    // no file has been found
-    file.fileSize = 0;
-    file.fileName = "";
-    return 0;
+    // outdated ones are left out by refreshPending
+    const auto id = m_retries.begin()->second;
+    m_retries.erase(m_retries.begin());
+    refreshPending(id);
   }
+}
+
+void SQLite::refreshPending(uint32_t srcFileId)
+{
+  m_pending.erase(srcFileId);
+  if(m_settling.count(srcFileId))
+    return;
 
-  // update queue/status
-  int count = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      m_pending.insert(toPendingFile(fields));
+      return 0;
+    }));
+
+  SQL << cb << PendingColumns << "sourcefiles.id=" << srcFileId << " and "
+      << PendingCondition;
+}
+
+bool SQLite::reserveFile(uint32_t srcFileId, BasicFileInfo &file)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
   bool queued = false;
+  int status = 0;
 
-  cb.reset(new Sqlite3CallbackFunctor(
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
     [&](void *ptr, int argc, char **fields, char **names) {
-      count = atoi(fields[0]);
-      queued = true;
+      found = true;
+      file.fileName = fields[0];
+      file.fileSize = atol(fields[1]);
+      queued = fields[2] != NULL;
+      status = queued ? atoi(fields[2]) : 0;
       return 0;
     }));
 
-  // INSERT INTO queue VALUES(1930,5,0,'2019-11-22 20:46:05.336946',NULL);
-  SQL << cb << "select count from queue where queue.id=" << srcId;
-  cb.reset();
+  SQL
+    << cb
+    << "select path, size, queue.status from sourcefiles left join queue using (id) where sourcefiles.id="
+    << srcFileId;
+
+  if(!found || status >= EncodingResultInfo::EncodingResult::OK ||
+    status == EncodingResultInfo::EncodingResult::NoGain ||
+    m_settling.count(srcFileId))
+  {
+    return false;
+  }
 
   if(!queued)
   {
-    SQL << "insert into queue (id,status,count,start) VALUES (" << srcId
+    SQL << "insert into queue (id,status,count,start) VALUES (" << srcFileId
         << ",1,1," << ExecSQL::now << ")";
   }
   else
   {
-    SQL << "update queue set status=1,count=count+1,start=" << ExecSQL::now
-        << " where queue.id=" << srcId;
+    SQL << "update queue set status=1,start=" << ExecSQL::now
+        << " where queue.id=" << srcFileId;
   }
-  return srcId;
+  m_pending.erase(srcFileId);
+  return true;
+}
+
+bool SQLite::getFile(uint32_t srcFileId, BasicFileInfo &file)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      found = true;
+      file.fileName = fields[0] ? fields[0] : "";
+      file.fileSize = fields[1] ? atol(fields[1]) : 0;
+      return 0;
+    }));
+
+  SQL << cb << "select path, size from sourcefiles where id=" << srcFileId;
+  return found;
 }
 
 uint32_t SQLite::addFile(
@@ -200,6 +467,7 @@ uint32_t SQLite::addFile(
   bool inQueue = false;
   bool processed = false;
   bool putToQueue = false;
+  bool changed = false;
   string archiveName;
   auto cb = unique_ptr<Sqlite3CallbackFunctor>();
 
@@ -234,6 +502,7 @@ uint32_t SQLite::addFile(
           << ExecSQL::escape(src->fileName) << "'," << src->fileSize << ")";
 
       srcId = sqlite3_last_insert_rowid(m_db);
+      changed = true;
     }
 
     if(!inQueue && (queue || dstGiven))
@@ -244,6 +513,7 @@ uint32_t SQLite::addFile(
 
       putToQueue = true;
       inQueue = true;
+      changed = true;
     }
   }
 
@@ -263,6 +533,8 @@ uint32_t SQLite::addFile(
       else
       {
         // archive name already found at putting source
+        if(changed)
+          refreshPending(srcId);
         return srcId;
       }
     }
@@ -290,6 +562,7 @@ uint32_t SQLite::addFile(
 
     if(srcId)
     {
+      changed = true;
       // if archive not present, add it w/ srcId, if present just add to
       // queue if needed
       if(!found)
@@ -313,6 +586,8 @@ uint32_t SQLite::addFile(
     }
   }
 
+  if(srcId && changed)
+    refreshPending(srcId);
   return srcId;
 }
 void SQLite::addEncodedFile(const EncodedFile &file)
@@ -320,21 +595,367 @@ void SQLite::addEncodedFile(const EncodedFile &file)
   lock_guard<mutex> lck(m_mtx);
   checkDBOpened();
 
-  string comment("NULL");
+  if(file.result < EncodingResultInfo::EncodingResult::NotStarted &&
+    file.result > EncodingResultInfo::EncodingResult::PermanentError)
+  {
+    recordFailure(file);
+  }
+  else
+  {
+    string comment("NULL");
 
-  if(!file.error.empty())
-    comment = string("'") + ExecSQL::escape(file.error) + "'";
+    if(!file.error.empty())
+      comment = string("'") + ExecSQL::escape(file.error) + "'";
 
-  SQL << "update queue set status=" << file.result
-      << ",start=" << ExecSQL::now << ",comment=" << comment
-      << " where id=" << file.originalFileId;
+    SQL << "update queue set status=" << file.result
+        << ",start=" << ExecSQL::now << ",comment=" << comment
+        << ",retryat=NULL where id=" << file.originalFileId;
+  }
 
   if(file.fileLength > 0)
   {
-    SQL << "INSERT INTO archives (id,path) VALUES (" << file.originalFileId
-        << ",'" << ExecSQL::escape(file.fileName)
-        << "') on conflict do nothing";
+    const string preset = file.preset.empty() ?
+      string("NULL") :
+      string("'") + ExecSQL::escape(file.preset) + "'";
+    const string settings =
+      file.settings ? to_string(file.settings) : string("NULL");
+    // an archive encoded again replaces the one made with other settings
+    SQL << "INSERT INTO archives (id,path,remux,preset,settings) VALUES ("
+        << file.originalFileId << ",'" << ExecSQL::escape(file.fileName)
+        << "'," << (file.remux ? 1 : 0) << "," << preset << "," << settings
+        << ") on conflict(id) do update set path=excluded.path,"
+           "remux=excluded.remux,preset=excluded.preset,"
+           "settings=excluded.settings";
+  }
+  refreshPending(file.originalFileId);
+}
+
+void SQLite::recordFailure(const EncodedFile &file)
+{
+  int attempts = 0;
+  uint32_t lastSignature = 0;
+  int lastRepeats = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      attempts = fields[0] ? atoi(fields[0]) : 0;
+      lastSignature = fields[1] ? atoll(fields[1]) : 0;
+      lastRepeats = fields[2] ? atoi(fields[2]) : 0;
+      return 0;
+    }));
+  SQL << cb << "select count, failsig, repeats from queue where id="
+      << file.originalFileId;
+
+  const int64_t now = time(nullptr);
+  const auto d = m_retry.decide(
+    file.result, file.error, attempts, lastSignature, lastRepeats, now);
+  const int status = d.quarantined ?
+    EncodingResultInfo::EncodingResult::Quarantined :
+    file.result;
+
+  const string comment = file.error.empty() ?
+    string("NULL") :
+    string("'") + ExecSQL::escape(file.error) + "'";
+  const string retryAt =
+    d.quarantined ? string("NULL") : to_string(d.retryAt);
+  SQL << "update queue set status=" << status << ",start=" << ExecSQL::now
+      << ",comment=" << comment << ",retryat=" << retryAt
+      << ",failclass=" << static_cast<int>(d.failureClass)
+      << ",failsig=" << d.signature << ",repeats=" << d.repeats
+      << " where id=" << file.originalFileId;
+
+  if(d.quarantined)
+  {
+    LOG_F(WARNING, "File %u quarantined after %d attempts (%s, %d same)",
+      file.originalFileId, attempts, RetryPolicy::getName(d.failureClass),
+      d.repeats);
+  }
+  else
+  {
+    LOG_F(INFO, "File %u (%s failure) is retried in %lld s",
+      file.originalFileId, RetryPolicy::getName(d.failureClass),
+      static_cast<long long>(d.retryAt - now));
+    if(d.retryAt > now)
+      m_retries.emplace(d.retryAt, file.originalFileId);
+  }
+}
+
+void SQLite::setRetryPolicy(const RetryPolicy &policy)
+{
+  lock_guard<mutex> lck(m_mtx);
+  m_retry = policy;
+}
+
+bool SQLite::getFailure(uint32_t srcFileId, FailureInfo &failure)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      failure.status = atoi(fields[0]);
+      found =
+        failure.status < EncodingResultInfo::EncodingResult::NotStarted;
+      failure.attempts = fields[1] ? atoi(fields[1]) : 0;
+      failure.repeats = fields[2] ? atoi(fields[2]) : 0;
+      failure.retryAt = fields[3] ? atoll(fields[3]) : 0;
+      failure.failureClass = static_cast<RetryPolicy::FailureClass>(
+        fields[4] ? atoi(fields[4]) : 0);
+      failure.error = fields[5] ? fields[5] : "";
+      return 0;
+    }));
+
+  SQL << cb
+      << "select status, count, repeats, retryat, failclass, comment from queue where status is not null and id="
+      << srcFileId;
+  return found;
+}
+
+uint32_t SQLite::getFileId(const std::string &fileName)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  uint32_t srcId = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      srcId = atoi(fields[0]);
+      return 0;
+    }));
+
+  SQL << cb << "select id from sourcefiles where path='"
+      << ExecSQL::escape(fileName) << "'";
+  return srcId;
+}
+
+uint32_t SQLite::moveFile(const std::string &from, const std::string &to)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  uint32_t srcId = 0;
+  uint32_t replaced = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      if(strcmp(fields[1], "from") == 0)
+        srcId = atoi(fields[0]);
+      else
+        replaced = atoi(fields[0]);
+      return 0;
+    }));
+
+  SQL << cb << "select id,'from' from sourcefiles where path='"
+      << ExecSQL::escape(from)
+      << "' union all select id,'to' from sourcefiles where path='"
+      << ExecSQL::escape(to) << "'";
+
+  if(!srcId)
+  {
+    // an archive was renamed
+    cb.reset(new Sqlite3CallbackFunctor(
+      [&](void *ptr, int argc, char **fields, char **names) {
+        srcId = atoi(fields[0]);
+        return 0;
+      }));
+    SQL << cb << "select id from archives where path='"
+        << ExecSQL::escape(from) << "'";
+    if(srcId)
+    {
+      SQL << "update archives set path='" << ExecSQL::escape(to)
+          << "' where id=" << srcId;
+    }
+    return srcId;
+  }
+
+  if(replaced && replaced != srcId)
+  {
+    LOG_F(WARNING, "%s was replaced by %s", to.c_str(), from.c_str());
+    SQL << "delete from queue where id=" << replaced
+        << ";delete from archives where id=" << replaced
+        << ";delete from sourcefiles where id=" << replaced;
+    m_pending.erase(replaced);
+  }
+
+  SQL << "update sourcefiles set path='" << ExecSQL::escape(to)
+      << "' where id=" << srcId;
+  if(m_pending.contains(srcId))
+    refreshPending(srcId);
+  return srcId;
+}
+
+size_t SQLite::moveDirectory(const std::string &from, const std::string &to)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  // everything below from/ is the range [from/, from0) of the path index
+  const auto src = ExecSQL::escape(from);
+  stringstream ss;
+  ss << " set path='" << ExecSQL::escape(to) << "'||substr(path,length('"
+     << src << "')+1) where path>='" << src << "/' and path<'" << src
+     << "0'";
+
+  SQL << "update sourcefiles" << ss.str();
+  const size_t moved = sqlite3_changes(m_db);
+  SQL << "update archives" << ss.str();
+
+  // the rank may depend on the folder
+  if(moved)
+    loadPending();
+  return moved;
+}
+
+bool SQLite::updateFileStat(uint32_t srcFileId, size_t size, int64_t mtime)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
+  bool known = false;
+  size_t oldSize = 0;
+  int64_t oldTime = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      found = true;
+      oldSize = fields[0] ? strtoull(fields[0], nullptr, 10) : 0;
+      known = fields[1] != NULL;
+      oldTime = known ? strtoll(fields[1], nullptr, 10) : 0;
+      return 0;
+    }));
+
+  SQL << cb << "select size, mtime from sourcefiles where id=" << srcFileId;
+  if(!found || (oldSize == size && known && oldTime == mtime))
+    return false;
+
+  SQL << "update sourcefiles set size=" << size
+      << ",mtime=" << std::to_string(mtime)
+      << " where id=" << srcFileId;
+
+  // catalogued before the times were recorded, only the size tells
+  if(oldSize == size && !known)
+    return false;
+
+  // the archive of the old content is replaced once encoded again
+  SQL << "update queue set " << ClearedQueue << " where id=" << srcFileId;
+  refreshPending(srcFileId);
+  return true;
+}
+
+bool SQLite::removeFile(uint32_t srcFileId)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
+  bool segment = false;
+  int status = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      found = true;
+      segment = fields[0] != NULL;
+      status = fields[1] ? atoi(fields[1]) : 0;
+      return 0;
+    }));
+
+  SQL
+    << cb
+    << "select parent, queue.status from sourcefiles left join queue using (id) where sourcefiles.id="
+    << srcFileId;
+
+  // segments go with their source file
+  if(!found || segment ||
+    status == EncodingResultInfo::EncodingResult::OK)
+  {
+    return false;
+  }
+
+  SQL << "BEGIN TRANSACTION;"
+         "delete from queue where id="
+      << srcFileId << ";delete from archives where id=" << srcFileId
+      << ";delete from sourcefiles where id=" << srcFileId << ";COMMIT;";
+  m_pending.erase(srcFileId);
+  m_settling.erase(srcFileId);
+  return true;
+}
+
+std::vector<uint32_t> SQLite::removeDirectory(const std::string &folder)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  std::vector<uint32_t> ids;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      ids.push_back(atoi(fields[0]));
+      return 0;
+    }));
+
+  // the range [folder/, folder0) of the path index, see moveDirectory
+  const auto path = ExecSQL::escape(folder);
+  stringstream below;
+  below << "parent is null and path>='" << path << "/' and path<'" << path
+        << "0'";
+  SQL << cb << "select id from sourcefiles where " << below.str();
+  if(ids.empty())
+    return ids;
+
+  // segments go with their source file, archived ones are kept
+  stringstream gone;
+  gone << "(select id from sourcefiles where " << below.str()
+       << " and id not in (select id from queue where status="
+       << std::to_string(EncodingResultInfo::EncodingResult::OK) << "))";
+  SQL << "BEGIN TRANSACTION;"
+         "delete from queue where id in "
+      << gone.str() << ";delete from archives where id in " << gone.str()
+      << ";delete from sourcefiles where id in " << gone.str()
+      << ";COMMIT;";
+
+  for(const auto id: ids)
+  {
+    m_pending.erase(id);
+    m_settling.erase(id);
+  }
+  return ids;
+}
+
+void SQLite::setSettling(uint32_t srcFileId, bool settling)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  if(settling)
+  {
+    m_settling.insert(srcFileId);
+    m_pending.erase(srcFileId);
   }
+  else if(m_settling.erase(srcFileId))
+    refreshPending(srcFileId);
+}
+
+uint32_t SQLite::removeArchive(const std::string &fileName)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  uint32_t srcId = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      srcId = atoi(fields[0]);
+      return 0;
+    }));
+
+  // encoded segments are removed after joining them
+  SQL
+    << cb
+    << "select archives.id from archives join sourcefiles using (id) where parent is null and archives.path='"
+    << ExecSQL::escape(fileName) << "'";
+  if(!srcId)
+    return 0;
+
+  SQL << "delete from archives where id=" << srcId
+      << ";update queue set " << ClearedQueue << " where id=" << srcId;
+  refreshPending(srcId);
+  return srcId;
 }
 
 void SQLite::checkDBOpened() const
@@ -351,5 +972,408 @@ void SQLite::reset(uint32_t srcFileId)
 
   SQL << "update queue set status=0"
       << " where id=" << srcFileId;
+  refreshPending(srcFileId);
+}
+
+void SQLite::addSegments(
+  uint32_t srcFileId, const std::vector<BasicFileInfo> &segments)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  std::vector<uint32_t> ids;
+  SQL << "BEGIN TRANSACTION";
+  try
+  {
+    for(size_t i = 0; i < segments.size(); ++i)
+    {
+      SQL << "INSERT INTO sourcefiles (path,size,parent,segment) VALUES('"
+          << ExecSQL::escape(segments[i].fileName) << "',"
+          << segments[i].fileSize << "," << srcFileId << ","
+          << static_cast<uint32_t>(i) << ")";
+
+      const uint32_t id = sqlite3_last_insert_rowid(m_db);
+      ids.push_back(id);
+      SQL << "INSERT INTO queue (id,status,count,start) VALUES(" << id
+          << ",0,0," << ExecSQL::now << ")";
+    }
+
+    SQL << "update queue set status="
+        << EncodingResultInfo::EncodingResult::Segmented
+        << ",start=" << ExecSQL::now << " where id=" << srcFileId;
+    SQL << "COMMIT";
+  }
+  catch(const DBError &)
+  {
+    SQL << "ROLLBACK";
+    throw;
+  }
+
+  refreshPending(srcFileId);
+  for(const auto id: ids)
+    refreshPending(id);
+}
+
+std::vector<SegmentInfo> SQLite::getSegments(uint32_t srcFileId)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  std::vector<SegmentInfo> segments;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      SegmentInfo s;
+      s.id = atoi(fields[0]);
+      s.index = fields[1] ? atoi(fields[1]) : 0;
+      s.fileName = fields[2] ? fields[2] : "";
+      s.archiveName = fields[3] ? fields[3] : "";
+      s.status = fields[4] ? atoi(fields[4]) : 0;
+      s.count = fields[5] ? atoi(fields[5]) : 0;
+      segments.push_back(s);
+      return 0;
+    }));
+
+  SQL
+    << cb
+    << "select sourcefiles.id, segment, sourcefiles.path, archives.path, queue.status, queue.count from sourcefiles left join queue using (id) left join archives using (id) where parent="
+    << srcFileId << " order by segment";
+  return segments;
+}
+
+uint32_t SQLite::getParent(uint32_t fileId)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  uint32_t parent = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      parent = fields[0] ? atoi(fields[0]) : 0;
+      return 0;
+    }));
+
+  SQL << cb << "select parent from sourcefiles where id=" << fileId;
+  return parent;
+}
+
+std::vector<uint32_t> SQLite::getSegmentedFiles()
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  std::vector<uint32_t> ids;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      ids.push_back(atoi(fields[0]));
+      return 0;
+    }));
+
+  SQL << cb << "select id from queue where status="
+      << EncodingResultInfo::EncodingResult::Segmented;
+  return ids;
+}
+
+void SQLite::removeSegments(uint32_t srcFileId)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      m_pending.erase(static_cast<uint32_t>(atol(fields[0])));
+      return 0;
+    }));
+  SQL << cb << "select id from sourcefiles where parent=" << srcFileId;
+
+  SQL << "BEGIN TRANSACTION;"
+         "delete from archives where id in (select id from sourcefiles where parent="
+      << srcFileId
+      << ");"
+         "delete from queue where id in (select id from sourcefiles where parent="
+      << srcFileId << ");"
+      << "delete from sourcefiles where parent=" << srcFileId << ";"
+      << "COMMIT;";
+}
+
+void SQLite::setMediaDetails(uint32_t srcFileId, const MediaDetails &details)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  const auto text = [](const std::string &s) {
+    return s.empty() ? string("NULL") : "'" + ExecSQL::escape(s) + "'";
+  };
+
+  SQL << "update sourcefiles set duration=" << details.duration
+      << ",vcodec=" << text(details.videoCodec)
+      << ",acodec=" << text(details.audioCodec)
+      << ",width=" << details.width << ",height=" << details.height
+      << ",bitrate=" << details.bitRate << " where id=" << srcFileId;
+
+  // the rank may depend on the details
+  if(m_pending.contains(srcFileId))
+    refreshPending(srcFileId);
+}
+
+bool SQLite::getMediaDetails(uint32_t srcFileId, MediaDetails &details)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      found = true;
+      details.duration = atof(fields[0]);
+      details.videoCodec = fields[1] ? fields[1] : "";
+      details.audioCodec = fields[2] ? fields[2] : "";
+      details.width = fields[3] ? atoi(fields[3]) : 0;
+      details.height = fields[4] ? atoi(fields[4]) : 0;
+      details.bitRate = fields[5] ? atoi(fields[5]) : 0;
+      return 0;
+    }));
+
+  SQL << cb
+      << "select duration, vcodec, acodec, width, height, bitrate from sourcefiles where duration is not null and id="
+      << srcFileId;
+  return found;
+}
+
+bool SQLite::getArchive(uint32_t srcFileId, ArchiveInfo &archive)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      found = true;
+      archive.fileName = fields[0] ? fields[0] : "";
+      archive.remux = fields[1] && atoi(fields[1]) != 0;
+      archive.preset = fields[2] ? fields[2] : "";
+      archive.settings =
+        fields[3] ? static_cast<uint32_t>(strtoul(fields[3], nullptr, 10)) : 0;
+      return 0;
+    }));
+
+  SQL << cb << "select path, remux, preset, settings from archives where id="
+      << srcFileId;
+  return found;
+}
+
+namespace
+{
+/** hex, SQLite integers are signed */
+std::string toHex(uint64_t hash)
+{
+  char hex[17];
+  snprintf(
+    hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+  return hex;
+}
+}
+
+void SQLite::setFingerprint(uint32_t srcFileId, const SourceFingerprint &fp)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  SQL << "update sourcefiles set fingerprint='" << toHex(fp.hash)
+      << "',device=" << static_cast<unsigned long>(fp.device)
+      << ",inode=" << static_cast<unsigned long>(fp.inode)
+      << " where id=" << srcFileId;
+}
+
+bool SQLite::getFingerprint(uint32_t srcFileId, SourceFingerprint &fp)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  bool found = false;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      found = true;
+      fp.hash = strtoull(fields[0], nullptr, 16);
+      fp.device = fields[1] ? strtoull(fields[1], nullptr, 10) : 0;
+      fp.inode = fields[2] ? strtoull(fields[2], nullptr, 10) : 0;
+      return 0;
+    }));
+
+  SQL << cb
+      << "select fingerprint, device, inode from sourcefiles where fingerprint is not null and id="
+      << srcFileId;
+  return found;
+}
+
+namespace
+{
+/** the other source files with the same size and hash or inode */
+std::string getTwinCondition(uint32_t srcFileId)
+{
+  const auto id = std::to_string(srcFileId);
+  return "sourcefiles.id<>" + id +
+    " and sourcefiles.id in (select t.id from sourcefiles s join sourcefiles t on t.size=s.size and t.fingerprint=s.fingerprint where s.id=" +
+    id +
+    " union select t.id from sourcefiles s join sourcefiles t on t.device=s.device and t.inode=s.inode where s.id=" +
+    id + ")";
+}
+}
+
+std::vector<uint32_t> SQLite::findFiles(
+  const SourceFingerprint &fp, size_t size)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  std::vector<uint32_t> files;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      files.push_back(atoi(fields[0]));
+      return 0;
+    }));
+
+  SQL << cb << "select id from sourcefiles where size=" << size
+      << " and fingerprint='" << toHex(fp.hash)
+      << "' and device=" << static_cast<unsigned long>(fp.device)
+      << " and inode=" << static_cast<unsigned long>(fp.inode);
+  return files;
+}
+
+uint32_t SQLite::findArchivedTwin(uint32_t srcFileId)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  uint32_t twin = 0;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      twin = atoi(fields[0]);
+      return 0;
+    }));
+
+  SQL << cb
+      << "select sourcefiles.id from sourcefiles join queue using (id) join archives using (id) where queue.status="
+      << static_cast<int>(EncodingResultInfo::EncodingResult::OK) << " and "
+      << getTwinCondition(srcFileId) << " limit 1";
+  return twin;
+}
+
+std::vector<uint32_t> SQLite::getPendingTwins(uint32_t srcFileId)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  std::vector<uint32_t> twins;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      twins.push_back(atoi(fields[0]));
+      return 0;
+    }));
+
+  SQL << cb
+      << "select sourcefiles.id from sourcefiles left join queue using (id) where "
+      << getTwinCondition(srcFileId) << " and " << PendingCondition;
+  return twins;
+}
+
+void SQLite::setUnknownArchiveSettings(uint32_t settings)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  SQL << "update archives set settings=" << settings
+      << " where settings is null";
+}
+
+std::vector<uint32_t> SQLite::getOutdatedArchives(
+  uint32_t settings, ReencodeOrder order, size_t limit)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  const char *orderBy = "archives.id";
+  if(order == ReencodeOrder::Largest)
+    orderBy = "sourcefiles.size desc";
+  else if(order == ReencodeOrder::Smallest)
+    orderBy = "sourcefiles.size";
+
+  std::vector<uint32_t> files;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      files.push_back(atoi(fields[0]));
+      return 0;
+    }));
+
+  // only the successfully archived ones, a file that did not gain anything
+  // with the new settings keeps its archive and is not tried again
+  SQL << cb
+      << "select archives.id from archives join queue using (id) join sourcefiles using (id) where queue.status="
+      << static_cast<int>(EncodingResultInfo::EncodingResult::OK)
+      << " and (archives.remux is null or archives.remux=0) and archives.settings<>"
+      << settings << " order by " << orderBy << " limit " << limit;
+  return files;
+}
+
+void SQLite::addJob(const JobRecord &job)
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  SQL << "insert into jobs (file, client, result, remux, seconds, outsize, duration, size, vcodec, height, finished) select id, '"
+      << ExecSQL::escape(job.client) << "', " << static_cast<int>(job.result)
+      << ", " << (job.remux ? 1 : 0) << ", " << job.seconds << ", "
+      << static_cast<unsigned long>(job.outputSize)
+      << ", duration, size, vcodec, height, " << ExecSQL::now
+      << " from sourcefiles where id=" << job.fileId;
+}
+
+std::vector<JobRecord> SQLite::getJobs()
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+
+  std::vector<JobRecord> jobs;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      jobs.emplace_back(JobRecord{static_cast<uint32_t>(atol(fields[0])),
+        fields[1] ? fields[1] : "", static_cast<int8_t>(atoi(fields[2])),
+        atoi(fields[3]) != 0, atof(fields[4]),
+        static_cast<uint64_t>(atoll(fields[5])),
+        fields[6] ? atof(fields[6]) : -1.0,
+        static_cast<uint64_t>(atoll(fields[7])), fields[8] ? fields[8] : "",
+        fields[9] ? atoi(fields[9]) : 0});
+      return 0;
+    }));
+
+  SQL << cb
+      << "select file, client, result, remux, seconds, outsize, duration, size, vcodec, height from jobs order by id";
+  return jobs;
+}
+
+std::vector<PendingFile> SQLite::getPendingFiles()
+{
+  lock_guard<mutex> lck(m_mtx);
+  checkDBOpened();
+  releaseRetries();
+
+  std::unordered_map<uint32_t, PendingFile> details;
+  auto cb = unique_ptr<Sqlite3CallbackFunctor>(new Sqlite3CallbackFunctor(
+    [&](void *ptr, int argc, char **fields, char **names) {
+      auto f = toPendingFile(fields);
+      details.emplace(f.id, std::move(f));
+      return 0;
+    }));
+
+  SQL << cb << PendingColumns << PendingCondition;
+
+  std::vector<PendingFile> files;
+  files.reserve(m_pending.size());
+  for(const auto &e: m_pending)
+  {
+    auto it = details.find(e.id);
+    if(it != details.end())
+      files.emplace_back(std::move(it->second));
+  }
+  return files;
+}
 }
-}
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include <memory>
 #include <sqlite3.h>
 #include <mutex>
+#include <map>
+#include <set>
 #include <functional>
 #include <chrono>
 #include <iomanip>
@@ -29,10 +31,59 @@ public:
   virtual void disconnect() override;
   virtual uint32_t getNextFile(
     const MediaFileRequirements &filter, BasicFileInfo &file) override;
+  virtual bool reserveFile(
+    uint32_t srcFileId, BasicFileInfo &file) override;
+  virtual void setPendingRank(const PendingIndex::Rank &rank) override;
+  virtual uint32_t startNextFile(
+    const std::function<uint32_t(const PendingIndex &)> &select,
+    BasicFileInfo &file) override;
+  virtual bool getFile(uint32_t srcFileId, BasicFileInfo &file) override;
   virtual uint32_t addFile(const BasicFileInfo *src,
     const BasicFileInfo *dst, bool queue) override;
   virtual void addEncodedFile(const EncodedFile &file) override;
+  virtual uint32_t getFileId(const std::string &fileName) override;
+  virtual uint32_t moveFile(
+    const std::string &from, const std::string &to) override;
+  virtual size_t moveDirectory(
+    const std::string &from, const std::string &to) override;
+  virtual bool updateFileStat(
+    uint32_t srcFileId, size_t size, int64_t mtime) override;
+  virtual bool removeFile(uint32_t srcFileId) override;
+  virtual std::vector<uint32_t> removeDirectory(
+    const std::string &folder) override;
+  virtual uint32_t removeArchive(const std::string &fileName) override;
+  virtual void setSettling(uint32_t srcFileId, bool settling) override;
+  virtual void setRetryPolicy(const RetryPolicy &policy) override;
+  virtual bool getFailure(
+    uint32_t srcFileId, FailureInfo &failure) override;
   virtual void reset(uint32_t srcFileId) override;
+  virtual void addSegments(uint32_t srcFileId,
+    const std::vector<BasicFileInfo> &segments) override;
+  virtual std::vector<SegmentInfo> getSegments(uint32_t srcFileId) override;
+  virtual uint32_t getParent(uint32_t fileId) override;
+  virtual std::vector<uint32_t> getSegmentedFiles() override;
+  virtual void removeSegments(uint32_t srcFileId) override;
+  virtual void setMediaDetails(
+    uint32_t srcFileId, const MediaDetails &details) override;
+  virtual bool getMediaDetails(
+    uint32_t srcFileId, MediaDetails &details) override;
+  virtual bool getArchive(
+    uint32_t srcFileId, ArchiveInfo &archive) override;
+  virtual void setFingerprint(
+    uint32_t srcFileId, const SourceFingerprint &fp) override;
+  virtual bool getFingerprint(
+    uint32_t srcFileId, SourceFingerprint &fp) override;
+  virtual std::vector<uint32_t> findFiles(
+    const SourceFingerprint &fp, size_t size) override;
+  virtual uint32_t findArchivedTwin(uint32_t srcFileId) override;
+  virtual std::vector<uint32_t> getPendingTwins(
+    uint32_t srcFileId) override;
+  virtual void setUnknownArchiveSettings(uint32_t settings) override;
+  virtual std::vector<uint32_t> getOutdatedArchives(
+    uint32_t settings, ReencodeOrder order, size_t limit) override;
+  virtual void addJob(const JobRecord &job) override;
+  virtual std::vector<JobRecord> getJobs() override;
+  virtual std::vector<PendingFile> getPendingFiles() override;
   virtual ~SQLite();
 
   using Sqlite3CallbackFunctor =
@@ -43,11 +94,29 @@ private:
   static int sqliteCallbackInvoker(void *, int, char **, char **);
   void checkDBOpened() const;
   bool isDBInitialized() const;
+  /** set the queue of a file to started and count the attempt */
+  bool start(uint32_t srcFileId, BasicFileInfo &file);
+  /** fill the pending index from the catalog */
+  void loadPending();
+  /** update the file in the pending index after its queue has changed */
+  void refreshPending(uint32_t srcFileId);
+  /** put the failed files whose retry time has come into m_pending */
+  void releaseRetries();
+  /** queue a failed job again or quarantine it, see RetryPolicy */
+  void recordFailure(const EncodedFile &file);
   void setupTables();
+  /** add the columns of newer versions to an existing database */
+  void upgradeTables();
   void execSql(const char *sql, sqlite3_callback cb = nullptr,
     void *data = nullptr) const;
   sqlite3 *m_db;
   mutex m_mtx;
+  PendingIndex m_pending;
+  // still being written, left out of m_pending
+  std::set<uint32_t> m_settling;
+  RetryPolicy m_retry;
+  // failed files by the time they are handed out again
+  std::multimap<int64_t, uint32_t> m_retries;
 };
 
 #define SQL ExecSQL(this)
@@ -109,6 +178,11 @@ public:
     m_ss << std::to_string(i);
     return *this;
   }
+  ExecSQL &operator<<(double d)
+  {
+    m_ss << std::to_string(d);
+    return *this;
+  }
   ExecSQL &operator<<(std::_Put_time<char> i)
   {
     m_ss << "'" << i << "'";
@@ -112,6 +112,27 @@ public:
     m_rpc->call(RpcFunctions::postFile, result);
   }
 
+  virtual bool offerResult(const SpooledResult &result) override
+  {
+    LOG_F(INFO, "Offering spooled result of job %u (%lu)", result.jobId,
+      result.result.fileLength);
+    return m_rpc->call(RpcFunctions::offerResult, result).as<bool>();
+  }
+
+  virtual EstimateVerdict reportEstimate(
+    const EncodeEstimate &estimate) override
+  {
+    LOG_F(INFO, "Reporting estimate: %.0f%% of the source, %.2fx realtime",
+      estimate.sizeRatio * 100, estimate.speed);
+    return m_rpc->call(RpcFunctions::reportEstimate, estimate)
+      .as<EstimateVerdict>();
+  }
+
+  virtual bool checkJob() override
+  {
+    return m_rpc->call(RpcFunctions::checkJob).as<bool>();
+  }
+
   virtual bool writeChunk(const DataChunk &data) override
   {
     try
@@ -0,0 +1,62 @@
+#include <algorithm>
+
+#include "SettleWheel.hpp"
+
+using namespace MediaArchiver;
+
+SettleWheel::SettleWheel(unsigned quietTicks, unsigned slots)
+  : m_slots(std::max(1u, slots))
+  , m_quietTicks(std::max(1u, quietTicks))
+  , m_pos(0)
+  , m_generation(0)
+{
+}
+
+void SettleWheel::add(const Entry &entry)
+{
+  // the slot visited after quietTicks ticks
+  const size_t n = m_slots.size();
+  const auto slot = (m_pos + m_quietTicks) % n;
+  const auto rounds = static_cast<unsigned>((m_quietTicks - 1) / n);
+
+  m_timers[entry.id] = ++m_generation;
+  m_slots[slot].push_back(Timer{entry, rounds, m_generation});
+}
+
+void SettleWheel::erase(uint32_t id)
+{
+  m_timers.erase(id);
+}
+
+bool SettleWheel::contains(uint32_t id) const
+{
+  return m_timers.count(id) > 0;
+}
+
+std::vector<SettleWheel::Entry> SettleWheel::tick()
+{
+  m_pos = (m_pos + 1) % m_slots.size();
+  auto &slot = m_slots[m_pos];
+
+  std::vector<Entry> due;
+  size_t kept = 0;
+  for(auto &t: slot)
+  {
+    const auto it = m_timers.find(t.entry.id);
+    if(it == m_timers.end() || it->second != t.generation)
+      continue;
+
+    if(t.rounds)
+    {
+      t.rounds--;
+      if(&slot[kept] != &t)
+        slot[kept] = std::move(t);
+      kept++;
+      continue;
+    }
+    m_timers.erase(it);
+    due.push_back(std::move(t.entry));
+  }
+  slot.resize(kept);
+  return due;
+}
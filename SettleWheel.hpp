@@ -0,0 +1,66 @@
+#ifndef __SETTLEWHEEL_HPP__
+#define __SETTLEWHEEL_HPP__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MediaArchiver
+{
+/**
+ * @brief The source files still being written, each waiting for a quiet
+ * period without changes before it may be handed out. The timers are kept
+ * in a hashed wheel: adding or restarting one is O(1) and a tick only
+ * visits the files of one slot, so tens of thousands of files are tracked
+ * by a single thread. Restarted timers are left in their slot and skipped
+ * when it comes round.
+ */
+class SettleWheel
+{
+public:
+  struct Entry
+  {
+    uint32_t id;          ///< file ID in source table
+    std::string fileName; ///< source file
+    size_t fileSize;      ///< length when the timer was started
+    int64_t mtime;        ///< modification time (s) at that moment
+  };
+
+  /**
+   * @param quietTicks ticks a file must stay unchanged, at least 1
+   * @param slots size of the wheel, longer periods take several rounds
+   */
+  explicit SettleWheel(unsigned quietTicks, unsigned slots = 256);
+
+  /** start the quiet period of the file, again if it is already waiting */
+  void add(const Entry &entry);
+  void erase(uint32_t id);
+  bool contains(uint32_t id) const;
+  size_t size() const { return m_timers.size(); }
+
+  /**
+   * @brief advance the wheel by one tick
+   *
+   * @return the files whose quiet period ended, they are not waiting
+   * anymore
+   */
+  std::vector<Entry> tick();
+
+private:
+  struct Timer
+  {
+    Entry entry;
+    unsigned rounds;     ///< full turns of the wheel left
+    uint64_t generation; ///< outdated if the file was added again
+  };
+
+  std::vector<std::vector<Timer>> m_slots;
+  /** current generation of the waiting files */
+  std::unordered_map<uint32_t, uint64_t> m_timers;
+  const unsigned m_quietTicks;
+  size_t m_pos;
+  uint64_t m_generation;
+};
+}
+#endif // !__SETTLEWHEEL_HPP__
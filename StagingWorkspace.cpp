@@ -0,0 +1,98 @@
+#include <algorithm>
+
+#ifndef WIN32
+  #include <sys/statvfs.h>
+#endif
+
+#include "StagingWorkspace.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+namespace
+{
+// the pass log and the container overhead of the output
+constexpr uint64_t FootprintReserve = 16u * 1024 * 1024;
+}
+
+StagingWorkspace::StagingWorkspace(const ClientConfig &cfg)
+  : m_cfg(cfg)
+  , m_budget(cfg.stagingFolder.empty() ?
+        0 :
+        static_cast<uint64_t>(std::max(cfg.stagingMemoryBudget, 0)) * 1024 *
+          1024)
+  , m_used(0)
+{
+}
+
+uint64_t StagingWorkspace::getFootprint(uint64_t fileLength)
+{
+  // archive encodes are expected to get smaller than their source, so the
+  // output needs at most as much space as the input
+  return 2 * fileLength + FootprintReserve;
+}
+
+uint64_t StagingWorkspace::getMaxFileLength(uint64_t space)
+{
+  return space > FootprintReserve ? (space - FootprintReserve) / 2 : 0;
+}
+
+std::string StagingWorkspace::reserve(uint64_t &bytes, uint64_t fileLength)
+{
+  bytes = 0;
+  if(!m_budget)
+    return m_cfg.tempFolder;
+
+  const auto footprint = getFootprint(fileLength);
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if(m_used + footprint > m_budget)
+  {
+    LOG_F(1, "Staging: %llu MiB do not fit into the budget (%llu/%llu MiB)",
+      static_cast<unsigned long long>(footprint >> 20),
+      static_cast<unsigned long long>(m_used >> 20),
+      static_cast<unsigned long long>(m_budget >> 20));
+    return m_cfg.tempFolder;
+  }
+
+  const auto available = getAvailable();
+  if(available < footprint)
+  {
+    LOG_F(WARNING, "Staging: only %llu MiB free in %s, using %s",
+      static_cast<unsigned long long>(available >> 20),
+      m_cfg.stagingFolder.c_str(), m_cfg.tempFolder.c_str());
+    return m_cfg.tempFolder;
+  }
+
+  m_used += footprint;
+  bytes = footprint;
+  return m_cfg.stagingFolder;
+}
+
+void StagingWorkspace::release(uint64_t bytes)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_used = bytes < m_used ? m_used - bytes : 0;
+}
+
+uint64_t StagingWorkspace::getUsed() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_used;
+}
+
+uint64_t StagingWorkspace::getAvailable() const
+{
+#ifdef WIN32
+  return m_budget;
+#else
+  struct statvfs st;
+  if(statvfs(m_cfg.stagingFolder.c_str(), &st) != 0)
+  {
+    LOG_F(ERROR, "Staging: could not access %s",
+      m_cfg.stagingFolder.c_str());
+    return 0;
+  }
+  return static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
+#endif
+}
@@ -0,0 +1,50 @@
+#ifndef __STAGINGWORKSPACE_HPP__
+#define __STAGINGWORKSPACE_HPP__
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "MediaArchiverClientConfig.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Hands out the folder the temp files of a job are written to. Jobs
+ * fitting into the memory budget are staged in a RAM backed folder (tmpfs),
+ * larger ones spill to the temp folder on disk.
+ */
+class StagingWorkspace
+{
+public:
+  StagingWorkspace(const ClientConfig &cfg);
+  StagingWorkspace(const StagingWorkspace &) = delete;
+
+  /**
+   * @brief reserve the space for the temp files of a job
+   *
+   * @param bytes space needed by the job, 0 if not staged
+   * @param fileLength size of the source file
+   * @return std::string folder for the temp files of the job
+   */
+  std::string reserve(uint64_t &bytes, uint64_t fileLength);
+  void release(uint64_t bytes);
+
+  uint64_t getUsed() const;
+
+  /** space a job needs for the source, the output and the pass log */
+  static uint64_t getFootprint(uint64_t fileLength);
+
+  /** largest source whose footprint fits into the space */
+  static uint64_t getMaxFileLength(uint64_t space);
+
+private:
+  uint64_t getAvailable() const;
+
+  const ClientConfig &m_cfg;
+  const uint64_t m_budget;
+  uint64_t m_used;
+  mutable std::mutex m_mtx;
+};
+}
+#endif // !__STAGINGWORKSPACE_HPP__
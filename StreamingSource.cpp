@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "StreamingSource.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+StreamingSource::StreamingSource(const std::string &path, uint64_t length)
+  : m_path(path)
+  , m_length(length)
+  , m_received(0)
+  , m_aborted(false)
+  , m_layout(Layout::Unknown)
+{
+}
+
+void StreamingSource::setReceived(uint64_t bytes)
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_received = std::min(bytes, m_length);
+  }
+  m_cv.notify_all();
+}
+
+void StreamingSource::abort()
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_aborted = true;
+  }
+  m_cv.notify_all();
+}
+
+bool StreamingSource::isComplete() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_received == m_length;
+}
+
+StreamingSource::Layout StreamingSource::getLayout() const
+{
+  uint64_t received;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    if(m_layout != Layout::Unknown)
+      return m_layout;
+    received = m_received;
+  }
+
+  const bool complete = received == m_length;
+  std::ifstream fs(m_path, std::ios::in | std::ios::binary);
+  unsigned char head[16];
+  const auto readAt = [&](uint64_t pos, size_t size) {
+    if(pos + size > received)
+      return false;
+    fs.clear();
+    fs.seekg(pos, std::ios_base::beg);
+    fs.read(reinterpret_cast<char *>(head), size);
+    return static_cast<size_t>(fs.gcount()) == size;
+  };
+  const auto decide = [&](Layout layout) {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_layout = layout;
+    return layout;
+  };
+
+  if(!readAt(0, 12))
+    return complete ? decide(Layout::Sequential) : Layout::Unknown;
+
+  // AVI keeps its index at the end
+  if(memcmp(head, "RIFF", 4) == 0)
+  {
+    return decide(memcmp(head + 8, "AVI ", 4) == 0 ? Layout::NeedsSeeking :
+                                                     Layout::Sequential);
+  }
+
+  const char *boxes[] = {"ftyp", "moov", "mdat", "free", "skip", "wide"};
+  if(std::none_of(std::begin(boxes), std::end(boxes),
+       [&](const char *b) { return memcmp(head + 4, b, 4) == 0; }))
+  {
+    return decide(Layout::Sequential);
+  }
+
+  // ISO media: walk the top level boxes up to the movie header or the data
+  uint64_t pos = 0;
+  while(readAt(pos, 8))
+  {
+    uint64_t size = 0;
+    for(int i = 0; i < 4; ++i)
+      size = (size << 8) | head[i];
+
+    if(memcmp(head + 4, "moov", 4) == 0)
+      return decide(Layout::Sequential);
+    if(memcmp(head + 4, "mdat", 4) == 0 || size == 0)
+      return decide(Layout::NeedsSeeking);
+
+    if(size == 1)
+    {
+      if(!readAt(pos + 8, 8))
+        break;
+      size = 0;
+      for(int i = 0; i < 8; ++i)
+        size = (size << 8) | head[i];
+    }
+    if(size < 8)
+      return decide(Layout::NeedsSeeking);
+    pos += size;
+  }
+  return complete ? decide(Layout::NeedsSeeking) : Layout::Unknown;
+}
+
+int64_t StreamingSource::read(uint64_t pos, char *data, size_t size)
+{
+  std::unique_lock<std::mutex> lck(m_mtx);
+  m_cv.wait(lck, [&]() {
+    return m_aborted || m_received > pos || m_received == m_length;
+  });
+
+  if(m_aborted)
+    return -1;
+
+  if(pos >= m_received)
+    return 0;
+
+  const auto available = std::min<uint64_t>(size, m_received - pos);
+  lck.unlock();
+
+  // only the reader uses the stream
+  if(!m_in.is_open())
+  {
+    m_in.open(m_path, std::ios::in | std::ios::binary);
+    if(!m_in.is_open())
+    {
+      LOG_F(ERROR, "Could not open %s for reading", m_path.c_str());
+      return -1;
+    }
+  }
+
+  m_in.clear();
+  m_in.seekg(pos, std::ios_base::beg);
+  m_in.read(data, available);
+  return m_in.gcount() > 0 ? m_in.gcount() : -1;
+}
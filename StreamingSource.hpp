@@ -0,0 +1,63 @@
+#ifndef __STREAMINGSOURCE_HPP__
+#define __STREAMINGSOURCE_HPP__
+
+#include <cstdint>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace MediaArchiver
+{
+/**
+ * @brief Source file that is still being received. The encoder reads it
+ * while the chunks arrive, waiting for data not written yet. Seeking is
+ * possible since the received part stays on disk.
+ */
+class StreamingSource
+{
+public:
+  enum class Layout : uint8_t
+  {
+    Unknown,      ///< not enough data received to decide
+    Sequential,   ///< can be decoded front to back, e.g. from a pipe
+    NeedsSeeking, ///< index at the end, e.g. MP4 with moov after mdat
+  };
+
+  /**
+   * @param path file the received chunks are written to
+   * @param length final length of the file
+   */
+  StreamingSource(const std::string &path, uint64_t length);
+  StreamingSource(const StreamingSource &) = delete;
+
+  /** receiver: the first bytes of the file are written and flushed */
+  void setReceived(uint64_t bytes);
+  /** receiver: the transfer failed, the reader gives up */
+  void abort();
+  bool isComplete() const;
+  uint64_t getLength() const { return m_length; }
+
+  /** container layout according to the data received so far */
+  Layout getLayout() const;
+
+  /**
+   * @brief read from the file, waits until the data has been received
+   *
+   * @return int64_t bytes read, 0 at the end of the file, -1 if aborted or
+   * on I/O error
+   */
+  int64_t read(uint64_t pos, char *data, size_t size);
+
+private:
+  const std::string m_path;
+  const uint64_t m_length;
+  uint64_t m_received;
+  bool m_aborted;
+  mutable Layout m_layout;
+  std::ifstream m_in;
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv;
+};
+}
+#endif // !__STREAMINGSOURCE_HPP__
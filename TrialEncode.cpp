@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#include "TrialEncode.hpp"
+#include "CommandLineEncoder.hpp"
+
+#include "loguru.hpp"
+
+using namespace MediaArchiver;
+
+TrialEncode::TrialEncode(const ClientConfig &cfg, const EncodeJob &job)
+  : m_cfg(cfg)
+  , m_job(job)
+{
+}
+
+std::vector<int> TrialEncode::getPositions(
+  int duration, int samples, int length)
+{
+  std::vector<int> positions;
+  if(samples <= 0 || length <= 0 || duration < samples * length)
+    return positions;
+
+  // centered in equal parts of the source, the first seconds of films
+  // (titles, black frames) are not representative
+  for(int i = 0; i < samples; i++)
+  {
+    const int center =
+      static_cast<int>(static_cast<int64_t>(duration) * (2 * i + 1) /
+        (2 * samples));
+    positions.push_back(
+      std::min(std::max(0, center - length / 2), duration - length));
+  }
+  return positions;
+}
+
+EncodeEstimate TrialEncode::run(int duration)
+{
+  uint64_t bytes = 0;
+  double wall = 0.0;
+  int encoded = 0;
+  int samples = 0;
+
+  for(const auto position:
+    getPositions(duration, m_cfg.trialSamples, m_cfg.trialLength))
+  {
+    uint64_t b = 0;
+    double s = 0.0;
+    if(!sample(position, b, s))
+      continue;
+
+    bytes += b;
+    wall += s;
+    encoded += m_cfg.trialLength;
+    samples++;
+  }
+  std::remove(m_job.outFile.c_str());
+
+  if(!samples || wall <= 0)
+    throw std::runtime_error("none of the trial encodes succeeded");
+
+  EncodeEstimate estimate;
+  estimate.outputSize = bytes * duration / encoded;
+  estimate.sizeRatio = m_job.fileLength ?
+    static_cast<double>(estimate.outputSize) / m_job.fileLength :
+    0.0;
+  estimate.speed = encoded / wall;
+  estimate.samples = samples;
+  return estimate;
+}
+
+bool TrialEncode::sample(int position, uint64_t &bytes, double &seconds)
+{
+  EncodeJob job = m_job;
+  job.startTime = position;
+  job.duration = m_cfg.trialLength;
+
+  CommandLineEncoder encoder(m_cfg);
+  std::string output;
+  int retcode = -1;
+  const auto start = std::chrono::steady_clock::now();
+  try
+  {
+    encoder.start(job);
+    while(encoder.poll(output))
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    retcode = encoder.finish();
+  }
+  catch(const std::exception &e)
+  {
+    LOG_F(ERROR, "trial encode at %is: %s", position, e.what());
+    return false;
+  }
+
+  const std::chrono::duration<double> wall =
+    std::chrono::steady_clock::now() - start;
+  std::ifstream fs(job.outFile, std::ios::in | std::ios::binary);
+  fs.seekg(0, std::ios_base::end);
+  if(retcode != 0 || !fs.is_open() || fs.tellg() <= 0)
+  {
+    LOG_F(ERROR, "trial encode at %is failed (%i): %s", position, retcode,
+      output.c_str());
+    return false;
+  }
+
+  bytes = fs.tellg();
+  seconds = wall.count();
+  LOG_F(1, "trial encode at %is: %llu bytes in %.1fs", position,
+    static_cast<unsigned long long>(bytes), seconds);
+  return true;
+}
@@ -0,0 +1,50 @@
+#ifndef __TRIALENCODE_HPP__
+#define __TRIALENCODE_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "IEncoder.hpp"
+#include "IMediaArchiverServer.hpp"
+#include "MediaArchiverClientConfig.hpp"
+
+namespace MediaArchiver
+{
+/**
+ * @brief Encodes a few short samples evenly spread over the source with the
+ * settings of the job to predict the size of the output and the speed of
+ * the encoder before the whole file is encoded.
+ */
+class TrialEncode
+{
+public:
+  /**
+   * @param cfg client configuration (encoder, number and length of the
+   * samples)
+   * @param job single pass job to estimate, its output file receives the
+   * samples
+   */
+  TrialEncode(const ClientConfig &cfg, const EncodeJob &job);
+
+  /** start positions (s) of the samples, empty if the source is too short */
+  static std::vector<int> getPositions(
+    int duration, int samples, int length);
+
+  /**
+   * @brief encode the samples
+   *
+   * @param duration length of the source in seconds
+   * @throws std::runtime_error if none of the samples could be encoded
+   */
+  EncodeEstimate run(int duration);
+
+private:
+  /** @return false the sample could not be encoded */
+  bool sample(int position, uint64_t &bytes, double &seconds);
+
+  const ClientConfig &m_cfg;
+  const EncodeJob m_job;
+};
+}
+#endif // !__TRIALENCODE_HPP__
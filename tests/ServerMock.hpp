@@ -27,6 +27,12 @@ public:
     MediaEncoderSettings &settings) override;
   bool readChunk(std::ostream &file) override;
   void postFile(const EncodingResultInfo &result) override;
+  bool offerResult(const SpooledResult &result) override { return false; }
+  EstimateVerdict reportEstimate(const EncodeEstimate &estimate) override
+  {
+    return EstimateVerdict{EstimateVerdict::Action::Encode, ""};
+  }
+  bool checkJob() override { return true; }
   bool writeChunk(const std::vector<char> &data) override { return true; }
   ~ServerMock() = default;
 
@@ -1,9 +1,26 @@
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 
+#include <atomic>
+#include <thread>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
 #include "FileUtils.hpp"
 #include "MediaArchiverConfig.hpp"
 #include "MediaArchiverClient.hpp"
+#include "EncoderCalibration.hpp"
+#include "ResultSpool.hpp"
+#include "StreamingSource.hpp"
+#include "CommandLineEncoder.hpp"
+#include "EncodeCheckpoint.hpp"
+#include "TrialEncode.hpp"
+#include "ClientProfile.hpp"
+#include "EncodePipeline.hpp"
+#include "ResourceGovernor.hpp"
 
 using namespace MediaArchiver;
 using namespace std;
@@ -76,4 +93,506 @@ TEST_CASE("ffmpeg [pass]", "[ffmpeg]")
   SECTION("FFPROBE") { tc.testFfprobe(srcName); }
   SECTION("ENCODING") { tc.testEncoding(srcName); }
   REQUIRE(true);
-}
\ No newline at end of file
+}
+TEST_CASE("encode pipeline [pass]", "[pipeline]")
+{
+  ClientConfig cfg;
+  cfg.parallelJobs = 2;
+  cfg.encoderThreads = 16;
+  {
+    EncodePipeline pipeline(cfg);
+    REQUIRE(pipeline.lanes() == 2);
+    REQUIRE(pipeline.threadsFor(EncodePipeline::Stage::Analysis) == 8);
+    REQUIRE(pipeline.threadsFor(EncodePipeline::Stage::Encode) == 8);
+
+    // each stage has its own slots
+    REQUIRE(pipeline.tryAcquire(EncodePipeline::Stage::Encode));
+    REQUIRE(pipeline.tryAcquire(EncodePipeline::Stage::Encode));
+    REQUIRE_FALSE(pipeline.tryAcquire(EncodePipeline::Stage::Encode));
+    REQUIRE(pipeline.tryAcquire(EncodePipeline::Stage::Analysis));
+    pipeline.release(EncodePipeline::Stage::Encode);
+    REQUIRE(pipeline.tryAcquire(EncodePipeline::Stage::Encode));
+
+    pipeline.release(EncodePipeline::Stage::Analysis);
+    pipeline.setPaused(true);
+    REQUIRE_FALSE(pipeline.tryAcquire(EncodePipeline::Stage::Analysis));
+    pipeline.setPaused(false);
+    REQUIRE(pipeline.tryAcquire(EncodePipeline::Stage::Analysis));
+
+    // limited to 1..parallelJobs
+    pipeline.setEncodeCapacity(5);
+    REQUIRE(pipeline.getEncodeCapacity() == 2);
+    pipeline.setEncodeCapacity(0);
+    REQUIRE(pipeline.getEncodeCapacity() == 1);
+  }
+
+  // the 1st pass of the next job runs in a lane of its own with its share
+  // of the threads
+  cfg.overlapPasses = true;
+  cfg.pass1ThreadShare = 25;
+  {
+    EncodePipeline pipeline(cfg);
+    REQUIRE(pipeline.lanes() == 4);
+    REQUIRE(pipeline.threadsFor(EncodePipeline::Stage::Analysis) == 2);
+    REQUIRE(pipeline.threadsFor(EncodePipeline::Stage::Encode) == 6);
+  }
+
+  // a single job is left to the encoder
+  EncodePipeline single{ClientConfig()};
+  REQUIRE(single.lanes() == 1);
+  REQUIRE(single.threadsFor(EncodePipeline::Stage::Encode) == 0);
+  REQUIRE(single.getMaxJobs() == 1);
+}
+
+class TestGovernor : public ResourceGovernor
+{
+public:
+  using ResourceGovernor::ResourceGovernor;
+  using ResourceGovernor::update;
+};
+
+TEST_CASE("resource governor [pass]", "[governor]")
+{
+  ClientConfig cfg;
+  cfg.parallelJobs = 4;
+  cfg.userIdleTime = 300;
+  EncodePipeline pipeline(cfg);
+  TestGovernor governor(cfg, pipeline);
+  using Level = ResourceGovernor::Level;
+
+  // sample: foreign load per core, pressure, user idle (s)
+  REQUIRE(governor.evaluate({0.0, -1.0, 1000}) == Level::Full);
+  REQUIRE(governor.evaluate({0.0, -1.0, 10}) == Level::Paused);
+  REQUIRE(governor.evaluate({0.0, -1.0, -1}) == Level::Full);
+  REQUIRE(governor.evaluate({0.8, -1.0, 10}) == Level::Paused);
+  REQUIRE(governor.evaluate({0.8, -1.0, 1000}) == Level::Reduced);
+  // the encoders stalling each other do not count
+  REQUIRE(governor.evaluate({0.05, 50.0, 1000}) == Level::Full);
+  REQUIRE(governor.evaluate({0.2, 50.0, 1000}) == Level::Reduced);
+
+  // throttled at once
+  governor.update(Level::Reduced);
+  REQUIRE(governor.getLevel() == Level::Reduced);
+  REQUIRE(pipeline.getEncodeCapacity() == 2);
+
+  // released after 3 calm samples in a row
+  governor.update(Level::Full);
+  governor.update(Level::Full);
+  governor.update(Level::Reduced);
+  governor.update(Level::Full);
+  governor.update(Level::Full);
+  REQUIRE(governor.getLevel() == Level::Reduced);
+  governor.update(Level::Full);
+  REQUIRE(governor.getLevel() == Level::Full);
+  REQUIRE(pipeline.getEncodeCapacity() == 4);
+
+  governor.update(Level::Paused);
+  REQUIRE(governor.getLevel() == Level::Paused);
+  REQUIRE(pipeline.isPaused());
+  REQUIRE_FALSE(pipeline.tryAcquire(EncodePipeline::Stage::Encode));
+  for(int i = 0; i < 3; i++)
+    governor.update(Level::Reduced);
+  REQUIRE(governor.getLevel() == Level::Reduced);
+  REQUIRE_FALSE(pipeline.isPaused());
+
+  // lowering the niceness again needs the privilege, see RLIMIT_NICE
+  const int pid = fork();
+  if(!pid)
+  {
+    setpgid(0, 0);
+    pause();
+    _exit(0);
+  }
+  pipeline.addEncoder(pid);
+  governor.update(Level::Reduced);
+  REQUIRE(getpriority(PRIO_PROCESS, pid) == 19);
+  for(int i = 0; i < 3; i++)
+    governor.update(Level::Full);
+  REQUIRE(governor.getLevel() == Level::Full);
+  REQUIRE(governor.isPriorityRestored() ==
+    (getpriority(PRIO_PROCESS, pid) == cfg.governorNice));
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+  pipeline.removeEncoder(pid);
+
+  // without an idle time the user is not watched
+  cfg.userIdleTime = 0;
+  REQUIRE(governor.evaluate({0.0, -1.0, 10}) == Level::Full);
+}
+
+TEST_CASE("calibration settings [pass]", "[calibration]")
+{
+  const auto grid = EncoderCalibration::getGrid(4);
+  REQUIRE(grid.size() == 6);
+  REQUIRE(grid.front() == make_pair(1u, 4u));
+  REQUIRE(grid.back() == make_pair(4u, 2u));
+
+  vector<CalibrationResult> results{
+    {1, 4, "-cpu-used 4", 10.0, 0.4, true},
+    {2, 2, "-cpu-used 4", 15.0, 0.3, true},
+    {4, 2, "-cpu-used 4", 30.0, 0.2, false},
+  };
+  REQUIRE(EncoderCalibration::getBest(results).jobs == 2);
+
+  const string cfgFile = "/tmp/test_calibration.cfg";
+  {
+    ofstream fs(cfgFile);
+    fs << "# parallelJobs = 9" << endl
+       << "ParallelJobs = 1" << endl
+       << "serverPort = 2020" << endl;
+  }
+
+  REQUIRE_NOTHROW(updateConfigFile(
+    cfgFile, {{"parallelJobs", "2"}, {"encoderThreads", "4"}}));
+
+  ClientConfig cfg;
+  auto mac = MediaArchiverConfig<ClientConfig>(cfg);
+  REQUIRE_NOTHROW(mac.read(cfgFile));
+  REQUIRE(cfg.parallelJobs == 2);
+  REQUIRE(cfg.encoderThreads == 4);
+  REQUIRE(cfg.serverPort == 2020);
+  std::remove(cfgFile.c_str());
+}
+
+TEST_CASE("staging workspace [pass]", "[staging]")
+{
+  ClientConfig cfg;
+  cfg.tempFolder = "/var/tmp";
+  cfg.stagingFolder = "/tmp";
+  cfg.stagingMemoryBudget = 100;
+  StagingWorkspace ws(cfg);
+
+  const uint64_t mib = 1024 * 1024;
+  uint64_t first = 0, second = 0, large = 0;
+  REQUIRE(ws.reserve(first, 10 * mib) == cfg.stagingFolder);
+  REQUIRE(first == StagingWorkspace::getFootprint(10 * mib));
+  REQUIRE(ws.reserve(second, 10 * mib) == cfg.stagingFolder);
+
+  // spills to disk if the budget is exhausted
+  REQUIRE(ws.reserve(large, 10 * mib) == cfg.tempFolder);
+  REQUIRE(large == 0);
+
+  ws.release(first);
+  REQUIRE(ws.getUsed() == second);
+  REQUIRE(ws.reserve(large, 10 * mib) == cfg.stagingFolder);
+  ws.release(second);
+  ws.release(large);
+  REQUIRE(ws.getUsed() == 0);
+}
+
+TEST_CASE("streaming source [pass]", "[streaming]")
+{
+  const std::string path = "/tmp/streaming_source.bin";
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  StreamingSource source(path, 8);
+
+  out << "abcd";
+  out.flush();
+  source.setReceived(4);
+
+  char buf[8];
+  REQUIRE(source.read(0, buf, sizeof(buf)) == 4);
+  REQUIRE(std::string(buf, 4) == "abcd");
+
+  // the reader waits for the rest of the file
+  std::thread receiver([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    out << "efgh";
+    out.flush();
+    source.setReceived(8);
+  });
+  REQUIRE(source.read(6, buf, sizeof(buf)) == 2);
+  REQUIRE(std::string(buf, 2) == "gh");
+  receiver.join();
+
+  REQUIRE(source.isComplete());
+  REQUIRE(source.read(8, buf, sizeof(buf)) == 0);
+
+  source.abort();
+  REQUIRE(source.read(0, buf, sizeof(buf)) == -1);
+  remove(path.c_str());
+}
+
+TEST_CASE("streaming layout [pass]", "[streaming]")
+{
+  const std::string path = "/tmp/streaming_layout.mp4";
+  const auto box = [](const char *type, uint32_t size) {
+    std::string b(size, '\0');
+    b[0] = static_cast<char>(size >> 24);
+    b[1] = static_cast<char>(size >> 16);
+    b[2] = static_cast<char>(size >> 8);
+    b[3] = static_cast<char>(size);
+    b.replace(4, 4, type);
+    return b;
+  };
+  const auto layout = [&](const std::string &data, uint64_t received) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+    StreamingSource source(path, data.size());
+    source.setReceived(received);
+    return source.getLayout();
+  };
+
+  const auto faststart = box("ftyp", 24) + box("moov", 100) +
+    box("mdat", 1000);
+  const auto indexAtEnd = box("ftyp", 24) + box("mdat", 1000) +
+    box("moov", 100);
+
+  REQUIRE(layout(faststart, 4) == StreamingSource::Layout::Unknown);
+  REQUIRE(layout(faststart, 24) == StreamingSource::Layout::Unknown);
+  REQUIRE(layout(faststart, 32) == StreamingSource::Layout::Sequential);
+  REQUIRE(layout(indexAtEnd, 32) == StreamingSource::Layout::NeedsSeeking);
+  REQUIRE(layout(std::string("RIFF\0\0\0\0AVI LIST", 16), 16) ==
+    StreamingSource::Layout::NeedsSeeking);
+  REQUIRE(layout("\x1a\x45\xdf\xa3 matroska", 16) ==
+    StreamingSource::Layout::Sequential);
+  remove(path.c_str());
+}
+
+TEST_CASE("stream into encoder [pass]", "[streaming]")
+{
+  const std::string in = "/tmp/stream_encoder_in.bin";
+  const std::string out = "/tmp/stream_encoder_out.bin";
+  ClientConfig cfg;
+  // stands in for ffmpeg: copies its stdin, ignores the options
+  cfg.pathToEncoder = "sh -c 'cat > " + out + "' sh";
+
+  std::ofstream fs(in, std::ios::binary | std::ios::trunc);
+  StreamingSource source(in, 16);
+  fs << "matroska-hdr";
+  fs.flush();
+  source.setReceived(12);
+
+  EncodeJob job{in, out, "", "", "", 2, 0, 16, &source};
+  CommandLineEncoder encoder(cfg);
+  REQUIRE(encoder.canStream(job));
+  encoder.start(job);
+
+  fs << "data";
+  fs.flush();
+  source.setReceived(16);
+
+  std::string output;
+  while(encoder.poll(output))
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE(encoder.finish() == 0);
+
+  std::ifstream result(out, std::ios::binary);
+  std::string content;
+  std::getline(result, content);
+  REQUIRE(content == "matroska-hdrdata");
+
+  // killing must not wait for the rest of the source
+  StreamingSource partial(in, 32);
+  partial.setReceived(16);
+  job.source = &partial;
+  encoder.start(job);
+  encoder.kill();
+  REQUIRE(encoder.pid() == 0);
+  remove(in.c_str());
+  remove(out.c_str());
+}
+
+TEST_CASE("result spool [pass]", "[spool]")
+{
+  ClientConfig cfg;
+  cfg.spoolFolder = "/tmp";
+  const string outFile = "/tmp/test_spool_out.mp4";
+  {
+    ofstream fs(outFile);
+    fs << "encoded";
+  }
+
+  const SpooledResult result{42, "1234", 1000, 1600000000, 0xabcdef,
+    EncodingResultInfo(EncodingResultInfo::EncodingResult::OK, 7, "")};
+
+  string spooled;
+  {
+    ResultSpool spool(cfg);
+    REQUIRE_NOTHROW(spool.load());
+    REQUIRE_NOTHROW(spooled = spool.add(result, outFile, ".mp4"));
+    REQUIRE(spooled == "/tmp/result42.mp4");
+  }
+
+  // survives a restart
+  ResultSpool spool(cfg);
+  REQUIRE_NOTHROW(spool.load());
+  const auto entries = spool.getEntries();
+  REQUIRE(entries.size() == 1);
+  REQUIRE(entries.front().fileName == spooled);
+  REQUIRE(entries.front().result.token == "1234");
+  REQUIRE(entries.front().result.sourceTime == 1600000000);
+  REQUIRE(entries.front().result.settingsHash == 0xabcdef);
+  REQUIRE(entries.front().result.result.fileLength == 7);
+
+  spool.remove(42);
+  REQUIRE(spool.getEntries().empty());
+  REQUIRE_FALSE(ifstream(spooled).good());
+  std::remove("/tmp/spool.journal");
+}
+
+TEST_CASE("spool owned by a lane [pass]", "[spool]")
+{
+  ClientConfig cfg;
+  cfg.spoolFolder = "/tmp";
+  // nothing listens there, an offered result fails the upload
+  cfg.serverName = "localhost";
+  cfg.serverPort = 1;
+  cfg.serverConnectionTimeout = 500;
+  const string outFile = "/tmp/test_spool_lane.mp4";
+  const SpooledResult result{43, "5678", 1000, 1600000000, 0xabcdef,
+    EncodingResultInfo(EncodingResultInfo::EncodingResult::OK, 7, "")};
+
+  ResultSpool spool(cfg);
+  REQUIRE_NOTHROW(spool.load());
+  std::atomic<bool> sent(false);
+  std::atomic<int> offered(0);
+  std::thread uploader([&]() {
+    while(!sent)
+    {
+      if(!spool.upload())
+        offered++;
+    }
+  });
+
+  // the lane sends its result while the uploader keeps running
+  for(int i = 0; i < 20; i++)
+  {
+    {
+      ofstream fs(outFile);
+      fs << "encoded";
+    }
+    string spooled;
+    REQUIRE_NOTHROW(spooled = spool.add(result, outFile, ".mp4"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    string content;
+    std::getline(ifstream(spooled), content);
+    REQUIRE(content == "encoded");
+    spool.remove(43);
+  }
+  sent = true;
+  uploader.join();
+  REQUIRE(offered == 0);
+
+  // handed over after the lane gave up
+  {
+    ofstream fs(outFile);
+    fs << "encoded";
+  }
+  REQUIRE_NOTHROW(spool.add(result, outFile, ".mp4"));
+  REQUIRE(spool.upload());
+  spool.release(43);
+  REQUIRE_FALSE(spool.upload());
+  REQUIRE(spool.getEntries().size() == 1);
+
+  spool.remove(43);
+  std::remove("/tmp/spool.journal");
+}
+
+TEST_CASE("encode checkpoint [pass]", "[checkpoint]")
+{
+  MediaEncoderSettings settings{1000, "ffmpeg", "mp4", ".mkv",
+    "-y -c:v libx265 -crf 23 -metadata title=\"a b\"", 42, 1600000000,
+    0xabcdef};
+  {
+    EncodeCheckpoint cp("/tmp", 3);
+    cp.clear();
+    EncodeCheckpoint::State st;
+    REQUIRE_FALSE(cp.load(st));
+    REQUIRE_NOTHROW(
+      cp.save(EncodeCheckpoint::State{1234, settings, 2, 4, 1900}));
+  }
+
+  // survives a restart
+  EncodeCheckpoint cp("/tmp", 3);
+  EncodeCheckpoint::State st;
+  REQUIRE(cp.load(st));
+  REQUIRE(st.token == 1234);
+  REQUIRE(st.passNo == 2);
+  REQUIRE(st.chunks == 4);
+  REQUIRE(st.duration == 1900);
+  REQUIRE(st.settings.fileLength == 1000);
+  REQUIRE(st.settings.fileExtension == "mp4");
+  REQUIRE(st.settings.finalExtension == ".mkv");
+  REQUIRE(
+    st.settings.commandLineParameters == settings.commandLineParameters);
+  REQUIRE(st.settings.jobId == 42);
+  REQUIRE(st.settings.sourceTime == 1600000000);
+  REQUIRE(st.settings.settingsHash == 0xabcdef);
+
+  cp.clear();
+  REQUIRE_FALSE(cp.load(st));
+}
+
+TEST_CASE("renditions [pass]", "[renditions]")
+{
+  ClientConfig cfg;
+  cfg.pathToEncoder = "ffmpeg";
+  EncodeJob job{"in.ts", "out.mkv", "-c:v libx265", "", "", 2, 0, 1000,
+    nullptr, 0, 0, {{"-vf scale=-2:720", "out_preview.mp4"}}};
+  CommandLineEncoder encoder(cfg);
+  const auto cmd = encoder.getCommandLine(job);
+  // the options in front of an output apply to it
+  const auto archive = cmd.find("\"out.mkv\"");
+  const auto preview = cmd.find("-vf scale=-2:720 \"out_preview.mp4\"");
+  REQUIRE(archive != string::npos);
+  REQUIRE(preview != string::npos);
+  REQUIRE(archive < preview);
+
+  MediaEncoderSettings settings{1000, "ffmpeg", "mp4", ".mkv", "-y", 42,
+    1600000000, 0xabcdef, "",
+    {RenditionSettings{"preview", ".mp4", "-vf scale=-2:720 -crf 28"}}};
+  EncodeCheckpoint cp("/tmp", 4);
+  REQUIRE_NOTHROW(cp.save(EncodeCheckpoint::State{1, settings, 2, 0, 0}));
+  EncodeCheckpoint::State st;
+  REQUIRE(cp.load(st));
+  REQUIRE(st.settings.renditions.size() == 1);
+  REQUIRE(st.settings.renditions[0].name == "preview");
+  REQUIRE(st.settings.renditions[0].extension == ".mp4");
+  REQUIRE(st.settings.renditions[0].commandLineParameters ==
+    "-vf scale=-2:720 -crf 28");
+  cp.clear();
+}
+
+TEST_CASE("trial encode positions [pass]", "[trial]")
+{
+  REQUIRE(TrialEncode::getPositions(600, 3, 10) ==
+    vector<int>{95, 295, 495});
+  // the samples stay within the source
+  REQUIRE(TrialEncode::getPositions(20, 2, 10) == vector<int>{0, 10});
+  REQUIRE(TrialEncode::getPositions(15, 2, 10).empty());
+  REQUIRE(TrialEncode::getPositions(600, 0, 10).empty());
+}
+
+TEST_CASE("client profile [pass]", "[profile]")
+{
+  std::istringstream ss("Encoders:\n"
+                        " V..... = Video\n"
+                        " A..... = Audio\n"
+                        " ------\n"
+                        " V....D libx264              libx264 H.264\n"
+                        " V....D libaom-av1           libaom AV1\n"
+                        " A....D aac                  AAC\n");
+  REQUIRE(ClientProfile::parseEncoders(ss) ==
+    vector<string>{"libx264", "libaom-av1", "aac"});
+
+  ClientConfig cfg;
+  cfg.tempFolder = "/tmp";
+  cfg.benchmarkFps = 12.5;
+  cfg.encoderEngine = "libav";
+  ClientProfile profile(cfg, 2);
+
+  MediaFileRequirements filter{"ffmpeg", 0};
+  REQUIRE(profile.update(filter));
+  REQUIRE(filter.slots == 2);
+  REQUIRE(filter.benchmarkFps == 12.5);
+  REQUIRE(filter.cores > 0);
+  REQUIRE(filter.memory > 0);
+  REQUIRE(filter.freeTempSpace == ClientProfile::getFreeSpace("/tmp"));
+
+  // the temp files of the largest job fit into the free space
+  REQUIRE(filter.maxFileSize > 0);
+  REQUIRE(StagingWorkspace::getFootprint(filter.maxFileSize) <=
+    filter.freeTempSpace);
+
+  REQUIRE(ClientProfile::getFreeSpace("/nonexistent") == 0);
+}
@@ -8,12 +8,16 @@
 #include <sstream>
 #include <fcntl.h>
 #include <streambuf>
+#include <fstream>
 
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 
 #include "ServerIf.hpp"
 #include "FileUtils.hpp"
+#include "MediaProbe.hpp"
+#include "MediaHeaderParser.hpp"
+#include "FileFingerprint.hpp"
 
 using namespace MediaArchiver;
 using namespace std;
@@ -257,4 +261,270 @@ TEST_CASE("setfileTime", "[filetime]")
   REQUIRE(ts2[0].tv_nsec == ts[0].tv_nsec);
   REQUIRE(ts2[1].tv_sec == ts[1].tv_sec);
   REQUIRE(ts2[1].tv_nsec == ts[1].tv_nsec);
-}
\ No newline at end of file
+}
+TEST_CASE("remux policy (pass)", "[probe]")
+{
+  const std::string output =
+    "Input #0, mov,mp4,m4a,3gp,3g2,mj2, from 'phone.mp4':\n"
+    "  Duration: 00:01:02.50, start: 0.000000, bitrate: 17300 kb/s\n"
+    "  Stream #0:0[0x1](und): Video: hevc (Main) (hvc1 / 0x31637668), "
+    "yuv420p(tv, bt709), 1920x1080, 17000 kb/s, 29.97 fps\n"
+    "  Stream #0:1[0x2](und): Audio: aac (LC) (mp4a / 0x6134706D), "
+    "48000 Hz, stereo, fltp, 256 kb/s\n"
+    "At least one output file must be specified\n";
+
+  MediaInfo info;
+  REQUIRE(MediaProbe::parse(output, info));
+  REQUIRE(info.videoCodec == "hevc");
+  REQUIRE(info.audioCodec == "aac");
+  REQUIRE(info.videoBitRate == 17000);
+  REQUIRE(info.bitRate == 17300);
+  REQUIRE(info.duration == Approx(62.5));
+
+  DaemonConfig cfg;
+  MediaProbe probe(cfg);
+  REQUIRE_FALSE(probe.isRemuxable(info));
+  cfg.remuxVideoCodecs = "av1, hevc";
+  REQUIRE(probe.isRemuxable(info));
+  cfg.remuxMaxBitRate = 10000;
+  REQUIRE_FALSE(probe.isRemuxable(info));
+  cfg.remuxMaxBitRate = 0;
+  cfg.remuxAudioCodecs = "opus";
+  REQUIRE_FALSE(probe.isRemuxable(info));
+
+  REQUIRE_FALSE(MediaProbe::parse("phone.mp4: No such file", info));
+}
+
+static std::string be(uint32_t v, unsigned bytes)
+{
+  std::string s;
+  while(bytes--)
+    s += static_cast<char>(bytes < 4 ? v >> bytes * 8 & 0xFF : 0);
+  return s;
+}
+
+static std::string le(uint32_t v, unsigned bytes)
+{
+  std::string s;
+  for(unsigned i = 0; i < bytes; i++)
+    s += static_cast<char>(i < 4 ? v >> i * 8 & 0xFF : 0);
+  return s;
+}
+
+static std::string box(const char *type, const std::string &payload)
+{
+  return be(8 + payload.size(), 4) + type + payload;
+}
+
+static std::string chunk(const char *id, const std::string &payload)
+{
+  return id + le(payload.size(), 4) + payload;
+}
+
+static std::string tsPacket(int pid, const std::string &adaptation,
+  const std::string &payload, bool unitStart)
+{
+  std::string pkt = "\x47" + be((unitStart ? 0x4000 : 0) | pid, 2);
+  pkt += static_cast<char>(adaptation.empty() ? 0x10 : 0x30);
+  if(!adaptation.empty())
+    pkt += static_cast<char>(adaptation.size()) + adaptation;
+  pkt += payload;
+  pkt.resize(188, '\xFF');
+  return pkt;
+}
+
+static std::string pcr(uint64_t base)
+{
+  return std::string("\x10", 1) + be(base >> 1, 4) +
+    static_cast<char>((base & 1) << 7 | 0x7E) + '\0';
+}
+
+TEST_CASE("media header index (pass)", "[header]")
+{
+  MediaDetails d;
+
+  // MP4: 62.5 s of hevc 1920x1080 with aac, moov behind mdat
+  const std::string visual = std::string(6, '\0') + be(1, 2) +
+    std::string(16, '\0') + be(1920, 2) + be(1080, 2) +
+    std::string(50, '\0');
+  const std::string mp4 = box("ftyp", "isom" + be(0, 4) + "isom") +
+    box("mdat", std::string(100000, '\0')) +
+    box("moov",
+      box("mvhd", be(0, 12) + be(1000, 4) + be(62500, 4) +
+          std::string(80, '\0')) +
+      box("trak",
+        box("mdia",
+          box("hdlr", be(0, 8) + "vide" + std::string(13, '\0')) +
+          box("minf",
+            box("stbl",
+              box("stsd", be(0, 4) + be(1, 4) + box("hvc1", visual)) +
+              box("stsz", be(0, 12)))))) +
+      box("trak",
+        box("mdia",
+          box("hdlr", be(0, 8) + "soun" + std::string(13, '\0')) +
+          box("minf",
+            box("stbl",
+              box("stsd", be(0, 4) + be(1, 4) +
+                  box("mp4a", std::string(28, '\0'))))))));
+
+  std::istringstream in(mp4);
+  REQUIRE(MediaHeaderParser::parse(in, mp4.size(), d));
+  REQUIRE(d.duration == Approx(62.5));
+  REQUIRE(d.videoCodec == "hevc");
+  REQUIRE(d.audioCodec == "aac");
+  REQUIRE(d.width == 1920);
+  REQUIRE(d.height == 1080);
+  REQUIRE(d.bitRate == static_cast<int>(mp4.size() * 8 / 62.5 / 1000));
+
+  // MPEG-TS: h264 1920x1080 with ac3, 120 s between the PCRs
+  std::string sps("\x67\x42\x00\x28", 4);
+  unsigned bits = 0, nbits = 0;
+  const auto put = [&](unsigned v, unsigned n) {
+    while(n--)
+    {
+      bits = bits << 1 | (v >> n & 1);
+      if(++nbits == 8)
+      {
+        sps += static_cast<char>(bits);
+        bits = nbits = 0;
+      }
+    }
+  };
+  const auto ue = [&](unsigned v) {
+    unsigned n = 0;
+    while(v + 1 >> (n + 1))
+      n++;
+    put(0, n);
+    put(v + 1, n + 1);
+  };
+  ue(0); // sps id
+  ue(0); // log2_max_frame_num_minus4
+  ue(0); // pic_order_cnt_type
+  ue(0);
+  ue(1); // max_num_ref_frames
+  put(0, 1);
+  ue(119); // 120 macroblocks
+  ue(67);  // 68 macroblocks
+  put(1, 1); // frame_mbs_only_flag
+  put(1, 1);
+  put(1, 1); // cropping: 1088 -> 1080
+  ue(0);
+  ue(0);
+  ue(0);
+  ue(4);
+  put(0, 1); // no vui
+  put(1, 1); // stop bit
+  put(0, 8 - nbits);
+
+  const std::string pat = std::string("\0\0\xB0\x0D\0\x01\xC1\0\0\0\x01"
+                                      "\xF0\x00",
+                            13) +
+    be(0, 4);
+  const std::string pmt = std::string("\0\x02\xB0\x1A\0\x01\xC1\0\0\xE1\x01"
+                                      "\xF0\x00"
+                                      "\x1B\xE1\x01\xF0\x00"
+                                      "\x06\xE1\x02\xF0\x03\x6A\x01\x00",
+                            26) +
+    be(0, 4);
+  const std::string pes =
+    std::string("\0\0\x01\xE0\0\0\x80\0\0", 9) + std::string("\0\0\x01", 3) +
+    sps;
+
+  std::string ts = tsPacket(0, "", pat, true) +
+    tsPacket(0x1000, "", pmt, true) +
+    tsPacket(0x101, pcr(1000), pes, true);
+  for(int i = 0; i < 1000; i++)
+    ts += tsPacket(0x1FFF, "", "", false);
+  ts += tsPacket(0x101, pcr(1000 + 120 * 90000), "", false);
+
+  d = MediaDetails{};
+  std::istringstream tsIn(ts);
+  REQUIRE(MediaHeaderParser::parse(tsIn, ts.size(), d));
+  REQUIRE(d.duration == Approx(120.0));
+  REQUIRE(d.videoCodec == "h264");
+  REQUIRE(d.audioCodec == "ac3");
+  REQUIRE(d.width == 1920);
+  REQUIRE(d.height == 1080);
+
+  // AVI: 250 frames of xvid 720x576 at 25 fps with mp3
+  const std::string avi = "RIFF" + le(0, 4) + "AVI " +
+    chunk("LIST",
+      "hdrl" +
+        chunk("avih",
+          le(40000, 4) + le(0, 12) + le(250, 4) + le(0, 12) + le(720, 4) +
+            le(576, 4) + le(0, 16)) +
+        chunk("LIST",
+          "strl" + chunk("strh", "vidsxvid" + std::string(48, '\0')) +
+            chunk("strf", le(40, 4) + le(720, 4) + le(576, 4) + le(0, 4) +
+                "XVID" + std::string(20, '\0'))) +
+        chunk("LIST",
+          "strl" + chunk("strh", "auds" + std::string(52, '\0')) +
+            chunk("strf", le(0x55, 2) + std::string(16, '\0'))));
+
+  d = MediaDetails{};
+  std::istringstream aviIn(avi);
+  REQUIRE(MediaHeaderParser::parse(aviIn, avi.size(), d));
+  REQUIRE(d.duration == Approx(10.0));
+  REQUIRE(d.videoCodec == "mpeg4");
+  REQUIRE(d.audioCodec == "mp3");
+  REQUIRE(d.width == 720);
+  REQUIRE(d.height == 576);
+
+  const std::string text = "not a media file at all";
+  std::istringstream textIn(text);
+  REQUIRE_FALSE(MediaHeaderParser::parse(textIn, text.size(), d));
+}
+
+TEST_CASE("source fingerprint (pass)", "[fingerprint]")
+{
+  const auto write = [](const char *name, const std::string &data) {
+    std::ofstream(name, std::ios::binary) << data;
+  };
+
+  // only the first, middle and last 64 KiB count besides the size
+  std::string clip(1024 * 1024, '\0');
+  for(size_t i = 0; i < clip.size(); i++)
+    clip[i] = static_cast<char>(i * 7 + i / 251);
+  std::string hidden(clip);
+  hidden[300 * 1024] ^= 1;
+  std::string tail(clip);
+  tail[clip.size() - 1] ^= 1;
+
+  write("/tmp/test_fp1.ts", clip);
+  write("/tmp/test_fp2.ts", clip);
+  write("/tmp/test_fp3.ts", hidden);
+  write("/tmp/test_fp4.ts", tail);
+  write("/tmp/test_fp5.ts", "short");
+  remove("/tmp/test_fp6.ts");
+  REQUIRE(link("/tmp/test_fp1.ts", "/tmp/test_fp6.ts") == 0);
+
+  SourceFingerprint fp[6];
+  for(int i = 0; i < 6; i++)
+  {
+    const auto name = "/tmp/test_fp" + std::to_string(i + 1) + ".ts";
+    REQUIRE(FileFingerprint::read(name, fp[i]));
+  }
+  REQUIRE(fp[0].hash == fp[1].hash);
+  REQUIRE(fp[0].inode != fp[1].inode);
+  REQUIRE(fp[0].hash == fp[2].hash);
+  REQUIRE(fp[0].hash != fp[3].hash);
+  REQUIRE(fp[0].hash != fp[4].hash);
+  REQUIRE(fp[5].device == fp[0].device);
+  REQUIRE(fp[5].inode == fp[0].inode);
+  REQUIRE_FALSE(FileFingerprint::read("/tmp/test_fp_none.ts", fp[0]));
+
+  // every length of the tail and every lane changes the hash
+  const std::string data(clip, 0, 100);
+  for(size_t len = 1; len < data.size(); len++)
+  {
+    REQUIRE(FileFingerprint::hash(data.data(), len, 0) !=
+      FileFingerprint::hash(data.data(), len - 1, 0));
+    std::string flipped(data, 0, len);
+    flipped[len / 2] ^= 0x10;
+    REQUIRE(FileFingerprint::hash(flipped.data(), len, 0) !=
+      FileFingerprint::hash(data.data(), len, 0));
+  }
+
+  for(int i = 1; i <= 6; i++)
+    remove(("/tmp/test_fp" + std::to_string(i) + ".ts").c_str());
+}
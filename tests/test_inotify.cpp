@@ -21,11 +21,15 @@ public:
   EventType evt;
   string src;
   string dst;
+  // last folder moved out of the watched ones
+  string movedAway;
   void onFileSystemChange(
     EventType e, const string &src, const string &dst) override
   {
     cout << "onFileSystemChange Type: " << static_cast<int>(e)
          << " File: " << dst << endl;
+    if(e == EventType::DirectoryMoved && dst.empty())
+      movedAway = src;
     evt = e;
     this->src = src;
     this->dst = dst;
@@ -63,3 +67,49 @@ TEST_CASE("linux file system watcher (pass)", "[watcher]")
   REQUIRE(e.evt == EventListener::EventType::FileCreated);
   REQUIRE(e.dst == f1);
 }
+
+TEST_CASE("directory move (pass)", "[dirmove]")
+{
+  const string root = folder + "_move";
+  system((string("rm -rf ") + root).c_str());
+  REQUIRE(mkdir(root.c_str(), S_IRWXU) >= 0);
+  mkdir((root + "/album").c_str(), S_IRWXU);
+  mkdir((root + "/album/cd2").c_str(), S_IRWXU);
+
+  EventListener e;
+  unique_ptr<IFileSystemWatcher> fsw(
+    FileSystemWatcher::create(e, list<string>{root}));
+
+  usleep(10000);
+  REQUIRE(rename((root + "/album").c_str(), (root + "/live").c_str()) == 0);
+  usleep(100000);
+  REQUIRE(e.evt == EventListener::EventType::DirectoryMoved);
+  REQUIRE(e.src == root + "/album");
+  REQUIRE(e.dst == root + "/live");
+
+  // the watch of the subfolder reports the new path
+  const string f = root + "/live/cd2/f.txt";
+  system((string("touch ") + f).c_str());
+  usleep(100000);
+  REQUIRE(e.evt == EventListener::EventType::FileCreated);
+  REQUIRE(e.dst == f);
+
+  REQUIRE(rename(f.c_str(), (root + "/live/g.txt").c_str()) == 0);
+  usleep(100000);
+  REQUIRE(e.evt == EventListener::EventType::FileMoved);
+  REQUIRE(e.src == f);
+  REQUIRE(e.dst == root + "/live/g.txt");
+
+  // moved out, known once the next event shows no counterpart comes
+  const string outside = folder + "_outside";
+  system((string("rm -rf ") + outside).c_str());
+  REQUIRE(rename((root + "/live").c_str(), outside.c_str()) == 0);
+  sleep(6);
+  system((string("touch ") + root + "/h.txt").c_str());
+  usleep(100000);
+  REQUIRE(e.movedAway == root + "/live");
+
+  fsw.reset();
+  system((string("rm -rf ") + outside).c_str());
+  system((string("rm -rf ") + root).c_str());
+}
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+
+#include "JobScheduler.hpp"
+#include "SettleWheel.hpp"
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+using namespace MediaArchiver;
+
+// pending files of a recorded catalog
+static const std::vector<PendingFile> gCatalog = {
+  {1, "/media/tv/news/2019-11-02.ts", 450000000, 900.0, "mpeg2video", 576,
+    false},
+  {2, "/media/tv/films/casablanca.ts", 5200000000, 6120.0, "mpeg2video",
+    576, false},
+  {3, "/media/phone/VID_0001.mp4", 95000000, 62.5, "hevc", 2160, false},
+  {4, "/media/tv/series/s01e01.ts", 1400000000, 2700.0, "h264", 1080,
+    false},
+  {5, "/media/phone/VID_0002.mp4", 240000000, 140.0, "h264", 1080, false},
+  {6, "/media/tv/series/s01e02.ts", 1350000000, 2640.0, "h264", 1080,
+    true},
+  {7, "/media/camera/00012.mts", 2100000000, 1020.0, "h264", 1080, false},
+  {8, "/media/tv/films/metropolis.avi", 1400000000, 9000.0, "mpeg4", 480,
+    false},
+  {9, "/media/tv/news/2019-11-03.ts", 460000000, 910.0, "mpeg2video", 576,
+    true},
+  {10, "/media/tv/series/s01e03.ts", 1380000000, 2690.0, "h264", 1080,
+    false},
+  {11, "/media/camera/00013.mts", 600000000, -1.0, "", 0, false},
+  {12, "/media/phone/VID_0003.mp4", 30000000, 15.0, "h264", 1080, false},
+};
+
+static JobRecord finished(const std::string &client, const PendingFile &f,
+  double secondsPerSecond, double sizeRatio)
+{
+  return JobRecord{f.id, client, EncodingResultInfo::EncodingResult::OK,
+    false, f.duration * secondsPerSecond,
+    static_cast<uint64_t>(f.fileSize * sizeRatio), f.duration, f.fileSize,
+    f.videoCodec, f.height};
+}
+
+struct Simulation
+{
+  double makespan;       ///< until the last job is done
+  double meanCompletion; ///< average time a job is done
+  std::vector<PendingFile> order;
+  std::vector<size_t> clients; ///< the client each job went to
+};
+
+/**
+ * clients encoding speed source seconds per second each, the finished jobs
+ * are learnt from
+ */
+static Simulation simulate(
+  const std::string &policy, const std::vector<double> &speeds)
+{
+  CostModel model;
+  std::unique_ptr<ISchedulingPolicy> p(
+    createSchedulingPolicy(policy, &model));
+  PendingIndex index;
+  index.setRank([&p](const PendingFile &f) { return p->rank(f); });
+  std::map<uint32_t, PendingFile> files;
+  for(const auto &f: gCatalog)
+  {
+    index.insert(f);
+    files[f.id] = f;
+  }
+
+  std::vector<double> idleAt(speeds.size(), 0.0);
+  std::vector<PendingFile> running(speeds.size());
+  Simulation sim{0.0, 0.0, {}, {}};
+
+  while(index.size())
+  {
+    // the client becoming idle first asks for the next job
+    const size_t c =
+      std::min_element(idleAt.begin(), idleAt.end()) - idleAt.begin();
+    const std::string client = "client" + std::to_string(c);
+    if(running[c].id)
+      model.add(finished(client, running[c], 1.0 / speeds[c], 0.3));
+
+    const auto e = p->select(index, 0, client);
+    REQUIRE(e);
+    p->onStarted(*e, client);
+    const auto &f = files[e->id];
+    index.erase(e->id);
+
+    idleAt[c] += estimateDuration(f) / speeds[c];
+    sim.meanCompletion += idleAt[c] / gCatalog.size();
+    sim.makespan = std::max(sim.makespan, idleAt[c]);
+    sim.order.push_back(f);
+    sim.clients.push_back(c);
+    running[c] = f;
+  }
+
+  std::cout << policy << ": makespan " << sim.makespan << " s, mean "
+            << sim.meanCompletion << " s" << std::endl;
+  return sim;
+}
+
+TEST_CASE("scheduling policies (pass)", "[scheduler]")
+{
+  const std::vector<double> speeds = {1.0, 2.5, 4.0};
+
+  const auto fifo = simulate("fifo", speeds);
+  REQUIRE(fifo.order.size() == gCatalog.size());
+  REQUIRE(fifo.order.front().id == 1);
+
+  // short jobs first minimize the time results are waited for
+  const auto shortest = simulate("shortest", speeds);
+  REQUIRE(shortest.order.front().id == 12);
+  REQUIRE(shortest.meanCompletion < fifo.meanCompletion);
+
+  const auto savings = simulate("savings", speeds);
+  REQUIRE(savings.order.front().id == 2);
+  REQUIRE(savings.order.back().id == 3);
+
+  // short jobs while the speeds are unknown, then the long films go to the
+  // fast clients
+  const auto fair = simulate("fairshare", speeds);
+  REQUIRE(fair.order.size() == gCatalog.size());
+  REQUIRE(fair.makespan < shortest.makespan);
+  REQUIRE(fair.meanCompletion < fifo.meanCompletion);
+
+  const auto retry = simulate("retrylast", speeds);
+  REQUIRE(retry.order[gCatalog.size() - 2].id == 6);
+  REQUIRE(retry.order[gCatalog.size() - 1].id == 9);
+
+  // every directory is finished before the next one is started
+  const auto dirs = simulate("directory", speeds);
+  std::set<std::string> done;
+  std::string current;
+  for(const auto &f: dirs.order)
+  {
+    const auto dir = f.fileName.substr(0, f.fileName.rfind('/'));
+    if(dir == current)
+      continue;
+    REQUIRE(done.insert(dir).second);
+    current = dir;
+  }
+  REQUIRE(done.size() == 5);
+
+  REQUIRE_THROWS_AS(createSchedulingPolicy("random"), std::invalid_argument);
+}
+
+TEST_CASE("fair share by speed (pass)", "[scheduler]")
+{
+  CostModel model;
+  std::unique_ptr<ISchedulingPolicy> fair(
+    createSchedulingPolicy("fairshare", &model));
+  PendingIndex index;
+  index.setRank([&fair](const PendingFile &f) { return fair->rank(f); });
+  for(const auto &f: gCatalog)
+    index.insert(f);
+
+  // not measured yet: the shortest job
+  REQUIRE(fair->select(index, 0, "slow")->id == 12);
+
+  // the slow machine happened to get the first long job
+  const auto film = *index.last(0);
+  fair->onStarted(film, "slow");
+  index.erase(film.id);
+  model.add(finished("slow", gCatalog[7], 5.0, 0.3));
+  model.add(finished("fast", gCatalog[3], 0.25, 0.3));
+
+  // by the measured speed, not by the work handed out
+  for(int i = 0; i < 3; i++)
+  {
+    const auto e = fair->select(index, 0, "slow");
+    REQUIRE(e == index.first(0));
+    fair->onStarted(*e, "slow");
+    index.erase(e->id);
+  }
+  REQUIRE(fair->select(index, 0, "fast") == index.last(0));
+
+  // the slow machine never gets the longest jobs of a simulated run
+  const auto sim = simulate("fairshare", {0.2, 4.0});
+  const double longest = std::max(estimateDuration(gCatalog[1]),
+    estimateDuration(gCatalog[7]));
+  size_t toSlow = 0;
+  for(size_t i = 0; i < sim.order.size(); i++)
+  {
+    if(sim.clients[i] == 0)
+    {
+      REQUIRE(estimateDuration(sim.order[i]) < longest);
+      toSlow++;
+    }
+  }
+  REQUIRE(toSlow > 0);
+}
+
+TEST_CASE("pending index (pass)", "[scheduler]")
+{
+  PendingIndex index;
+  for(const auto &f: gCatalog)
+    index.insert(f);
+  REQUIRE(index.size() == gCatalog.size());
+  REQUIRE(index.first(0)->id == 1);
+  REQUIRE(index.last(0)->id == 12);
+
+  // too large for the client
+  REQUIRE(index.first(200000000)->id == 3);
+  REQUIRE(index.last(200000000)->id == 12);
+  REQUIRE(index.first(1000) == nullptr);
+
+  index.erase(1);
+  index.erase(1);
+  REQUIRE_FALSE(index.contains(1));
+  REQUIRE(index.first(0)->id == 2);
+  REQUIRE(index.first(5.0, 0)->id == 5);
+
+  // updated in place
+  auto moved = gCatalog[1];
+  moved.id = 13;
+  index.insert(moved);
+  index.insert(moved);
+  REQUIRE(index.size() == gCatalog.size());
+  REQUIRE(index.last(0)->id == 13);
+}
+
+TEST_CASE("pending index by size (pass)", "[scheduler]")
+{
+  // sizes across many buckets, several files per bucket
+  PendingIndex index;
+  uint32_t seed = 1;
+  for(uint32_t id = 1; id <= 2000; ++id)
+  {
+    seed = seed * 1103515245 + 12345;
+    const size_t size = (size_t(seed % 4096) + 1) << (id % 24);
+    index.insert(PendingFile{id, "/media/f.ts", size, -1, "", 0, false});
+  }
+  for(uint32_t id = 1; id <= 2000; id += 3)
+    index.erase(id);
+
+  for(size_t maxSize: {size_t(1), size_t(4097), size_t(300000),
+        size_t(123456789), size_t(4096) << 23})
+  {
+    const PendingIndex::Entry *first = nullptr;
+    const PendingIndex::Entry *middle = nullptr;
+    const PendingIndex::Entry *last = nullptr;
+    for(const auto &e: index)
+    {
+      if(e.fileSize > maxSize)
+        continue;
+      if(!first)
+        first = &e;
+      if(!middle && e.rank >= 1000.0)
+        middle = &e;
+      last = &e;
+    }
+    const auto id = [](const PendingIndex::Entry *e) {
+      return e ? e->id : 0;
+    };
+    REQUIRE(id(index.first(maxSize)) == id(first));
+    REQUIRE(id(index.first(1000.0, maxSize)) == id(middle));
+    REQUIRE(id(index.last(maxSize)) == id(last));
+  }
+}
+
+TEST_CASE("settle wheel (pass)", "[scheduler]")
+{
+  // a quiet period longer than one turn of the wheel
+  SettleWheel wheel(5, 4);
+  wheel.add(SettleWheel::Entry{1, "/media/a.ts", 100, 10});
+  wheel.tick();
+  wheel.tick();
+  wheel.add(SettleWheel::Entry{2, "/media/b.ts", 200, 20});
+  REQUIRE(wheel.size() == 2);
+  REQUIRE(wheel.tick().empty());
+  REQUIRE(wheel.tick().empty());
+
+  auto due = wheel.tick();
+  REQUIRE(due.size() == 1);
+  REQUIRE(due[0].id == 1);
+  REQUIRE(due[0].fileName == "/media/a.ts");
+  REQUIRE_FALSE(wheel.contains(1));
+
+  // still growing, the quiet period starts again
+  wheel.add(SettleWheel::Entry{2, "/media/b.ts", 300, 21});
+  for(int i = 0; i < 4; i++)
+    REQUIRE(wheel.tick().empty());
+  due = wheel.tick();
+  REQUIRE(due.size() == 1);
+  REQUIRE(due[0].fileSize == 300);
+  REQUIRE(wheel.size() == 0);
+
+  wheel.add(SettleWheel::Entry{3, "/media/c.ts", 1, 1});
+  wheel.erase(3);
+  for(int i = 0; i < 10; i++)
+    REQUIRE(wheel.tick().empty());
+
+  // many files at once
+  SettleWheel large(30);
+  for(uint32_t id = 1; id <= 20000; id++)
+    large.add(SettleWheel::Entry{id, "", id, 0});
+  size_t settled = 0;
+  for(int i = 0; i < 29; i++)
+    settled += large.tick().size();
+  REQUIRE(settled == 0);
+  REQUIRE(large.tick().size() == 20000);
+}
+
+TEST_CASE("cost model (pass)", "[scheduler]")
+{
+  const auto &news = gCatalog[0];
+  const auto &film = gCatalog[1];
+  const auto &episode = gCatalog[3];
+  const auto &phone = gCatalog[4];
+
+  CostModel model;
+  REQUIRE(model.predict(news).samples == 0);
+  REQUIRE(estimateCost(news, &model) == Approx(900.0));
+
+  // the fast machine only got HD jobs, the slow one both classes
+  model.add(finished("fast", episode, 0.5, 0.3));
+  model.add(finished("fast", phone, 0.5, 0.3));
+  model.add(finished("slow", episode, 2.0, 0.3));
+  model.add(finished("slow", news, 1.0, 0.2));
+
+  // neither failed nor copied jobs tell anything about the encoder
+  auto failed = finished("fast", film, 10.0, 0.0);
+  failed.result = EncodingResultInfo::EncodingResult::UnknownError;
+  model.add(failed);
+  auto remuxed = finished("slow", film, 0.01, 1.0);
+  remuxed.remux = true;
+  model.add(remuxed);
+  REQUIRE(model.samples() == 4);
+
+  // measured for the client and the class
+  auto fc = model.predict(gCatalog[9], "fast");
+  REQUIRE(fc.seconds == Approx(2690.0 * 0.5));
+  REQUIRE(fc.outputSize == Approx(1380000000 * 0.3).epsilon(0.001));
+  REQUIRE(fc.samples == 2);
+  REQUIRE(model.getSpeed("fast") == Approx(2.0));
+
+  // SD is easier than the average for the slow machine, so for the fast
+  // one as well
+  const double all = (2700 * 0.5 + 140 * 0.5 + 2700 * 2.0 + 900) /
+    (2700 + 140 + 2700 + 900.0);
+  fc = model.predict(film, "fast");
+  REQUIRE(fc.seconds == Approx(6120.0 * 0.5 * 1.0 / all));
+  REQUIRE(fc.outputSize == Approx(5200000000 * 0.2).epsilon(0.001));
+
+  // unknown machine: the average of the class
+  fc = model.predict(film, "new");
+  REQUIRE(fc.seconds == Approx(6120.0));
+  REQUIRE(model.getSpeed("new") == 0.0);
+
+  // no header details: the length by the bit rate seen so far
+  fc = model.predict(gCatalog[10]);
+  REQUIRE(fc.seconds > 0.0);
+  REQUIRE(fc.outputSize > 0);
+
+  // the policies rank by the prediction
+  std::unique_ptr<ISchedulingPolicy> shortest(
+    createSchedulingPolicy("shortest", &model));
+  REQUIRE(shortest->rank(news) == Approx(900.0));
+  REQUIRE(shortest->rank(episode) ==
+    Approx(2700.0 * (1350 + 70 + 5400) / (2700 + 140 + 2700.0)));
+  std::unique_ptr<ISchedulingPolicy> savings(
+    createSchedulingPolicy("savings", &model));
+  REQUIRE(savings->rank(news) == Approx(-450000000 * 0.8));
+
+  model.clear();
+  REQUIRE(model.predict(news, "fast").samples == 0);
+}
+
+TEST_CASE("capability matching (pass)", "[scheduler]")
+{
+  CostModel model;
+  CapabilityMatcher matcher(model, 2.0);
+
+  MediaFileRequirements strong{"ffmpeg", 0};
+  strong.cores = 16;
+  strong.benchmarkFps = 100.0;
+  strong.slots = 2;
+  strong.memory = 32ull << 30;
+  MediaFileRequirements weak{"ffmpeg", 4000000000};
+  weak.cores = 4;
+  weak.slots = 1;
+  weak.memory = 4ull << 30;
+
+  // guessed from the profile until jobs are measured
+  REQUIRE(matcher.getSpeed("strong", strong) == Approx(2.0));
+  REQUIRE(matcher.getSpeed("weak", weak) == Approx(0.2));
+
+  // alone it takes anything, next to a faster one only what it finishes
+  // in 2 hours
+  REQUIRE(matcher.getMaxFileSize("weak", weak) == 4000000000);
+  REQUIRE(matcher.getMaxFileSize("strong", strong) == 0);
+  REQUIRE(matcher.getMaxFileSize("weak", weak) ==
+    Approx(2 * 3600 * 0.2 * 1000000.0));
+
+  // swapping machines only get short jobs
+  auto small = strong;
+  small.memory = 1ull << 30;
+  REQUIRE(matcher.getMaxFileSize("small", small) > 0);
+  REQUIRE(matcher.getMaxFileSize("small", small) < 20000000000);
+
+  // measured speed and bit rate come first
+  model.add(finished("weak", gCatalog[3], 2.0, 0.3));
+  REQUIRE(matcher.getSpeed("weak", weak) == Approx(0.5));
+  REQUIRE(matcher.getMaxFileSize("weak", weak) ==
+    Approx(2 * 3600 * 0.5 * 1400000000 / 2700.0).epsilon(0.001));
+
+  // the slots of all machines share the backlog
+  REQUIRE(matcher.getBacklogHours(0) == 0.0);
+  REQUIRE(matcher.getBacklogHours(10) ==
+    Approx(10 * 2700 * 2.0 / (2 + 1 + 2) / 3600));
+
+  // no limit configured
+  CapabilityMatcher unlimited(model, 0.0);
+  REQUIRE(unlimited.getMaxFileSize("strong", strong) == 0);
+  REQUIRE(unlimited.getMaxFileSize("weak", weak) == 4000000000);
+}
@@ -70,6 +70,615 @@ TEST_CASE("open db (pass)", "[sqlite]")
 
   db.addEncodedFile(ef5);
 
+  // taking over results encoded earlier
+  BasicFileInfo reserved;
+  REQUIRE_FALSE(db.reserveFile(id4, reserved));
+  REQUIRE_FALSE(db.reserveFile(99, reserved));
+  REQUIRE(db.reserveFile(id1, reserved));
+  REQUIRE(reserved.fileName == "ss");
+  REQUIRE(reserved.fileSize == 10000);
+
+  db.disconnect();
+}
+
+
+TEST_CASE("segments (pass)", "[sqlite]")
+{
+  remove("/tmp/test_segments.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_segments.db", true);
+
+  auto movie = BasicFileInfo{.fileName = "movie.vob", .fileSize = 5000};
+  const auto parent = db.addFile(&movie, nullptr, true);
+  auto mfr = MediaFileRequirements{.encoderType = "ffmpeg",
+    .maxFileSize = 0};
+  BasicFileInfo next;
+  REQUIRE(db.getNextFile(mfr, next) == parent);
+
+  db.addSegments(parent,
+    {
+      BasicFileInfo{.fileName = "movie.vob.1.seg000", .fileSize = 3000},
+      BasicFileInfo{.fileName = "movie.vob.1.seg001", .fileSize = 2000},
+    });
+
+  auto segments = db.getSegments(parent);
+  REQUIRE(segments.size() == 2);
+  REQUIRE(segments[1].index == 1);
+  REQUIRE(segments[1].fileName == "movie.vob.1.seg001");
+  REQUIRE(segments[0].status == 0);
+  REQUIRE(db.getParent(segments[0].id) == parent);
+  REQUIRE(db.getParent(parent) == 0);
+  REQUIRE(db.getSegmentedFiles() == std::vector<uint32_t>{parent});
+
+  // only the segments are handed out
+  const auto first = db.getNextFile(mfr, next);
+  REQUIRE(db.getParent(first) == parent);
+  db.addEncodedFile(EncodedFile(
+    {EncodingResultInfo::EncodingResult::OK, 1000, ""}, first,
+    next.fileName + ".out"));
+  const auto second = db.getNextFile(mfr, next);
+  REQUIRE(db.getParent(second) == parent);
+  REQUIRE(second != first);
+  REQUIRE(db.getNextFile(mfr, next) == 0);
+
+  segments = db.getSegments(parent);
+  const auto &done = segments[0].id == first ? segments[0] : segments[1];
+  REQUIRE(done.status == EncodingResultInfo::EncodingResult::OK);
+  REQUIRE(done.archiveName == done.fileName + ".out");
+
+  BasicFileInfo src;
+  REQUIRE(db.getFile(parent, src));
+  REQUIRE(src.fileName == "movie.vob");
+
+  db.removeSegments(parent);
+  REQUIRE(db.getSegments(parent).empty());
+  REQUIRE(db.getParent(first) == 0);
+  BasicFileInfo gone;
+  REQUIRE_FALSE(db.getFile(first, gone));
   db.disconnect();
 }
 
+TEST_CASE("no gain (pass)", "[sqlite]")
+{
+  remove("/tmp/test_nogain.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_nogain.db", true);
+
+  auto phone = BasicFileInfo{.fileName = "phone.mp4", .fileSize = 1000};
+  auto camera = BasicFileInfo{.fileName = "camera.mts", .fileSize = 2000};
+  db.addFile(&phone, nullptr, true);
+  db.addFile(&camera, nullptr, true);
+  auto mfr = MediaFileRequirements{.encoderType = "ffmpeg",
+    .maxFileSize = 0};
+
+  BasicFileInfo next;
+  const auto first = db.getNextFile(mfr, next);
+  db.addEncodedFile(EncodedFile(
+    {EncodingResultInfo::EncodingResult::NoGain, 0, "projected 95%"},
+    first));
+
+  // recorded permanently, unlike errors
+  const auto second = db.getNextFile(mfr, next);
+  REQUIRE(second != 0);
+  REQUIRE(second != first);
+  db.addEncodedFile(EncodedFile(
+    {EncodingResultInfo::EncodingResult::RetriableError, 0, "crashed"},
+    second));
+  REQUIRE(db.getNextFile(mfr, next) == second);
+  REQUIRE(db.getNextFile(mfr, next) == 0);
+
+  BasicFileInfo reserved;
+  REQUIRE_FALSE(db.reserveFile(first, reserved));
+  db.disconnect();
+  remove("/tmp/test_nogain.db");
+}
+
+TEST_CASE("media details (pass)", "[sqlite]")
+{
+  remove("/tmp/test_details.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_details.db", true);
+
+  auto film = BasicFileInfo{.fileName = "film.ts", .fileSize = 1000};
+  const auto id = db.addFile(&film, nullptr, true);
+
+  MediaDetails d;
+  REQUIRE_FALSE(db.getMediaDetails(id, d));
+  db.setMediaDetails(
+    id, MediaDetails{7200.5, "mpeg2video", "", 720, 576, 6000});
+  REQUIRE(db.getMediaDetails(id, d));
+  REQUIRE(d.duration == Approx(7200.5));
+  REQUIRE(d.videoCodec == "mpeg2video");
+  REQUIRE(d.audioCodec.empty());
+  REQUIRE(d.width == 720);
+  REQUIRE(d.bitRate == 6000);
+
+  // as seen by the scheduler
+  PendingFile ranked{0, "", 0, 0.0, "", 0, true};
+  db.setPendingRank([&](const PendingFile &f) {
+    ranked = f;
+    return f.duration;
+  });
+  REQUIRE(ranked.id == id);
+  REQUIRE(ranked.videoCodec == "mpeg2video");
+  REQUIRE(ranked.height == 576);
+  REQUIRE_FALSE(ranked.retry);
+
+  BasicFileInfo started;
+  double rank = 0.0;
+  REQUIRE(db.startNextFile(
+            [&](const PendingIndex &index) {
+              rank = index.first(0)->rank;
+              return index.first(0)->id;
+            },
+            started) == id);
+  REQUIRE(rank == Approx(7200.5));
+  REQUIRE(started.fileName == "film.ts");
+  REQUIRE(db.startNextFile(
+            [](const PendingIndex &index) {
+              return index.size() ? index.first(0)->id : 0;
+            },
+            started) == 0);
+
+  // failed once, pending again
+  db.addEncodedFile(EncodedFile(
+    {EncodingResultInfo::EncodingResult::RetriableError, 0, "crashed"},
+    id));
+  auto mfr = MediaFileRequirements{.encoderType = "ffmpeg",
+    .maxFileSize = 0};
+  REQUIRE(db.getNextFile(mfr, started) == id);
+  db.disconnect();
+  remove("/tmp/test_details.db");
+}
+
+TEST_CASE("job history (pass)", "[sqlite]")
+{
+  remove("/tmp/test_jobs.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_jobs.db", true);
+
+  auto film = BasicFileInfo{.fileName = "film.ts", .fileSize = 1000};
+  auto clip = BasicFileInfo{.fileName = "clip.mp4", .fileSize = 200};
+  const auto filmId = db.addFile(&film, nullptr, true);
+  const auto clipId = db.addFile(&clip, nullptr, true);
+  db.setMediaDetails(
+    filmId, MediaDetails{600.0, "mpeg2video", "mp2", 720, 576, 6000});
+
+  REQUIRE(db.getJobs().empty());
+  db.addJob(JobRecord{filmId, "attic", 5, false, 300.5, 400});
+  db.addJob(JobRecord{clipId, "cellar", -1, false, 12.0, 0});
+
+  // the details of the source are kept with the job
+  const auto jobs = db.getJobs();
+  REQUIRE(jobs.size() == 2);
+  REQUIRE(jobs[0].fileId == filmId);
+  REQUIRE(jobs[0].client == "attic");
+  REQUIRE(jobs[0].result == 5);
+  REQUIRE(jobs[0].seconds == Approx(300.5));
+  REQUIRE(jobs[0].outputSize == 400);
+  REQUIRE(jobs[0].duration == Approx(600.0));
+  REQUIRE(jobs[0].fileSize == 1000);
+  REQUIRE(jobs[0].videoCodec == "mpeg2video");
+  REQUIRE(jobs[0].height == 576);
+  REQUIRE(jobs[1].result == -1);
+  REQUIRE(jobs[1].duration < 0);
+  REQUIRE(jobs[1].videoCodec.empty());
+
+  // in the order they are handed out
+  db.setPendingRank([](const PendingFile &f) { return -1.0 * f.id; });
+  auto pending = db.getPendingFiles();
+  REQUIRE(pending.size() == 2);
+  REQUIRE(pending[0].id == clipId);
+  REQUIRE(pending[1].id == filmId);
+  REQUIRE(pending[1].duration == Approx(600.0));
+
+  db.disconnect();
+  remove("/tmp/test_jobs.db");
+}
+
+TEST_CASE("archive preset (pass)", "[sqlite]")
+{
+  remove("/tmp/test_preset.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_preset.db", true);
+
+  auto film = BasicFileInfo{.fileName = "film.ts", .fileSize = 1000};
+  auto clip = BasicFileInfo{.fileName = "clip.mp4", .fileSize = 200};
+  const auto filmId = db.addFile(&film, nullptr, true);
+  const auto clipId = db.addFile(&clip, nullptr, true);
+
+  ArchiveInfo archive;
+  REQUIRE_FALSE(db.getArchive(filmId, archive));
+
+  EncodedFile encoded(
+    {EncodingResultInfo::EncodingResult::OK, 500, ""}, filmId, "film.mp4");
+  encoded.preset = "fast+downgrade";
+  db.addEncodedFile(encoded);
+  db.addEncodedFile(EncodedFile(
+    {EncodingResultInfo::EncodingResult::OK, 100, ""}, clipId, "clip.mkv"));
+
+  REQUIRE(db.getArchive(filmId, archive));
+  REQUIRE(archive.fileName == "film.mp4");
+  REQUIRE_FALSE(archive.remux);
+  REQUIRE(archive.preset == "fast+downgrade");
+  REQUIRE(db.getArchive(clipId, archive));
+  REQUIRE(archive.preset.empty());
+
+  db.disconnect();
+  remove("/tmp/test_preset.db");
+}
+
+
+TEST_CASE("outdated archives (pass)", "[sqlite]")
+{
+  remove("/tmp/test_outdated.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_outdated.db", true);
+
+  auto film = BasicFileInfo{.fileName = "film.ts", .fileSize = 1000};
+  auto clip = BasicFileInfo{.fileName = "clip.ts", .fileSize = 200};
+  auto show = BasicFileInfo{.fileName = "show.ts", .fileSize = 600};
+  auto copy = BasicFileInfo{.fileName = "copy.ts", .fileSize = 400};
+  const auto filmId = db.addFile(&film, nullptr, true);
+  const auto clipId = db.addFile(&clip, nullptr, true);
+  const auto showId = db.addFile(&show, nullptr, true);
+  const auto copyId = db.addFile(&copy, nullptr, true);
+
+  const auto archive = [&db](uint32_t id, const char *name, uint32_t hash) {
+    EncodedFile encoded(
+      {EncodingResultInfo::EncodingResult::OK, 100, ""}, id, name);
+    encoded.settings = hash;
+    db.addEncodedFile(encoded);
+  };
+  // made before the settings were recorded
+  archive(filmId, "film.mp4", 0);
+  archive(clipId, "clip.mp4", 1);
+  archive(showId, "show.mp4", 2);
+  EncodedFile remuxed(
+    {EncodingResultInfo::EncodingResult::OK, 100, ""}, copyId, "copy.mp4");
+  remuxed.remux = true;
+  remuxed.settings = 1;
+  db.addEncodedFile(remuxed);
+
+  db.setUnknownArchiveSettings(1);
+  ArchiveInfo info;
+  REQUIRE(db.getArchive(filmId, info));
+  REQUIRE(info.settings == 1);
+
+  // remuxed archives are never encoded again
+  REQUIRE(db.getOutdatedArchives(1, ReencodeOrder::Oldest, 10) ==
+    std::vector<uint32_t>{showId});
+  REQUIRE(db.getOutdatedArchives(2, ReencodeOrder::Oldest, 10) ==
+    std::vector<uint32_t>{filmId, clipId});
+  REQUIRE(db.getOutdatedArchives(3, ReencodeOrder::Largest, 10) ==
+    std::vector<uint32_t>{filmId, showId, clipId});
+  REQUIRE(db.getOutdatedArchives(3, ReencodeOrder::Smallest, 2) ==
+    std::vector<uint32_t>{clipId, showId});
+
+  // queued again it is not outdated until it is encoded, then replaced
+  db.reset(filmId);
+  REQUIRE(db.getOutdatedArchives(2, ReencodeOrder::Oldest, 10) ==
+    std::vector<uint32_t>{clipId});
+  archive(filmId, "film.mkv", 2);
+  REQUIRE(db.getArchive(filmId, info));
+  REQUIRE(info.fileName == "film.mkv");
+  REQUIRE(info.settings == 2);
+  REQUIRE(db.getOutdatedArchives(2, ReencodeOrder::Oldest, 10) ==
+    std::vector<uint32_t>{clipId});
+
+  db.disconnect();
+  remove("/tmp/test_outdated.db");
+}
+
+TEST_CASE("source twins (pass)", "[sqlite]")
+{
+  remove("/tmp/test_twins.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_twins.db", true);
+
+  auto clip = BasicFileInfo{.fileName = "clip.mp4", .fileSize = 1000};
+  auto backup =
+    BasicFileInfo{.fileName = "backup/clip.mp4", .fileSize = 1000};
+  auto link = BasicFileInfo{.fileName = "album/clip.mp4", .fileSize = 1000};
+  auto other = BasicFileInfo{.fileName = "other.mp4", .fileSize = 2000};
+  const auto clipId = db.addFile(&clip, nullptr, true);
+  const auto backupId = db.addFile(&backup, nullptr, true);
+  const auto linkId = db.addFile(&link, nullptr, true);
+  const auto otherId = db.addFile(&other, nullptr, true);
+
+  SourceFingerprint fp;
+  REQUIRE_FALSE(db.getFingerprint(clipId, fp));
+  const uint64_t hash = 0xfedcba9876543210ull;
+  db.setFingerprint(clipId, SourceFingerprint{hash, 1, 10});
+  db.setFingerprint(backupId, SourceFingerprint{hash, 1, 11});
+  // a hard link, the content may have changed since it was hashed
+  db.setFingerprint(linkId, SourceFingerprint{0x1234, 1, 10});
+  // same hash but another size
+  db.setFingerprint(otherId, SourceFingerprint{hash, 1, 12});
+
+  REQUIRE(db.getFingerprint(clipId, fp));
+  REQUIRE(fp.hash == hash);
+  REQUIRE(fp.inode == 10);
+
+  REQUIRE(db.findArchivedTwin(backupId) == 0);
+  REQUIRE(db.getPendingTwins(clipId) ==
+    std::vector<uint32_t>{backupId, linkId});
+  REQUIRE(db.getPendingTwins(otherId).empty());
+
+  db.addEncodedFile(EncodedFile(
+    {EncodingResultInfo::EncodingResult::OK, 500, ""}, clipId, "clip.mkv"));
+  REQUIRE(db.findArchivedTwin(backupId) == clipId);
+  REQUIRE(db.findArchivedTwin(linkId) == clipId);
+  REQUIRE(db.findArchivedTwin(otherId) == 0);
+  REQUIRE(db.findArchivedTwin(clipId) == 0);
+
+  // a twin being copied is not pending any more
+  BasicFileInfo f;
+  REQUIRE(db.reserveFile(backupId, f));
+  REQUIRE(db.getPendingTwins(clipId) == std::vector<uint32_t>{linkId});
+
+  db.disconnect();
+  remove("/tmp/test_twins.db");
+}
+
+TEST_CASE("moved files (pass)", "[sqlite]")
+{
+  remove("/tmp/test_moves.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_moves.db", true);
+
+  auto song = BasicFileInfo{.fileName = "/m/album/song.ts", .fileSize = 10};
+  auto deep =
+    BasicFileInfo{.fileName = "/m/album/cd2/b.ts", .fileSize = 20};
+  auto near = BasicFileInfo{.fileName = "/m/album2/c.ts", .fileSize = 30};
+  auto arch = BasicFileInfo{.fileName = "/m/album/song.mkv", .fileSize = 5};
+  const auto songId = db.addFile(&song, &arch, true);
+  const auto deepId = db.addFile(&deep, nullptr, true);
+  const auto nearId = db.addFile(&near, nullptr, true);
+
+  REQUIRE(db.getFileId("/m/album/song.ts") == songId);
+  REQUIRE(db.getFileId("/m/album/none.ts") == 0);
+
+  // the folder and everything below it, not the one sharing the prefix
+  REQUIRE(db.moveDirectory("/m/album", "/m/Album 'live'") == 2);
+  BasicFileInfo f;
+  REQUIRE(db.getFile(songId, f));
+  REQUIRE(f.fileName == "/m/Album 'live'/song.ts");
+  REQUIRE(db.getFile(deepId, f));
+  REQUIRE(f.fileName == "/m/Album 'live'/cd2/b.ts");
+  REQUIRE(db.getFile(nearId, f));
+  REQUIRE(f.fileName == "/m/album2/c.ts");
+  ArchiveInfo archive;
+  REQUIRE(db.getArchive(songId, archive));
+  REQUIRE(archive.fileName == "/m/Album 'live'/song.mkv");
+
+  // renamed in place, still archived and still pending
+  REQUIRE(db.moveFile("/m/Album 'live'/song.ts", "/m/song.ts") == songId);
+  REQUIRE(db.getFileId("/m/song.ts") == songId);
+  REQUIRE(db.getArchive(songId, archive));
+  REQUIRE(db.moveFile("/m/Album 'live'/song.mkv", "/m/song.mkv") == songId);
+  REQUIRE(db.getArchive(songId, archive));
+  REQUIRE(archive.fileName == "/m/song.mkv");
+  REQUIRE(db.moveFile("/m/unknown.ts", "/m/other.ts") == 0);
+
+  const auto pending = db.getPendingFiles();
+  REQUIRE(pending.size() == 2);
+  REQUIRE(pending[0].fileName == "/m/Album 'live'/cd2/b.ts");
+
+  // a rename onto another source replaces it
+  REQUIRE(db.moveFile("/m/album2/c.ts", "/m/Album 'live'/cd2/b.ts") ==
+    nearId);
+  REQUIRE_FALSE(db.getFile(deepId, f));
+  REQUIRE(db.getFileId("/m/Album 'live'/cd2/b.ts") == nearId);
+  REQUIRE(db.getPendingFiles().size() == 1);
+
+  db.setFingerprint(nearId, SourceFingerprint{0xabc, 7, 70});
+  REQUIRE(db.findFiles(SourceFingerprint{0xabc, 7, 70}, 30) ==
+    std::vector<uint32_t>{nearId});
+  REQUIRE(db.findFiles(SourceFingerprint{0xabc, 7, 71}, 30).empty());
+  REQUIRE(db.findFiles(SourceFingerprint{0xabc, 7, 70}, 31).empty());
+
+  db.disconnect();
+  remove("/tmp/test_moves.db");
+}
+
+TEST_CASE("deleted and changed files (pass)", "[sqlite]")
+{
+  remove("/tmp/test_deletes.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_deletes.db", true);
+
+  auto a = BasicFileInfo{.fileName = "/m/a.ts", .fileSize = 10};
+  auto b = BasicFileInfo{.fileName = "/m/b.ts", .fileSize = 20};
+  auto c = BasicFileInfo{.fileName = "/m/c.ts", .fileSize = 30};
+  auto cArch = BasicFileInfo{.fileName = "/m/c.mkv", .fileSize = 5};
+  const auto aId = db.addFile(&a, nullptr, true);
+  const auto bId = db.addFile(&b, nullptr, true);
+  const auto cId = db.addFile(&c, &cArch, true);
+  REQUIRE(db.getPendingFiles().size() == 2);
+
+  // the first time is only recorded
+  REQUIRE_FALSE(db.updateFileStat(aId, 10, 1000));
+  REQUIRE_FALSE(db.updateFileStat(aId, 10, 1000));
+  REQUIRE_FALSE(db.updateFileStat(cId, 30, 2000));
+
+  // rewritten while it is encoded
+  BasicFileInfo f;
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == aId);
+  REQUIRE(db.getPendingFiles().size() == 1);
+  REQUIRE(db.updateFileStat(aId, 10, 1001));
+  REQUIRE(db.getPendingFiles().size() == 2);
+  REQUIRE(db.getFile(aId, f));
+  REQUIRE(f.fileSize == 10);
+
+  // a changed archived file is encoded again, its archive is kept meanwhile
+  REQUIRE(db.updateFileStat(cId, 31, 2000));
+  REQUIRE(db.getFile(cId, f));
+  REQUIRE(f.fileSize == 31);
+  ArchiveInfo archive;
+  REQUIRE(db.getArchive(cId, archive));
+  REQUIRE(db.getPendingFiles().size() == 3);
+  db.addEncodedFile(EncodedFile(
+    EncodingResultInfo(EncodingResultInfo::EncodingResult::OK, 4, ""), cId,
+    "/m/c.mkv"));
+
+  // pending ones are purged, archived ones kept
+  REQUIRE(db.removeFile(bId));
+  REQUIRE_FALSE(db.getFile(bId, f));
+  REQUIRE_FALSE(db.removeFile(bId));
+  REQUIRE_FALSE(db.removeFile(cId));
+  REQUIRE(db.getFile(cId, f));
+  REQUIRE(db.getPendingFiles().size() == 1);
+
+  // not handed out while it is still being copied
+  db.setSettling(aId, true);
+  REQUIRE(db.getPendingFiles().empty());
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == 0);
+  REQUIRE_FALSE(db.reserveFile(aId, f));
+  db.setSettling(aId, false);
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == aId);
+  db.reset(aId);
+
+  // without its archive the source is encoded again
+  REQUIRE(db.removeArchive("/m/none.mkv") == 0);
+  REQUIRE(db.removeArchive("/m/c.mkv") == cId);
+  REQUIRE_FALSE(db.getArchive(cId, archive));
+  REQUIRE(db.getPendingFiles().size() == 2);
+  REQUIRE(db.removeFile(cId));
+  REQUIRE(db.getPendingFiles().size() == 1);
+
+  // a folder moved out of the watched ones, not the one sharing the prefix
+  auto d = BasicFileInfo{.fileName = "/m/sub/d.ts", .fileSize = 40};
+  auto e = BasicFileInfo{.fileName = "/m/sub/deep/e.ts", .fileSize = 50};
+  auto eArch =
+    BasicFileInfo{.fileName = "/m/sub/deep/e.mkv", .fileSize = 5};
+  auto g = BasicFileInfo{.fileName = "/m/sub2/g.ts", .fileSize = 60};
+  const auto dId = db.addFile(&d, nullptr, true);
+  const auto eId = db.addFile(&e, &eArch, true);
+  const auto gId = db.addFile(&g, nullptr, true);
+  db.addEncodedFile(EncodedFile(
+    EncodingResultInfo(EncodingResultInfo::EncodingResult::OK, 4, ""), eId,
+    "/m/sub/deep/e.mkv"));
+  REQUIRE(db.getPendingFiles().size() == 3);
+
+  REQUIRE(db.removeDirectory("/m/none").empty());
+  auto ids = db.removeDirectory("/m/sub");
+  std::sort(ids.begin(), ids.end());
+  REQUIRE(ids == std::vector<uint32_t>{dId, eId});
+  REQUIRE_FALSE(db.getFile(dId, f));
+  REQUIRE(db.getFile(eId, f));
+  REQUIRE(db.getFile(gId, f));
+  REQUIRE(db.getPendingFiles().size() == 2);
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) != dId);
+
+  db.disconnect();
+  remove("/tmp/test_deletes.db");
+}
+
+TEST_CASE("retry policy (pass)", "[sqlite]")
+{
+  using Result = EncodingResultInfo::EncodingResult;
+  using Class = RetryPolicy::FailureClass;
+  const std::string crash = "frame=  100 fps=25\n"
+                            "Segmentation fault at 0x1234\n"
+                            "Conversion failed!\n";
+
+  REQUIRE(RetryPolicy::classify(Result::ServerIOError, "rename failed") ==
+    Class::Transient);
+  REQUIRE(RetryPolicy::classify(
+            Result::UnknownError, "moov atom not found") == Class::Input);
+  REQUIRE(RetryPolicy::classify(Result::UnknownError,
+            "Cannot allocate memory") == Class::Resource);
+  REQUIRE(
+    RetryPolicy::classify(Result::UnknownError, crash) == Class::Encoder);
+
+  // progress and addresses do not make failures differ
+  REQUIRE(RetryPolicy::getSignature(crash) ==
+    RetryPolicy::getSignature("frame= 7\nSegmentation fault at 0x99\n"));
+  REQUIRE(RetryPolicy::getSignature("") == 0);
+  REQUIRE(RetryPolicy::getSignature("a") != RetryPolicy::getSignature("b"));
+
+  // server problems are retried later and later
+  RetryPolicy policy(60);
+  auto d =
+    policy.decide(Result::ServerIOError, "rename failed", 1, 0, 0, 1000);
+  REQUIRE_FALSE(d.quarantined);
+  REQUIRE(d.retryAt == 1060);
+  d = policy.decide(Result::ServerIOError, "rename failed", 3,
+    d.signature, d.repeats, 1000);
+  REQUIRE_FALSE(d.quarantined);
+  REQUIRE(d.repeats == 2);
+  REQUIRE(d.retryAt == 1240);
+
+  // a crash is retried once, the same crash again is quarantined
+  d = policy.decide(Result::UnknownError, crash, 1, 0, 0, 1000);
+  REQUIRE(d.retryAt == 1300);
+  d = policy.decide(
+    Result::UnknownError, crash, 2, d.signature, d.repeats, 1000);
+  REQUIRE(d.quarantined);
+  REQUIRE(d.retryAt == 0);
+  REQUIRE_FALSE(policy.decide(Result::UnknownError, "a", 2, 1, 1, 0)
+                  .quarantined);
+  REQUIRE(policy.decide(Result::UnknownError, "a", 3, 1, 1, 0).quarantined);
+
+  remove("/tmp/test_retry.db");
+  SQLite db;
+  db.init();
+  db.connect("/tmp/test_retry.db", true);
+  db.setRetryPolicy(RetryPolicy(3600));
+
+  auto film = BasicFileInfo{.fileName = "film.ts", .fileSize = 1000};
+  const auto id = db.addFile(&film, nullptr, true);
+  BasicFileInfo f;
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == id);
+  db.addEncodedFile(
+    EncodedFile({Result::ServerIOError, 0, "rename failed"}, id));
+
+  // waits for its retry time, also after a restart
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == 0);
+  REQUIRE(db.getPendingFiles().empty());
+  FailureInfo failure;
+  REQUIRE(db.getFailure(id, failure));
+  REQUIRE(failure.status == Result::ServerIOError);
+  REQUIRE(failure.attempts == 1);
+  REQUIRE(failure.failureClass == Class::Transient);
+  REQUIRE(failure.repeats == 1);
+  REQUIRE(failure.retryAt > time(nullptr) + 3000);
+  REQUIRE(failure.error == "rename failed");
+  {
+    SQLite reopened;
+    reopened.init();
+    reopened.connect("/tmp/test_retry.db", false);
+    REQUIRE(reopened.getNextFile(MediaFileRequirements(), f) == 0);
+  }
+
+  // reserved anyway, then the same crash twice
+  db.setRetryPolicy(RetryPolicy(0));
+  REQUIRE(db.reserveFile(id, f));
+  db.addEncodedFile(EncodedFile({Result::UnknownError, 0, crash}, id));
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == id);
+  db.addEncodedFile(EncodedFile({Result::UnknownError, 0, crash}, id));
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == 0);
+  REQUIRE(db.getFailure(id, failure));
+  REQUIRE(failure.status == Result::Quarantined);
+  REQUIRE(failure.failureClass == Class::Encoder);
+  REQUIRE(failure.repeats == 2);
+  REQUIRE(failure.retryAt == 0);
+
+  // until it is reset
+  db.reset(id);
+  REQUIRE_FALSE(db.getFailure(id, failure));
+  REQUIRE(db.getNextFile(MediaFileRequirements(), f) == id);
+
+  db.disconnect();
+  remove("/tmp/test_retry.db");
+}